@@ -0,0 +1,330 @@
+#include "Arena.hpp"
+
+// Static member definition
+Arena* Arena::_active = NULL;
+
+/**
+ * @brief Constructor for Arena class
+ * @param blockSize Size of each block of scratch memory
+ */
+Arena::Arena(size_t blockSize)
+    : _current(0), _blockSize(blockSize), _poison(false), _resets(0), _peakUsed(0), _oversized(0) {
+    addBlock(_blockSize);
+}
+
+/**
+ * @brief Destructor for Arena class - frees all blocks
+ */
+Arena::~Arena() {
+    for (size_t i = 0; i < _blocks.size(); ++i) {
+        delete[] _blocks[i].data;
+    }
+    if (_active == this) {
+        _active = NULL;
+    }
+}
+
+/**
+ * @brief Allocate raw bytes
+ * @param size Number of bytes
+ * @return Pointer valid until the next reset()
+ */
+char* Arena::allocate(size_t size) {
+    return static_cast<char*>(allocateAligned(size, 1));
+}
+
+/**
+ * @brief Allocate aligned bytes
+ * @param size Number of bytes
+ * @param alignment Required alignment (power of two)
+ * @return Pointer valid until the next reset()
+ *
+ * When the current block is full we move on to the next one (reusing blocks
+ * from earlier ticks) and only allocate a new block when we run out.
+ */
+void* Arena::allocateAligned(size_t size, size_t alignment) {
+    while (true) {
+        Block& block = _blocks[_current];
+        size_t start = (block.used + alignment - 1) & ~(alignment - 1);
+        if (start + size <= block.size) {
+            block.used = start + size;
+            return block.data + start;
+        }
+
+        if (_current + 1 < _blocks.size() && _blocks[_current + 1].size >= size + alignment) {
+            _current++;
+            continue;
+        }
+
+        if (size + alignment > _blockSize) {
+            _oversized++;
+        }
+        _current = addBlock(size + alignment);
+    }
+}
+
+/**
+ * @brief Grow the most recent allocation without moving it
+ * @param data Start of the allocation
+ * @param oldSize Its current size
+ * @param newSize The wanted size
+ * @return true if it was grown, false if the caller has to allocate and copy
+ */
+bool Arena::tryExtend(char* data, size_t oldSize, size_t newSize) {
+    Block& block = _blocks[_current];
+    if (data + oldSize != block.data + block.used) {
+        return false;  // Something else was allocated after it
+    }
+    if (static_cast<size_t>(data - block.data) + newSize > block.size) {
+        return false;  // Doesn't fit in this block
+    }
+    block.used = static_cast<size_t>(data - block.data) + newSize;
+    return true;
+}
+
+/**
+ * @brief Copy characters into the arena
+ * @param data The characters
+ * @param length Number of characters
+ * @return View of the copy
+ */
+StringRef Arena::copy(const char* data, size_t length) {
+    char* copy = allocate(length);
+    memcpy(copy, data, length);
+    return StringRef(copy, length);
+}
+
+/**
+ * @brief Forget every allocation (called at the end of each event-loop tick)
+ */
+void Arena::reset() {
+    size_t used = getBytesUsed();
+    if (used > _peakUsed) {
+        _peakUsed = used;
+    }
+
+    for (size_t i = 0; i < _blocks.size(); ++i) {
+        if (_poison && _blocks[i].used > 0) {
+            memset(_blocks[i].data, 0xDD, _blocks[i].used);
+        }
+        _blocks[i].used = 0;
+    }
+    _current = 0;
+    _resets++;
+}
+
+/**
+ * @brief Enable or disable poisoning on reset (debug mode)
+ * @param poison true to fill released memory with 0xDD
+ */
+void Arena::setPoison(bool poison) {
+    _poison = poison;
+}
+
+/**
+ * @brief Check if poisoning is enabled
+ * @return true if released memory is poisoned
+ */
+bool Arena::isPoisoned() const {
+    return _poison;
+}
+
+/**
+ * @brief Get the number of bytes used in the current tick
+ * @return Bytes used
+ */
+size_t Arena::getBytesUsed() const {
+    size_t used = 0;
+    for (size_t i = 0; i < _blocks.size(); ++i) {
+        used += _blocks[i].used;
+    }
+    return used;
+}
+
+/**
+ * @brief Get the number of bytes held in blocks
+ * @return Bytes reserved
+ */
+size_t Arena::getBytesReserved() const {
+    size_t reserved = 0;
+    for (size_t i = 0; i < _blocks.size(); ++i) {
+        reserved += _blocks[i].size;
+    }
+    return reserved;
+}
+
+/**
+ * @brief Get the number of blocks
+ * @return Block count
+ */
+size_t Arena::getBlockCount() const {
+    return _blocks.size();
+}
+
+/**
+ * @brief Get the number of resets (ticks) so far
+ * @return Reset count
+ */
+size_t Arena::getResets() const {
+    return _resets;
+}
+
+/**
+ * @brief Get the most bytes used in a single tick
+ * @return Peak bytes
+ */
+size_t Arena::getPeakUsed() const {
+    return _peakUsed;
+}
+
+/**
+ * @brief Get the number of requests bigger than a block
+ * @return Oversized request count
+ */
+size_t Arena::getOversized() const {
+    return _oversized;
+}
+
+/**
+ * @brief Get the scratch arena of the running server
+ * @return The active arena
+ *
+ * Code without access to the Server (Utils, Channel) formats through this.
+ * If no server is running (shouldn't happen) a fallback arena is used.
+ */
+Arena& Arena::active() {
+    if (!_active) {
+        static Arena fallback;
+        _active = &fallback;
+    }
+    return *_active;
+}
+
+/**
+ * @brief Set the scratch arena of the running server
+ * @param arena The arena (NULL to unset)
+ */
+void Arena::setActive(Arena* arena) {
+    _active = arena;
+}
+
+/**
+ * @brief Append a new block after the current one
+ * @param minimumSize Smallest acceptable block size
+ * @return Index of the new block
+ */
+size_t Arena::addBlock(size_t minimumSize) {
+    Block block;
+    block.size = minimumSize > _blockSize ? minimumSize : _blockSize;
+    block.data = new char[block.size];
+    block.used = 0;
+
+    if (_blocks.empty()) {
+        _blocks.push_back(block);
+        return 0;
+    }
+
+    // Insert right after the current block so the blocks after it stay reusable
+    _blocks.insert(_blocks.begin() + _current + 1, block);
+    return _current + 1;
+}
+
+/**
+ * @brief Constructor for ScratchWriter class
+ * @param arena Arena to build the string in
+ * @param initialCapacity Bytes reserved up front
+ */
+ScratchWriter::ScratchWriter(Arena& arena, size_t initialCapacity)
+    : _arena(arena), _data(NULL), _length(0), _capacity(initialCapacity) {
+    _data = _arena.allocate(_capacity);
+}
+
+/**
+ * @brief Append characters
+ * @param data The characters
+ * @param length Number of characters
+ * @return Reference to this writer (for chaining)
+ */
+ScratchWriter& ScratchWriter::append(const char* data, size_t length) {
+    reserve(_length + length);
+    memcpy(_data + _length, data, length);
+    _length += length;
+    return *this;
+}
+
+/**
+ * @brief Append a std::string
+ * @param value The string
+ * @return Reference to this writer (for chaining)
+ */
+ScratchWriter& ScratchWriter::append(const std::string& value) {
+    return append(value.data(), value.length());
+}
+
+/**
+ * @brief Append a string view
+ * @param value The view
+ * @return Reference to this writer (for chaining)
+ */
+ScratchWriter& ScratchWriter::append(const StringRef& value) {
+    return append(value.data, value.length);
+}
+
+/**
+ * @brief Append a C string
+ * @param value The NUL-terminated string
+ * @return Reference to this writer (for chaining)
+ */
+ScratchWriter& ScratchWriter::append(const char* value) {
+    return append(value, strlen(value));
+}
+
+/**
+ * @brief Append a single character
+ * @param c The character
+ * @return Reference to this writer (for chaining)
+ */
+ScratchWriter& ScratchWriter::append(char c) {
+    return append(&c, 1);
+}
+
+/**
+ * @brief Get the string built so far
+ * @return View valid until the arena is reset
+ */
+StringRef ScratchWriter::str() const {
+    return StringRef(_data, _length);
+}
+
+/**
+ * @brief Get the length of the string built so far
+ * @return Number of characters
+ */
+size_t ScratchWriter::length() const {
+    return _length;
+}
+
+/**
+ * @brief Make room for at least needed characters
+ * @param needed Required capacity
+ */
+void ScratchWriter::reserve(size_t needed) {
+    if (needed <= _capacity) {
+        return;
+    }
+
+    size_t newCapacity = _capacity * 2;
+    if (newCapacity < needed) {
+        newCapacity = needed;
+    }
+
+    if (_arena.tryExtend(_data, _capacity, newCapacity)) {
+        _capacity = newCapacity;
+        return;
+    }
+
+    char* newData = _arena.allocate(newCapacity);
+    memcpy(newData, _data, _length);
+    _data = newData;
+    _capacity = newCapacity;
+}
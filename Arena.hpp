@@ -0,0 +1,123 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include "ircserv.hpp"
+
+/**
+ * @brief A non-owning view of characters (pointer + length)
+ *
+ * Used for strings that live in an Arena or inside another buffer. The view
+ * is only valid as long as the memory it points to; for arena strings that
+ * means until the end of the current event-loop tick.
+ */
+struct StringRef {
+    const char* data;
+    size_t length;
+
+    StringRef() : data(""), length(0) {}
+    StringRef(const char* d, size_t l) : data(d), length(l) {}
+    StringRef(const std::string& s) : data(s.data()), length(s.length()) {}
+    StringRef(const char* s) : data(s), length(strlen(s)) {}
+
+    std::string str() const { return std::string(data, length); }
+};
+
+/**
+ * @brief Bump-pointer allocator for short-lived scratch memory
+ *
+ * Parsing and formatting need many temporary strings per command. Instead of
+ * a malloc/free pair for each one, they take memory from the arena by moving
+ * a pointer forward, and the whole arena is reset at the end of every
+ * event-loop tick. Blocks are kept across resets, so a steady-state tick does
+ * not allocate at all.
+ *
+ * In poison mode every reset fills the used memory with 0xDD, so code that
+ * keeps a StringRef past the end of a tick reads obvious garbage instead of
+ * silently working by accident.
+ */
+class Arena {
+private:
+    struct Block {
+        char* data;
+        size_t size;
+        size_t used;
+    };
+
+    std::vector<Block> _blocks;         // All blocks, reused after reset
+    size_t _current;                    // Index of the block we allocate from
+    size_t _blockSize;                  // Default size of new blocks
+    bool _poison;                       // Fill memory with 0xDD on reset
+
+    // Statistics
+    size_t _resets;                     // Number of ticks completed
+    size_t _peakUsed;                   // Most bytes used in a single tick
+    size_t _oversized;                  // Requests bigger than a block (got their own block)
+
+    static Arena* _active;              // Arena used by code with no Server access
+
+    // Not copyable (owns its blocks)
+    Arena(const Arena& other);
+    Arena& operator=(const Arena& other);
+
+public:
+    static const size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+    explicit Arena(size_t blockSize = DEFAULT_BLOCK_SIZE);
+    ~Arena();
+
+    char* allocate(size_t size);                            // Raw bytes (no alignment)
+    void* allocateAligned(size_t size, size_t alignment);
+    bool tryExtend(char* data, size_t oldSize, size_t newSize);  // Grow the last allocation in place
+    StringRef copy(const char* data, size_t length);
+    void reset();                                           // End of tick: forget everything
+
+    void setPoison(bool poison);
+    bool isPoisoned() const;
+
+    // Statistics getters
+    size_t getBytesUsed() const;        // Bytes used so far in this tick
+    size_t getBytesReserved() const;    // Bytes held in blocks
+    size_t getBlockCount() const;
+    size_t getResets() const;
+    size_t getPeakUsed() const;
+    size_t getOversized() const;
+
+    // The scratch arena of the running server (set by Server::run)
+    static Arena& active();
+    static void setActive(Arena* arena);
+
+private:
+    size_t addBlock(size_t minimumSize);
+};
+
+/**
+ * @brief Builds a string in arena memory with cheap appends
+ *
+ * As long as nothing else is allocated from the arena in between, appends
+ * extend the string in place; otherwise the string is moved to a bigger
+ * piece of the arena. Nothing is ever freed until the arena is reset.
+ */
+class ScratchWriter {
+private:
+    Arena& _arena;
+    char* _data;
+    size_t _length;
+    size_t _capacity;
+
+public:
+    explicit ScratchWriter(Arena& arena, size_t initialCapacity = 128);
+
+    ScratchWriter& append(const char* data, size_t length);
+    ScratchWriter& append(const std::string& value);
+    ScratchWriter& append(const StringRef& value);
+    ScratchWriter& append(const char* value);
+    ScratchWriter& append(char c);
+
+    StringRef str() const;
+    size_t length() const;
+
+private:
+    void reserve(size_t needed);
+};
+
+#endif
@@ -0,0 +1,632 @@
+#include "BufferPool.hpp"
+#include <sys/uio.h>     // For writev()
+#include <sys/syscall.h> // For getcpu()
+#include <dirent.h>      // For counting NUMA nodes in sysfs
+
+// Size classes: a short reply, a typical burst, a large burst (LIST, NAMES...)
+const size_t BufferPool::CLASS_SIZES[BufferPool::CLASS_COUNT] = { 512, 4096, 65536 };
+const size_t BufferPool::SLAB_SIZES[BufferPool::CLASS_COUNT] = { 64 * 1024, 256 * 1024, 1024 * 1024 };
+
+// Static member definition
+__thread BufferPool::ThreadCache* BufferPool::_threadCache = NULL;
+
+/**
+ * @brief Constructor for BufferPool class
+ */
+BufferPool::BufferPool() : _nodes(0), _caches(NULL) {
+    for (size_t node = 0; node < MAX_NODES; ++node) {
+        _nodeIds[node] = 0;
+        for (size_t i = 0; i < CLASS_COUNT; ++i) {
+            _depots[node][i].freeList = NULL;
+            _depots[node][i].freeCount = 0;
+            _depots[node][i].total = 0;
+        }
+    }
+    
+    // One directory per node in sysfs, named by its id; none at all on kernels without NUMA
+    DIR* directory = opendir("/sys/devices/system/node");
+    if (directory) {
+        struct dirent* entry;
+        while ((entry = readdir(directory)) != NULL && _nodes < MAX_NODES) {
+            if (strncmp(entry->d_name, "node", 4) == 0 && isdigit(static_cast<unsigned char>(entry->d_name[4]))) {
+                _nodeIds[_nodes++] = static_cast<size_t>(atol(entry->d_name + 4));
+            }
+        }
+        closedir(directory);
+    }
+    if (_nodes == 0) {
+        _nodes = 1;     // Id 0
+    }
+    pthread_mutex_init(&_lock, NULL);
+    pthread_key_create(&_cacheKey, &BufferPool::destroyThreadCache);
+}
+
+/**
+ * @brief Destructor for BufferPool class - frees every slab
+ */
+BufferPool::~BufferPool() {
+    pthread_key_delete(_cacheKey);
+    while (_caches) {
+        ThreadCache* next = _caches->nextCache;
+        delete _caches;
+        _caches = next;
+    }
+    _threadCache = NULL;
+
+    for (size_t node = 0; node < MAX_NODES; ++node) {
+        for (size_t i = 0; i < CLASS_COUNT; ++i) {
+            for (size_t j = 0; j < _depots[node][i].slabs.size(); ++j) {
+                delete[] _depots[node][i].slabs[j];
+            }
+        }
+    }
+    pthread_mutex_destroy(&_lock);
+}
+
+/**
+ * @brief Get the process-wide pool
+ * @return The pool
+ */
+BufferPool& BufferPool::instance() {
+    static BufferPool pool;
+    return pool;
+}
+
+/**
+ * @brief Get a chunk
+ * @param minimumSize Payload bytes wanted
+ * @return A chunk of the smallest class that fits (the largest class if none does)
+ */
+IoChunk* BufferPool::acquire(size_t minimumSize) {
+    size_t sizeClass = 0;
+    while (sizeClass + 1 < CLASS_COUNT && CLASS_SIZES[sizeClass] < minimumSize) {
+        sizeClass++;
+    }
+
+    ThreadCache* cache = threadCache();
+    if (cache->counts[sizeClass] == 0) {
+        refill(cache, sizeClass);
+    }
+
+    size_t count = cache->counts[sizeClass] - 1;
+    IoChunk* chunk = cache->chunks[sizeClass][count];
+    __atomic_store_n(&cache->counts[sizeClass], count, __ATOMIC_RELAXED);
+    chunk->next = NULL;
+    chunk->start = 0;
+    chunk->end = 0;
+    return chunk;
+}
+
+/**
+ * @brief Give a chunk back
+ * @param chunk The chunk (NULL is ignored)
+ */
+void BufferPool::release(IoChunk* chunk) {
+    if (!chunk) {
+        return;
+    }
+
+    ThreadCache* cache = threadCache();
+    size_t sizeClass = chunk->sizeClass;
+    if (cache->counts[sizeClass] == CACHE_SIZE) {
+        flush(cache, sizeClass, CACHE_SIZE - BATCH_SIZE);
+    }
+    size_t count = cache->counts[sizeClass];
+    cache->chunks[sizeClass][count] = chunk;
+    __atomic_store_n(&cache->counts[sizeClass], count + 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Give back every chunk of a chain
+ * @param head First chunk of the chain
+ */
+void BufferPool::releaseChain(IoChunk* head) {
+    while (head) {
+        IoChunk* next = head->next;
+        release(head);
+        head = next;
+    }
+}
+
+/**
+ * @brief Return all chunks cached by the calling thread to the depot
+ *
+ * Called when the server goes idle so memory freed by a burst becomes
+ * available to every thread again.
+ */
+void BufferPool::trimThreadCache() {
+    ThreadCache* cache = _threadCache;
+    if (!cache) {
+        return;
+    }
+    for (size_t i = 0; i < CLASS_COUNT; ++i) {
+        flush(cache, i, 0);
+    }
+}
+
+/**
+ * @brief Make the calling thread's cache use the depot of its current NUMA node
+ *
+ * Called by threads right after they are pinned to a CPU: chunks cached so
+ * far go back to their depots, and later refills (and new slabs) come from
+ * the node the thread now runs on.
+ */
+void BufferPool::localizeThreadCache() {
+    ThreadCache* cache = threadCache();
+    for (size_t i = 0; i < CLASS_COUNT; ++i) {
+        flush(cache, i, 0);
+    }
+    cache->node = depotFor(currentNode());
+}
+
+/**
+ * @brief Get the number of NUMA nodes the pool keeps depots for
+ * @return Node count (1 without NUMA)
+ */
+size_t BufferPool::getNodeCount() const {
+    return _nodes;
+}
+
+/**
+ * @brief Get the NUMA node of the CPU the calling thread runs on
+ * @return Node number (0 if the kernel can't tell)
+ */
+size_t BufferPool::currentNode() {
+    unsigned int cpu = 0;
+    unsigned int node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+        return 0;
+    }
+    return node;
+}
+
+/**
+ * @brief Collect per-class statistics
+ * @param stats Array filled with one entry per size class
+ *
+ * Thread cache counts are relaxed atomic reads while their threads keep
+ * working; the numbers are only used for reporting, so a slightly stale
+ * value is fine.
+ */
+void BufferPool::getStats(ClassStats stats[CLASS_COUNT]) {
+    pthread_mutex_lock(&_lock);
+    for (size_t i = 0; i < CLASS_COUNT; ++i) {
+        stats[i].chunkSize = CLASS_SIZES[i];
+        stats[i].slabs = 0;
+        stats[i].total = 0;
+        stats[i].depotFree = 0;
+        for (size_t node = 0; node < _nodes; ++node) {
+            stats[i].slabs += _depots[node][i].slabs.size();
+            stats[i].total += _depots[node][i].total;
+            stats[i].depotFree += _depots[node][i].freeCount;
+        }
+        stats[i].cached = 0;
+        for (ThreadCache* cache = _caches; cache; cache = cache->nextCache) {
+            stats[i].cached += __atomic_load_n(&cache->counts[i], __ATOMIC_RELAXED);
+        }
+        stats[i].inUse = stats[i].total - stats[i].depotFree - stats[i].cached;
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+/**
+ * @brief Get (or create) the calling thread's cache
+ * @return The cache
+ */
+BufferPool::ThreadCache* BufferPool::threadCache() {
+    if (_threadCache) {
+        return _threadCache;
+    }
+
+    ThreadCache* cache = new ThreadCache();
+    for (size_t i = 0; i < CLASS_COUNT; ++i) {
+        cache->counts[i] = 0;
+    }
+    cache->node = depotFor(currentNode());
+
+    pthread_mutex_lock(&_lock);
+    cache->nextCache = _caches;
+    _caches = cache;
+    pthread_mutex_unlock(&_lock);
+
+    pthread_setspecific(_cacheKey, cache);
+    _threadCache = cache;
+    return cache;
+}
+
+/**
+ * @brief Find the depot of a NUMA node
+ * @param node Node id (as getcpu() reports it)
+ * @return Depot index; the first depot for a node without one of its own
+ */
+size_t BufferPool::depotFor(size_t node) const {
+    for (size_t i = 0; i < _nodes; ++i) {
+        if (_nodeIds[i] == node) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Move a batch of free chunks from the depot into a thread cache
+ * @param cache The cache to fill
+ * @param sizeClass The size class
+ */
+void BufferPool::refill(ThreadCache* cache, size_t sizeClass) {
+    Depot& depot = _depots[cache->node][sizeClass];
+
+    pthread_mutex_lock(&_lock);
+    if (depot.freeCount < BATCH_SIZE) {
+        addSlab(cache->node, sizeClass);
+    }
+    size_t count = cache->counts[sizeClass];
+    while (count < BATCH_SIZE && depot.freeList) {
+        IoChunk* chunk = depot.freeList;
+        depot.freeList = chunk->next;
+        depot.freeCount--;
+        cache->chunks[sizeClass][count++] = chunk;
+    }
+    __atomic_store_n(&cache->counts[sizeClass], count, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&_lock);
+}
+
+/**
+ * @brief Move free chunks from a thread cache back to their depots
+ * @param cache The cache to drain
+ * @param sizeClass The size class
+ * @param keep Number of chunks to leave in the cache
+ */
+void BufferPool::flush(ThreadCache* cache, size_t sizeClass, size_t keep) {
+    pthread_mutex_lock(&_lock);
+    size_t count = cache->counts[sizeClass];
+    while (count > keep) {
+        IoChunk* chunk = cache->chunks[sizeClass][--count];
+        Depot& depot = _depots[chunk->node][sizeClass];  // Home node, not the freeing thread's
+        chunk->next = depot.freeList;
+        depot.freeList = chunk;
+        depot.freeCount++;
+    }
+    __atomic_store_n(&cache->counts[sizeClass], count, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&_lock);
+}
+
+/**
+ * @brief Carve a new slab into chunks (called with _lock held)
+ * @param node The node's depot (the caller runs on that node, so the pages it touches land there)
+ * @param sizeClass The size class
+ */
+void BufferPool::addSlab(size_t node, size_t sizeClass) {
+    Depot& depot = _depots[node][sizeClass];
+    size_t stride = sizeof(IoChunk) + CLASS_SIZES[sizeClass];
+    size_t count = SLAB_SIZES[sizeClass] / stride;
+
+    char* slab = new char[count * stride];
+    depot.slabs.push_back(slab);
+
+    for (size_t i = 0; i < count; ++i) {
+        IoChunk* chunk = reinterpret_cast<IoChunk*>(slab + i * stride);
+        chunk->sizeClass = static_cast<unsigned short>(sizeClass);
+        chunk->node = static_cast<unsigned short>(node);
+        chunk->capacity = static_cast<unsigned int>(CLASS_SIZES[sizeClass]);
+        chunk->start = 0;
+        chunk->end = 0;
+        chunk->next = depot.freeList;
+        depot.freeList = chunk;
+    }
+    depot.freeCount += count;
+    depot.total += count;
+}
+
+/**
+ * @brief Thread exit hook: hand the thread's cached chunks back to the depot
+ * @param cache The exiting thread's cache
+ */
+void BufferPool::destroyThreadCache(void* cache) {
+    BufferPool& pool = instance();
+    ThreadCache* threadCache = static_cast<ThreadCache*>(cache);
+    for (size_t i = 0; i < CLASS_COUNT; ++i) {
+        pool.flush(threadCache, i, 0);
+    }
+
+    pthread_mutex_lock(&pool._lock);
+    ThreadCache** link = &pool._caches;
+    while (*link && *link != threadCache) {
+        link = &(*link)->nextCache;
+    }
+    if (*link) {
+        *link = threadCache->nextCache;
+    }
+    pthread_mutex_unlock(&pool._lock);
+
+    delete threadCache;
+    _threadCache = NULL;
+}
+
+/**
+ * @brief Constructor for InputBuffer class (holds no memory until data arrives)
+ */
+InputBuffer::InputBuffer() : _chunk(NULL) {
+}
+
+/**
+ * @brief Destructor for InputBuffer class
+ */
+InputBuffer::~InputBuffer() {
+    release();
+}
+
+/**
+ * @brief Read from a socket into the buffer
+ * @param fd The socket
+ * @return What recv() returned
+ *
+ * A 4 KiB chunk is taken from the pool on demand. Unconsumed bytes (a
+ * partial line) are moved to the front first so lines stay contiguous.
+ */
+ssize_t InputBuffer::readFrom(int fd) {
+    if (!_chunk) {
+        _chunk = BufferPool::instance().acquire(4096);
+    } else if (_chunk->start > 0) {
+        memmove(_chunk->data(), _chunk->data() + _chunk->start, _chunk->length());
+        _chunk->end -= _chunk->start;
+        _chunk->start = 0;
+    }
+
+    ssize_t bytesRead = recv(fd, _chunk->data() + _chunk->end, _chunk->space(), 0);
+    if (bytesRead > 0) {
+        _chunk->end += static_cast<unsigned int>(bytesRead);
+    } else if (_chunk->length() == 0) {
+        release();
+    }
+    return bytesRead;
+}
+
+/**
+ * @brief Get the unconsumed bytes
+ * @return Pointer to the first unconsumed byte
+ */
+const char* InputBuffer::data() const {
+    return _chunk ? _chunk->data() + _chunk->start : "";
+}
+
+/**
+ * @brief Get the number of unconsumed bytes
+ * @return Byte count
+ */
+size_t InputBuffer::length() const {
+    return _chunk ? _chunk->length() : 0;
+}
+
+/**
+ * @brief Mark bytes at the front as processed
+ * @param count Number of bytes
+ *
+ * Once nothing is left the chunk is returned to the pool right away.
+ */
+void InputBuffer::consume(size_t count) {
+    if (!_chunk) {
+        return;
+    }
+    _chunk->start += static_cast<unsigned int>(std::min(count, _chunk->length()));
+    if (_chunk->length() == 0) {
+        release();
+    }
+}
+
+/**
+ * @brief Drop all data and return the chunk to the pool
+ */
+void InputBuffer::release() {
+    if (_chunk) {
+        BufferPool::instance().release(_chunk);
+        _chunk = NULL;
+    }
+}
+
+/**
+ * @brief Get the pooled memory held by this buffer
+ * @return Chunk payload size, 0 when idle
+ */
+size_t InputBuffer::getCapacity() const {
+    return _chunk ? _chunk->capacity : 0;
+}
+
+/**
+ * @brief Constructor for OutputQueue class (empty, holds no memory)
+ */
+OutputQueue::OutputQueue() : _head(NULL), _tail(NULL), _bytes(0) {
+}
+
+/**
+ * @brief Destructor for OutputQueue class - unsent data is dropped
+ */
+OutputQueue::~OutputQueue() {
+    clear();
+}
+
+/**
+ * @brief Queue bytes for sending
+ * @param data The bytes
+ * @param length Number of bytes
+ *
+ * The first chunk of a queue is a small one (most queues only ever hold a
+ * reply or two); bursts continue in 4 KiB chunks, or 64 KiB for big writes.
+ */
+void OutputQueue::append(const char* data, size_t length) {
+    while (length > 0) {
+        if (!_tail || _tail->space() == 0) {
+            size_t wanted = _head ? std::max(length, static_cast<size_t>(4096)) : length;
+            IoChunk* chunk = BufferPool::instance().acquire(wanted);
+            if (_tail) {
+                _tail->next = chunk;
+            } else {
+                _head = chunk;
+            }
+            _tail = chunk;
+        }
+
+        size_t count = std::min(length, _tail->space());
+        memcpy(_tail->data() + _tail->end, data, count);
+        _tail->end += static_cast<unsigned int>(count);
+        _bytes += count;
+        data += count;
+        length -= count;
+    }
+}
+
+/**
+ * @brief Get space to format bytes in place
+ * @param length Number of bytes that may be written (at most 64 KiB, the largest chunk)
+ * @return Pointer to at least length contiguous bytes after the queued data
+ *
+ * Lets a formatter write a line straight into the queue instead of building
+ * it elsewhere and copying it in. Nothing is queued until commit(). If the
+ * last chunk is too full, a new one is started and the rest of the old one
+ * stays unused.
+ */
+char* OutputQueue::reserve(size_t length) {
+    if (!_tail || _tail->space() < length) {
+        size_t wanted = _head ? std::max(length, static_cast<size_t>(4096)) : length;
+        IoChunk* chunk = BufferPool::instance().acquire(wanted);
+        if (_tail) {
+            _tail->next = chunk;
+        } else {
+            _head = chunk;
+        }
+        _tail = chunk;
+    }
+    return _tail->data() + _tail->end;
+}
+
+/**
+ * @brief Queue bytes written into reserved space
+ * @param length Number of bytes written (at most what was reserved)
+ */
+void OutputQueue::commit(size_t length) {
+    _tail->end += static_cast<unsigned int>(length);
+    _bytes += length;
+}
+
+/**
+ * @brief Write as much queued data as the socket accepts
+ * @param fd The socket
+ * @return Number of bytes written, or -1 on a socket error
+ *
+ * writev() sends several chunks with one system call. Sent chunks are
+ * returned to the pool immediately.
+ */
+ssize_t OutputQueue::flush(int fd) {
+    ssize_t total = 0;
+
+    while (_head) {
+        struct iovec vectors[16];
+        int count = 0;
+        size_t requested = 0;
+        for (IoChunk* chunk = _head; chunk && count < 16; chunk = chunk->next) {
+            vectors[count].iov_base = chunk->data() + chunk->start;
+            vectors[count].iov_len = chunk->length();
+            requested += chunk->length();
+            count++;
+        }
+
+        ssize_t written = writev(fd, vectors, count);
+        if (written < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                break;  // Socket full, try again when poll() says POLLOUT
+            }
+            return -1;
+        }
+
+        total += written;
+        size_t remaining = static_cast<size_t>(written);
+        _bytes -= remaining;
+        while (_head && remaining >= _head->length()) {
+            remaining -= _head->length();
+            IoChunk* sent = _head;
+            _head = _head->next;
+            BufferPool::instance().release(sent);
+        }
+        if (!_head) {
+            _tail = NULL;
+        } else {
+            _head->start += static_cast<unsigned int>(remaining);
+        }
+        if (static_cast<size_t>(written) < requested) {
+            break;  // Partial write: the socket buffer is full
+        }
+    }
+
+    return total;
+}
+
+/**
+ * @brief Take all queued data out as a chain of chunks
+ * @return The chain (NULL if the queue is empty); the caller now owns it
+ *
+ * Used to hand a client's output to an I/O thread without copying it.
+ */
+IoChunk* OutputQueue::detach() {
+    IoChunk* chain = _head;
+    _head = NULL;
+    _tail = NULL;
+    _bytes = 0;
+    return chain;
+}
+
+/**
+ * @brief Queue a chain taken from another queue with detach()
+ * @param chain The chain (NULL does nothing); the queue now owns it
+ */
+void OutputQueue::appendChain(IoChunk* chain) {
+    if (!chain) {
+        return;
+    }
+    if (_tail) {
+        _tail->next = chain;
+    } else {
+        _head = chain;
+    }
+    for (IoChunk* chunk = chain; chunk; chunk = chunk->next) {
+        _bytes += chunk->length();
+        _tail = chunk;
+    }
+}
+
+/**
+ * @brief Drop all queued data
+ */
+void OutputQueue::clear() {
+    BufferPool::instance().releaseChain(_head);
+    _head = NULL;
+    _tail = NULL;
+    _bytes = 0;
+}
+
+/**
+ * @brief Check if anything is waiting to be sent
+ * @return true if the queue is empty
+ */
+bool OutputQueue::empty() const {
+    return _bytes == 0;
+}
+
+/**
+ * @brief Get the number of bytes waiting to be sent
+ * @return Byte count
+ */
+size_t OutputQueue::size() const {
+    return _bytes;
+}
+
+/**
+ * @brief Get the pooled memory held by the queue
+ * @return Sum of chunk payload sizes
+ */
+size_t OutputQueue::getCapacity() const {
+    size_t capacity = 0;
+    for (IoChunk* chunk = _head; chunk; chunk = chunk->next) {
+        capacity += chunk->capacity;
+    }
+    return capacity;
+}
@@ -0,0 +1,179 @@
+#ifndef BUFFERPOOL_HPP
+#define BUFFERPOOL_HPP
+
+#include "ircserv.hpp"
+#include <pthread.h>     // For the depot mutex and thread cache cleanup
+
+/**
+ * @brief One fixed-size network buffer carved out of a slab
+ *
+ * The header sits right in front of the payload. The next pointer links the
+ * chunk into a freelist while it is free and into a client's output chain
+ * while it is in use, so neither needs any extra list nodes.
+ */
+struct IoChunk {
+    IoChunk* next;              // Freelist / output chain link
+    unsigned short sizeClass;   // Index into BufferPool::CLASS_SIZES
+    unsigned short node;        // Depot the chunk belongs to (slot of its NUMA node, see BufferPool::depotFor)
+    unsigned int capacity;      // Payload bytes
+    unsigned int start;         // First byte not yet consumed/sent
+    unsigned int end;           // One past the last valid byte
+
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+    size_t length() const { return end - start; }
+    size_t space() const { return capacity - end; }
+};
+
+/**
+ * @brief Slab allocator for receive and send buffers
+ *
+ * Buffers come in three size classes (512 B, 4 KiB, 64 KiB). Memory is taken
+ * from the system in large slabs that are cut into chunks of one class and
+ * never returned, so steady-state I/O never calls malloc.
+ *
+ * Every thread has its own small cache of free chunks per class. acquire()
+ * and release() only touch that cache, without locks or atomics; the cache
+ * exchanges chunks with the shared depot in batches (under a mutex) when it
+ * runs empty or overflows. That keeps the fast path contention-free once
+ * I/O runs on several threads.
+ *
+ * There is one depot per NUMA node. A thread cache refills from the depot
+ * of the node its thread runs on, new slabs are carved (first touched) by
+ * that thread so the kernel places them on that node, and a released chunk
+ * always goes back to the depot it came from, whichever thread frees it.
+ * Threads that are pinned to a CPU call localizeThreadCache() once so their
+ * cache follows them to the right node. With a single node this is the
+ * plain one-depot pool. Node ids can have gaps (nodes 0 and 2 only), so
+ * depots are found by the node's id, never by counting.
+ *
+ * Only its own thread changes a cache's counts; getStats() reads them from
+ * another thread, so they are written and read with relaxed atomics.
+ */
+class BufferPool {
+public:
+    static const size_t CLASS_COUNT = 3;
+    static const size_t CLASS_SIZES[CLASS_COUNT];   // Payload size of each class
+    static const size_t SLAB_SIZES[CLASS_COUNT];    // Bytes per slab of each class
+    static const size_t CACHE_SIZE = 32;            // Chunks a thread keeps per class
+    static const size_t BATCH_SIZE = 16;            // Chunks moved per depot exchange
+    static const size_t MAX_NODES = 8;              // NUMA nodes with a depot of their own
+
+    // Per-class counters for STATS
+    struct ClassStats {
+        size_t chunkSize;       // Payload bytes per chunk
+        size_t slabs;           // Slabs allocated
+        size_t total;           // Chunks carved from slabs
+        size_t depotFree;       // Free chunks in the shared depot
+        size_t cached;          // Free chunks in thread caches
+        size_t inUse;           // Chunks held by buffers
+    };
+
+private:
+    struct ThreadCache {
+        IoChunk* chunks[CLASS_COUNT][CACHE_SIZE];
+        size_t counts[CLASS_COUNT];     // Owner thread writes, stats read (atomic access)
+        size_t node;                    // Depot the cache refills from
+        ThreadCache* nextCache;         // Registry of all caches (for stats)
+    };
+
+    struct Depot {
+        IoChunk* freeList;
+        size_t freeCount;
+        size_t total;
+        std::vector<char*> slabs;
+    };
+
+    Depot _depots[MAX_NODES][CLASS_COUNT];
+    size_t _nodes;                      // NUMA nodes with a depot (1 without NUMA)
+    size_t _nodeIds[MAX_NODES];         // Node id of each depot
+    pthread_mutex_t _lock;              // Protects the depots and the cache registry
+    pthread_key_t _cacheKey;            // Flushes a thread's cache when it exits
+    ThreadCache* _caches;               // All live thread caches
+
+    static __thread ThreadCache* _threadCache;  // This thread's cache
+
+    BufferPool();
+    ~BufferPool();
+    BufferPool(const BufferPool& other);
+    BufferPool& operator=(const BufferPool& other);
+
+public:
+    static BufferPool& instance();
+
+    IoChunk* acquire(size_t minimumSize);   // Smallest class that fits (capped at the largest)
+    void release(IoChunk* chunk);           // Back to this thread's cache
+    void releaseChain(IoChunk* head);       // Release a whole output chain
+
+    void trimThreadCache();                 // Give this thread's cached chunks back to the depot
+    void localizeThreadCache();             // After pinning: refill from this CPU's node from now on
+    void getStats(ClassStats stats[CLASS_COUNT]);
+    size_t getNodeCount() const;
+    static size_t currentNode();            // NUMA node of the CPU the caller runs on
+
+private:
+    ThreadCache* threadCache();
+    size_t depotFor(size_t node) const;     // Depot of a NUMA node id
+    void refill(ThreadCache* cache, size_t sizeClass);
+    void flush(ThreadCache* cache, size_t sizeClass, size_t keep);
+    void addSlab(size_t node, size_t sizeClass);
+    static void destroyThreadCache(void* cache);
+};
+
+/**
+ * @brief A client's receive buffer backed by one pooled chunk
+ *
+ * recv() writes straight into the chunk and lines are parsed where they lie.
+ * When everything received has been consumed the chunk goes back to the
+ * pool, so idle clients hold no receive memory at all.
+ */
+class InputBuffer {
+private:
+    IoChunk* _chunk;
+
+    InputBuffer(const InputBuffer& other);
+    InputBuffer& operator=(const InputBuffer& other);
+
+public:
+    InputBuffer();
+    ~InputBuffer();
+
+    ssize_t readFrom(int fd);           // recv() into the free space
+    const char* data() const;
+    size_t length() const;
+    void consume(size_t count);         // Drop bytes from the front (releases the chunk when empty)
+    void release();
+    size_t getCapacity() const;         // Pooled bytes held (0 when idle)
+};
+
+/**
+ * @brief A client's pending output as a chain of pooled chunks
+ *
+ * Replies are appended here and written out with writev() when the socket
+ * is writable. Fully sent chunks go straight back to the pool.
+ */
+class OutputQueue {
+private:
+    IoChunk* _head;
+    IoChunk* _tail;
+    size_t _bytes;
+
+    OutputQueue(const OutputQueue& other);
+    OutputQueue& operator=(const OutputQueue& other);
+
+public:
+    OutputQueue();
+    ~OutputQueue();
+
+    void append(const char* data, size_t length);
+    char* reserve(size_t length);       // Contiguous space for up to length bytes at the end
+    void commit(size_t length);         // Queue bytes written into reserve()d space
+    IoChunk* detach();                  // Take the whole chain out (the queue is left empty)
+    void appendChain(IoChunk* chain);   // Queue a detached chain after the current data
+    ssize_t flush(int fd);              // Bytes written, -1 on a socket error
+    void clear();
+    bool empty() const;
+    size_t size() const;                // Bytes waiting to be sent
+    size_t getCapacity() const;         // Pooled bytes held
+};
+
+#endif
@@ -0,0 +1,52 @@
+#include "Capabilities.hpp"
+
+// Capability names, in bit order
+static const char* const NAMES[Capabilities::COUNT] = {
+    "server-time",
+    "message-tags",
+    "echo-message"
+};
+
+/**
+ * @brief Look up a capability by name
+ * @param name Capability name as sent in CAP REQ
+ * @return Its bit, or 0 if the server doesn't offer it
+ */
+unsigned int Capabilities::find(const std::string& name) {
+    for (unsigned int i = 0; i < COUNT; ++i) {
+        if (name == NAMES[i]) {
+            return 1u << i;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Get the names of all capabilities
+ * @return Space-separated list, built on first use
+ */
+const std::string& Capabilities::list() {
+    static std::string all;
+    if (all.empty()) {
+        all = names((1u << COUNT) - 1);
+    }
+    return all;
+}
+
+/**
+ * @brief Get the names of a set of capabilities
+ * @param caps Capability bits
+ * @return Space-separated names (empty if no bit is set)
+ */
+std::string Capabilities::names(unsigned int caps) {
+    std::string result;
+    for (unsigned int i = 0; i < COUNT; ++i) {
+        if (caps & (1u << i)) {
+            if (!result.empty()) {
+                result += ' ';
+            }
+            result += NAMES[i];
+        }
+    }
+    return result;
+}
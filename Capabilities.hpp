@@ -0,0 +1,30 @@
+#ifndef CAPABILITIES_HPP
+#define CAPABILITIES_HPP
+
+#include "ircserv.hpp"
+
+/**
+ * @brief IRCv3 capabilities the server offers (CAP LS/REQ/ACK)
+ *
+ * A client's enabled capabilities are one bitmask (Client::getCaps), so
+ * checking one during fanout is a single AND. Only server-time and
+ * message-tags change how a relayed message looks; they are the
+ * TAG_CAPS bits that select a rendering in TaggedMessage.
+ */
+class Capabilities {
+public:
+    enum {
+        CAP_SERVER_TIME = 1 << 0,       // @time=... on relayed messages
+        CAP_MESSAGE_TAGS = 1 << 1,      // @msgid=..., client tags (+tag) and TAGMSG
+        CAP_ECHO_MESSAGE = 1 << 2       // PRIVMSG/TAGMSG are echoed to the sender
+    };
+
+    static const unsigned int COUNT = 3;
+    static const unsigned int TAG_CAPS = CAP_SERVER_TIME | CAP_MESSAGE_TAGS;
+
+    static unsigned int find(const std::string& name);     // Bit for a capability name, 0 if unknown
+    static const std::string& list();                       // All names, space separated (CAP LS)
+    static std::string names(unsigned int caps);            // Names of the bits set (CAP LIST)
+};
+
+#endif
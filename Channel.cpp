@@ -1,17 +1,22 @@
 #include "Channel.hpp"
 #include "Client.hpp"
 #include "Utils.hpp"
+#include "Reactor.hpp"
 
 /**
  * @brief Constructor for Channel class
- * @param name The name of the channel
+ * @param name The name of the channel (handle from the server's pool)
+ * @param index Index to keep informed about the member count (optional)
  * 
  * std::vector is like a dynamic array that can grow and shrink.
  * We initialize all modes to false and user limit to 0.
  */
-Channel::Channel(const std::string& name) 
-    : _name(name), _inviteOnly(false), _topicRestricted(false), 
-      _hasKey(false), _hasUserLimit(false), _userLimit(0) {
+Channel::Channel(const InternedString& name, ChannelIndex* index) 
+    : _name(name), _index(index), _topicTime(0), _shard(NULL), _fanout(NULL), _inviteOnly(false), _topicRestricted(false), 
+      _stripColors(false), _hasKey(false), _hasUserLimit(false), _userLimit(0) {
+    if (_index) {
+        _index->add(this, 0);
+    }
 }
 
 /**
@@ -19,8 +24,18 @@ Channel::Channel(const std::string& name)
  */
 Channel::~Channel() {
     // We don't delete the Client pointers because they're owned by the Server
-    // We just clear our vectors
+    // We just make sure no member, index or shard still lists us, then clear our vectors
+    if (_index) {
+        _index->remove(this, _clients.size());
+    }
+    for (size_t i = 0; i < _clients.size(); ++i) {
+        _clients[i]->leftChannel(this);
+    }
+    if (_shard && !_clients.empty()) {
+        _shard->forget(this);
+    }
     _clients.clear();
+    _silencers.clear();
     _operators.clear();
     _invited.clear();
 }
@@ -30,6 +45,14 @@ Channel::~Channel() {
  * @return Reference to the channel name
  */
 const std::string& Channel::getName() const {
+    return _name.str();
+}
+
+/**
+ * @brief Get the pooled handle of the channel name
+ * @return Reference to the handle (also used as the key in Server::_channels)
+ */
+const InternedString& Channel::getNameHandle() const {
     return _name;
 }
 
@@ -41,6 +64,14 @@ const std::string& Channel::getTopic() const {
     return _topic;
 }
 
+/**
+ * @brief Get the time the topic was last set
+ * @return Timestamp, 0 if no topic was ever set
+ */
+time_t Channel::getTopicTime() const {
+    return _topicTime;
+}
+
 /**
  * @brief Get the channel key (password)
  * @return Reference to the channel key
@@ -92,6 +123,14 @@ bool Channel::isTopicRestricted() const {
     return _topicRestricted;
 }
 
+/**
+ * @brief Check if formatting codes are stripped from messages
+ * @return true if +S is set
+ */
+bool Channel::isStripColors() const {
+    return _stripColors;
+}
+
 /**
  * @brief Check if channel has a key (password)
  * @return true if has key, false otherwise
@@ -118,6 +157,16 @@ bool Channel::hasUserLimit() const {
 void Channel::addClient(Client* client) {
     if (!hasClient(client)) {
         _clients.push_back(client);
+        client->joinedChannel(this);
+        if (client->getSilence()) {
+            _silencers.push_back(client);
+        }
+        if (_shard) {
+            _shard->join(this, shardMember(client));
+        }
+        if (_index) {
+            _index->resize(this, _clients.size() - 1, _clients.size());
+        }
         // If this is the first client, make them an operator
         if (_clients.size() == 1) {
             addOperator(client);
@@ -137,6 +186,17 @@ void Channel::removeClient(Client* client) {
     std::vector<Client*>::iterator it = std::find(_clients.begin(), _clients.end(), client);
     if (it != _clients.end()) {
         _clients.erase(it);
+        client->leftChannel(this);
+        it = std::find(_silencers.begin(), _silencers.end(), client);
+        if (it != _silencers.end()) {
+            _silencers.erase(it);
+        }
+        if (_shard) {
+            _shard->leave(this, client->getConnection());
+        }
+        if (_index) {
+            _index->resize(this, _clients.size() + 1, _clients.size());
+        }
     }
     
     // Also remove from operators and invited lists
@@ -227,6 +287,7 @@ bool Channel::isInvited(Client* client) const {
  */
 void Channel::setTopic(const std::string& topic) {
     _topic = topic;
+    _topicTime = time(NULL);
 }
 
 /**
@@ -279,6 +340,115 @@ void Channel::setTopicRestricted(bool restricted) {
     _topicRestricted = restricted;
 }
 
+/**
+ * @brief Set strip-colors mode
+ * @param strip true to remove formatting codes from messages and topics
+ */
+void Channel::setStripColors(bool strip) {
+    _stripColors = strip;
+}
+
+/**
+ * @brief Get one of the mask lists
+ * @param mode 'b' (bans), 'e' (ban exceptions) or 'I' (invite exceptions)
+ * @return The list, or NULL for any other mode
+ */
+MaskMatcher* Channel::getMaskList(char mode) {
+    if (mode == 'b') return &_bans;
+    if (mode == 'e') return &_exceptions;
+    if (mode == 'I') return &_inviteExceptions;
+    return NULL;
+}
+
+/**
+ * @brief Check if a client is banned from the channel
+ * @param client The client
+ * @return true if a +b mask matches and no +e mask does
+ * 
+ * Most channels have no bans, so that case returns before the client's
+ * prefix is even built.
+ */
+bool Channel::isBanned(Client* client) const {
+    if (_bans.empty()) {
+        return false;
+    }
+    std::string subject = MaskMatcher::fold(client->getPrefix());
+    return _bans.matches(subject) && !_exceptions.matches(subject);
+}
+
+/**
+ * @brief Get the table of texts sent to the channel lately
+ * @return Reference to the table
+ */
+FloodGuard& Channel::getRecentMessages() {
+    return _recent;
+}
+
+/**
+ * @brief Hand the channel's traffic to a shard (set once, right after creation)
+ * @param shard The shard
+ */
+void Channel::setShard(ChannelShard* shard) {
+    _shard = shard;
+}
+
+/**
+ * @brief Get the shard delivering the channel's traffic
+ * @return The shard, or NULL if broadcasts loop over the members here
+ */
+ChannelShard* Channel::getShard() const {
+    return _shard;
+}
+
+/**
+ * @brief Use a worker pool for broadcasts once the channel is large
+ * @param fanout The pool
+ */
+void Channel::setFanout(FanoutPool* fanout) {
+    _fanout = fanout;
+}
+
+/**
+ * @brief Take note that a member's caps or SILENCE list changed
+ * @param client The member
+ */
+void Channel::refreshMember(Client* client) {
+    std::vector<Client*>::iterator it = std::find(_silencers.begin(), _silencers.end(), client);
+    if (client->getSilence() && it == _silencers.end()) {
+        _silencers.push_back(client);
+    } else if (!client->getSilence() && it != _silencers.end()) {
+        _silencers.erase(it);
+    }
+    if (_shard) {
+        _shard->join(this, shardMember(client));  // Updates the caps the shard knows
+    }
+}
+
+/**
+ * @brief Describe a member for the shard
+ * @param client The member
+ * @return Its connection and caps
+ */
+ShardMember Channel::shardMember(const Client* client) const {
+    ShardMember member;
+    member.reactor = client->getReactor();
+    member.connection = client->getConnection();
+    member.caps = client->getCaps();
+    return member;
+}
+
+/**
+ * @brief Check if a client may join without an invite
+ * @param client The client
+ * @return true if a +I mask matches
+ */
+bool Channel::isInviteExempt(Client* client) const {
+    if (_inviteExceptions.empty()) {
+        return false;
+    }
+    return _inviteExceptions.matches(MaskMatcher::fold(client->getPrefix()));
+}
+
 /**
  * @brief Get the channel modes as a string
  * @return String representation of channel modes (e.g., "+itk")
@@ -290,6 +460,7 @@ std::string Channel::getModeString() const {
     if (_topicRestricted) modes += "t";
     if (_hasKey) modes += "k";
     if (_hasUserLimit) modes += "l";
+    if (_stripColors) modes += "S";
     
     if (modes == "+") {
         return "";  // No modes set
@@ -299,39 +470,75 @@ std::string Channel::getModeString() const {
 }
 
 /**
- * @brief Get the list of users for the NAMES command
- * @return String with all usernames, operators prefixed with @
+ * @brief Send a message to all clients in the channel
+ * @param message The message to send
+ * @param exclude Client to exclude from the broadcast (usually the sender)
+ * @param sender Client the message comes from, for SILENCE checks (NULL: no checks)
+ * 
+ * The \r\n-terminated line is built once in scratch memory and the same
+ * bytes are sent to every member.
  */
-std::string Channel::getUserList() const {
-    std::string userList;
-    
-    for (size_t i = 0; i < _clients.size(); ++i) {
-        if (i > 0) userList += " ";
-        
-        // Prefix operators with @
-        if (isOperator(_clients[i])) {
-            userList += "@";
-        }
-        
-        userList += _clients[i]->getNickname();
-    }
-    
-    return userList;
+void Channel::broadcast(const std::string& message, Client* exclude, const Client* sender, Client* actor) {
+    ScratchWriter line(Arena::active(), message.length() + 2);
+    line.append(message).append("\r\n", 2);
+    TaggedMessage tagged(line.str());
+    broadcastMessage(tagged, exclude, sender, actor);
 }
 
 /**
- * @brief Send a message to all clients in the channel
- * @param message The message to send
+ * @brief Send a message to all clients in the channel, tagged per recipient
+ * @param message The message (renders each tag variant once)
  * @param exclude Client to exclude from the broadcast (usually the sender)
+ * @param sender Client the message comes from, for SILENCE checks (NULL: no checks)
  * 
- * This function will be implemented after we create the Utils class
- * for sending messages to clients.
- */
-void Channel::broadcast(const std::string& message, Client* exclude) {
+ * @param actor Member whose command caused the message (JOIN, PART...), NULL if none
+ * 
+ * Members who silenced the sender are skipped. For members without a
+ * silence list that is a single NULL check. Members with the same
+ * server-time/message-tags settings share one rendered line.
+ * 
+ * On a sharded channel the members are not visited here: the shard gets
+ * the line and the connections to skip (exclude and the few members whose
+ * SILENCE list matches). The actor's own copy is queued right away so it
+ * arrives before the replies to its command (NAMES after JOIN...).
+ * 
+ * Above fanout_threshold members the loop is split over the FanoutPool
+ * workers; it is still complete when this returns.
+ */
+void Channel::broadcastMessage(TaggedMessage& message, Client* exclude, const Client* sender, Client* actor) {
+    if (_shard) {
+        ShardTask* task = new ShardTask();
+        task->kind = ShardTask::DELIVER;
+        task->channel = this;
+        task->line = ChannelShard::share(message, 1);
+        if (exclude) {
+            task->skip.push_back(exclude->getConnection());
+        }
+        if (actor && actor != exclude && hasClient(actor)) {
+            message.send(actor);
+            task->skip.push_back(actor->getConnection());
+        }
+        for (size_t i = 0; sender && i < _silencers.size(); ++i) {
+            if (_silencers[i]->isSilencing(sender)) {
+                task->skip.push_back(_silencers[i]->getConnection());
+            }
+        }
+        _shard->publish(task);
+        return;
+    }
+    
+    if (_fanout && _fanout->wants(_clients.size())) {
+        _fanout->broadcast(message, _clients, exclude, sender);
+        return;
+    }
+    
     for (size_t i = 0; i < _clients.size(); ++i) {
-        if (_clients[i] != exclude) {
-            // We'll implement sendToClient in Utils.cpp
-            Utils::sendToClient(_clients[i], message);
+        if (_clients[i] == exclude) {
+            continue;
+        }
+        if (sender && _clients[i]->isSilencing(sender)) {
+            continue;
         }
+        message.send(_clients[i]);
     }
 }
@@ -2,6 +2,14 @@
 #define CHANNEL_HPP
 
 #include "ircserv.hpp"
+#include "InternPool.hpp"
+#include "Arena.hpp"
+#include "MaskMatcher.hpp"
+#include "ChannelIndex.hpp"
+#include "FloodGuard.hpp"
+#include "TaggedMessage.hpp"
+#include "ChannelShard.hpp"
+#include "FanoutPool.hpp"
 
 /**
  * @brief The Channel class represents an IRC channel
@@ -11,30 +19,42 @@
  */
 class Channel {
 private:
-    std::string _name;                      // Channel name (e.g., "#general")
+    InternedString _name;                   // Channel name (e.g., "#general", pooled)
+    ChannelIndex* _index;                   // Server's index by member count (NULL: not indexed)
     std::string _topic;                     // Channel topic
+    time_t _topicTime;                      // When the topic was last set (0: never)
     std::string _key;                       // Channel password (if any)
     std::vector<Client*> _clients;          // List of clients in the channel
     std::vector<Client*> _operators;        // List of channel operators
     std::vector<Client*> _invited;          // List of invited clients (for invite-only mode)
+    MaskMatcher _bans;                      // +b list: masks that may not join or speak
+    MaskMatcher _exceptions;                // +e list: masks exempt from bans
+    MaskMatcher _inviteExceptions;          // +I list: masks that may join without an invite
+    FloodGuard _recent;                     // Texts sent to the channel lately (flood detection)
+    ChannelShard* _shard;                   // Shard delivering the channel's traffic (NULL: done here)
+    FanoutPool* _fanout;                    // Workers for broadcasts to large memberships (NULL: none)
+    std::vector<Client*> _silencers;        // Members with a SILENCE list (checked per message by shards)
     
     // Channel modes
     bool _inviteOnly;                       // +i mode: only invited users can join
     bool _topicRestricted;                  // +t mode: only operators can change topic
+    bool _stripColors;                      // +S mode: formatting codes are removed from messages
     bool _hasKey;                           // +k mode: channel has a password
     bool _hasUserLimit;                     // +l mode: channel has user limit
     size_t _userLimit;                      // Maximum number of users
 
 public:
     // Constructor
-    Channel(const std::string& name);
+    Channel(const InternedString& name, ChannelIndex* index = NULL);
     
     // Destructor
     ~Channel();
     
     // Getters
     const std::string& getName() const;
+    const InternedString& getNameHandle() const;
     const std::string& getTopic() const;
+    time_t getTopicTime() const;
     const std::string& getKey() const;
     const std::vector<Client*>& getClients() const;
     const std::vector<Client*>& getOperators() const;
@@ -43,6 +63,7 @@ public:
     // Mode getters
     bool isInviteOnly() const;
     bool isTopicRestricted() const;
+    bool isStripColors() const;
     bool hasKey() const;
     bool hasUserLimit() const;
     
@@ -62,6 +83,22 @@ public:
     void removeInvited(Client* client);
     bool isInvited(Client* client) const;
     
+    // Mask lists (mode is 'b', 'e' or 'I')
+    MaskMatcher* getMaskList(char mode);
+    bool isBanned(Client* client) const;            // Matches +b and not +e
+    bool isInviteExempt(Client* client) const;      // Matches +I
+    
+    // Texts sent to the channel lately (flood detection)
+    FloodGuard& getRecentMessages();
+    
+    // Channel shards (channel_shards)
+    void setShard(ChannelShard* shard);
+    ChannelShard* getShard() const;
+    void refreshMember(Client* client);     // Caps or SILENCE list changed
+    
+    // Parallel fanout (fanout_threads)
+    void setFanout(FanoutPool* fanout);
+    
     // Channel operations
     void setTopic(const std::string& topic);
     void setKey(const std::string& key);
@@ -70,11 +107,17 @@ public:
     void removeUserLimit();
     void setInviteOnly(bool inviteOnly);
     void setTopicRestricted(bool restricted);
+    void setStripColors(bool strip);
     
     // Utility functions
     std::string getModeString() const;      // Returns the channel modes as a string
-    std::string getUserList() const;        // Returns list of users for NAMES command
-    void broadcast(const std::string& message, Client* exclude = NULL);  // Send message to all clients
+    void broadcast(const std::string& message, Client* exclude = NULL,
+                   const Client* sender = NULL, Client* actor = NULL);   // Send message to all clients
+    void broadcastMessage(TaggedMessage& message, Client* exclude = NULL,
+                          const Client* sender = NULL, Client* actor = NULL);  // Same, one rendering per tag variant
+
+private:
+    ShardMember shardMember(const Client* client) const;
 };
 
 #endif
@@ -0,0 +1,100 @@
+#include "ChannelIndex.hpp"
+
+/**
+ * @brief Constructor for ChannelIndex class
+ */
+ChannelIndex::ChannelIndex() : _queries(0), _visited(0) {
+}
+
+/**
+ * @brief Add a channel
+ * @param channel The channel
+ * @param members Its current member count
+ */
+void ChannelIndex::add(Channel* channel, size_t members) {
+    _bySize.insert(std::make_pair(members, channel));
+}
+
+/**
+ * @brief Remove a channel
+ * @param channel The channel
+ * @param members Its member count as last reported
+ */
+void ChannelIndex::remove(Channel* channel, size_t members) {
+    _bySize.erase(std::make_pair(members, channel));
+}
+
+/**
+ * @brief Move a channel after its member count changed
+ * @param channel The channel
+ * @param oldMembers The count it is filed under
+ * @param newMembers The new count
+ */
+void ChannelIndex::resize(Channel* channel, size_t oldMembers, size_t newMembers) {
+    if (oldMembers == newMembers) {
+        return;
+    }
+    _bySize.erase(std::make_pair(oldMembers, channel));
+    _bySize.insert(std::make_pair(newMembers, channel));
+}
+
+/**
+ * @brief Step to the next channel within a member count range
+ * @param minMembers Smallest member count wanted
+ * @param maxMembers Largest member count wanted
+ * @param cursor Where the walk stands (default-constructed for a new walk)
+ * @return The next channel, biggest first, or NULL when the range is done
+ */
+Channel* ChannelIndex::next(size_t minMembers, size_t maxMembers, Cursor& cursor) {
+    if (minMembers > maxMembers) {
+        return NULL;
+    }
+
+    // Walk backwards: from just above maxMembers, then from the last channel returned
+    Set::iterator it;
+    if (!cursor.started) {
+        _queries++;
+        cursor.started = true;
+        it = maxMembers == static_cast<size_t>(-1)
+           ? _bySize.end()
+           : _bySize.lower_bound(std::make_pair(maxMembers + 1, static_cast<Channel*>(NULL)));
+    } else {
+        it = _bySize.lower_bound(std::make_pair(cursor.members, cursor.channel));
+    }
+    if (it == _bySize.begin()) {
+        return NULL;
+    }
+    --it;
+    if (it->first < minMembers) {
+        return NULL;
+    }
+
+    _visited++;
+    cursor.members = it->first;
+    cursor.channel = it->second;
+    return it->second;
+}
+
+/**
+ * @brief Get the number of channels
+ * @return Channel count
+ */
+size_t ChannelIndex::size() const {
+    return _bySize.size();
+}
+
+/**
+ * @brief Get the number of LIST queries
+ * @return Query count
+ */
+size_t ChannelIndex::getQueries() const {
+    return _queries;
+}
+
+/**
+ * @brief Get the number of channels visited by queries
+ * @return Visited channel count
+ */
+size_t ChannelIndex::getVisited() const {
+    return _visited;
+}
@@ -0,0 +1,56 @@
+#ifndef CHANNELINDEX_HPP
+#define CHANNELINDEX_HPP
+
+#include "ircserv.hpp"
+
+/**
+ * @brief All channels, ordered by member count (for LIST)
+ *
+ * Each Channel reports its member count changes here from addClient() and
+ * removeClient(), so the order is kept up to date one join/part at a time
+ * and never has to be rebuilt. A LIST with a user count filter ("<n",
+ * ">n") then only visits the channels inside that range, biggest first,
+ * instead of looking at every channel on the server.
+ *
+ * A LIST walks the index with a Cursor, one channel per next() call, so
+ * nothing is copied up front. The cursor is the position of the channel
+ * last returned, not an iterator, so channels may come and go in between.
+ * A channel whose member count changes during the walk may be listed twice
+ * or not at all.
+ */
+class ChannelIndex {
+public:
+    // Where a walk stands: the (member count, channel) key last returned
+    struct Cursor {
+        bool started;
+        size_t members;
+        Channel* channel;
+
+        Cursor() : started(false), members(0), channel(NULL) {}
+    };
+
+private:
+    typedef std::set<std::pair<size_t, Channel*> > Set;
+
+    Set _bySize;                        // (member count, channel)
+
+    // Statistics
+    size_t _queries;                    // Walks started
+    size_t _visited;                    // Channels returned by next()
+
+public:
+    ChannelIndex();
+
+    void add(Channel* channel, size_t members);
+    void remove(Channel* channel, size_t members);
+    void resize(Channel* channel, size_t oldMembers, size_t newMembers);
+
+    // Next channel with minMembers <= count <= maxMembers, biggest first; NULL at the end
+    Channel* next(size_t minMembers, size_t maxMembers, Cursor& cursor);
+
+    size_t size() const;
+    size_t getQueries() const;
+    size_t getVisited() const;
+};
+
+#endif
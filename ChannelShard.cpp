@@ -0,0 +1,389 @@
+#include "ChannelShard.hpp"
+#include "Reactor.hpp"
+
+/**
+ * @brief Constructor for ChannelShard class
+ * @param index Shard number (for log messages)
+ */
+ChannelShard::ChannelShard(size_t index)
+    : _index(index), _started(false), _stop(0), _wakePending(0), _handOff(NULL), _handOffContext(NULL), _posted(0), _tasks(0),
+      _deliveries(0), _channels(0) {
+    _wake[0] = _wake[1] = -1;
+}
+
+/**
+ * @brief Destructor for ChannelShard class
+ */
+ChannelShard::~ChannelShard() {
+    stop();
+
+    ShardTask* task;
+    while (_mailbox.pop(task)) {
+        release(task->line);
+        delete task;
+    }
+    for (int i = 0; i < 2; ++i) {
+        if (_wake[i] >= 0) {
+            close(_wake[i]);
+        }
+    }
+}
+
+/**
+ * @brief Start the shard thread
+ * @return true if it is running
+ */
+bool ChannelShard::start() {
+    if (pipe(_wake) < 0) {
+        std::cerr << "Shard " << _index << ": pipe: " << strerror(errno) << std::endl;
+        return false;
+    }
+    fcntl(_wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(_wake[1], F_SETFL, O_NONBLOCK);
+
+    // Signals must keep going to the state thread
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &previous);
+    int result = pthread_create(&_thread, NULL, &ChannelShard::threadMain, this);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (result != 0) {
+        std::cerr << "Shard " << _index << ": cannot start thread" << std::endl;
+        return false;
+    }
+    _started = true;
+    return true;
+}
+
+/**
+ * @brief Stop the shard thread once everything already posted is delivered
+ */
+void ChannelShard::stop() {
+    if (_started) {
+        __atomic_store_n(&_stop, 1, __ATOMIC_RELEASE);
+        ssize_t ignored = write(_wake[1], "s", 1);
+        (void)ignored;
+        pthread_join(_thread, NULL);
+        _started = false;
+    }
+}
+
+/**
+ * @brief Queue a task for the shard (state thread)
+ * @param task The task (now owned by the shard)
+ *
+ * Tasks are numbered in the order they are posted, from 1; getTasks()
+ * reaching a task's number means its lines are with the reactors. Only the
+ * first post after the shard last looked writes to the wake-up pipe.
+ */
+void ChannelShard::post(ShardTask* task) {
+    _posted++;
+    _mailbox.push(task);
+    if (__atomic_exchange_n(&_wakePending, 1, __ATOMIC_ACQ_REL) == 0) {
+        ssize_t ignored = write(_wake[1], "w", 1);
+        (void)ignored;
+    }
+}
+
+/**
+ * @brief Set what publish() calls before posting a line (before start())
+ * @param handOff Hands the state thread's queued output to the reactors
+ * @param context Passed to handOff
+ */
+void ChannelShard::setHandOff(HandOff handOff, void* context) {
+    _handOff = handOff;
+    _handOffContext = context;
+}
+
+/**
+ * @brief Post a line for members (state thread)
+ * @param task A DELIVER or DIRECT task
+ *
+ * Whatever the state thread queued for any client so far reaches the
+ * reactors first, so no member gets this line before output that was
+ * produced earlier.
+ */
+void ChannelShard::publish(ShardTask* task) {
+    if (_handOff) {
+        _handOff(_handOffContext);
+    }
+    post(task);
+}
+
+/**
+ * @brief Add a member to a channel's roster, or update its caps
+ * @param channel The channel
+ * @param member The member
+ */
+void ChannelShard::join(const void* channel, const ShardMember& member) {
+    ShardTask* task = new ShardTask();
+    task->kind = ShardTask::JOIN;
+    task->channel = channel;
+    task->member = member;
+    post(task);
+}
+
+/**
+ * @brief Remove a member from a channel's roster
+ * @param channel The channel
+ * @param connection The member's connection id
+ */
+void ChannelShard::leave(const void* channel, unsigned long connection) {
+    ShardTask* task = new ShardTask();
+    task->kind = ShardTask::LEAVE;
+    task->channel = channel;
+    task->member.reactor = NULL;
+    task->member.connection = connection;
+    task->member.caps = 0;
+    post(task);
+}
+
+/**
+ * @brief Drop a channel's roster (the Channel object is being destroyed)
+ * @param channel The channel
+ */
+void ChannelShard::forget(const void* channel) {
+    ShardTask* task = new ShardTask();
+    task->kind = ShardTask::FORGET;
+    task->channel = channel;
+    post(task);
+}
+
+/**
+ * @brief Point a member's roster entries at the reactor its connection moved to
+ * @param channels The member's channels on this shard (may be empty)
+ * @param member The member, with its new reactor
+ * @param from The reactor the connection left
+ *
+ * Posted to every shard, whether it has rosters with the member or not: a
+ * DIRECT line posted before the move may still be on its way to the old
+ * reactor, and the FENCE this task sends after it is what tells the new
+ * reactor that nothing from this shard is still coming the long way round.
+ */
+void ChannelShard::move(const std::vector<const void*>& channels, const ShardMember& member, Reactor* from) {
+    ShardTask* task = new ShardTask();
+    task->kind = ShardTask::MOVE;
+    task->member = member;
+    task->channels = channels;
+    task->from = from;
+    post(task);
+}
+
+/**
+ * @brief Render every tag variant of a message for the shards
+ * @param message The message
+ * @param refs Number of tasks that will hold the line
+ * @return The shared line
+ *
+ * At most four small renders, whatever the number of recipients.
+ */
+ShardLine* ChannelShard::share(TaggedMessage& message, int refs) {
+    ShardLine* line = new ShardLine();
+    for (unsigned int caps = 0; caps <= Capabilities::TAG_CAPS; ++caps) {
+        StringRef variant = message.render(caps);
+        line->variants[caps].assign(variant.data, variant.length);
+    }
+    line->refs = refs;
+    return line;
+}
+
+/**
+ * @brief Get the number of tasks posted (state thread)
+ * @return Task count, also the number of the last task posted
+ */
+size_t ChannelShard::getPosted() const {
+    return _posted;
+}
+
+/**
+ * @brief Get the number of tasks finished
+ * @return Task count; a task's lines were handed to the reactors before it is counted
+ */
+size_t ChannelShard::getTasks() const {
+    return __atomic_load_n(&_tasks, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Get the number of lines handed to reactors
+ * @return Delivery count
+ */
+size_t ChannelShard::getDeliveries() const {
+    return __atomic_load_n(&_deliveries, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the number of channels with members on this shard
+ * @return Channel count
+ */
+size_t ChannelShard::getChannels() const {
+    return __atomic_load_n(&_channels, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Thread entry point
+ * @param shard The ChannelShard
+ * @return NULL
+ */
+void* ChannelShard::threadMain(void* shard) {
+    static_cast<ChannelShard*>(shard)->loop();
+    return NULL;
+}
+
+/**
+ * @brief The shard thread: sleep on the pipe, run whatever was posted
+ */
+void ChannelShard::loop() {
+    while (!__atomic_load_n(&_stop, __ATOMIC_ACQUIRE)) {
+        struct pollfd entry;
+        entry.fd = _wake[0];
+        entry.events = POLLIN;
+        entry.revents = 0;
+        if (poll(&entry, 1, 1000) < 0 && errno != EINTR) {
+            break;
+        }
+        drain();
+    }
+    drain();
+}
+
+/**
+ * @brief Run every task in the mailbox
+ */
+void ChannelShard::drain() {
+    char buffer[64];
+    while (read(_wake[0], buffer, sizeof(buffer)) > 0) {
+    }
+    // Reset first: a post racing with the loop below wakes us again
+    __atomic_store_n(&_wakePending, 0, __ATOMIC_RELEASE);
+
+    ShardTask* task;
+    while (_mailbox.pop(task)) {
+        run(task);
+        release(task->line);
+        delete task;
+        __atomic_fetch_add(&_tasks, 1, __ATOMIC_RELEASE);  // Pairs with the reactors' ShardMark checks
+    }
+}
+
+/**
+ * @brief Apply one task
+ * @param task The task
+ */
+void ChannelShard::run(ShardTask* task) {
+    if (task->kind == ShardTask::DIRECT) {
+        deliver(task->targets, NULL, task->line);
+        return;
+    }
+    if (task->kind == ShardTask::MOVE) {
+        for (size_t i = 0; i < task->channels.size(); ++i) {
+            std::map<const void*, Roster>::iterator it = _rosters.find(task->channels[i]);
+            if (it == _rosters.end()) {
+                continue;
+            }
+            Roster& roster = it->second;
+            for (size_t j = 0; j < roster.size(); ++j) {
+                if (roster[j].connection == task->member.connection) {
+                    roster[j] = task->member;
+                    break;
+                }
+            }
+        }
+        ReactorOutput fence;
+        fence.kind = ReactorOutput::FENCE;
+        fence.connection = task->member.connection;
+        task->from->deliver(fence);
+        return;
+    }
+
+    std::map<const void*, Roster>::iterator it = _rosters.find(task->channel);
+    if (task->kind == ShardTask::JOIN) {
+        if (it == _rosters.end()) {
+            it = _rosters.insert(std::make_pair(task->channel, Roster())).first;
+            __atomic_fetch_add(&_channels, 1, __ATOMIC_RELAXED);
+        }
+        Roster& roster = it->second;
+        for (size_t i = 0; i < roster.size(); ++i) {
+            if (roster[i].connection == task->member.connection) {
+                roster[i] = task->member;   // Already in: caps changed
+                return;
+            }
+        }
+        roster.push_back(task->member);
+        return;
+    }
+    if (it == _rosters.end()) {
+        return;
+    }
+
+    Roster& roster = it->second;
+    if (task->kind == ShardTask::LEAVE) {
+        for (size_t i = 0; i < roster.size(); ++i) {
+            if (roster[i].connection == task->member.connection) {
+                roster[i] = roster.back();  // Order doesn't matter, removal is O(1) after the search
+                roster.pop_back();
+                break;
+            }
+        }
+    } else if (task->kind == ShardTask::DELIVER) {
+        deliver(roster, &task->skip, task->line);
+    }
+    if (task->kind == ShardTask::FORGET || roster.empty()) {
+        _rosters.erase(it);
+        __atomic_fetch_sub(&_channels, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Give a line to its recipients' reactors, one BATCH per reactor
+ * @param members The recipients
+ * @param skip Connections among them that don't get the line (NULL: none)
+ * @param line The line (each batch takes a reference)
+ *
+ * One mailbox node per reactor however many members it serves; the
+ * reactor copies the line into each member's queue.
+ */
+void ChannelShard::deliver(const std::vector<ShardMember>& members, const std::vector<unsigned long>* skip,
+                           ShardLine* line) {
+    std::vector<Reactor*> reactors;     // A handful: a linear search is enough
+    std::vector<ShardBatch*> batches;
+    size_t delivered = 0;
+    for (size_t i = 0; i < members.size(); ++i) {
+        const ShardMember& member = members[i];
+        if (line->variants[member.caps & Capabilities::TAG_CAPS].empty()) {
+            continue;   // TAGMSG for a client without message-tags
+        }
+        if (skip && !skip->empty() && std::find(skip->begin(), skip->end(), member.connection) != skip->end()) {
+            continue;
+        }
+        size_t b = std::find(reactors.begin(), reactors.end(), member.reactor) - reactors.begin();
+        if (b == reactors.size()) {
+            reactors.push_back(member.reactor);
+            ShardBatch* batch = new ShardBatch();
+            batch->line = line;
+            batch->shard = _index;
+            batch->task = __atomic_load_n(&_tasks, __ATOMIC_RELAXED) + 1;  // The one running
+            batches.push_back(batch);
+        }
+        batches[b]->members.push_back(member);
+        delivered++;
+    }
+
+    for (size_t b = 0; b < batches.size(); ++b) {
+        __atomic_add_fetch(&line->refs, 1, __ATOMIC_ACQ_REL);
+        ReactorOutput output;
+        output.kind = ReactorOutput::BATCH;
+        output.batch = batches[b];
+        reactors[b]->deliver(output);
+    }
+    __atomic_fetch_add(&_deliveries, delivered, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Drop a reference to a line (a task's or a reactor's batch's)
+ * @param line The line (NULL does nothing)
+ */
+void ChannelShard::release(ShardLine* line) {
+    if (line && __atomic_sub_fetch(&line->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        delete line;
+    }
+}
@@ -0,0 +1,155 @@
+#ifndef CHANNELSHARD_HPP
+#define CHANNELSHARD_HPP
+
+#include "ircserv.hpp"
+#include "MpscMailbox.hpp"
+#include "TaggedMessage.hpp"
+#include <pthread.h>
+
+class Reactor;
+
+/**
+ * @brief A channel member as a shard sees it: where its socket lives and which tags it wants
+ */
+struct ShardMember {
+    Reactor* reactor;                   // I/O thread owning the connection
+    unsigned long connection;           // Connection id within the reactors
+    unsigned int caps;                  // Client capabilities (picks the tag variant)
+};
+
+/**
+ * @brief A relayed line in every tag variant, shared by the shards delivering it
+ *
+ * Rendered once on the state thread; each shard task and each batch
+ * holding it counts as one reference, and the last to finish frees it.
+ */
+struct ShardLine {
+    std::string variants[Capabilities::TAG_CAPS + 1];  // Index = caps & TAG_CAPS (empty: send nothing)
+    int refs;                           // Tasks and batches still holding the line (atomic access)
+};
+
+/**
+ * @brief A line for the recipients a shard task has on one reactor (ReactorOutput::BATCH)
+ */
+struct ShardBatch {
+    ShardLine* line;                    // Holds one reference
+    std::vector<ShardMember> members;   // Recipients on that reactor
+    size_t shard;                       // Index of the shard that sent it
+    size_t task;                        // Number of the task it comes from (see getPosted())
+};
+
+/**
+ * @brief One message in a shard's mailbox
+ */
+struct ShardTask {
+    enum Kind {
+        JOIN,                           // Add member to channel's roster (or update its caps)
+        LEAVE,                          // Remove member.connection from the roster
+        FORGET,                         // Drop the whole roster (channel destroyed)
+        DELIVER,                        // Send line to the roster, except the skip list
+        DIRECT,                         // Send line to targets (NICK/QUIT neighbors)
+        MOVE                            // member moved to another reactor: update rosters, FENCE from
+    };
+
+    Kind kind;
+    const void* channel;                // Roster key: the Channel object (JOIN, LEAVE, FORGET, DELIVER)
+    ShardMember member;                 // JOIN, LEAVE
+    ShardLine* line;                    // DELIVER, DIRECT
+    std::vector<unsigned long> skip;    // DELIVER: connections that don't get the line
+    std::vector<ShardMember> targets;   // DIRECT: recipients
+    std::vector<const void*> channels;  // MOVE: rosters on this shard holding the member
+    Reactor* from;                      // MOVE: the reactor the member's connection left
+
+    ShardTask() : kind(JOIN), channel(NULL), line(NULL), from(NULL) {}
+};
+
+/**
+ * @brief A worker thread delivering the traffic of a subset of the channels
+ *
+ * With channel_shards > 0 (and io_threads > 0), channels are split over the
+ * shards by a hash of their name. The state thread still owns every Channel
+ * and Client and checks each command (membership, modes, bans, flood,
+ * content filter), but no longer loops over the members: it posts one task
+ * to the channel's shard, and the shard writes the line for every member
+ * and hands it to the member's reactor. The fanout, which is where the time
+ * goes for busy channels, runs on as many cores as there are shards.
+ *
+ * A shard keeps its own roster per channel (connection ids and caps),
+ * updated by JOIN/LEAVE tasks in the same mailbox as the messages, so a
+ * member gets exactly the messages sent while it was in the channel and
+ * each channel's messages arrive in the order the state thread accepted
+ * them. The mailbox is an MpscMailbox: any thread may post.
+ *
+ * A member also gets output from the state thread (replies, private
+ * messages), through the same reactor mailbox. Lines are posted with
+ * publish(), which first has the state thread hand over what it queued so
+ * far, so a line never overtakes output produced before it (a JOINer gets
+ * its JOIN and NAMES before the channel's next line). Output the state
+ * thread queues after a line may still reach the reactor before the shard
+ * got to that line; it carries a ShardMark and the reactor holds it back
+ * until every task posted before it is finished. Each task sends one BATCH
+ * per reactor, not one output per recipient.
+ */
+class ChannelShard {
+public:
+    typedef void (*HandOff)(void* context);  // State thread: give the reactors the output queued so far
+
+private:
+    typedef std::vector<ShardMember> Roster;
+
+    size_t _index;
+    pthread_t _thread;
+    bool _started;
+    int _stop;                          // Set by the state thread (atomic access)
+    int _wake[2];                       // Pipe: posters -> shard wake-up
+    int _wakePending;                   // A wake-up byte is under way (atomic access)
+    MpscMailbox<ShardTask*> _mailbox;
+    HandOff _handOff;                   // Called by publish() (NULL: nothing to hand over)
+    void* _handOffContext;
+    size_t _posted;                     // Tasks posted (state thread only)
+
+    // Shard thread only
+    std::map<const void*, Roster> _rosters;
+
+    // Counters (written by the shard, read with atomic loads for STATS)
+    size_t _tasks;
+    size_t _deliveries;
+    size_t _channels;
+
+    // Not copyable (owns a thread)
+    ChannelShard(const ChannelShard& other);
+    ChannelShard& operator=(const ChannelShard& other);
+
+public:
+    explicit ChannelShard(size_t index);
+    ~ChannelShard();
+
+    bool start();
+    void stop();                        // Finish the queued tasks, then end the thread
+
+    void post(ShardTask* task);         // State thread; the shard deletes the task
+    void setHandOff(HandOff handOff, void* context);
+    void publish(ShardTask* task);      // State thread: DELIVER/DIRECT, behind the output queued before it
+
+    // State thread helpers
+    void join(const void* channel, const ShardMember& member);
+    void leave(const void* channel, unsigned long connection);
+    void forget(const void* channel);
+    void move(const std::vector<const void*>& channels, const ShardMember& member, Reactor* from);
+    static ShardLine* share(TaggedMessage& message, int refs);  // Render every variant once
+    static void release(ShardLine* line);  // Drop one reference (any thread)
+
+    size_t getPosted() const;           // State thread: tasks posted so far (the last one's number)
+    size_t getTasks() const;            // Any thread: tasks finished, deliveries included
+    size_t getDeliveries() const;
+    size_t getChannels() const;
+
+private:
+    static void* threadMain(void* shard);
+    void loop();
+    void drain();
+    void run(ShardTask* task);
+    void deliver(const std::vector<ShardMember>& members, const std::vector<unsigned long>* skip, ShardLine* line);
+};
+
+#endif
@@ -3,15 +3,25 @@
 /**
  * @brief Constructor for Client class
  * @param fd File descriptor of the client's socket
- * @param hostname The hostname/IP address of the client
+ * @param addr The client's address as returned by accept()
+ * @param names The server's pool, where the rendered address is stored
  * 
  * A constructor is a special function that runs when you create a new object.
  * It initializes all the member variables to their starting values.
  */
-Client::Client(int fd, const std::string& hostname) 
-    : _fd(fd), _hostname(hostname), _authenticated(false), _registered(false), _welcomeSent(false) {
+Client::Client(int fd, const struct sockaddr_in& addr, InternPool& names) 
+    : _fd(fd), _flags(0), _caps(0), _addr(addr), _info(NULL), _silence(NULL), _pending(NULL), _fanoutMark(0),
+      _reactor(NULL), _connection(0), _backlog(NULL), _handOffs(NULL), _handle(0), _activity(0) {
     // The : syntax is called "member initializer list"
     // It's more efficient than setting variables inside the constructor body
+    
+    // Rendered once, here on the state thread: getHostname() is a plain read
+    // that other threads (fanout workers) may call
+    char address[INET_ADDRSTRLEN];
+    if (!inet_ntop(AF_INET, &_addr.sin_addr, address, sizeof(address))) {
+        address[0] = '\0';
+    }
+    _hostname = names.intern(address);
 }
 
 /**
@@ -22,8 +32,10 @@ Client::Client(int fd, const std::string& hostname)
  * It cleans up resources that the object was using.
  */
 Client::~Client() {
-    // In this case, we don't need to do anything special
-    // The socket will be closed by the Server class
+    // The socket will be closed by the Server class, we only free the records we own
+    delete _info;
+    delete _silence;
+    delete _pending;
 }
 
 /**
@@ -37,48 +49,85 @@ int Client::getFd() const {
     return _fd;
 }
 
+/**
+ * @brief Check if capability negotiation is in progress
+ * @return true between CAP LS/REQ and CAP END during registration
+ */
+bool Client::isNegotiating() const {
+    return (_flags & FLAG_NEGOTIATING) != 0;
+}
+
+/**
+ * @brief Check if the hostname lookup is still running
+ * @return true while registration waits for it
+ */
+bool Client::isResolving() const {
+    return (_flags & FLAG_RESOLVING) != 0;
+}
+
+/**
+ * @brief Get the enabled capabilities
+ * @return Capabilities::CAP_* bits
+ */
+unsigned int Client::getCaps() const {
+    return _caps;
+}
+
+/**
+ * @brief Check for an enabled capability
+ * @param cap One Capabilities::CAP_* bit
+ * @return true if the client enabled it
+ */
+bool Client::hasCap(unsigned int cap) const {
+    return (_caps & cap) != 0;
+}
+
 /**
  * @brief Get the client's nickname
- * @return Reference to the nickname string
+ * @return Copy of the nickname
  * 
- * Returning a const reference (&) is efficient because:
- * 1. We don't copy the string (just return a reference to it)
- * 2. const prevents the caller from modifying our internal data
+ * The nickname is stored inline (not as a std::string), so we return a copy.
+ * Use hasNickname() for comparisons to avoid building the copy.
+ */
+std::string Client::getNickname() const {
+    return _nickname.str();
+}
+
+/**
+ * @brief Get the client's nickname without copying it
+ * @return View of the inline nickname (valid until it changes)
  */
-const std::string& Client::getNickname() const {
-    return _nickname;
+StringRef Client::getNicknameRef() const {
+    return StringRef(_nickname.c_str(), _nickname.length());
 }
 
 /**
  * @brief Get the client's username
- * @return Reference to the username string
+ * @return Reference to the username string (empty before USER)
  */
 const std::string& Client::getUsername() const {
-    return _username;
+    static const std::string emptyString;
+    return _info ? _info->username.str() : emptyString;
 }
 
 /**
  * @brief Get the client's real name
- * @return Reference to the realname string
+ * @return Reference to the realname string (empty before USER)
  */
 const std::string& Client::getRealname() const {
-    return _realname;
+    static const std::string emptyString;
+    return _info ? _info->realname : emptyString;
 }
 
 /**
  * @brief Get the client's hostname
  * @return Reference to the hostname string
+ * 
+ * The rendered address (or the looked-up name) lives in the pool, where
+ * clients from the same address share it.
  */
 const std::string& Client::getHostname() const {
-    return _hostname;
-}
-
-/**
- * @brief Get the client's input buffer
- * @return Reference to the buffer string
- */
-const std::string& Client::getBuffer() const {
-    return _buffer;
+    return _hostname.str();
 }
 
 /**
@@ -86,7 +135,7 @@ const std::string& Client::getBuffer() const {
  * @return true if authenticated, false otherwise
  */
 bool Client::isAuthenticated() const {
-    return _authenticated;
+    return (_flags & FLAG_AUTHENTICATED) != 0;
 }
 
 /**
@@ -94,7 +143,7 @@ bool Client::isAuthenticated() const {
  * @return true if registered, false otherwise
  */
 bool Client::isRegistered() const {
-    return _registered;
+    return (_flags & FLAG_REGISTERED) != 0;
 }
 
 /**
@@ -102,7 +151,16 @@ bool Client::isRegistered() const {
  * @return true if welcome sent, false otherwise
  */
 bool Client::isWelcomeSent() const {
-    return _welcomeSent;
+    return (_flags & FLAG_WELCOME_SENT) != 0;
+}
+
+/**
+ * @brief Check if the client has a given nickname
+ * @param nickname The nickname to compare with
+ * @return true if equal, false otherwise
+ */
+bool Client::hasNickname(const std::string& nickname) const {
+    return _nickname == nickname;
 }
 
 /**
@@ -111,17 +169,19 @@ bool Client::isWelcomeSent() const {
  * 
  * A setter function modifies a private member variable.
  * We take the parameter by const reference to avoid copying.
+ * Nicknames longer than IRC::NICKLEN are rejected by Utils::isValidNickname
+ * before we get here, so assign() always fits.
  */
 void Client::setNickname(const std::string& nickname) {
-    _nickname = nickname;
+    _nickname.assign(nickname);
 }
 
 /**
  * @brief Set the client's username
- * @param username The new username
+ * @param username The new username (handle from the server's pool)
  */
-void Client::setUsername(const std::string& username) {
-    _username = username;
+void Client::setUsername(const InternedString& username) {
+    info().username = username;
 }
 
 /**
@@ -129,7 +189,7 @@ void Client::setUsername(const std::string& username) {
  * @param realname The new real name
  */
 void Client::setRealname(const std::string& realname) {
-    _realname = realname;
+    info().realname = realname;
 }
 
 /**
@@ -137,7 +197,7 @@ void Client::setRealname(const std::string& realname) {
  * @param auth Authentication status
  */
 void Client::setAuthenticated(bool auth) {
-    _authenticated = auth;
+    setFlag(FLAG_AUTHENTICATED, auth);
 }
 
 /**
@@ -145,7 +205,7 @@ void Client::setAuthenticated(bool auth) {
  * @param reg Registration status
  */
 void Client::setRegistered(bool reg) {
-    _registered = reg;
+    setFlag(FLAG_REGISTERED, reg);
 }
 
 /**
@@ -153,25 +213,310 @@ void Client::setRegistered(bool reg) {
  * @param sent Welcome sent status
  */
 void Client::setWelcomeSent(bool sent) {
-    _welcomeSent = sent;
+    setFlag(FLAG_WELCOME_SENT, sent);
 }
 
 /**
- * @brief Add data to the client's input buffer
- * @param data The data to add
+ * @brief Get the client's input buffer
+ * @return Reference to the buffer
  * 
  * The buffer stores incoming data until we have a complete command.
  * IRC commands end with \r\n (carriage return + line feed).
  */
-void Client::appendToBuffer(const std::string& data) {
-    _buffer += data;
+InputBuffer& Client::getInput() {
+    return _input;
+}
+
+/**
+ * @brief Get the client's output queue
+ * @return Reference to the queue
+ * 
+ * Everything we send to the client is queued here and written out
+ * when the socket is writable.
+ */
+OutputQueue& Client::getOutput() {
+    return _output;
+}
+
+/**
+ * @brief Get the client's output queue to append to it (state thread)
+ * @return Reference to the queue
+ *
+ * With channel_shards the client is also put on the server's hand-off
+ * list, once, so its output can be handed to its reactor before the next
+ * shard line (see ChannelShard::publish).
+ */
+OutputQueue& Client::queueOutput() {
+    if (_handOffs && !(_flags & FLAG_LISTED)) {
+        _flags |= FLAG_LISTED;
+        _handOffs->push_back(this);
+    }
+    return _output;
+}
+
+/**
+ * @brief Record that the client joined a channel
+ * @param channel The channel
+ */
+void Client::joinedChannel(Channel* channel) {
+    if (std::find(_channels.begin(), _channels.end(), channel) == _channels.end()) {
+        _channels.push_back(channel);
+    }
+}
+
+/**
+ * @brief Record that the client left a channel
+ * @param channel The channel
+ */
+void Client::leftChannel(Channel* channel) {
+    std::vector<Channel*>::iterator it = std::find(_channels.begin(), _channels.end(), channel);
+    if (it != _channels.end()) {
+        _channels.erase(it);
+    }
 }
 
 /**
- * @brief Clear the client's input buffer
+ * @brief Get the channels this client is in
+ * @return Reference to the channel list
  */
-void Client::clearBuffer() {
-    _buffer.clear();  // clear() is a std::string method that empties the string
+const std::vector<Channel*>& Client::getChannels() const {
+    return _channels;
+}
+
+/**
+ * @brief Get the silence list, allocating it on first use
+ * @return Reference to the list
+ */
+SilenceList& Client::silence() {
+    if (!_silence) {
+        _silence = new SilenceList();
+    }
+    return *_silence;
+}
+
+/**
+ * @brief Get the silence list if there is one
+ * @return The list, or NULL
+ */
+const SilenceList* Client::getSilence() const {
+    return _silence;
+}
+
+/**
+ * @brief Free the silence list once its last mask is removed
+ * 
+ * This brings the client back to the no-list fast path.
+ */
+void Client::dropSilenceIfEmpty() {
+    if (_silence && _silence->size() == 0) {
+        delete _silence;
+        _silence = NULL;
+    }
+}
+
+/**
+ * @brief Check if messages from a sender should be dropped for this client
+ * @param sender The sending client
+ * @return true if the sender matches the client's silence list
+ */
+bool Client::isSilencing(const Client* sender) const {
+    return _silence && _silence->matches(sender);
+}
+
+/**
+ * @brief Check if messages from an already folded sender should be dropped for this client
+ * @param sender The sender
+ * @return true if the sender matches the client's silence list
+ */
+bool Client::isSilencing(const SilenceSubject& sender) const {
+    return _silence && _silence->matches(sender);
+}
+
+/**
+ * @brief Get the table of texts this client sent lately
+ * @return Reference to the table (kept in the cold record)
+ */
+FloodGuard& Client::getRecentMessages() {
+    return info().recent;
+}
+
+/**
+ * @brief Queue a reply to be rendered later
+ * @param reply The reply
+ */
+void Client::queueReply(const PendingReply& reply) {
+    if (!_pending) {
+        _pending = new std::deque<PendingReply>();
+    }
+    _pending->push_back(reply);
+}
+
+/**
+ * @brief Check if replies are waiting to be rendered
+ * @return true if the queue is not empty
+ */
+bool Client::hasPendingReplies() const {
+    return _pending != NULL;
+}
+
+/**
+ * @brief Get the number of replies waiting to be rendered
+ * @return Queue length
+ */
+size_t Client::getPendingCount() const {
+    return _pending ? _pending->size() : 0;
+}
+
+/**
+ * @brief Look at the next queued reply without taking it
+ * @return The reply (the queue must not be empty)
+ */
+PendingReply& Client::peekReply() {
+    return _pending->front();
+}
+
+/**
+ * @brief Take the next queued reply
+ * @return The reply (the queue must not be empty)
+ * 
+ * The queue is freed when it runs empty.
+ */
+PendingReply Client::popReply() {
+    PendingReply reply = _pending->front();
+    _pending->pop_front();
+    if (_pending->empty()) {
+        delete _pending;
+        _pending = NULL;
+    }
+    return reply;
+}
+
+/**
+ * @brief Mark the client as reached by a fanout
+ * @param epoch The fanout's epoch number
+ * @return true if this is the first time the client sees this epoch
+ * 
+ * A fanout over several channels meets the same client once per shared
+ * channel; only the first meeting should deliver the message.
+ */
+bool Client::markFanout(unsigned int epoch) {
+    if (_fanoutMark == epoch) {
+        return false;
+    }
+    _fanoutMark = epoch;
+    return true;
+}
+
+/**
+ * @brief Record which I/O thread owns the client's socket
+ * @param reactor The reactor
+ * @param connection The connection id it gave the socket
+ * @param backlog The connection's output counters (valid until the close is handed over)
+ */
+void Client::setConnection(Reactor* reactor, unsigned long connection, ReactorBacklog* backlog) {
+    _reactor = reactor;
+    _connection = connection;
+    _backlog = backlog;
+}
+
+/**
+ * @brief Get the counters of output the client's reactor still has to write
+ * @return The counters, NULL when the main loop handles the socket
+ */
+ReactorBacklog* Client::getBacklog() const {
+    return _backlog;
+}
+
+/**
+ * @brief Get the I/O thread owning the client's socket
+ * @return The reactor, or NULL when the main loop handles the socket
+ */
+Reactor* Client::getReactor() const {
+    return _reactor;
+}
+
+/**
+ * @brief Get the client's connection id within the reactors
+ * @return Connection id (0 without I/O threads)
+ */
+unsigned long Client::getConnection() const {
+    return _connection;
+}
+
+/**
+ * @brief Check if the socket is moving to another I/O thread
+ * @return true between Server::migrateClient and the reactor's answer
+ */
+bool Client::isMigrating() const {
+    return (_flags & FLAG_MIGRATING) != 0;
+}
+
+/**
+ * @brief Set whether the socket is moving to another I/O thread
+ * @param migrating true when the move is requested, false once it is done or refused
+ */
+void Client::setMigrating(bool migrating) {
+    setFlag(FLAG_MIGRATING, migrating);
+}
+
+/**
+ * @brief Set the list queueOutput() puts the client on
+ * @param list The server's hand-off list, NULL to stop listing
+ */
+void Client::setHandOffList(std::vector<Client*>* list) {
+    _handOffs = list;
+}
+
+/**
+ * @brief Note that the client was taken off the hand-off list
+ */
+void Client::unlist() {
+    setFlag(FLAG_LISTED, false);
+}
+
+/**
+ * @brief Count a line received from the client (picks whom to move when rebalancing)
+ */
+void Client::countActivity() {
+    _activity++;
+}
+
+/**
+ * @brief Get the lines received since the last call, and start counting again
+ * @return Line count
+ */
+unsigned int Client::takeActivity() {
+    unsigned int activity = _activity;
+    _activity = 0;
+    return activity;
+}
+
+/**
+ * @brief Give the client its handle
+ * @param handle A number never used for another client
+ */
+void Client::setHandle(unsigned long handle) {
+    _handle = handle;
+}
+
+/**
+ * @brief Get the client's handle
+ * @return The handle (see Server::findClient)
+ *
+ * Tasks on other threads refer to the client by handle, never by pointer:
+ * once the client is gone its slot may hold another client, but the handle
+ * no longer finds anything.
+ */
+unsigned long Client::getHandle() const {
+    return _handle;
+}
+
+/**
+ * @brief Get the client's address in binary form
+ * @return The address as returned by accept()
+ */
+const struct sockaddr_in& Client::getAddress() const {
+    return _addr;
 }
 
 /**
@@ -182,5 +527,105 @@ void Client::clearBuffer() {
  * This is used when forwarding messages to other clients.
  */
 std::string Client::getPrefix() const {
-    return _nickname + "!" + _username + "@" + _hostname;
+    return _nickname.str() + "!" + getUsername() + "@" + getHostname();
+}
+
+/**
+ * @brief Write the IRC prefix into scratch memory
+ * @param out The writer to append "nickname!username@hostname" to
+ * 
+ * Used on the message fanout path, where building a std::string per
+ * message would cost an allocation.
+ */
+void Client::appendPrefix(ScratchWriter& out) const {
+    out.append(_nickname.c_str(), _nickname.length()).append('!')
+       .append(getUsername()).append('@').append(getHostname());
+}
+
+/**
+ * @brief Get the memory used by this client
+ * @return Bytes used by the object and the heap data it owns
+ * 
+ * Pooled strings (hostname, username) are shared and counted by the pool.
+ */
+size_t Client::getMemoryUsage() const {
+    size_t bytes = sizeof(Client) + _input.getCapacity() + _output.getCapacity() +
+                   _channels.capacity() * sizeof(Channel*);
+    if (_info) {
+        bytes += sizeof(ClientInfo) + _info->realname.capacity();
+    }
+    if (_silence) {
+        bytes += sizeof(SilenceList);
+    }
+    if (_pending) {
+        bytes += sizeof(std::deque<PendingReply>) + _pending->size() * sizeof(PendingReply);
+    }
+    return bytes;
+}
+
+/**
+ * @brief Get the cold record, allocating it on first use
+ * @return Reference to the record
+ */
+ClientInfo& Client::info() {
+    if (!_info) {
+        _info = new ClientInfo();
+    }
+    return *_info;
+}
+
+/**
+ * @brief Check if the cold record (username, realname, flood history) exists
+ * @return true once USER was received or the flood guard was used
+ */
+bool Client::hasColdRecord() const {
+    return _info != NULL;
+}
+
+/**
+ * @brief Set whether capability negotiation is in progress
+ * @param negotiating true on CAP LS/REQ before registration, false on CAP END
+ */
+void Client::setNegotiating(bool negotiating) {
+    setFlag(FLAG_NEGOTIATING, negotiating);
+}
+
+/**
+ * @brief Set whether the hostname lookup is still running
+ * @param resolving true when the lookup starts, false when it ended or was given up
+ */
+void Client::setResolving(bool resolving) {
+    setFlag(FLAG_RESOLVING, resolving);
+}
+
+/**
+ * @brief Show a looked-up name instead of the address
+ * @param hostname The name (pooled)
+ *
+ * Only done before registration, while nobody has seen the prefix yet;
+ * the caller updates the server's index.
+ */
+void Client::setHostname(const InternedString& hostname) {
+    _hostname = hostname;
+}
+
+/**
+ * @brief Set the enabled capabilities (CAP REQ)
+ * @param caps Capabilities::CAP_* bits
+ */
+void Client::setCaps(unsigned int caps) {
+    _caps = caps;
+}
+
+/**
+ * @brief Set or clear one of the state bits
+ * @param flag The FLAG_* bit
+ * @param value true to set, false to clear
+ */
+void Client::setFlag(unsigned int flag, bool value) {
+    if (value) {
+        _flags |= flag;
+    } else {
+        _flags &= ~flag;
+    }
 }
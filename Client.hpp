@@ -2,57 +2,210 @@
 #define CLIENT_HPP
 
 #include "ircserv.hpp"
+#include "InternPool.hpp"
+#include "FixedString.hpp"
+#include "BufferPool.hpp"
+#include "SilenceList.hpp"
+#include "FloodGuard.hpp"
+#include "ChannelIndex.hpp"
+#include "Utils.hpp"
+
+class Reactor;
+struct ReactorBacklog;
+
+/**
+ * @brief Rarely used client details (the "cold" part of a Client)
+ *
+ * Only needed for USER, the prefix and future WHOIS-style queries, so it is
+ * allocated on demand when USER arrives instead of living in every Client.
+ */
+struct ClientInfo {
+    InternedString username;    // Client's username (for identification, pooled)
+    std::string realname;       // Client's real name
+    FloodGuard recent;          // Texts this client sent lately (flood detection)
+};
+
+/**
+ * @brief A LIST still walking the channel index (see PendingReply::LIST_SCAN)
+ */
+struct ListQuery {
+    size_t minMembers;                  // Member count range
+    size_t maxMembers;
+    time_t topicAfter;                  // T<n: topic set after this (0: no limit)
+    time_t topicBefore;                 // T>n: topic set before this (0: no limit)
+    std::vector<std::string> masks;     // Folded name masks, one must match (none: any name)
+    std::vector<std::string> excluded;  // Folded !masks, none may match
+    ChannelIndex::Cursor cursor;
+
+    ListQuery() : minMembers(0), maxMembers(static_cast<size_t>(-1)), topicAfter(0), topicBefore(0) {}
+};
+
+/**
+ * @brief One reply waiting to be sent to a client (see Server::pumpReplies)
+ *
+ * Large WHO and LIST results are not rendered all at once; each row is
+ * rendered when the client's output queue has room. Rows name the client or
+ * channel they describe, so one that disappeared in the meantime is simply
+ * skipped. A LIST over the channel index is a single LIST_SCAN entry that
+ * stays at the front of the queue until its walk is done.
+ */
+struct PendingReply {
+    enum Kind {
+        LINE,                   // Send line as-is
+        WHO_ROW,                // RPL_WHOREPLY about the client with "handle"
+        LIST_ROW,               // RPL_LIST about channel "name"
+        LIST_SCAN               // RPL_LIST rows for the channels "list" still has to visit
+    };
+
+    Kind kind;
+    unsigned long handle;       // Client the WHO row is about (WHO_ROW)
+    std::string name;           // Channel name (LIST_ROW)
+    std::string channel;        // Channel the WHO row is for ("*" if none)
+    std::string line;           // Ready-made line (LINE)
+    ListQuery list;             // Filters and position (LIST_SCAN)
+
+    PendingReply() : kind(LINE), handle(0) {}
+};
 
 /**
  * @brief The Client class represents a connected IRC client
- * 
+ *
  * This class stores all information about a client connected to our IRC server.
  * Each client has a socket file descriptor, nickname, username, and various states.
+ *
+ * The object is kept small because most connections are idle most of the time:
+ * the hot fields (fd, state bits, inline nickname, binary peer address) live
+ * directly in the Client, and username/realname live in a separately allocated
+ * ClientInfo. The hostname is only rendered (and pooled) when first needed.
  */
 class Client {
 private:
+    // State bits stored in _flags
+    enum {
+        FLAG_AUTHENTICATED = 1 << 0,    // Client has provided correct password
+        FLAG_REGISTERED = 1 << 1,       // Client has completed registration (NICK + USER)
+        FLAG_WELCOME_SENT = 1 << 2,     // We've sent the welcome message
+        FLAG_NEGOTIATING = 1 << 3,      // CAP LS/REQ seen, registration waits for CAP END
+        FLAG_RESOLVING = 1 << 4,        // Hostname lookup running, registration waits for it
+        FLAG_MIGRATING = 1 << 5,        // Socket moving to another I/O thread, output held back
+        FLAG_LISTED = 1 << 6            // In the hand-off list: output queued since the last hand-off
+    };
+
     int _fd;                    // File descriptor for the client's socket connection
-    std::string _nickname;      // Client's nickname (what others see)
-    std::string _username;      // Client's username (for identification)
-    std::string _realname;      // Client's real name
-    std::string _hostname;      // Client's hostname/IP address
-    std::string _buffer;        // Buffer to store incoming data
-    bool _authenticated;        // Whether client has provided correct password
-    bool _registered;           // Whether client has completed registration (NICK + USER)
-    bool _welcomeSent;          // Whether we've sent the welcome message
+    unsigned int _flags;        // FLAG_* state bits
+    unsigned int _caps;         // Enabled IRCv3 capabilities (Capabilities::CAP_* bits)
+    FixedString<IRC::NICKLEN> _nickname;  // Client's nickname (what others see), stored inline
+    struct sockaddr_in _addr;   // Client's address in binary form
+    InternedString _hostname;   // Rendered address or looked-up name (pooled)
+    ClientInfo* _info;          // Username/realname, NULL until USER is received
+    SilenceList* _silence;      // Server-side ignore list, NULL unless SILENCE is used
+    std::deque<PendingReply>* _pending;  // Replies not rendered yet, NULL when there are none
+    InputBuffer _input;         // Received data not yet processed (pooled, empty when idle)
+    OutputQueue _output;        // Replies not yet sent (pooled, empty when idle)
+    std::vector<Channel*> _channels;  // Channels this client is in (kept up to date by Channel)
+    unsigned int _fanoutMark;   // Last fanout epoch that already reached this client
+    Reactor* _reactor;          // I/O thread owning the socket (io_threads), NULL otherwise
+    unsigned long _connection;  // Connection id within the reactors
+    ReactorBacklog* _backlog;   // Output the reactor hasn't written yet (owned by the reactor)
+    std::vector<Client*>* _handOffs;  // Listed here when output is queued (channel_shards), NULL otherwise
+    unsigned long _handle;      // Unique for the server's lifetime (offloaded task results)
+    unsigned int _activity;     // Lines received since the last rebalance check
+
+    // Not copyable (owns _info)
+    Client(const Client& other);
+    Client& operator=(const Client& other);
 
 public:
     // Constructor
-    Client(int fd, const std::string& hostname);
-    
+    Client(int fd, const struct sockaddr_in& addr, InternPool& names);
+
     // Destructor
     ~Client();
-    
+
     // Getters (const means they don't modify the object)
     int getFd() const;
-    const std::string& getNickname() const;
+    std::string getNickname() const;
+    StringRef getNicknameRef() const;   // Same characters, without a copy
     const std::string& getUsername() const;
     const std::string& getRealname() const;
     const std::string& getHostname() const;
-    const std::string& getBuffer() const;
     bool isAuthenticated() const;
     bool isRegistered() const;
     bool isWelcomeSent() const;
-    
+    bool isNegotiating() const;
+    bool isResolving() const;
+    unsigned int getCaps() const;
+    bool hasCap(unsigned int cap) const;
+    bool hasNickname(const std::string& nickname) const;  // Compare without copying
+
     // Setters
     void setNickname(const std::string& nickname);
-    void setUsername(const std::string& username);
+    void setUsername(const InternedString& username);
     void setRealname(const std::string& realname);
     void setAuthenticated(bool auth);
     void setRegistered(bool reg);
     void setWelcomeSent(bool sent);
-    
+    void setNegotiating(bool negotiating);
+    void setResolving(bool resolving);
+    void setHostname(const InternedString& hostname);  // Looked-up name instead of the address
+    void setCaps(unsigned int caps);
+
     // Buffer operations
-    void appendToBuffer(const std::string& data);
-    void clearBuffer();
+    InputBuffer& getInput();
+    OutputQueue& getOutput();
+    OutputQueue& queueOutput();             // For appending: also lists the client for the next hand-off
+
+    // Channel membership (called by Channel::addClient/removeClient)
+    void joinedChannel(Channel* channel);
+    void leftChannel(Channel* channel);
+    const std::vector<Channel*>& getChannels() const;
+    
+    // Server-side ignore list (SILENCE)
+    SilenceList& silence();                     // Allocates the list on first use
+    const SilenceList* getSilence() const;      // NULL if the client never used SILENCE
+    void dropSilenceIfEmpty();
+    bool isSilencing(const Client* sender) const;  // Drop messages from sender?
+    bool isSilencing(const SilenceSubject& sender) const;
+    
+    // Texts this client sent lately (flood detection)
+    FloodGuard& getRecentMessages();
+    
+    // Replies rendered bit by bit (large WHO results)
+    void queueReply(const PendingReply& reply);
+    bool hasPendingReplies() const;
+    size_t getPendingCount() const;
+    PendingReply& peekReply();
+    PendingReply popReply();
+    
+    // Fanout deduplication: true the first time a given epoch is seen
+    bool markFanout(unsigned int epoch);
+    
+    // Where the socket lives when I/O threads are used
+    void setConnection(Reactor* reactor, unsigned long connection, ReactorBacklog* backlog);
+    ReactorBacklog* getBacklog() const;     // NULL without a reactor connection
+    Reactor* getReactor() const;            // NULL: the socket is handled by Server::run
+    unsigned long getConnection() const;
+    bool isMigrating() const;
+    void setMigrating(bool migrating);      // While set, Server::handOff keeps the output here
+    void setHandOffList(std::vector<Client*>* list);  // Where queueOutput() lists the client
+    void unlist();                          // Taken off the hand-off list
+    void countActivity();                   // One more line received
+    unsigned int takeActivity();            // Lines since the last call
+    
+    // Identifies the client to tasks running on other threads (see TaskPool)
+    void setHandle(unsigned long handle);
+    unsigned long getHandle() const;
+    const struct sockaddr_in& getAddress() const;
     
     // Helper functions
     std::string getPrefix() const;  // Returns the IRC prefix (nickname!username@hostname)
+    void appendPrefix(ScratchWriter& out) const;  // Same, written into scratch memory
+    size_t getMemoryUsage() const;  // Bytes used by this client (object + owned heap data)
+    bool hasColdRecord() const;     // ClientInfo allocated?
+
+private:
+    ClientInfo& info();             // Allocates the cold record on first use
+    void setFlag(unsigned int flag, bool value);
 };
 
 #endif
@@ -0,0 +1,190 @@
+#include "ClientIndex.hpp"
+#include "Client.hpp"
+#include "MaskMatcher.hpp"
+
+/**
+ * @brief Constructor for ClientIndex class
+ */
+ClientIndex::ClientIndex() : _queries(0), _scans(0), _visited(0) {
+}
+
+/**
+ * @brief File a client under its current nickname, username and hostname
+ * @param client The client
+ *
+ * Entries under names the client no longer has are removed first.
+ */
+void ClientIndex::update(Client* client) {
+    Keys keys;
+    keys.nick = MaskMatcher::fold(client->getNickname());
+    keys.user = MaskMatcher::fold(client->getUsername());
+    keys.host = MaskMatcher::fold(client->getHostname());
+
+    std::map<Client*, Keys>::iterator it = _keys.find(client);
+    if (it != _keys.end()) {
+        Keys& old = it->second;
+        if (old.nick != keys.nick) {
+            unfile(_byNick, old.nick, client);
+            file(_byNick, keys.nick, client);
+        }
+        if (old.user != keys.user) {
+            unfile(_byUser, old.user, client);
+            file(_byUser, keys.user, client);
+        }
+        if (old.host != keys.host) {
+            unfile(_byHost, old.host, client);
+            file(_byHost, keys.host, client);
+        }
+        old = keys;
+        return;
+    }
+
+    file(_byNick, keys.nick, client);
+    file(_byUser, keys.user, client);
+    file(_byHost, keys.host, client);
+    _keys[client] = keys;
+}
+
+/**
+ * @brief Remove a client from all indexes
+ * @param client The client
+ */
+void ClientIndex::remove(Client* client) {
+    std::map<Client*, Keys>::iterator it = _keys.find(client);
+    if (it == _keys.end()) {
+        return;
+    }
+    unfile(_byNick, it->second.nick, client);
+    unfile(_byUser, it->second.user, client);
+    unfile(_byHost, it->second.host, client);
+    _keys.erase(it);
+}
+
+/**
+ * @brief Find a client by exact nickname
+ * @param nickname The nickname
+ * @return The client, or NULL
+ *
+ * The map is keyed by the folded nickname, but nicknames are unique
+ * case-sensitively in this server, so the candidates are compared exactly.
+ */
+Client* ClientIndex::findNick(const std::string& nickname) const {
+    std::pair<Map::const_iterator, Map::const_iterator> range = _byNick.equal_range(MaskMatcher::fold(nickname));
+    for (Map::const_iterator it = range.first; it != range.second; ++it) {
+        if (it->second->hasNickname(nickname)) {
+            return it->second;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Find clients whose nickname, username or hostname matches a mask
+ * @param mask Glob mask ('*' and '?')
+ * @param results Matching clients are appended here (each once)
+ */
+void ClientIndex::match(const std::string& mask, std::vector<Client*>& results) {
+    _queries++;
+
+    std::string folded = MaskMatcher::fold(mask);
+    size_t prefix = folded.find_first_of("*?");
+    if (prefix == std::string::npos) {
+        prefix = folded.length();
+    }
+    if (prefix == 0) {
+        _scans++;
+    }
+
+    std::set<Client*> seen;
+    matchRange(_byNick, folded, prefix, results, seen);
+    matchRange(_byUser, folded, prefix, results, seen);
+    matchRange(_byHost, folded, prefix, results, seen);
+}
+
+/**
+ * @brief Get the number of indexed clients
+ * @return Client count
+ */
+size_t ClientIndex::size() const {
+    return _keys.size();
+}
+
+/**
+ * @brief Get the number of mask queries
+ * @return Query count
+ */
+size_t ClientIndex::getQueries() const {
+    return _queries;
+}
+
+/**
+ * @brief Get the number of queries that visited every client
+ * @return Full scan count
+ */
+size_t ClientIndex::getScans() const {
+    return _scans;
+}
+
+/**
+ * @brief Get the number of index entries visited by queries
+ * @return Visited entry count
+ */
+size_t ClientIndex::getVisited() const {
+    return _visited;
+}
+
+/**
+ * @brief Add a client under a key
+ * @param map The index
+ * @param key The folded name (empty names are not filed)
+ * @param client The client
+ */
+void ClientIndex::file(Map& map, const std::string& key, Client* client) {
+    if (!key.empty()) {
+        map.insert(std::make_pair(key, client));
+    }
+}
+
+/**
+ * @brief Remove a client from under a key
+ * @param map The index
+ * @param key The folded name
+ * @param client The client
+ */
+void ClientIndex::unfile(Map& map, const std::string& key, Client* client) {
+    std::pair<Map::iterator, Map::iterator> range = map.equal_range(key);
+    for (Map::iterator it = range.first; it != range.second; ++it) {
+        if (it->second == client) {
+            map.erase(it);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Collect the clients of one index whose key matches a mask
+ * @param map The index
+ * @param mask The folded mask
+ * @param prefix Number of literal characters at the start of the mask
+ * @param results Matching clients are appended here
+ * @param seen Clients already in results (a client can match in several indexes)
+ */
+void ClientIndex::matchRange(const Map& map, const std::string& mask, size_t prefix,
+                             std::vector<Client*>& results, std::set<Client*>& seen) {
+    std::string literal = mask.substr(0, prefix);
+    Map::const_iterator it = map.lower_bound(literal);
+
+    for (; it != map.end(); ++it) {
+        if (it->first.compare(0, prefix, literal) != 0) {
+            break;  // Past the keys that start with the literal prefix
+        }
+        _visited++;
+        if (prefix == mask.length() ? it->first == mask
+                                    : MaskMatcher::globMatch(mask.data(), mask.length(),
+                                                             it->first.data(), it->first.length())) {
+            if (seen.insert(it->second).second) {
+                results.push_back(it->second);
+            }
+        }
+    }
+}
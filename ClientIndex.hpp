@@ -0,0 +1,65 @@
+#ifndef CLIENTINDEX_HPP
+#define CLIENTINDEX_HPP
+
+#include "ircserv.hpp"
+
+/**
+ * @brief Secondary indexes over the connected clients
+ *
+ * WHO, WHOIS and nickname lookups used to scan every client. The index keeps
+ * three sorted maps from case-folded nickname, username and hostname to the
+ * clients carrying them, so:
+ * - an exact lookup is one O(log n) map search
+ * - a mask with a literal prefix ("alice*", "10.0.*") visits only the keys
+ *   in that prefix range, because sorted keys sharing a prefix are adjacent
+ *   (the same walk a prefix trie does, using the map's own tree)
+ * - only masks starting with a wildcard fall back to visiting every client
+ *
+ * The Server calls update() whenever a client's nickname or username
+ * changes (and on connect), and remove() on disconnect. The index remembers
+ * the keys it filed each client under, so an update only touches that
+ * client's own entries.
+ */
+class ClientIndex {
+private:
+    typedef std::multimap<std::string, Client*> Map;
+
+    // The keys a client is currently filed under
+    struct Keys {
+        std::string nick;
+        std::string user;
+        std::string host;
+    };
+
+    Map _byNick;
+    Map _byUser;
+    Map _byHost;
+    std::map<Client*, Keys> _keys;
+
+    // Statistics
+    size_t _queries;                // match() calls
+    size_t _scans;                  // match() calls that had to visit every client
+    size_t _visited;                // Index entries looked at by match()
+
+public:
+    ClientIndex();
+
+    void update(Client* client);    // (Re)file the client under its current names
+    void remove(Client* client);    // Forget the client
+
+    Client* findNick(const std::string& nickname) const;  // Exact, case-sensitive like NICK
+    void match(const std::string& mask, std::vector<Client*>& results);  // WHO-style mask on nick/user/host
+
+    size_t size() const;
+    size_t getQueries() const;
+    size_t getScans() const;
+    size_t getVisited() const;
+
+private:
+    static void file(Map& map, const std::string& key, Client* client);
+    static void unfile(Map& map, const std::string& key, Client* client);
+    void matchRange(const Map& map, const std::string& mask, size_t prefix,
+                    std::vector<Client*>& results, std::set<Client*>& seen);
+};
+
+#endif
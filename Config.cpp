@@ -0,0 +1,124 @@
+#include "Config.hpp"
+#include "Utils.hpp"
+#include <fstream>
+
+/**
+ * @brief Constructor for Config class (no settings, all defaults)
+ */
+Config::Config() {
+}
+
+/**
+ * @brief Load settings from a file
+ * @param path Path of the configuration file
+ * @return true if the file was read, false otherwise
+ *
+ * Each line has the format "key = value". Later lines override earlier ones.
+ * Lines without '=' are reported and skipped.
+ */
+bool Config::load(const std::string& path) {
+    std::ifstream file(path.c_str());
+    if (!file.is_open()) {
+        std::cerr << "Error: Cannot open config file " << path << std::endl;
+        return false;
+    }
+
+    _path = path;
+    _values.clear();
+
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        line = Utils::trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            std::cerr << "Warning: " << path << ":" << lineNumber << ": expected key = value" << std::endl;
+            continue;
+        }
+
+        std::string key = Utils::trim(line.substr(0, equals));
+        std::string value = Utils::trim(line.substr(equals + 1));
+        _values[key] = value;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Get the path the configuration was loaded from
+ * @return The path, or an empty string if no file was loaded
+ */
+const std::string& Config::getPath() const {
+    return _path;
+}
+
+/**
+ * @brief Get a string setting
+ * @param key The setting name
+ * @param defaultValue Value used when the setting is missing
+ * @return The setting value
+ */
+std::string Config::getString(const std::string& key, const std::string& defaultValue) const {
+    std::map<std::string, std::string>::const_iterator it = _values.find(key);
+    if (it == _values.end()) {
+        return defaultValue;
+    }
+    return it->second;
+}
+
+/**
+ * @brief Get a non-negative numeric setting
+ * @param key The setting name
+ * @param defaultValue Value used when the setting is missing or invalid
+ * @return The setting value
+ */
+size_t Config::getSize(const std::string& key, size_t defaultValue) const {
+    std::map<std::string, std::string>::const_iterator it = _values.find(key);
+    if (it == _values.end()) {
+        return defaultValue;
+    }
+
+    int value;
+    if (!Utils::stringToInt(it->second, value) || value < 0) {
+        std::cerr << "Warning: invalid value for " << key << ", using default" << std::endl;
+        return defaultValue;
+    }
+    return static_cast<size_t>(value);
+}
+
+/**
+ * @brief Get a yes/no setting
+ * @param key The setting name
+ * @param defaultValue Value used when the setting is missing or invalid
+ * @return The setting value ("yes", "true", "on", "1" mean true)
+ */
+bool Config::getBool(const std::string& key, bool defaultValue) const {
+    std::map<std::string, std::string>::const_iterator it = _values.find(key);
+    if (it == _values.end()) {
+        return defaultValue;
+    }
+
+    std::string value = Utils::toLower(it->second);
+    if (value == "yes" || value == "true" || value == "on" || value == "1") {
+        return true;
+    }
+    if (value == "no" || value == "false" || value == "off" || value == "0") {
+        return false;
+    }
+    std::cerr << "Warning: invalid value for " << key << ", using default" << std::endl;
+    return defaultValue;
+}
+
+/**
+ * @brief Check if a setting is present
+ * @param key The setting name
+ * @return true if the file set this key
+ */
+bool Config::has(const std::string& key) const {
+    return _values.find(key) != _values.end();
+}
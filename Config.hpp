@@ -0,0 +1,37 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include "ircserv.hpp"
+
+/**
+ * @brief Optional server configuration loaded from a file
+ *
+ * The file is a list of "key = value" lines; blank lines and lines starting
+ * with # are ignored. Every setting has a built-in default, so the server
+ * runs without any configuration file at all.
+ *
+ * Example:
+ *     # Preallocate room for 1000 clients
+ *     client_pool_capacity = 1000
+ */
+class Config {
+private:
+    std::string _path;                              // File we were loaded from (empty if none)
+    std::map<std::string, std::string> _values;     // key -> raw value
+
+public:
+    // Constructor
+    Config();
+
+    // Loading
+    bool load(const std::string& path);             // false if the file can't be read
+    const std::string& getPath() const;
+
+    // Typed getters - return defaultValue when the key is missing or malformed
+    std::string getString(const std::string& key, const std::string& defaultValue) const;
+    size_t getSize(const std::string& key, size_t defaultValue) const;
+    bool getBool(const std::string& key, bool defaultValue) const;
+    bool has(const std::string& key) const;
+};
+
+#endif
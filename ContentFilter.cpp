@@ -0,0 +1,253 @@
+#include "ContentFilter.hpp"
+#include "MaskMatcher.hpp"
+#include "Utils.hpp"
+#include <fstream>
+
+/**
+ * @brief Constructor for ContentFilter class (no rules, matches nothing)
+ */
+ContentFilter::ContentFilter() : _classes(1) {
+    memset(_classOf, 0, sizeof(_classOf));
+    compile();
+}
+
+/**
+ * @brief Add the rules of a rules file
+ * @param path Path of the rules file
+ * @param error Set to a description of the problem when false is returned
+ * @return true if the whole file was read
+ *
+ * Each rule line is a scope ("*" or a channel name), a space, and the phrase.
+ * A bad line rejects the whole file, so a typo never silently drops rules
+ * that were active before a reload.
+ */
+bool ContentFilter::loadFile(const std::string& path, std::string& error) {
+    std::ifstream file(path.c_str());
+    if (!file.is_open()) {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        line = Utils::trim(line);
+        if (line.empty() || (line[0] == '#' && (line.length() == 1 || line[1] == ' '))) {
+            continue;
+        }
+
+        size_t space = line.find(' ');
+        std::string scope = line.substr(0, space);
+        std::string phrase = space == std::string::npos ? "" : Utils::trim(line.substr(space + 1));
+        if (phrase.empty() || (scope != "*" && scope[0] != '#')) {
+            error = path + ":" + Utils::intToString(static_cast<int>(lineNumber)) + ": expected \"* phrase\" or \"#channel phrase\"";
+            return false;
+        }
+        addRule(phrase, scope == "*" ? "" : scope);
+    }
+    return true;
+}
+
+/**
+ * @brief Add a rule (call compile() afterwards)
+ * @param phrase Text to block, matched anywhere in a message, ignoring case
+ * @param channel Channel the rule is limited to, or empty for all messages
+ */
+void ContentFilter::addRule(const std::string& phrase, const std::string& channel) {
+    Rule rule;
+    rule.phrase = MaskMatcher::fold(phrase);
+    rule.channel = MaskMatcher::fold(channel);
+    _rules.push_back(rule);
+}
+
+/**
+ * @brief Build the automaton from the rules
+ *
+ * 1. Give every byte that occurs in a phrase its own input class.
+ * 2. Insert the phrases into a trie; state 0 is the root.
+ * 3. Walk the trie breadth-first. A state's failure link is the longest
+ *    proper suffix of its text that is also a trie state; missing
+ *    transitions are copied from the failure state (which, being shallower,
+ *    is already complete), and so are its outputs, so a state reports every
+ *    phrase that ends at that point of the text.
+ */
+void ContentFilter::compile() {
+    memset(_classOf, 0, sizeof(_classOf));
+    _classes = 1;
+    for (size_t r = 0; r < _rules.size(); ++r) {
+        const std::string& phrase = _rules[r].phrase;
+        for (size_t i = 0; i < phrase.length(); ++i) {
+            unsigned char c = static_cast<unsigned char>(phrase[i]);
+            if (_classOf[c] == 0) {
+                _classOf[c] = static_cast<unsigned char>(_classes++);
+                _classOf[toupper(c)] = _classOf[c];  // Phrases are folded to lower case
+            }
+        }
+    }
+
+    // Trie (-1 = no transition yet)
+    _next.assign(_classes, -1);
+    std::vector<std::vector<size_t> > outputs(1);
+    for (size_t r = 0; r < _rules.size(); ++r) {
+        const std::string& phrase = _rules[r].phrase;
+        if (phrase.empty()) {
+            continue;
+        }
+        int state = 0;
+        for (size_t i = 0; i < phrase.length(); ++i) {
+            size_t slot = state * _classes + _classOf[static_cast<unsigned char>(phrase[i])];
+            if (_next[slot] < 0) {
+                _next[slot] = static_cast<int>(outputs.size());
+                _next.resize(_next.size() + _classes, -1);
+                outputs.push_back(std::vector<size_t>());
+            }
+            state = _next[slot];
+        }
+        outputs[state].push_back(r);
+    }
+
+    // Failure links, breadth-first
+    std::vector<int> fail(outputs.size(), 0);
+    std::deque<int> queue;
+    for (size_t c = 0; c < _classes; ++c) {
+        if (_next[c] < 0) {
+            _next[c] = 0;
+        } else {
+            queue.push_back(_next[c]);
+        }
+    }
+    while (!queue.empty()) {
+        int state = queue.front();
+        queue.pop_front();
+
+        const std::vector<size_t>& inherited = outputs[fail[state]];
+        outputs[state].insert(outputs[state].end(), inherited.begin(), inherited.end());
+
+        for (size_t c = 0; c < _classes; ++c) {
+            size_t slot = state * _classes + c;
+            int failNext = _next[fail[state] * _classes + c];
+            if (_next[slot] < 0) {
+                _next[slot] = failNext;
+            } else {
+                fail[_next[slot]] = failNext;
+                queue.push_back(_next[slot]);
+            }
+        }
+    }
+
+    // Flatten the outputs
+    _outStart.assign(outputs.size(), 0);
+    _outCount.assign(outputs.size(), 0);
+    _outputs.clear();
+    for (size_t s = 0; s < outputs.size(); ++s) {
+        _outStart[s] = _outputs.size();
+        _outCount[s] = outputs[s].size();
+        _outputs.insert(_outputs.end(), outputs[s].begin(), outputs[s].end());
+    }
+}
+
+/**
+ * @brief Look for a blocked phrase in a message
+ * @param text The message text
+ * @param length Length of the text
+ * @param channel Channel the message goes to (empty for private messages)
+ * @return Index of the first matching rule, or -1 if the message is clean
+ *
+ * Channel rules for other channels are still found by the automaton (there
+ * is only one), they are just skipped here. That costs nothing for clean
+ * messages, which are the ones that matter.
+ */
+int ContentFilter::scan(const char* text, size_t length, const std::string& channel) const {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(text);
+    const int* next = &_next[0];
+    int state = 0;
+    std::string folded;
+
+    for (size_t i = 0; i < length; ++i) {
+        state = next[state * _classes + _classOf[bytes[i]]];
+        if (_outCount[state] == 0) {
+            continue;
+        }
+        for (size_t k = 0; k < _outCount[state]; ++k) {
+            size_t rule = _outputs[_outStart[state] + k];
+            if (_rules[rule].channel.empty()) {
+                return static_cast<int>(rule);
+            }
+            if (folded.empty()) {
+                folded = MaskMatcher::fold(channel);
+            }
+            if (_rules[rule].channel == folded) {
+                return static_cast<int>(rule);
+            }
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Find every blocked phrase in a message
+ * @param text The message text
+ * @param length Length of the text
+ * @param rules Indexes of the rules found are appended here, each once
+ *
+ * For a message with several targets: one pass over the text, then each
+ * target only compares its channel with the scopes of the rules found.
+ */
+void ContentFilter::scanAll(const char* text, size_t length, std::vector<size_t>& rules) const {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(text);
+    const int* next = &_next[0];
+    int state = 0;
+
+    for (size_t i = 0; i < length; ++i) {
+        state = next[state * _classes + _classOf[bytes[i]]];
+        for (size_t k = 0; k < _outCount[state]; ++k) {
+            size_t rule = _outputs[_outStart[state] + k];
+            if (std::find(rules.begin(), rules.end(), rule) == rules.end()) {
+                rules.push_back(rule);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Get a rule
+ * @param index Rule index as returned by scan()
+ * @return Reference to the rule
+ */
+const ContentFilter::Rule& ContentFilter::getRule(size_t index) const {
+    return _rules[index];
+}
+
+/**
+ * @brief Get the number of rules
+ * @return Rule count
+ */
+size_t ContentFilter::getRuleCount() const {
+    return _rules.size();
+}
+
+/**
+ * @brief Get the number of automaton states
+ * @return State count
+ */
+size_t ContentFilter::getStateCount() const {
+    return _outCount.size();
+}
+
+/**
+ * @brief Get the number of input classes (table columns)
+ * @return Class count
+ */
+size_t ContentFilter::getClassCount() const {
+    return _classes;
+}
+
+/**
+ * @brief Get the memory used by the automaton tables
+ * @return Bytes
+ */
+size_t ContentFilter::getTableBytes() const {
+    return sizeof(_classOf) + _next.size() * sizeof(int)
+         + (_outStart.size() + _outCount.size() + _outputs.size()) * sizeof(size_t);
+}
@@ -0,0 +1,60 @@
+#ifndef CONTENTFILTER_HPP
+#define CONTENTFILTER_HPP
+
+#include "ircserv.hpp"
+
+/**
+ * @brief Banned-phrase filter for message text (Aho-Corasick automaton)
+ *
+ * Rules come from a file with one rule per line:
+ *     * free money           <- global: blocked everywhere
+ *     #help buy followers    <- only blocked in #help
+ * Blank lines and lines starting with "# " (hash and a space) are comments.
+ *
+ * All phrases, global and per-channel, are compiled into one automaton, so
+ * a message is scanned once, one table lookup per byte, no matter how many
+ * phrases there are. The automaton is a full DFA: every state has a
+ * transition for every input class, so scanning never follows failure links.
+ * To keep the table small, bytes are mapped to classes first: each character
+ * that occurs in some phrase gets its own class (upper and lower case
+ * share one, so matching ignores case) and all other bytes share class 0.
+ *
+ * A filter is built once and then only read. Reloading builds a whole new
+ * filter and swaps the pointer (see Server::pollFilterReload).
+ */
+class ContentFilter {
+public:
+    struct Rule {
+        std::string phrase;     // Folded phrase
+        std::string channel;    // Channel the rule applies to (empty: global)
+    };
+
+private:
+    std::vector<Rule> _rules;
+    unsigned char _classOf[256];        // Byte -> input class
+    size_t _classes;                    // Number of input classes
+    std::vector<int> _next;             // DFA: _next[state * _classes + class]
+    std::vector<size_t> _outStart;      // Per state: first entry in _outputs
+    std::vector<size_t> _outCount;      // Per state: rules matching when the state is reached
+    std::vector<size_t> _outputs;       // Rule indexes, grouped per state
+
+public:
+    ContentFilter();
+
+    bool loadFile(const std::string& path, std::string& error);  // Add the rules from a file
+    void addRule(const std::string& phrase, const std::string& channel);
+    void compile();                     // Build the automaton from the rules
+
+    // Index of the first rule that applies to channel and occurs in text, -1 if none
+    int scan(const char* text, size_t length, const std::string& channel) const;
+    // Every rule that occurs in text, whatever its channel (each index once)
+    void scanAll(const char* text, size_t length, std::vector<size_t>& rules) const;
+
+    const Rule& getRule(size_t index) const;
+    size_t getRuleCount() const;
+    size_t getStateCount() const;
+    size_t getClassCount() const;
+    size_t getTableBytes() const;
+};
+
+#endif
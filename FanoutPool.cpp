@@ -0,0 +1,308 @@
+#include "FanoutPool.hpp"
+#include "Client.hpp"
+#include "Utils.hpp"
+
+/**
+ * @brief Constructor for FanoutPool class
+ * @param threads Worker threads (0 disables parallel fanout)
+ * @param threshold Channel size from which broadcasts use the workers
+ */
+FanoutPool::FanoutPool(size_t threads, size_t threshold)
+    : _size(threads), _threshold(threshold), _message(NULL), _members(NULL), _exclude(NULL), _sender(NULL),
+      _ranges(0), _nextRange(0), _delivered(0), _generation(0), _running(0), _stop(false),
+      _broadcasts(0), _recipients(0), _seconds(0) {
+    pthread_mutex_init(&_lock, NULL);
+    pthread_cond_init(&_wake, NULL);
+    pthread_cond_init(&_finished, NULL);
+}
+
+/**
+ * @brief Destructor for FanoutPool class
+ */
+FanoutPool::~FanoutPool() {
+    stop();
+    pthread_cond_destroy(&_finished);
+    pthread_cond_destroy(&_wake);
+    pthread_mutex_destroy(&_lock);
+}
+
+/**
+ * @brief Start the worker threads
+ * @return true if all of them are running
+ */
+bool FanoutPool::start() {
+    // Signals must keep going to the main thread
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &previous);
+    for (size_t i = 0; i < _size; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, &FanoutPool::threadMain, this) != 0) {
+            pthread_sigmask(SIG_SETMASK, &previous, NULL);
+            std::cerr << "Fanout pool: cannot start thread" << std::endl;
+            stop();
+            return false;
+        }
+        _threads.push_back(thread);
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (_size > 0) {
+        std::cout << "Parallel fanout for channels of " << _threshold << "+ members on "
+                  << _size << " threads" << std::endl;
+    }
+    return true;
+}
+
+/**
+ * @brief Stop and join the worker threads
+ */
+void FanoutPool::stop() {
+    pthread_mutex_lock(&_lock);
+    _stop = true;
+    pthread_cond_broadcast(&_wake);
+    pthread_mutex_unlock(&_lock);
+    for (size_t i = 0; i < _threads.size(); ++i) {
+        pthread_join(_threads[i], NULL);
+    }
+    _threads.clear();
+}
+
+/**
+ * @brief Check whether a channel's broadcasts should use the workers
+ * @param members Number of members
+ * @return true if the pool runs and the channel reaches the threshold
+ */
+bool FanoutPool::wants(size_t members) const {
+    return !_threads.empty() && members >= _threshold;
+}
+
+/**
+ * @brief Queue a message for every member, in parallel
+ * @param message The message
+ * @param members The channel's members
+ * @param exclude Member that doesn't get the message (NULL: none)
+ * @param sender Client the message comes from, for SILENCE checks (NULL: no checks)
+ * @return Number of lines queued
+ *
+ * Same rules as Channel::broadcastMessage. Returns when every member has
+ * the message in its output queue.
+ */
+size_t FanoutPool::broadcast(TaggedMessage& message, const std::vector<Client*>& members,
+                             const Client* exclude, const Client* sender) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t delivered = runBroadcast(message, members, exclude, sender);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    TaggedMessage::addDeliveries(delivered);
+    _broadcasts++;
+    _recipients += delivered;
+    _seconds += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return delivered;
+}
+
+/**
+ * @brief Get the number of worker threads
+ * @return Thread count (0: disabled)
+ */
+size_t FanoutPool::getThreads() const {
+    return _threads.size();
+}
+
+/**
+ * @brief Get the channel size from which broadcasts go parallel
+ * @return Member count
+ */
+size_t FanoutPool::getThreshold() const {
+    return _threshold;
+}
+
+/**
+ * @brief Get the number of parallel broadcasts
+ * @return Broadcast count
+ */
+size_t FanoutPool::getBroadcasts() const {
+    return _broadcasts;
+}
+
+/**
+ * @brief Get the number of lines queued by parallel broadcasts
+ * @return Line count
+ */
+size_t FanoutPool::getRecipients() const {
+    return _recipients;
+}
+
+/**
+ * @brief Get the time spent in parallel broadcasts
+ * @return Seconds
+ */
+double FanoutPool::getSeconds() const {
+    return _seconds;
+}
+
+/**
+ * @brief Measure the time to queue one line for a channel of a given size
+ * @param members Channel size
+ * @param names Pool for the test clients' names
+ * @param parallel true to use the workers, false for the single-threaded loop
+ * @return Microseconds per broadcast (best of a few runs)
+ *
+ * Uses unconnected test clients and a 400-byte line; their queues are
+ * emptied between runs, so chunk allocation is measured as well.
+ */
+double FanoutPool::benchmark(size_t members, InternPool& names, bool parallel) {
+    static const int RUNS = 5;
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    std::vector<Client*> clients;
+    for (size_t i = 0; i < members; ++i) {
+        clients.push_back(new Client(-1, address, names));
+    }
+    std::string text(":bench!bench@127.0.0.1 PRIVMSG #bench :");
+    text.append(400 - text.length() - 2, 'x').append("\r\n");
+
+    double best = 0;
+    for (int run = 0; run < RUNS; ++run) {
+        TaggedMessage message(StringRef(text.data(), text.length()));
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (parallel && !_threads.empty()) {
+            runBroadcast(message, clients, NULL, NULL);
+        } else {
+            _message = &message;
+            _members = &clients;
+            _exclude = NULL;
+            _sender = NULL;
+            deliver(0, clients.size());
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double micros = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+        if (run == 0 || micros < best) {
+            best = micros;
+        }
+        for (size_t i = 0; i < clients.size(); ++i) {
+            clients[i]->getOutput().clear();
+        }
+    }
+
+    for (size_t i = 0; i < clients.size(); ++i) {
+        delete clients[i];
+    }
+    return best;
+}
+
+/**
+ * @brief Thread entry point
+ * @param pool The FanoutPool
+ * @return NULL
+ */
+void* FanoutPool::threadMain(void* pool) {
+    static_cast<FanoutPool*>(pool)->work();
+    return NULL;
+}
+
+/**
+ * @brief Worker loop: wait for a broadcast, take ranges, report done
+ */
+void FanoutPool::work() {
+    unsigned long seen = 0;
+    pthread_mutex_lock(&_lock);
+    while (true) {
+        while (!_stop && _generation == seen) {
+            pthread_cond_wait(&_wake, &_lock);
+        }
+        if (_stop) {
+            break;
+        }
+        seen = _generation;
+        pthread_mutex_unlock(&_lock);
+
+        runRanges();
+
+        pthread_mutex_lock(&_lock);
+        if (--_running == 0) {
+            pthread_cond_signal(&_finished);
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+/**
+ * @brief Run one broadcast on the workers and the calling thread
+ * @param message The message
+ * @param members The recipients
+ * @param exclude Member that doesn't get the message (NULL: none)
+ * @param sender Client the message comes from, for SILENCE checks (NULL: no checks)
+ * @return Number of lines queued
+ */
+size_t FanoutPool::runBroadcast(TaggedMessage& message, const std::vector<Client*>& members,
+                                const Client* exclude, const Client* sender) {
+    // Render every variant and fold the sender now: the workers must only read them
+    for (unsigned int caps = 0; caps <= Capabilities::TAG_CAPS; ++caps) {
+        message.render(caps);
+    }
+    SilenceSubject* subject = sender ? new SilenceSubject(sender) : NULL;
+
+    pthread_mutex_lock(&_lock);
+    _message = &message;
+    _members = &members;
+    _exclude = exclude;
+    _sender = subject;
+    _ranges = (members.size() + RANGE - 1) / RANGE;
+    _nextRange = 0;
+    _delivered = 0;
+    _running = _threads.size();
+    _generation++;
+    pthread_cond_broadcast(&_wake);
+    pthread_mutex_unlock(&_lock);
+
+    runRanges();
+
+    // Join: the workers' appends are visible once we hold the lock after them
+    pthread_mutex_lock(&_lock);
+    while (_running > 0) {
+        pthread_cond_wait(&_finished, &_lock);
+    }
+    _sender = NULL;
+    pthread_mutex_unlock(&_lock);
+    delete subject;
+    return _delivered;
+}
+
+/**
+ * @brief Take ranges of the current broadcast until there are none left
+ */
+void FanoutPool::runRanges() {
+    size_t delivered = 0;
+    size_t range;
+    while ((range = __atomic_fetch_add(&_nextRange, 1, __ATOMIC_RELAXED)) < _ranges) {
+        size_t begin = range * RANGE;
+        delivered += deliver(begin, std::min(begin + RANGE, _members->size()));
+    }
+    __atomic_fetch_add(&_delivered, delivered, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Queue the message for a range of members
+ * @param begin First member
+ * @param end One past the last member
+ * @return Number of lines queued
+ */
+size_t FanoutPool::deliver(size_t begin, size_t end) {
+    const std::vector<Client*>& members = *_members;
+    size_t delivered = 0;
+    for (size_t i = begin; i < end; ++i) {
+        Client* member = members[i];
+        if (member == _exclude || (_sender && member->isSilencing(*_sender))) {
+            continue;
+        }
+        StringRef line = _message->render(member->getCaps());
+        if (line.length > 0) {
+            Utils::sendLine(member, line);
+            delivered++;
+        }
+    }
+    return delivered;
+}
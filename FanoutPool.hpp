@@ -0,0 +1,93 @@
+#ifndef FANOUTPOOL_HPP
+#define FANOUTPOOL_HPP
+
+#include "ircserv.hpp"
+#include "TaggedMessage.hpp"
+#include "InternPool.hpp"
+#include <pthread.h>
+
+struct SilenceSubject;
+
+/**
+ * @brief Worker threads that queue one broadcast for a very large channel in parallel
+ *
+ * Queuing a line for 100k members is 100k appends to 100k output queues,
+ * milliseconds during which no other client is served. Channels with at
+ * least fanout_threshold members hand the loop to this pool instead: the
+ * member list is cut into ranges of RANGE members, the workers and the
+ * calling thread take ranges from a shared counter until none are left,
+ * and the caller returns once every range is done (fork-join).
+ *
+ * Every tag variant is rendered, and the sender's names folded for the
+ * SILENCE checks, before the workers start, so they only read the
+ * message. Each member is in exactly one range, so no two threads touch
+ * the same output queue; and since the broadcast is complete when
+ * broadcast() returns, every member still gets its lines in the order the
+ * server produced them. BufferPool has per-thread caches, so workers
+ * allocate chunks without contention.
+ *
+ * Workers read the channel's member list and the members without a lock:
+ * the state thread, the only one that changes memberships or frees
+ * clients, is inside broadcast() until every worker is done.
+ */
+class FanoutPool {
+private:
+    static const size_t RANGE = 1024;   // Members per unit of work
+
+    size_t _size;                       // Worker threads (0: disabled)
+    size_t _threshold;                  // Members from which broadcasts go parallel
+    std::vector<pthread_t> _threads;
+
+    // The current broadcast (written by the caller under _lock, read-only while it runs)
+    TaggedMessage* _message;
+    const std::vector<Client*>* _members;
+    const Client* _exclude;
+    const SilenceSubject* _sender;      // Folded once by the caller (NULL: no SILENCE checks)
+    size_t _ranges;
+    size_t _nextRange;                  // Next range to take (atomic access)
+    size_t _delivered;                  // Lines queued by all threads (atomic access)
+
+    pthread_mutex_t _lock;
+    pthread_cond_t _wake;               // Workers wait here for a broadcast (or stop)
+    pthread_cond_t _finished;           // The caller waits here for the workers
+    unsigned long _generation;          // Broadcast number, so a worker runs each one once
+    size_t _running;                    // Workers still busy with the current broadcast
+    bool _stop;
+
+    // Counters (caller thread only)
+    size_t _broadcasts;
+    size_t _recipients;
+    double _seconds;
+
+    // Not copyable (owns threads)
+    FanoutPool(const FanoutPool& other);
+    FanoutPool& operator=(const FanoutPool& other);
+
+public:
+    FanoutPool(size_t threads, size_t threshold);
+    ~FanoutPool();
+
+    bool start();
+    void stop();
+
+    bool wants(size_t members) const;   // Enabled and the channel is big enough?
+    size_t broadcast(TaggedMessage& message, const std::vector<Client*>& members,
+                     const Client* exclude, const Client* sender);  // Lines queued
+
+    size_t getThreads() const;
+    size_t getThreshold() const;
+    size_t getBroadcasts() const;
+    size_t getRecipients() const;
+    double getSeconds() const;
+    double benchmark(size_t members, InternPool& names, bool parallel);  // Microseconds per broadcast
+
+private:
+    static void* threadMain(void* pool);
+    void work();
+    size_t runBroadcast(TaggedMessage& message, const std::vector<Client*>& members,
+                        const Client* exclude, const Client* sender);
+    void runRanges();
+    size_t deliver(size_t begin, size_t end);
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef FIXEDSTRING_HPP
+#define FIXEDSTRING_HPP
+
+#include "ircserv.hpp"
+
+/**
+ * @brief A string stored inline with a fixed maximum length
+ * @tparam Capacity Maximum number of characters (must fit in an unsigned char)
+ *
+ * Unlike std::string this never allocates: the characters live inside the
+ * object itself. Used for short, bounded identifiers such as nicknames so
+ * they sit in the same cache lines as the rest of the owning object.
+ */
+template <size_t Capacity>
+class FixedString {
+private:
+    unsigned char _length;              // Number of characters in use
+    char _data[Capacity + 1];           // Characters + terminating '\0'
+
+public:
+    FixedString() : _length(0) {
+        _data[0] = '\0';
+    }
+
+    /**
+     * @brief Replace the contents
+     * @param value The new contents
+     * @return false (and contents unchanged) if value is longer than Capacity
+     */
+    bool assign(const std::string& value) {
+        if (value.length() > Capacity) {
+            return false;
+        }
+        _length = static_cast<unsigned char>(value.length());
+        memcpy(_data, value.data(), value.length());
+        _data[_length] = '\0';
+        return true;
+    }
+
+    void clear() {
+        _length = 0;
+        _data[0] = '\0';
+    }
+
+    const char* c_str() const { return _data; }
+    size_t length() const { return _length; }
+    bool empty() const { return _length == 0; }
+    std::string str() const { return std::string(_data, _length); }
+
+    bool operator==(const std::string& other) const {
+        return other.length() == _length && memcmp(_data, other.data(), _length) == 0;
+    }
+    bool operator!=(const std::string& other) const {
+        return !(*this == other);
+    }
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include "FloodGuard.hpp"
+
+/**
+ * @brief Constructor for FloodGuard class (all entries free)
+ */
+FloodGuard::FloodGuard() : _start(0) {
+    memset(_entries, 0, sizeof(_entries));
+}
+
+/**
+ * @brief Count one more copy of a text
+ * @param hash Hash of the text (from hash())
+ * @param now Current time
+ * @param window Seconds over which copies are counted
+ * @return Copies seen within about the last window, this one included
+ *
+ * The count is the copies of the current window plus those of the window
+ * before, scaled down by how much of the current window has gone by. The
+ * text's entry moves to the front of the table.
+ */
+unsigned int FloodGuard::record(unsigned int hash, time_t now, time_t window) {
+    advance(now, window);
+    time_t remaining = window - (now - _start);
+
+    size_t index = find(hash, remaining, window);
+    Entry entry = _entries[index];
+    if (entry.hash != hash || (entry.current == 0 && entry.previous == 0)) {
+        entry.hash = hash;
+        entry.current = 0;
+        entry.previous = 0;
+    }
+    if (entry.current < 0xFFFF) {
+        entry.current++;
+    }
+    memmove(_entries + 1, _entries, index * sizeof(Entry));
+    _entries[0] = entry;
+    return copies(entry, remaining, window);
+}
+
+/**
+ * @brief Hash a message text
+ * @param text The text
+ * @return 32-bit FNV-1a hash of the lower-cased text
+ *
+ * Lower-casing means "BUY NOW" and "buy now" count as the same line.
+ */
+unsigned int FloodGuard::hash(const std::string& text) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < text.length(); ++i) {
+        hash = (hash ^ static_cast<unsigned char>(tolower(static_cast<unsigned char>(text[i])))) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Start a new window if the current one is over
+ * @param now Current time
+ * @param window Window length in seconds
+ */
+void FloodGuard::advance(time_t now, time_t window) {
+    time_t elapsed = now - _start;
+    if (elapsed < window) {
+        return;
+    }
+    bool adjacent = elapsed < 2 * window;
+    for (size_t i = 0; i < SLOTS; ++i) {
+        _entries[i].previous = adjacent ? _entries[i].current : 0;
+        _entries[i].current = 0;
+    }
+    _start = adjacent ? _start + window : now;
+}
+
+/**
+ * @brief Find the entry a text is counted in
+ * @param hash Hash of the text
+ * @param remaining Seconds left in the current window
+ * @param window Window length in seconds
+ * @return The text's entry if it has one, else the entry to reuse for it
+ *
+ * The entry to reuse is the one with the fewest copies, the least recently
+ * seen of those; a free entry has none.
+ */
+size_t FloodGuard::find(unsigned int hash, time_t remaining, time_t window) const {
+    size_t victim = SLOTS - 1;
+    unsigned int fewest = static_cast<unsigned int>(-1);
+    for (size_t i = SLOTS; i-- > 0;) {
+        unsigned int count = copies(_entries[i], remaining, window);
+        if (_entries[i].hash == hash && (_entries[i].current > 0 || _entries[i].previous > 0)) {
+            return i;
+        }
+        if (count < fewest) {
+            victim = i;
+            fewest = count;
+        }
+    }
+    return victim;
+}
+
+/**
+ * @brief Copies of an entry's text within about the last window
+ * @param entry The entry
+ * @param remaining Seconds left in the current window
+ * @param window Window length in seconds
+ * @return Copies of this window plus the weighted copies of the one before
+ */
+unsigned int FloodGuard::copies(const Entry& entry, time_t remaining, time_t window) {
+    return entry.current + static_cast<unsigned int>(entry.previous * remaining / window);
+}
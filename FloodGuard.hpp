@@ -0,0 +1,55 @@
+#ifndef FLOODGUARD_HPP
+#define FLOODGUARD_HPP
+
+#include "ircserv.hpp"
+
+/**
+ * @brief Recently seen message texts of one channel or one sender
+ *
+ * Floods repeat the same line: one bot in many channels, or many bots in one
+ * channel. Every channel and every client counts the hashes of the texts it
+ * saw lately. The message text is hashed once (see hash()) and the same hash
+ * is counted in the sender's guard and in the channel's guard.
+ *
+ * The counts live in a small table of SLOTS entries, each keyed by the
+ * full 32-bit hash, so one text's count never includes another's. The
+ * table is kept most recently seen first. A new text takes a free entry,
+ * or else the one with the lowest count, the least recently seen of
+ * those: lines sent once are what a busy channel has most of, and they
+ * make room for each other while a text that keeps coming back stays.
+ *
+ * Counts decay instead of being reset: the guard keeps the counts of the
+ * current window and of the one before, and the older ones weigh less the
+ * further the current window has run. A text that keeps coming back is
+ * allowed again once it slows down, so a flood is rate-limited rather than
+ * blocked forever. Memory stays fixed no matter what is sent.
+ */
+class FloodGuard {
+public:
+    static const size_t SLOTS = 32;
+
+private:
+    struct Entry {
+        unsigned int hash;                      // FloodGuard::hash() of the text
+        unsigned short current;                 // Copies counted in this window
+        unsigned short previous;                // Copies counted in the window before
+    };
+
+    Entry _entries[SLOTS];                      // Most recently seen first; both counts zero: free
+    time_t _start;                              // When the current window began
+
+public:
+    FloodGuard();
+
+    // Count one more copy of a text; returns the copies seen within about the last window
+    unsigned int record(unsigned int hash, time_t now, time_t window);
+
+    static unsigned int hash(const std::string& text);  // Case-insensitive FNV-1a
+
+private:
+    void advance(time_t now, time_t window);
+    size_t find(unsigned int hash, time_t remaining, time_t window) const;
+    static unsigned int copies(const Entry& entry, time_t remaining, time_t window);
+};
+
+#endif
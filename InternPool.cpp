@@ -0,0 +1,218 @@
+#include "InternPool.hpp"
+
+/**
+ * @brief Default constructor - the empty string handle
+ */
+InternedString::InternedString() : _node(NULL) {
+}
+
+/**
+ * @brief Private constructor used by the pool
+ * @param node The entry this handle refers to (reference already taken)
+ */
+InternedString::InternedString(InternedString::Node* node) : _node(node) {
+}
+
+/**
+ * @brief Copy constructor - shares the entry and bumps its refcount
+ * @param other The handle to copy
+ */
+InternedString::InternedString(const InternedString& other) : _node(other._node) {
+    if (_node) {
+        _node->pool->retain(_node);
+    }
+}
+
+/**
+ * @brief Assignment operator
+ * @param other The handle to copy
+ * @return Reference to this handle
+ *
+ * We retain the new entry before releasing the old one so that
+ * self-assignment never drops the last reference.
+ */
+InternedString& InternedString::operator=(const InternedString& other) {
+    if (other._node) {
+        other._node->pool->retain(other._node);
+    }
+    if (_node) {
+        _node->pool->release(_node);
+    }
+    _node = other._node;
+    return *this;
+}
+
+/**
+ * @brief Destructor - drops our reference (the pool frees unused entries)
+ */
+InternedString::~InternedString() {
+    if (_node) {
+        _node->pool->release(_node);
+    }
+}
+
+/**
+ * @brief Get the pooled string
+ * @return Reference to the characters (an empty string for empty handles)
+ */
+const std::string& InternedString::str() const {
+    static const std::string emptyString;
+    return _node ? *_node->value : emptyString;
+}
+
+/**
+ * @brief Check if this handle stands for the empty string
+ * @return true if empty, false otherwise
+ */
+bool InternedString::empty() const {
+    return _node == NULL;
+}
+
+/**
+ * @brief Constructor for InternPool class
+ */
+InternPool::InternPool() : _lookups(0), _hits(0), _bytesStored(0), _bytesSaved(0) {
+}
+
+/**
+ * @brief Destructor for InternPool class
+ *
+ * All handles must be gone by now (the Server destroys clients and channels
+ * before its pool), so the map is normally already empty.
+ */
+InternPool::~InternPool() {
+    if (!_entries.empty()) {
+        std::cerr << "Warning: intern pool destroyed with " << _entries.size()
+                  << " live entries" << std::endl;
+    }
+}
+
+/**
+ * @brief Get a handle to the pooled copy of a string, inserting it if needed
+ * @param value The string to intern
+ * @return Handle to the pooled string
+ */
+InternedString InternPool::intern(const std::string& value) {
+    if (value.empty()) {
+        return InternedString();
+    }
+
+    _lookups++;
+
+    std::map<std::string, InternedString::Node>::iterator it = _entries.find(value);
+    if (it != _entries.end()) {
+        _hits++;
+        retain(&it->second);
+        return InternedString(&it->second);
+    }
+
+    // New entry - the node points to the key stored inside the map node
+    InternedString::Node node;
+    node.refs = 1;
+    node.pool = this;
+    node.value = NULL;
+    it = _entries.insert(std::make_pair(value, node)).first;
+    it->second.value = &it->first;
+    _bytesStored += value.length();
+
+    return InternedString(&it->second);
+}
+
+/**
+ * @brief Look up a string without inserting it
+ * @param value The string to look up
+ * @return Handle to the pooled string, or an empty handle if it is not pooled
+ *
+ * Used for lookups (e.g. channel names in JOIN/PRIVMSG) where a missing entry
+ * simply means "no such object", so there is no point in adding it.
+ */
+InternedString InternPool::find(const std::string& value) {
+    std::map<std::string, InternedString::Node>::iterator it = _entries.find(value);
+    if (it == _entries.end()) {
+        return InternedString();
+    }
+    retain(&it->second);
+    return InternedString(&it->second);
+}
+
+/**
+ * @brief Take one more reference on an entry
+ * @param node The entry
+ */
+void InternPool::retain(InternedString::Node* node) {
+    // Every extra reference is a copy of the string we didn't have to make
+    if (node->refs > 0) {
+        _bytesSaved += node->value->length();
+    }
+    node->refs++;
+}
+
+/**
+ * @brief Drop one reference on an entry, freeing it when it was the last one
+ * @param node The entry
+ */
+void InternPool::release(InternedString::Node* node) {
+    node->refs--;
+    if (node->refs > 0) {
+        _bytesSaved -= node->value->length();
+        return;
+    }
+
+    // Locate the map node first: the key we search with lives inside it
+    _bytesStored -= node->value->length();
+    std::map<std::string, InternedString::Node>::iterator it = _entries.find(*node->value);
+    if (it != _entries.end()) {
+        _entries.erase(it);
+    }
+}
+
+/**
+ * @brief Get the number of distinct strings in the pool
+ * @return Number of entries
+ */
+size_t InternPool::size() const {
+    return _entries.size();
+}
+
+/**
+ * @brief Get the number of intern() lookups so far
+ * @return Number of lookups
+ */
+size_t InternPool::getLookups() const {
+    return _lookups;
+}
+
+/**
+ * @brief Get the number of lookups that found an existing entry
+ * @return Number of hits
+ */
+size_t InternPool::getHits() const {
+    return _hits;
+}
+
+/**
+ * @brief Get the hit rate of intern() lookups
+ * @return Percentage (0-100) of lookups that were hits
+ */
+size_t InternPool::getHitRate() const {
+    if (_lookups == 0) {
+        return 0;
+    }
+    return (_hits * 100) / _lookups;
+}
+
+/**
+ * @brief Get the number of characters stored in the pool
+ * @return Bytes of string data held once
+ */
+size_t InternPool::getBytesStored() const {
+    return _bytesStored;
+}
+
+/**
+ * @brief Get the number of bytes saved by sharing entries
+ * @return Bytes of string data that would otherwise be duplicated
+ */
+size_t InternPool::getBytesSaved() const {
+    return _bytesSaved;
+}
@@ -0,0 +1,92 @@
+#ifndef INTERNPOOL_HPP
+#define INTERNPOOL_HPP
+
+#include "ircserv.hpp"
+
+class InternPool;
+
+/**
+ * @brief A refcounted handle to a string stored once in an InternPool
+ *
+ * Many clients share the same hostname (NAT gateways, bouncers) and every
+ * channel name used to be stored twice (map key + Channel::_name).
+ * An InternedString is just one pointer: copying it bumps a refcount instead
+ * of copying the characters, and two handles from the same pool are equal
+ * exactly when they point to the same entry, so == is a pointer compare.
+ *
+ * An empty (default constructed) handle stands for the empty string.
+ */
+class InternedString {
+public:
+    // One pooled string (lives inside the pool's map node, so it never moves)
+    struct Node {
+        size_t refs;                    // Number of live handles
+        InternPool* pool;               // Pool that owns this entry
+        const std::string* value;       // Points to the map key
+    };
+
+private:
+    Node* _node;                        // NULL for the empty string
+
+public:
+    InternedString();
+    InternedString(const InternedString& other);
+    InternedString& operator=(const InternedString& other);
+    ~InternedString();
+
+    const std::string& str() const;     // The pooled characters
+    bool empty() const;
+
+    // Pointer comparisons - only meaningful between handles of the same pool
+    bool operator==(const InternedString& other) const { return _node == other._node; }
+    bool operator!=(const InternedString& other) const { return _node != other._node; }
+    bool operator<(const InternedString& other) const { return _node < other._node; }
+
+private:
+    friend class InternPool;
+    explicit InternedString(Node* node);  // Adopts one reference
+};
+
+/**
+ * @brief Pool of deduplicated, refcounted identifier strings
+ *
+ * Used for hostnames, usernames and channel names. Entries are removed
+ * as soon as their last handle goes away, so the pool never grows beyond
+ * the set of identifiers currently in use.
+ */
+class InternPool {
+private:
+    std::map<std::string, InternedString::Node> _entries;
+
+    // Statistics
+    size_t _lookups;                    // Number of intern() calls
+    size_t _hits;                       // intern() calls that found an existing entry
+    size_t _bytesStored;                // Characters held by the pool
+    size_t _bytesSaved;                 // Characters we would have copied without the pool
+
+    // Not copyable (handles point back to us)
+    InternPool(const InternPool& other);
+    InternPool& operator=(const InternPool& other);
+
+public:
+    InternPool();
+    ~InternPool();
+
+    InternedString intern(const std::string& value);       // Find or insert
+    InternedString find(const std::string& value);         // Find only, empty handle if absent
+
+    // Statistics getters
+    size_t size() const;
+    size_t getLookups() const;
+    size_t getHits() const;
+    size_t getHitRate() const;          // Percentage of lookups that were hits
+    size_t getBytesStored() const;
+    size_t getBytesSaved() const;
+
+private:
+    friend class InternedString;
+    void retain(InternedString::Node* node);
+    void release(InternedString::Node* node);
+};
+
+#endif
@@ -0,0 +1,385 @@
+#include "MaskMatcher.hpp"
+
+// Static member definitions
+size_t MaskMatcher::_checks = 0;
+size_t MaskMatcher::_globTests = 0;
+
+static const size_t NO_CHILD = static_cast<size_t>(-1);
+
+/**
+ * @brief Constructor for MaskMatcher class
+ */
+MaskMatcher::MaskMatcher() : _dirty(false) {
+}
+
+/**
+ * @brief Add a mask to the list
+ * @param mask The mask (normalized first)
+ * @param setBy Nickname of whoever set it
+ * @return true if added, false if an equal mask is already listed or the list is full
+ */
+bool MaskMatcher::add(const std::string& mask, const std::string& setBy) {
+    std::string normalized = normalize(mask);
+    std::string folded = fold(normalized);
+    if (_entries.size() >= MAX_ENTRIES || find(folded) != NO_CHILD) {
+        return false;
+    }
+
+    MaskEntry entry;
+    entry.mask = normalized;
+    entry.setBy = setBy;
+    entry.setAt = time(NULL);
+    _entries.push_back(entry);
+    _folded.push_back(folded);
+
+    // Compiled tries stay valid: just file the new mask
+    if (!_dirty) {
+        file(_entries.size() - 1);
+    }
+    return true;
+}
+
+/**
+ * @brief Remove a mask from the list
+ * @param mask The mask (normalized first, compared case-insensitively)
+ * @return true if it was listed
+ */
+bool MaskMatcher::remove(const std::string& mask) {
+    size_t index = find(fold(normalize(mask)));
+    if (index == NO_CHILD) {
+        return false;
+    }
+    _entries.erase(_entries.begin() + index);
+    _folded.erase(_folded.begin() + index);
+    _dirty = true;
+    return true;
+}
+
+/**
+ * @brief Check if any mask in the list matches a subject
+ * @param foldedSubject The client's nick!user@host, passed through fold()
+ * @return true if at least one mask matches
+ */
+bool MaskMatcher::matches(const std::string& foldedSubject) const {
+    if (_entries.empty()) {
+        return false;
+    }
+    if (_dirty) {
+        compile();
+    }
+    __atomic_fetch_add(&_checks, 1, __ATOMIC_RELAXED);
+
+    const char* text = foldedSubject.data();
+    size_t length = foldedSubject.length();
+
+    // Forwards through the prefix trie
+    size_t node = 0;
+    for (size_t i = 0; i < length; ++i) {
+        node = findChild(_prefixTrie[node], text[i]);
+        if (node == NO_CHILD) {
+            break;
+        }
+        if (testCandidates(_prefixTrie[node].masks, foldedSubject, true)) {
+            return true;
+        }
+    }
+
+    // Backwards through the suffix trie
+    node = 0;
+    for (size_t i = length; i > 0; --i) {
+        node = findChild(_suffixTrie[node], text[i - 1]);
+        if (node == NO_CHILD) {
+            break;
+        }
+        if (testCandidates(_suffixTrie[node].masks, foldedSubject, false)) {
+            return true;
+        }
+    }
+
+    // Masks that start and end with a wildcard
+    for (size_t i = 0; i < _unanchored.size(); ++i) {
+        const Compiled& mask = _compiled[_unanchored[i]];
+        __atomic_fetch_add(&_globTests, 1, __ATOMIC_RELAXED);
+        if (globMatch(mask.pattern.data(), mask.pattern.length(), text, length)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Get the list entries (for the list replies)
+ * @return Reference to the entries, in the order they were added
+ */
+const std::vector<MaskEntry>& MaskMatcher::getEntries() const {
+    return _entries;
+}
+
+/**
+ * @brief Get the number of masks in the list
+ * @return Number of masks
+ */
+size_t MaskMatcher::size() const {
+    return _entries.size();
+}
+
+/**
+ * @brief Check if the list is empty
+ * @return true if there are no masks
+ */
+bool MaskMatcher::empty() const {
+    return _entries.empty();
+}
+
+/**
+ * @brief Bring a mask into full nick!user@host form
+ * @param mask The mask as given by the user
+ * @return The normalized mask
+ *
+ * "nick" becomes "nick!*@*", "user@host" becomes "*!user@host" and
+ * "nick!user" becomes "nick!user@*". Runs of '*' are collapsed.
+ */
+std::string MaskMatcher::normalize(const std::string& mask) {
+    std::string full;
+    size_t bang = mask.find('!');
+    size_t at = mask.find('@');
+
+    if (bang == std::string::npos && at == std::string::npos) {
+        full = mask + "!*@*";
+    } else if (bang == std::string::npos) {
+        full = "*!" + mask;
+    } else if (at == std::string::npos) {
+        full = mask + "@*";
+    } else {
+        full = mask;
+    }
+
+    std::string collapsed;
+    collapsed.reserve(full.length());
+    for (size_t i = 0; i < full.length(); ++i) {
+        if (full[i] == '*' && !collapsed.empty() && collapsed[collapsed.length() - 1] == '*') {
+            continue;
+        }
+        collapsed += full[i];
+    }
+    return collapsed;
+}
+
+/**
+ * @brief Case-fold text for mask comparisons
+ * @param text The text
+ * @return Lowercase copy
+ */
+std::string MaskMatcher::fold(const std::string& text) {
+    std::string folded(text);
+    for (size_t i = 0; i < folded.length(); ++i) {
+        folded[i] = static_cast<char>(std::tolower(static_cast<unsigned char>(folded[i])));
+    }
+    return folded;
+}
+
+/**
+ * @brief Match text against a glob pattern
+ * @param pattern The pattern ('*' any characters, '?' one character)
+ * @param patternLength Length of the pattern
+ * @param text The text
+ * @param textLength Length of the text
+ * @return true if the whole text matches the whole pattern
+ *
+ * Iterative matcher: on a mismatch we only ever return to the most recent
+ * '*', so there is no recursion and no exponential blow-up.
+ */
+bool MaskMatcher::globMatch(const char* pattern, size_t patternLength, const char* text, size_t textLength) {
+    size_t p = 0;
+    size_t t = 0;
+    size_t starPattern = NO_CHILD;
+    size_t starText = 0;
+
+    while (t < textLength) {
+        if (p < patternLength && (pattern[p] == '?' || pattern[p] == text[t])) {
+            p++;
+            t++;
+        } else if (p < patternLength && pattern[p] == '*') {
+            starPattern = p++;
+            starText = t;
+        } else if (starPattern != NO_CHILD) {
+            p = starPattern + 1;
+            t = ++starText;
+        } else {
+            return false;
+        }
+    }
+
+    while (p < patternLength && pattern[p] == '*') {
+        p++;
+    }
+    return p == patternLength;
+}
+
+/**
+ * @brief Get the number of subjects tested against any list
+ * @return Check count
+ */
+size_t MaskMatcher::getChecks() {
+    return __atomic_load_n(&_checks, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the number of masks that needed a glob check
+ * @return Glob test count
+ */
+size_t MaskMatcher::getGlobTests() {
+    return __atomic_load_n(&_globTests, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Rebuild the tries from the entries
+ */
+void MaskMatcher::compile() const {
+    _compiled.clear();
+    _prefixTrie.assign(1, TrieNode());
+    _suffixTrie.assign(1, TrieNode());
+    _unanchored.clear();
+
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        file(i);
+    }
+
+    _dirty = false;
+}
+
+/**
+ * @brief Compile one entry and file it in the tries
+ * @param index Index of the entry (must be the next compiled index)
+ */
+void MaskMatcher::file(size_t index) const {
+    if (_prefixTrie.empty()) {
+        _prefixTrie.push_back(TrieNode());
+        _suffixTrie.push_back(TrieNode());
+    }
+
+    Compiled mask;
+    mask.pattern = _folded[index];
+
+    size_t first = mask.pattern.find_first_of("*?");
+    size_t last = mask.pattern.find_last_of("*?");
+    mask.literal = (first == std::string::npos);
+    mask.prefix = mask.literal ? mask.pattern.length() : first;
+    mask.suffix = mask.literal ? mask.pattern.length() : mask.pattern.length() - last - 1;
+    _compiled.push_back(mask);
+
+    // File the mask under its longer literal end
+    if (mask.prefix == 0 && mask.suffix == 0) {
+        _unanchored.push_back(index);
+    } else if (mask.prefix >= mask.suffix) {
+        size_t node = insert(_prefixTrie, mask.pattern.substr(0, mask.prefix), false);
+        _prefixTrie[node].masks.push_back(index);
+    } else {
+        size_t node = insert(_suffixTrie, mask.pattern.substr(mask.pattern.length() - mask.suffix), true);
+        _suffixTrie[node].masks.push_back(index);
+    }
+}
+
+/**
+ * @brief Find a mask in the list
+ * @param folded The normalized mask, passed through fold()
+ * @return Index of the entry, or NO_CHILD
+ */
+size_t MaskMatcher::find(const std::string& folded) const {
+    for (size_t i = 0; i < _folded.size(); ++i) {
+        if (_folded[i] == folded) {
+            return i;
+        }
+    }
+    return NO_CHILD;
+}
+
+/**
+ * @brief Add a key to a trie
+ * @param trie The trie
+ * @param key The literal text
+ * @param reversed Insert the key back to front (for the suffix trie)
+ * @return Index of the node where the key ends
+ */
+size_t MaskMatcher::insert(std::vector<TrieNode>& trie, const std::string& key, bool reversed) {
+    size_t node = 0;
+    for (size_t i = 0; i < key.length(); ++i) {
+        char c = reversed ? key[key.length() - 1 - i] : key[i];
+        size_t child = findChild(trie[node], c);
+        if (child == NO_CHILD) {
+            child = trie.size();
+            trie.push_back(TrieNode());
+
+            // Keep children sorted so findChild() can binary search
+            std::vector<std::pair<char, size_t> >& children = trie[node].children;
+            std::vector<std::pair<char, size_t> >::iterator it = children.begin();
+            while (it != children.end() && it->first < c) {
+                ++it;
+            }
+            children.insert(it, std::make_pair(c, child));
+        }
+        node = child;
+    }
+    return node;
+}
+
+/**
+ * @brief Find the child of a trie node for a character
+ * @param node The node
+ * @param c The character
+ * @return Index of the child, or NO_CHILD
+ */
+size_t MaskMatcher::findChild(const TrieNode& node, char c) {
+    size_t low = 0;
+    size_t high = node.children.size();
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (node.children[middle].first < c) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low < node.children.size() && node.children[low].first == c) {
+        return node.children[low].second;
+    }
+    return NO_CHILD;
+}
+
+/**
+ * @brief Glob-check the masks filed under a trie node
+ * @param candidates Indexes of the compiled masks
+ * @param subject The folded subject
+ * @param fromPrefix true for prefix trie candidates, false for suffix trie ones
+ * @return true if one of them matches
+ *
+ * The literal end already matched while walking the trie, so only the rest
+ * of the mask is compared against the rest of the subject.
+ */
+bool MaskMatcher::testCandidates(const std::vector<size_t>& candidates, const std::string& subject,
+                                 bool fromPrefix) const {
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        const Compiled& mask = _compiled[candidates[i]];
+        if (mask.literal) {
+            if (mask.pattern.length() == subject.length()) {
+                return true;
+            }
+            continue;
+        }
+
+        __atomic_fetch_add(&_globTests, 1, __ATOMIC_RELAXED);
+        if (fromPrefix) {
+            if (globMatch(mask.pattern.data() + mask.prefix, mask.pattern.length() - mask.prefix,
+                          subject.data() + mask.prefix, subject.length() - mask.prefix)) {
+                return true;
+            }
+        } else {
+            if (globMatch(mask.pattern.data(), mask.pattern.length() - mask.suffix,
+                          subject.data(), subject.length() - mask.suffix)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,99 @@
+#ifndef MASKMATCHER_HPP
+#define MASKMATCHER_HPP
+
+#include "ircserv.hpp"
+
+/**
+ * @brief One entry of a channel mask list (+b, +e or +I)
+ */
+struct MaskEntry {
+    std::string mask;           // Normalized mask (nick!user@host, original case)
+    std::string setBy;          // Nickname of the operator who set it
+    time_t setAt;               // When it was set
+};
+
+/**
+ * @brief A list of hostmasks compiled for fast matching
+ *
+ * Masks look like nick!user@host with '*' (any characters) and '?' (one
+ * character) as wildcards. Testing a client against a list by glob-matching
+ * every mask in turn costs O(masks) per JOIN, which hurts on channels with
+ * thousands of bans.
+ *
+ * Instead, the list is compiled into:
+ * - a prefix trie over the literal text in front of the first wildcard
+ *   ("baduser!*@*" is filed under "baduser!")
+ * - a suffix trie over the literal text after the last wildcard
+ *   ("*!*@spam.example.com" is filed under "@spam.example.com")
+ * - a short list of masks with no literal text at either end
+ *
+ * Each mask goes into the trie where its literal part is longest. Matching
+ * walks the subject forwards through the prefix trie and backwards through
+ * the suffix trie, so only masks whose literal ends already agree with the
+ * subject are glob-checked, and only on the middle part they don't cover.
+ * Masks without wildcards end at a trie node and need no glob check at all.
+ * An added mask is filed straight into the tries; a removal marks them for
+ * a rebuild on the next match.
+ *
+ * Matching is case-insensitive: masks and subjects are folded with fold().
+ */
+class MaskMatcher {
+private:
+    // A mask ready for matching
+    struct Compiled {
+        std::string pattern;    // Folded mask
+        size_t prefix;          // Literal characters before the first wildcard
+        size_t suffix;          // Literal characters after the last wildcard
+        bool literal;           // No wildcards at all
+    };
+
+    // Trie node; children are sorted by character
+    struct TrieNode {
+        std::vector<std::pair<char, size_t> > children;
+        std::vector<size_t> masks;      // Compiled masks whose literal part ends here
+    };
+
+    std::vector<MaskEntry> _entries;
+    std::vector<std::string> _folded;   // fold() of each entry's mask, same order
+
+    // Compiled form (rebuilt on the first match after a change)
+    mutable bool _dirty;
+    mutable std::vector<Compiled> _compiled;
+    mutable std::vector<TrieNode> _prefixTrie;
+    mutable std::vector<TrieNode> _suffixTrie;
+    mutable std::vector<size_t> _unanchored;
+
+    // Statistics shared by all lists (atomic access: fanout workers check silence lists)
+    static size_t _checks;              // Subjects tested
+    static size_t _globTests;           // Masks that needed a glob check
+
+public:
+    static const size_t MAX_ENTRIES = 100;      // Per list, advertised as MAXLIST=beI:100
+
+    MaskMatcher();
+
+    bool add(const std::string& mask, const std::string& setBy);  // false if already listed or full
+    bool remove(const std::string& mask);                         // false if not listed
+    bool matches(const std::string& foldedSubject) const;         // Subject folded with fold()
+
+    const std::vector<MaskEntry>& getEntries() const;
+    size_t size() const;
+    bool empty() const;
+
+    static std::string normalize(const std::string& mask);  // Fill in missing nick!user@host parts
+    static std::string fold(const std::string& text);       // Case-fold for comparison
+    static bool globMatch(const char* pattern, size_t patternLength, const char* text, size_t textLength);
+
+    static size_t getChecks();
+    static size_t getGlobTests();
+
+private:
+    void compile() const;
+    void file(size_t index) const;
+    size_t find(const std::string& folded) const;
+    static size_t insert(std::vector<TrieNode>& trie, const std::string& key, bool reversed);
+    static size_t findChild(const TrieNode& node, char c);
+    bool testCandidates(const std::vector<size_t>& candidates, const std::string& subject, bool fromPrefix) const;
+};
+
+#endif
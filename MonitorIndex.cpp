@@ -0,0 +1,143 @@
+#include "MonitorIndex.hpp"
+
+/**
+ * @brief Constructor for MonitorIndex class
+ */
+MonitorIndex::MonitorIndex() : _subscriptions(0), _notifications(0) {
+}
+
+/**
+ * @brief Subscribe a client to a nickname
+ * @param watcher The subscribing client
+ * @param nick The nickname to watch
+ * @return true if added, false if the client already watches it
+ */
+bool MonitorIndex::add(Client* watcher, const std::string& nick) {
+    std::vector<Client*>& watchers = _watchers[nick];
+    if (std::find(watchers.begin(), watchers.end(), watcher) != watchers.end()) {
+        return false;
+    }
+
+    watchers.push_back(watcher);
+    _targets[watcher].push_back(nick);
+    _subscriptions++;
+    return true;
+}
+
+/**
+ * @brief Unsubscribe a client from a nickname
+ * @param watcher The client
+ * @param nick The nickname
+ * @return true if the client was watching it
+ */
+bool MonitorIndex::remove(Client* watcher, const std::string& nick) {
+    std::map<Client*, std::vector<std::string> >::iterator it = _targets.find(watcher);
+    if (it == _targets.end()) {
+        return false;
+    }
+
+    std::vector<std::string>& targets = it->second;
+    for (size_t i = 0; i < targets.size(); ++i) {
+        if (targets[i] == nick) {
+            targets.erase(targets.begin() + i);
+            if (targets.empty()) {
+                _targets.erase(it);
+            }
+            unlink(nick, watcher);
+            _subscriptions--;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Remove all subscriptions of a client
+ * @param watcher The client
+ */
+void MonitorIndex::clear(Client* watcher) {
+    std::map<Client*, std::vector<std::string> >::iterator it = _targets.find(watcher);
+    if (it == _targets.end()) {
+        return;
+    }
+
+    for (size_t i = 0; i < it->second.size(); ++i) {
+        unlink(it->second[i], watcher);
+    }
+    _subscriptions -= it->second.size();
+    _targets.erase(it);
+}
+
+/**
+ * @brief Get the nicknames a client watches
+ * @param watcher The client
+ * @return The nicknames as they were given (empty if none)
+ */
+const std::vector<std::string>& MonitorIndex::getTargets(Client* watcher) const {
+    static const std::vector<std::string> none;
+    std::map<Client*, std::vector<std::string> >::const_iterator it = _targets.find(watcher);
+    return it != _targets.end() ? it->second : none;
+}
+
+/**
+ * @brief Get the clients watching a nickname
+ * @param nick The nickname
+ * @return The watchers (empty if none)
+ */
+const std::vector<Client*>& MonitorIndex::getWatchers(const std::string& nick) const {
+    static const std::vector<Client*> none;
+    std::map<std::string, std::vector<Client*> >::const_iterator it = _watchers.find(nick);
+    return it != _watchers.end() ? it->second : none;
+}
+
+/**
+ * @brief Record sent notifications (for STATS)
+ * @param count Number of replies sent
+ */
+void MonitorIndex::countNotifications(size_t count) {
+    _notifications += count;
+}
+
+/**
+ * @brief Get the number of distinct nicknames watched
+ * @return Nickname count
+ */
+size_t MonitorIndex::getWatchedNicks() const {
+    return _watchers.size();
+}
+
+/**
+ * @brief Get the number of subscriptions over all clients
+ * @return Subscription count
+ */
+size_t MonitorIndex::getSubscriptions() const {
+    return _subscriptions;
+}
+
+/**
+ * @brief Get the number of online/offline notifications sent
+ * @return Notification count
+ */
+size_t MonitorIndex::getNotifications() const {
+    return _notifications;
+}
+
+/**
+ * @brief Remove a watcher from a nickname's reverse index entry
+ * @param nick The nickname
+ * @param watcher The client
+ */
+void MonitorIndex::unlink(const std::string& nick, Client* watcher) {
+    std::map<std::string, std::vector<Client*> >::iterator it = _watchers.find(nick);
+    if (it == _watchers.end()) {
+        return;
+    }
+
+    std::vector<Client*>::iterator pos = std::find(it->second.begin(), it->second.end(), watcher);
+    if (pos != it->second.end()) {
+        it->second.erase(pos);
+    }
+    if (it->second.empty()) {
+        _watchers.erase(it);
+    }
+}
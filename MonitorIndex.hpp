@@ -0,0 +1,49 @@
+#ifndef MONITORINDEX_HPP
+#define MONITORINDEX_HPP
+
+#include "ircserv.hpp"
+
+/**
+ * @brief Who is watching whom (MONITOR presence subscriptions)
+ *
+ * Each client can subscribe to a list of nicknames and is told when one of
+ * them comes online or goes offline. Two maps are kept in step:
+ * - watcher -> the nicknames it subscribed to (for MONITOR L / C)
+ * - nickname -> its watchers (the reverse index)
+ *
+ * Nicknames are compared exactly, like NICK and the ClientIndex do: in this
+ * server "Bob" and "bob" are different users.
+ *
+ * When a nickname appears or disappears the Server looks it up in the
+ * reverse index and notifies exactly those watchers, so a sign-on costs one
+ * map lookup plus one reply per interested client, no matter how many
+ * clients or subscriptions exist.
+ */
+class MonitorIndex {
+private:
+    std::map<std::string, std::vector<Client*> > _watchers;    // Nick -> watchers
+    std::map<Client*, std::vector<std::string> > _targets;     // Watcher -> nicks as given
+    size_t _subscriptions;              // Total entries over all watchers
+    size_t _notifications;              // Online/offline replies sent
+
+public:
+    MonitorIndex();
+
+    bool add(Client* watcher, const std::string& nick);     // false if already watched
+    bool remove(Client* watcher, const std::string& nick);  // false if not watched
+    void clear(Client* watcher);                            // MONITOR C, and on disconnect
+
+    const std::vector<std::string>& getTargets(Client* watcher) const;
+    const std::vector<Client*>& getWatchers(const std::string& nick) const;
+
+    void countNotifications(size_t count);
+
+    size_t getWatchedNicks() const;
+    size_t getSubscriptions() const;
+    size_t getNotifications() const;
+
+private:
+    void unlink(const std::string& nick, Client* watcher);
+};
+
+#endif
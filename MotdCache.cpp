@@ -0,0 +1,126 @@
+#include "MotdCache.hpp"
+#include "Utils.hpp"
+#include <sys/stat.h>   // For stat()
+
+/**
+ * @brief Constructor for MotdCache class (no file)
+ */
+MotdCache::MotdCache() : _checkedAt(0), _modified(0), _size(0), _loaded(false), _renders(0) {
+}
+
+/**
+ * @brief Set the MOTD file
+ * @param path Path of the file ("" for none)
+ * @param serverName Server name used as the prefix of the lines
+ */
+void MotdCache::configure(const std::string& path, const std::string& serverName) {
+    _path = path;
+    _serverName = serverName;
+    _checkedAt = 0;
+    _loaded = false;
+    _lines.clear();
+}
+
+/**
+ * @brief Queue the MOTD for a client
+ * @param client The client
+ * @return true if sent, false if there is no MOTD (send 422 instead)
+ */
+bool MotdCache::send(Client* client) {
+    refresh();
+    if (_lines.empty()) {
+        return false;
+    }
+    _lines.emit(client);
+    return true;
+}
+
+/**
+ * @brief Get the number of times the file was rendered
+ * @return Render count
+ */
+size_t MotdCache::getRenders() const {
+    return _renders;
+}
+
+/**
+ * @brief Get the number of lines in the rendered MOTD
+ * @return Line count (375 and 376 included), 0 without MOTD
+ */
+size_t MotdCache::getLines() const {
+    return _lines.getLines();
+}
+
+/**
+ * @brief Re-render the MOTD if the file changed since the last check
+ */
+void MotdCache::refresh() {
+    time_t now = time(NULL);
+    if (_path.empty() || now == _checkedAt) {
+        return;
+    }
+    _checkedAt = now;
+
+    struct stat info;
+    if (stat(_path.c_str(), &info) != 0) {
+        _lines.clear();     // File removed: no MOTD until it comes back
+        _loaded = false;
+        return;
+    }
+    if (_loaded && info.st_mtime == _modified && info.st_size == _size) {
+        return;
+    }
+
+    // Copied with read(): a mapping would fault (SIGBUS) if the file were
+    // truncated while we look at it, a copy just ends early
+    int fd = open(_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    size_t limit = MAX_BYTES;
+    std::string data(std::min(static_cast<size_t>(info.st_size), limit), '\0');
+    size_t length = 0;
+    while (length < data.size()) {
+        ssize_t got = read(fd, &data[length], data.size() - length);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            break;
+        }
+        length += static_cast<size_t>(got);
+    }
+    close(fd);
+    render(data.data(), length);
+
+    _modified = info.st_mtime;
+    _size = info.st_size;
+    _loaded = true;
+    _renders++;
+}
+
+/**
+ * @brief Build the reply lines from the file contents
+ * @param data The file contents
+ * @param length Size of the file
+ */
+void MotdCache::render(const char* data, size_t length) {
+    _lines.clear();
+    _lines.addNumeric(_serverName, IRC::RPL_MOTDSTART, ":- " + _serverName + " Message of the day - ");
+
+    size_t start = 0;
+    size_t count = 0;
+    while (start < length && count < MAX_LINES) {
+        const char* newline = static_cast<const char*>(memchr(data + start, '\n', length - start));
+        size_t end = newline ? static_cast<size_t>(newline - data) : length;
+        size_t lineEnd = end;
+        if (lineEnd > start && data[lineEnd - 1] == '\r') {
+            lineEnd--;
+        }
+        _lines.addNumeric(_serverName, IRC::RPL_MOTD, ":- " + std::string(data + start, lineEnd - start));
+        count++;
+        start = end + 1;
+    }
+
+    _lines.addNumeric(_serverName, IRC::RPL_ENDOFMOTD, ":End of /MOTD command.");
+}
@@ -0,0 +1,46 @@
+#ifndef MOTDCACHE_HPP
+#define MOTDCACHE_HPP
+
+#include "ircserv.hpp"
+#include "ReplyTemplate.hpp"
+
+/**
+ * @brief The message of the day, rendered once per version of the file
+ *
+ * The file (motd_file) is read with read() and turned into a ReplyTemplate
+ * (375, one 372 per line, 376), which every registering client then gets
+ * with a single copy. Before sending, the file's modification time and size
+ * are checked with stat(), at most once per second, and the template is only
+ * rebuilt when they changed. A burst of registrations after a restart
+ * therefore reads the file once and shares the rendered lines.
+ */
+class MotdCache {
+public:
+    static const size_t MAX_LINES = 100;    // Longer files are cut (keeps the block under 64 KiB)
+    static const size_t MAX_BYTES = MAX_LINES * 512;  // Never read more than this much of the file
+
+private:
+    std::string _path;                      // The file ("": no MOTD)
+    std::string _serverName;
+    ReplyTemplate _lines;                   // 375/372/376, empty if the file is missing
+    time_t _checkedAt;                      // Last stat() (at most once per second)
+    time_t _modified;                       // st_mtime of the rendered version
+    off_t _size;                            // st_size of the rendered version
+    bool _loaded;                           // A version of the file is rendered
+    size_t _renders;                        // Times the file was rendered
+
+public:
+    MotdCache();
+
+    void configure(const std::string& path, const std::string& serverName);
+    bool send(Client* client);              // MOTD lines, or false if there is no MOTD
+
+    size_t getRenders() const;
+    size_t getLines() const;
+
+private:
+    void refresh();                         // Re-render if the file changed
+    void render(const char* data, size_t length);
+};
+
+#endif
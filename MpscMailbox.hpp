@@ -0,0 +1,91 @@
+#ifndef MPSCMAILBOX_HPP
+#define MPSCMAILBOX_HPP
+
+#include "ircserv.hpp"
+
+/**
+ * @brief Unbounded lock-free queue with any number of producers and one consumer
+ * @tparam T The element type (small, copyable)
+ *
+ * A linked list where the producers own the newest end and the consumer the
+ * oldest. A producer links its node in with a single atomic exchange of the
+ * newest pointer, then publishes the link from the previous node with a
+ * release store; it never waits for other producers or for the consumer.
+ * The consumer follows next pointers with acquire loads and frees the node
+ * it leaves behind. There is always one node (the "stub") in the list, so
+ * neither side has to handle an empty list specially.
+ *
+ * Between a producer's exchange and its store the list is briefly cut, and
+ * pop() reports the mailbox empty. That is harmless here: producers signal
+ * the consumer after push() returns, and the consumer drains again then.
+ *
+ * Messages sent by one producer arrive in the order it sent them.
+ */
+template <typename T>
+class MpscMailbox {
+private:
+    struct Node {
+        Node* next;
+        T value;
+    };
+
+    Node* _newest;                      // Producers: last node linked in (atomic exchange)
+    char _pad[64 - sizeof(Node*)];      // Keep the two ends on separate cache lines
+    Node* _oldest;                      // Consumer: the stub, whose next is the next message
+
+    // Not copyable (owns the nodes)
+    MpscMailbox(const MpscMailbox& other);
+    MpscMailbox& operator=(const MpscMailbox& other);
+
+public:
+    MpscMailbox() {
+        Node* stub = new Node();
+        stub->next = NULL;
+        _newest = stub;
+        _oldest = stub;
+    }
+
+    /**
+     * @brief Destructor (no thread may use the mailbox any more)
+     *
+     * Elements still queued are discarded; pop them first if they own memory.
+     */
+    ~MpscMailbox() {
+        while (_oldest) {
+            Node* next = _oldest->next;
+            delete _oldest;
+            _oldest = next;
+        }
+    }
+
+    /**
+     * @brief Add an element (any thread)
+     * @param value The element
+     */
+    void push(const T& value) {
+        Node* node = new Node();
+        node->next = NULL;
+        node->value = value;
+        Node* previous = __atomic_exchange_n(&_newest, node, __ATOMIC_ACQ_REL);
+        __atomic_store_n(&previous->next, node, __ATOMIC_RELEASE);
+    }
+
+    /**
+     * @brief Take the oldest element (consumer thread only)
+     * @param value Receives the element
+     * @return false if there is none (or a push is halfway through)
+     */
+    bool pop(T& value) {
+        Node* stub = _oldest;
+        Node* next = __atomic_load_n(&stub->next, __ATOMIC_ACQUIRE);
+        if (!next) {
+            return false;
+        }
+        value = next->value;    // next becomes the new stub
+        _oldest = next;
+        delete stub;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef OBJECTPOOL_HPP
+#define OBJECTPOOL_HPP
+
+#include "ircserv.hpp"
+#include <new>          // For placement new
+
+/**
+ * @brief Typed pool allocator with a freelist
+ * @tparam T The type of object stored in the pool
+ *
+ * Memory is allocated in blocks of slots. Free slots are chained together
+ * in a singly linked freelist, so allocate() and destroy() are a couple of
+ * pointer moves instead of a trip through malloc/free. Slots are never
+ * returned to the system while the pool is alive.
+ *
+ * Usage:
+ *     Client* client = new (pool.allocate()) Client(...);
+ *     pool.destroy(client);
+ */
+template <typename T>
+class ObjectPool {
+private:
+    // A slot holds either a live object or a link to the next free slot.
+    // The extra members force an alignment good enough for any T we store.
+    union Slot {
+        Slot* next;
+        char storage[sizeof(T)];
+        long double alignLongDouble;
+        void* alignPointer;
+    };
+
+    std::vector<Slot*> _blocks;         // Blocks allocated so far (freed in the destructor)
+    Slot* _freeList;                    // First free slot
+    size_t _capacity;                   // Total number of slots
+    size_t _live;                       // Slots currently holding an object
+    size_t _highWater;                  // Highest _live ever seen
+    size_t _growth;                     // Slots added when the freelist runs dry
+
+    // Not copyable (owns its blocks)
+    ObjectPool(const ObjectPool& other);
+    ObjectPool& operator=(const ObjectPool& other);
+
+public:
+    /**
+     * @brief Constructor
+     * @param capacity Number of slots to preallocate
+     */
+    explicit ObjectPool(size_t capacity = 0)
+        : _freeList(NULL), _capacity(0), _live(0), _highWater(0), _growth(16) {
+        reserve(capacity);
+    }
+
+    /**
+     * @brief Destructor - releases all blocks
+     *
+     * Objects still alive at this point are not destroyed; owners must
+     * destroy() everything they allocated first.
+     */
+    ~ObjectPool() {
+        for (size_t i = 0; i < _blocks.size(); ++i) {
+            delete[] _blocks[i];
+        }
+    }
+
+    /**
+     * @brief Make sure at least count slots exist in total
+     * @param count Wanted capacity
+     */
+    void reserve(size_t count) {
+        if (count > _capacity) {
+            addBlock(count - _capacity);
+        }
+    }
+
+    /**
+     * @brief Take a free slot (grows the pool if needed)
+     * @return Raw memory for one T, to be used with placement new
+     */
+    void* allocate() {
+        if (!_freeList) {
+            // Grow geometrically so a burst of connections costs few allocations
+            addBlock(_capacity > _growth ? _capacity : _growth);
+        }
+        Slot* slot = _freeList;
+        _freeList = slot->next;
+        _live++;
+        if (_live > _highWater) {
+            _highWater = _live;
+        }
+        return slot->storage;
+    }
+
+    /**
+     * @brief Destroy an object and put its slot back on the freelist
+     * @param object Object created in memory from allocate() (NULL is ignored)
+     */
+    void destroy(T* object) {
+        if (!object) {
+            return;
+        }
+        object->~T();
+        Slot* slot = reinterpret_cast<Slot*>(object);
+        slot->next = _freeList;
+        _freeList = slot;
+        _live--;
+    }
+
+    // Statistics getters
+    size_t getCapacity() const { return _capacity; }
+    size_t getLive() const { return _live; }
+    size_t getFree() const { return _capacity - _live; }
+    size_t getHighWater() const { return _highWater; }
+
+private:
+    /**
+     * @brief Allocate a block of slots and chain them into the freelist
+     * @param count Number of slots in the new block
+     */
+    void addBlock(size_t count) {
+        if (count == 0) {
+            return;
+        }
+        Slot* block = new Slot[count];
+        _blocks.push_back(block);
+        for (size_t i = count; i > 0; --i) {
+            block[i - 1].next = _freeList;
+            _freeList = &block[i - 1];
+        }
+        _capacity += count;
+    }
+};
+
+#endif
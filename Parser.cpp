@@ -3,6 +3,10 @@
 #include "Client.hpp"
 #include "Channel.hpp"
 #include "Utils.hpp"
+#include "TextScanner.hpp"
+#include "ReplyWriter.hpp"
+#include "Capabilities.hpp"
+#include "TaggedMessage.hpp"
 #include <unistd.h> // For usleep
 
 /**
@@ -10,6 +14,11 @@
  * @param server Pointer to the server instance
  */
 Parser::Parser(Server* server) : _server(server) {
+    buildWelcome();
+    
+    _capList.addText(":" + _server->getServerName() + " CAP ");
+    _capList.addSlot(ReplyTemplate::SLOT_NICK);
+    _capList.addText(" LS :" + Capabilities::list() + "\r\n");
 }
 
 /**
@@ -24,72 +33,134 @@ Parser::~Parser() {
  * @param message The raw IRC message
  * @return Parsed IRCCommand structure
  * 
- * IRC messages have the format: [:prefix] COMMAND [param1] [param2] ... [:trailing param]
+ * IRC messages have the format: [@tags] [:prefix] COMMAND [param1] [param2] ... [:trailing param]
  * For example: "PRIVMSG #channel :Hello world" or "NICK john"
  */
 IRCCommand Parser::parseCommand(const std::string& message) {
+    return parseCommand(message.data(), message.length());
+}
+
+/**
+ * @brief Parse an IRC command from raw bytes
+ * @param data Start of the message (not necessarily NUL-terminated)
+ * @param length Length of the message
+ * @return Parsed IRCCommand structure
+ * 
+ * Works on the bytes in place: surrounding whitespace is skipped by moving
+ * the bounds instead of making a trimmed copy, and only the resulting
+ * command and parameters are copied into the IRCCommand.
+ */
+IRCCommand Parser::parseCommand(const char* data, size_t length) {
     IRCCommand cmd;
-    std::string line = Utils::trim(message);
     
-    if (line.empty()) {
+    // Trim whitespace by moving the bounds (no copy)
+    size_t pos = 0;
+    size_t end = length;
+    while (pos < end && isWhitespace(data[pos])) {
+        pos++;
+    }
+    while (end > pos && isWhitespace(data[end - 1])) {
+        end--;
+    }
+    
+    if (pos == end) {
         return cmd;  // Return empty command
     }
     
-    size_t pos = 0;
+    // Message tags (IRCv3, start with @). Only client-only tags (+name) are
+    // kept, to be relayed; anything else a client sends is meaningless to us.
+    if (data[pos] == '@') {
+        size_t tagsEnd = findSpace(data, pos + 1, end);
+        size_t tag = pos + 1;
+        while (tag < tagsEnd) {
+            const char* semicolon = static_cast<const char*>(memchr(data + tag, ';', tagsEnd - tag));
+            size_t tagEnd = semicolon ? static_cast<size_t>(semicolon - data) : tagsEnd;
+            if (data[tag] == '+' && tagEnd > tag + 1) {
+                if (!cmd.tags.empty()) {
+                    cmd.tags += ';';
+                }
+                cmd.tags.append(data + tag, tagEnd - tag);
+            }
+            tag = tagEnd + 1;
+        }
+        pos = tagsEnd;
+        while (pos < end && data[pos] == ' ') {
+            pos++;
+        }
+        if (pos == end) {
+            return cmd;
+        }
+    }
     
     // Check for prefix (starts with :)
-    if (line[0] == ':') {
-        size_t spacePos = line.find(' ', 1);
-        if (spacePos != std::string::npos) {
-            cmd.prefix = line.substr(1, spacePos - 1);
+    if (data[pos] == ':') {
+        size_t spacePos = findSpace(data, pos + 1, end);
+        if (spacePos != end) {
+            cmd.prefix.assign(data + pos + 1, spacePos - pos - 1);
             pos = spacePos + 1;
         }
     }
     
     // Skip whitespace
-    while (pos < line.length() && line[pos] == ' ') {
+    while (pos < end && data[pos] == ' ') {
         pos++;
     }
     
     // Extract command
-    size_t cmdEnd = line.find(' ', pos);
-    if (cmdEnd == std::string::npos) {
-        cmd.command = line.substr(pos);  // Keep original case
+    size_t cmdEnd = findSpace(data, pos, end);
+    cmd.command.assign(data + pos, cmdEnd - pos);  // Keep original case
+    if (cmdEnd == end) {
         return cmd;  // No parameters
     }
-    
-    cmd.command = line.substr(pos, cmdEnd - pos);  // Keep original case
     pos = cmdEnd + 1;
     
     // Extract parameters
-    while (pos < line.length()) {
+    while (pos < end) {
         // Skip whitespace
-        while (pos < line.length() && line[pos] == ' ') {
+        while (pos < end && data[pos] == ' ') {
             pos++;
         }
         
-        if (pos >= line.length()) break;
+        if (pos >= end) break;
         
         // Check for trailing parameter (starts with :)
-        if (line[pos] == ':') {
-            cmd.params.push_back(line.substr(pos + 1));
+        if (data[pos] == ':') {
+            cmd.params.push_back(std::string(data + pos + 1, end - pos - 1));
             break;
         }
         
         // Regular parameter
-        size_t paramEnd = line.find(' ', pos);
-        if (paramEnd == std::string::npos) {
-            cmd.params.push_back(line.substr(pos));
-            break;
-        } else {
-            cmd.params.push_back(line.substr(pos, paramEnd - pos));
-            pos = paramEnd + 1;
-        }
+        size_t paramEnd = findSpace(data, pos, end);
+        cmd.params.push_back(std::string(data + pos, paramEnd - pos));
+        pos = paramEnd + 1;
     }
     
     return cmd;
 }
 
+/**
+ * @brief Check for the whitespace characters Utils::trim removes
+ * @param c The character
+ * @return true for space, tab, \r and \n
+ */
+bool Parser::isWhitespace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/**
+ * @brief Find the next space within bounds
+ * @param data The message bytes
+ * @param pos Where to start looking
+ * @param end End of the message
+ * @return Index of the space, or end if there is none
+ */
+size_t Parser::findSpace(const char* data, size_t pos, size_t end) {
+    while (pos < end && data[pos] != ' ') {
+        pos++;
+    }
+    return pos;
+}
+
 /**
  * @brief Execute a parsed IRC command
  * @param client The client who sent the command
@@ -113,6 +184,8 @@ void Parser::executeCommand(Client* client, const IRCCommand& cmd) {
         handlePart(client, cmd);
     } else if (cmd.command == "PRIVMSG") {
         handlePrivmsg(client, cmd);
+    } else if (cmd.command == "NOTICE") {
+        handleNotice(client, cmd);
     } else if (cmd.command == "KICK") {
         handleKick(client, cmd);
     } else if (cmd.command == "INVITE") {
@@ -123,9 +196,31 @@ void Parser::executeCommand(Client* client, const IRCCommand& cmd) {
         handleMode(client, cmd);
     } else if (cmd.command == "QUIT") {
         handleQuit(client, cmd);
+    } else if (cmd.command == "STATS") {
+        handleStats(client, cmd);
+    } else if (cmd.command == "MIGRATE") {
+        handleMigrate(client, cmd);
+    } else if (cmd.command == "SILENCE") {
+        handleSilence(client, cmd);
+    } else if (cmd.command == "WHO") {
+        handleWho(client, cmd);
+    } else if (cmd.command == "WHOIS") {
+        handleWhois(client, cmd);
+    } else if (cmd.command == "USERHOST") {
+        handleUserhost(client, cmd);
+    } else if (cmd.command == "MONITOR") {
+        handleMonitor(client, cmd);
+    } else if (cmd.command == "LIST") {
+        handleList(client, cmd);
+    } else if (cmd.command == "MOTD") {
+        handleMotd(client, cmd);
+    } else if (cmd.command == "CAP") {
+        handleCap(client, cmd);
+    } else if (cmd.command == "TAGMSG") {
+        handleTagmsg(client, cmd);
     } else {
         // Unknown command
-        sendError(client, IRC::ERR_UNKNOWNCOMMAND, cmd.command + " :Unknown command");
+        sendError(client, IRC::ERR_UNKNOWNCOMMAND, cmd.command, "Unknown command");
     }
 }
 
@@ -138,12 +233,12 @@ void Parser::executeCommand(Client* client, const IRCCommand& cmd) {
  */
 void Parser::handlePass(Client* client, const IRCCommand& cmd) {
     if (client->isRegistered()) {
-        sendError(client, IRC::ERR_ALREADYREGISTERED, ":You may not reregister");
+        sendError(client, IRC::ERR_ALREADYREGISTERED, "You may not reregister");
         return;
     }
     
     if (cmd.params.empty()) {
-        sendError(client, IRC::ERR_NEEDMOREPARAMS, "PASS :Not enough parameters");
+        sendError(client, IRC::ERR_NEEDMOREPARAMS, "PASS", "Not enough parameters");
         return;
     }
     
@@ -152,7 +247,7 @@ void Parser::handlePass(Client* client, const IRCCommand& cmd) {
         // No response is sent for successful PASS according to RFC 1459
         // The client will know it succeeded when they don't get ERR_PASSWDMISMATCH
     } else {
-        sendError(client, IRC::ERR_PASSWDMISMATCH, ":Password incorrect");
+        sendError(client, IRC::ERR_PASSWDMISMATCH, "Password incorrect");
         // Keep client connected, let them try again
     }
 }
@@ -164,44 +259,48 @@ void Parser::handlePass(Client* client, const IRCCommand& cmd) {
  */
 void Parser::handleNick(Client* client, const IRCCommand& cmd) {
     if (cmd.params.empty()) {
-        sendError(client, IRC::ERR_NONICKNAMEGIVEN, ":No nickname given");
+        sendError(client, IRC::ERR_NONICKNAMEGIVEN, "No nickname given");
         return;
     }
     
     // Require authentication before setting nickname
     if (!client->isAuthenticated()) {
-        sendError(client, IRC::ERR_NOTREGISTERED, ":You have not registered");
+        sendError(client, IRC::ERR_NOTREGISTERED, "You have not registered");
         return;
     }
     
     std::string newNick = cmd.params[0];
     
     if (!Utils::isValidNickname(newNick)) {
-        sendError(client, IRC::ERR_ERRONEUSNICKNAME, newNick + " :Erroneous nickname");
+        sendError(client, IRC::ERR_ERRONEUSNICKNAME, newNick, "Erroneous nickname");
         return;
     }
     
     // Check if nickname is already in use
     Client* existingClient = _server->getClientByNick(newNick);
     if (existingClient && existingClient != client) {
-        sendError(client, IRC::ERR_NICKNAMEINUSE, newNick + " :Nickname is already in use");
+        sendError(client, IRC::ERR_NICKNAMEINUSE, newNick, "Nickname is already in use");
         return;
     }
     
-    std::string oldNick = client->getNickname();
-    client->setNickname(newNick);
-    
-    // If client was already registered, notify other users
-    if (client->isRegistered() && !oldNick.empty()) {
-        std::string message = Utils::formatMessage(client->getPrefix(), "NICK", newNick);
-        _server->broadcastToAll(message, client);
+    // If client was already registered, notify the client and everyone who shares a channel
+    // with it (the message carries the old prefix, so it is built before the change)
+    if (client->isRegistered() && !client->getNickname().empty()) {
+        ScratchWriter nickMsg(Arena::active());
+        nickMsg.append(':');
+        client->appendPrefix(nickMsg);
+        nickMsg.append(" NICK ").append(newNick).append("\r\n", 2);
+        _server->notifyPresence(client, false);  // Old nick goes offline for MONITOR
+        client->setNickname(newNick);
+        _server->sendToNeighbors(client, nickMsg.str(), true);
+        _server->indexClient(client);
+        _server->notifyPresence(client, true);
+        return;
     }
     
-    // Check if client is now fully registered
-    if (client->isAuthenticated() && !client->getUsername().empty() && !client->isRegistered()) {
-        client->setRegistered(true);
-        sendWelcome(client);
-    }
+    client->setNickname(newNick);
+    _server->indexClient(client);
+    completeRegistration(client);
 }
 
 /**
@@ -211,35 +310,152 @@ void Parser::handleNick(Client* client, const IRCCommand& cmd) {
  */
 void Parser::handleUser(Client* client, const IRCCommand& cmd) {
     if (client->isRegistered()) {
-        sendError(client, IRC::ERR_ALREADYREGISTERED, ":You may not reregister");
+        sendError(client, IRC::ERR_ALREADYREGISTERED, "You may not reregister");
         return;
     }
     
     // Require authentication before setting user info
     if (!client->isAuthenticated()) {
-        sendError(client, IRC::ERR_NOTREGISTERED, ":You have not registered");
+        sendError(client, IRC::ERR_NOTREGISTERED, "You have not registered");
         return;
     }
     
     if (cmd.params.size() < 4) {
-        sendError(client, IRC::ERR_NEEDMOREPARAMS, "USER :Not enough parameters");
+        sendError(client, IRC::ERR_NEEDMOREPARAMS, "USER", "Not enough parameters");
         return;
     }
     
-    client->setUsername(cmd.params[0]);
+    client->setUsername(_server->intern(cmd.params[0]));
     client->setRealname(cmd.params[3]);
+    _server->indexClient(client);
+    completeRegistration(client);
+}
+
+/**
+ * @brief Register the client if nothing is missing any more
+ * @param client The client
+ * 
+ * Called after NICK, USER and CAP END: registration needs the password,
+ * a nickname and a username, and waits while capabilities are negotiated
+ * and while the hostname is looked up (the server calls this again then).
+ */
+void Parser::completeRegistration(Client* client) {
+    if (client->isRegistered() || !client->isAuthenticated() || client->isNegotiating() || client->isResolving() ||
+        client->getNickname().empty() || client->getUsername().empty()) {
+        return;
+    }
+    client->setRegistered(true);
+    sendWelcome(client);
+    _server->notifyPresence(client, true);
+}
+
+/**
+ * @brief Tell a client's channels that its caps or SILENCE list changed
+ * @param client The client
+ * 
+ * Sharded channels keep their own copy of what they need to know about
+ * members (see ChannelShard).
+ */
+static void refreshMemberships(Client* client) {
+    const std::vector<Channel*>& channels = client->getChannels();
+    for (size_t i = 0; i < channels.size(); ++i) {
+        channels[i]->refreshMember(client);
+    }
+}
+
+/**
+ * @brief Handle CAP command (IRCv3 capability negotiation)
+ * @param client The client
+ * @param cmd The command
+ * 
+ * - CAP LS [302]: list the capabilities (pauses registration)
+ * - CAP REQ :a b -c: enable/disable, all or nothing (ACK or NAK)
+ * - CAP LIST: the capabilities enabled
+ * - CAP END: finish negotiating, registration continues
+ * Allowed before PASS, as clients send CAP LS first thing.
+ */
+void Parser::handleCap(Client* client, const IRCCommand& cmd) {
+    if (cmd.params.empty()) {
+        sendError(client, IRC::ERR_NEEDMOREPARAMS, "CAP", "Not enough parameters");
+        return;
+    }
+    
+    const std::string& subcommand = cmd.params[0];
+    StringRef nick = client->getNicknameRef();
+    std::string head = ":" + _server->getServerName() + " CAP " + (nick.length ? nick.str() : "*");
     
-    // Check if client is now fully registered
-    if (client->isAuthenticated() && !client->getNickname().empty() && !client->isRegistered()) {
-        client->setRegistered(true);
-        sendWelcome(client);
+    if (subcommand == "LS") {
+        if (!client->isRegistered()) {
+            client->setNegotiating(true);
+        }
+        _capList.emit(client);
+    } else if (subcommand == "LIST") {
+        Utils::sendToClient(client, head + " LIST :" + Capabilities::names(client->getCaps()));
+    } else if (subcommand == "REQ") {
+        if (!client->isRegistered()) {
+            client->setNegotiating(true);
+        }
+        const std::string requested = cmd.params.size() > 1 ? cmd.params[1] : "";
+        std::vector<std::string> names = Utils::split(requested, ' ');
+        unsigned int caps = client->getCaps();
+        bool valid = true;
+        for (size_t i = 0; i < names.size() && valid; ++i) {
+            bool remove = !names[i].empty() && names[i][0] == '-';
+            unsigned int cap = Capabilities::find(remove ? names[i].substr(1) : names[i]);
+            if (cap == 0) {
+                valid = false;
+            } else if (remove) {
+                caps &= ~cap;
+            } else {
+                caps |= cap;
+            }
+        }
+        if (valid) {
+            client->setCaps(caps);
+            refreshMemberships(client);
+        }
+        Utils::sendToClient(client, head + (valid ? " ACK :" : " NAK :") + requested);
+    } else if (subcommand == "END") {
+        if (client->isNegotiating()) {
+            client->setNegotiating(false);
+            completeRegistration(client);
+        }
+    } else {
+        sendError(client, IRC::ERR_INVALIDCAPCMD, subcommand, "Invalid CAP command");
+    }
+}
+
+/**
+ * @brief Split a JOIN key list, keeping empty keys in place
+ * @param keys Comma-separated keys
+ * @return The keys (key n goes with channel n)
+ */
+static std::vector<std::string> splitKeys(const std::string& keys) {
+    std::vector<std::string> result;
+    if (keys.empty()) {
+        return result;
+    }
+    size_t start = 0;
+    while (true) {
+        size_t comma = keys.find(',', start);
+        result.push_back(keys.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+        if (comma == std::string::npos) {
+            break;
+        }
+        start = comma + 1;
     }
+    return result;
 }
 
 /**
- * @brief Handle JOIN command (join a channel)
+ * @brief Handle JOIN command (join channels)
  * @param client The client
  * @param cmd The command
+ * 
+ * JOIN #a,#b,#c key1,key2 joins each channel in turn, the n-th key going
+ * with the n-th channel. The client's prefix is rendered once for the whole
+ * list, and all the replies (JOIN, topic, names) land in the output queue
+ * to leave together in one writev() at the end of the tick.
  */
 void Parser::handleJoin(Client* client, const IRCCommand& cmd) {
     if (!client->isRegistered()) {
@@ -247,36 +463,66 @@ void Parser::handleJoin(Client* client, const IRCCommand& cmd) {
     }
     
     if (cmd.params.empty()) {
-        sendError(client, IRC::ERR_NEEDMOREPARAMS, "JOIN :Not enough parameters");
+        sendError(client, IRC::ERR_NEEDMOREPARAMS, "JOIN", "Not enough parameters");
         return;
     }
     
-    std::string channelName = cmd.params[0];
-    std::string key = cmd.params.size() > 1 ? cmd.params[1] : "";
+    std::vector<std::string> channels = Utils::split(cmd.params[0], ',');
+    std::vector<std::string> keys = splitKeys(cmd.params.size() > 1 ? cmd.params[1] : "");
+    std::string prefix = client->getPrefix();
     
+    for (size_t i = 0; i < channels.size(); ++i) {
+        joinChannel(client, channels[i], i < keys.size() ? keys[i] : "", prefix);
+    }
+}
+
+/**
+ * @brief Join one channel of a JOIN list
+ * @param client The client
+ * @param channelName The channel
+ * @param key The key given for it (empty if none)
+ * @param prefix The client's nick!user@host
+ */
+void Parser::joinChannel(Client* client, const std::string& channelName, const std::string& key,
+                         const std::string& prefix) {
     if (!Utils::isValidChannelName(channelName)) {
-        sendError(client, IRC::ERR_NOSUCHCHANNEL, channelName + " :No such channel");
+        sendError(client, IRC::ERR_NOSUCHCHANNEL, channelName, "No such channel");
         return;
     }
     
     Channel* channel = _server->getChannel(channelName);
+    if (channel && channel->hasClient(client)) {
+        return;  // Already there (e.g. listed twice)
+    }
+    
+    if (client->getChannels().size() >= _server->getChannelLimit()) {
+        sendError(client, IRC::ERR_TOOMANYCHANNELS, channelName, "You have joined too many channels");
+        return;
+    }
+    
     if (!channel) {
         channel = _server->createChannel(channelName);
     }
     
     // Check channel restrictions
-    if (channel->isInviteOnly() && !channel->isInvited(client)) {
-        sendError(client, IRC::ERR_INVITEONLYCHAN, channelName + " :Cannot join channel (+i)");
+    if (channel->isInviteOnly() && !channel->isInvited(client) && !channel->isInviteExempt(client)) {
+        sendError(client, IRC::ERR_INVITEONLYCHAN, channelName, "Cannot join channel (+i)");
+        return;
+    }
+    
+    // An invite overrides a ban
+    if (!channel->isInvited(client) && channel->isBanned(client)) {
+        sendError(client, IRC::ERR_BANNEDFROMCHAN, channelName, "Cannot join channel (+b)");
         return;
     }
     
     if (channel->hasKey() && channel->getKey() != key) {
-        sendError(client, IRC::ERR_BADCHANNELKEY, channelName + " :Cannot join channel (+k)");
+        sendError(client, IRC::ERR_BADCHANNELKEY, channelName, "Cannot join channel (+k)");
         return;
     }
     
     if (channel->hasUserLimit() && channel->getClientCount() >= channel->getUserLimit()) {
-        sendError(client, IRC::ERR_CHANNELISFULL, channelName + " :Cannot join channel (+l)");
+        sendError(client, IRC::ERR_CHANNELISFULL, channelName, "Cannot join channel (+l)");
         return;
     }
     
@@ -285,30 +531,34 @@ void Parser::handleJoin(Client* client, const IRCCommand& cmd) {
     channel->removeInvited(client);  // Remove from invited list if they were invited
     
     // Send JOIN message to all channel members
-    std::string joinMsg = Utils::formatMessage(client->getPrefix(), "JOIN", channelName);
-    channel->broadcast(joinMsg);
+    std::string joinMsg = Utils::formatMessage(prefix, "JOIN", channelName);
+    channel->broadcast(joinMsg, NULL, NULL, client);
     
     // Send topic if set
     if (!channel->getTopic().empty()) {
-        std::string topicMsg = Utils::formatReply(_server->getServerName(), IRC::RPL_TOPIC, client->getNickname(), 
-                                                channelName + " :" + channel->getTopic());
-        Utils::sendToClient(client, topicMsg);
+        ReplyWriter(client, _server->getServerName(), IRC::RPL_TOPIC)
+            .param(channelName).trailing(channel->getTopic()).send();
     }
     
-    // Send names list
-    std::string namesMsg = Utils::formatReply(_server->getServerName(), IRC::RPL_NAMREPLY, client->getNickname(),
-                                            "= " + channelName + " :" + channel->getUserList());
-    Utils::sendToClient(client, namesMsg);
+    // Send names list, split over several 353 lines if the channel is big
+    ReplyWriter names(client, _server->getServerName(), IRC::RPL_NAMREPLY);
+    names.param("=").param(channelName);
+    const std::vector<Client*>& members = channel->getClients();
+    for (size_t i = 0; i < members.size(); ++i) {
+        names.item(channel->isOperator(members[i]) ? '@' : '\0', members[i]->getNicknameRef());
+    }
+    names.send();
     
-    std::string endNamesMsg = Utils::formatReply(_server->getServerName(), IRC::RPL_ENDOFNAMES, client->getNickname(),
-                                               channelName + " :End of /NAMES list");
-    Utils::sendToClient(client, endNamesMsg);
+    ReplyWriter(client, _server->getServerName(), IRC::RPL_ENDOFNAMES)
+        .param(channelName).trailing("End of /NAMES list").send();
 }
 
 /**
- * @brief Handle PART command (leave a channel)
+ * @brief Handle PART command (leave channels)
  * @param client The client
  * @param cmd The command
+ * 
+ * PART #a,#b :reason leaves each channel with the same reason.
  */
 void Parser::handlePart(Client* client, const IRCCommand& cmd) {
     if (!client->isRegistered()) {
@@ -316,83 +566,338 @@ void Parser::handlePart(Client* client, const IRCCommand& cmd) {
     }
     
     if (cmd.params.empty()) {
-        sendError(client, IRC::ERR_NEEDMOREPARAMS, "PART :Not enough parameters");
+        sendError(client, IRC::ERR_NEEDMOREPARAMS, "PART", "Not enough parameters");
         return;
     }
     
-    std::string channelName = cmd.params[0];
+    std::vector<std::string> channels = Utils::split(cmd.params[0], ',');
     std::string reason = cmd.params.size() > 1 ? cmd.params[1] : "";
-    
-    Channel* channel = _server->getChannel(channelName);
-    if (!channel || !channel->hasClient(client)) {
-        sendError(client, IRC::ERR_NOTONCHANNEL, channelName + " :You're not on that channel");
-        return;
-    }
-    
-    // Send PART message to all channel members
-    std::string params = channelName;
-    if (!reason.empty()) {
-        params += " :" + reason;
-    }
-    std::string partMsg = Utils::formatMessage(client->getPrefix(), "PART", params);
-    channel->broadcast(partMsg);
-    
-    channel->removeClient(client);
-    
-    // Remove channel if empty
-    if (channel->getClientCount() == 0) {
-        _server->removeChannel(channelName);
+    std::string prefix = client->getPrefix();
+    
+    for (size_t i = 0; i < channels.size(); ++i) {
+        const std::string& channelName = channels[i];
+        Channel* channel = _server->getChannel(channelName);
+        if (!channel || !channel->hasClient(client)) {
+            sendError(client, IRC::ERR_NOTONCHANNEL, channelName, "You're not on that channel");
+            continue;
+        }
+        
+        // Send PART message to all channel members
+        std::string params = channelName;
+        if (!reason.empty()) {
+            params += " :" + reason;
+        }
+        std::string partMsg = Utils::formatMessage(prefix, "PART", params);
+        channel->broadcast(partMsg, NULL, NULL, client);
+        
+        channel->removeClient(client);
+        
+        // Remove channel if empty
+        if (channel->getClientCount() == 0) {
+            _server->removeChannel(channelName);
+        }
     }
 }
 
 /**
- * @brief Handle PRIVMSG command (send private message)
+ * @brief Handle PRIVMSG command (send a message to channels and users)
  * @param client The client
  * @param cmd The command
  */
 void Parser::handlePrivmsg(Client* client, const IRCCommand& cmd) {
+    relayMessage(client, cmd, "PRIVMSG");
+}
+
+/**
+ * @brief Handle NOTICE command (like PRIVMSG, but never answered by clients)
+ * @param client The client
+ * @param cmd The command
+ */
+void Parser::handleNotice(Client* client, const IRCCommand& cmd) {
+    relayMessage(client, cmd, "NOTICE");
+}
+
+/**
+ * @brief Handle TAGMSG command (message with tags only, IRCv3 message-tags)
+ * @param client The client
+ * @param cmd The command
+ * 
+ * Typing notifications and the like: only recipients with message-tags
+ * get anything, the others never see the message.
+ */
+void Parser::handleTagmsg(Client* client, const IRCCommand& cmd) {
+    relayMessage(client, cmd, "TAGMSG");
+}
+
+/**
+ * @brief Deliver a PRIVMSG, NOTICE or TAGMSG to each of its targets
+ * @param client The sender
+ * @param cmd The command ("target1,target2 :text")
+ * @param command "PRIVMSG", "NOTICE" or "TAGMSG"
+ * 
+ * Up to max_targets comma-separated targets (TARGMAX). Whatever doesn't
+ * depend on the target is done once for the whole list: the sender's
+ * prefix and command are formatted once, the text is classified once (an
+ * invalid UTF-8 text is refused once, not per target), scanned by the
+ * content filter once, hashed once and counted once in the sender's flood
+ * table, and a target listed twice is only delivered to once. Each target
+ * then costs a lookup, a scope check of the filter hits, a count in the
+ * channel's flood table and the fanout of one line.
+ *
+ * A NOTICE is never answered automatically: every error a PRIVMSG would
+ * get (401, 403, 404, 411, 412, FAIL ...) is dropped silently.
+ */
+void Parser::relayMessage(Client* client, const IRCCommand& cmd, const char* command) {
     if (!client->isRegistered()) {
         return;
     }
     
-    if (cmd.params.size() < 2) {
-        if (cmd.params.empty()) {
-            sendError(client, IRC::ERR_NORECIPIENT, ":No recipient given (PRIVMSG)");
-        } else {
-            sendError(client, IRC::ERR_NOTEXTTOSEND, ":No text to send");
+    bool tagOnly = strcmp(command, "TAGMSG") == 0;
+    bool quiet = strcmp(command, "NOTICE") == 0;  // A NOTICE never gets an automatic reply
+    if (cmd.params.empty()) {
+        if (!quiet) {
+            sendError(client, IRC::ERR_NORECIPIENT, (std::string("No recipient given (") + command + ")").c_str());
+        }
+        return;
+    }
+    if (!tagOnly && cmd.params.size() < 2) {
+        if (!quiet) {
+            sendError(client, IRC::ERR_NOTEXTTOSEND, "No text to send");
         }
         return;
     }
     
-    std::string target = cmd.params[0];
-    std::string message = cmd.params[1];
+    std::vector<std::string> targets = Utils::split(cmd.params[0], ',');
+    if (targets.empty()) {
+        if (!quiet) {
+            sendError(client, IRC::ERR_NORECIPIENT, (std::string("No recipient given (") + command + ")").c_str());
+        }
+        return;
+    }
+    if (targets.size() > _server->getMaxTargets()) {
+        if (!quiet) {
+            sendError(client, IRC::ERR_TOOMANYTARGETS, cmd.params[0], "Too many recipients");
+        }
+        return;
+    }
     
+    // Shared by every target: ":nick!user@host COMMAND "
+    ScratchWriter head(Arena::active());
+    head.append(':');
+    client->appendPrefix(head);
+    head.append(' ').append(command).append(' ');
+    
+    static const std::string noText;
+    const std::string& text = tagOnly ? noText : cmd.params[1];
+    unsigned int textFlags = tagOnly ? 0 : TextScanner::classify(text);
+    if (quiet && _server->isUtf8Only() && (textFlags & TextScanner::TEXT_INVALID_UTF8)) {
+        return;  // Refused like a PRIVMSG, but without the FAIL reply
+    }
+    
+    // Filter and flood checks look at the text without formatting, once for
+    // all targets; each target then only checks its own scope and table
+    std::vector<size_t> filterRules;
+    unsigned int hash = 0;
+    bool senderFlooding = false;
+    if (!tagOnly) {
+        std::string plain;
+        const std::string* canonical = &text;
+        unsigned int hidden = textFlags & (TextScanner::TEXT_FORMATTING | TextScanner::TEXT_CONTROL);
+        if (hidden) {
+            plain = TextScanner::strip(text, hidden);
+            canonical = &plain;
+        }
+        _server->scanFilter(*canonical, filterRules);
+        hash = FloodGuard::hash(*canonical);
+        senderFlooding = _server->isFlooding(client, hash);
+    }
+    std::vector<const void*> delivered;  // Channels and clients already sent to
+    
+    for (size_t i = 0; i < targets.size(); ++i) {
+        const std::string& target = targets[i];
+        Channel* channel = NULL;
+        Client* targetClient = NULL;
+        if (!resolveTarget(client, target, channel, targetClient, !quiet)) {
+            continue;
+        }
+        const void* recipient = channel ? static_cast<const void*>(channel) : targetClient;
+        if (std::find(delivered.begin(), delivered.end(), recipient) != delivered.end()) {
+            continue;
+        }
+        delivered.push_back(recipient);
+        
+        // UTF8ONLY and +S may refuse the text or hand back a cleaned copy
+        std::string stripped;
+        const std::string* message = &text;
+        if (!tagOnly) {
+            message = checkText(client, command, channel, text, textFlags, stripped);
+            if (!message) {
+                return;  // Invalid UTF-8: the same for every target
+            }
+            if (message->empty()) {
+                if (!quiet) {
+                    sendError(client, IRC::ERR_NOTEXTTOSEND, "No text to send");
+                }
+                continue;
+            }
+            
+            if (!filterRules.empty() && _server->isFiltered(filterRules, channel ? target : "")) {
+                if (!quiet) {
+                    sendBlocked(client, channel, target, "Message blocked by content filter");
+                }
+                continue;
+            }
+            
+            if (senderFlooding || (channel && _server->isFlooding(channel, hash))) {
+                if (!quiet) {
+                    sendBlocked(client, channel, target, "Message suppressed (repeated text)");
+                }
+                continue;
+            }
+        }
+        
+        // One line per target; tagged variants are rendered from it on demand
+        ScratchWriter line(Arena::active(), head.length() + target.length() + message->length() + 4);
+        line.append(head.str()).append(target);
+        if (!tagOnly) {
+            line.append(" :", 2).append(*message);
+        }
+        line.append("\r\n", 2);
+        TaggedMessage tagged(line.str(), cmd.tags, tagOnly);
+        
+        if (channel) {
+            channel->broadcastMessage(tagged, client, client);  // Exclude sender, honor SILENCE
+        } else if (!targetClient->isSilencing(client)) {
+            // Silently dropped if the target ignores the sender
+            tagged.send(targetClient);
+        }
+        if (client->hasCap(Capabilities::CAP_ECHO_MESSAGE)) {
+            tagged.send(client);
+        }
+    }
+}
+
+/**
+ * @brief Tell a sender that a message was held back by a server policy
+ * @param client The sender
+ * @param channel The target channel, or NULL for a nickname target
+ * @param target The target as given
+ * @param reason Why the message was not delivered
+ *
+ * ERR_CANNOTSENDTOCHAN is about channels only, so a refused private
+ * message is reported with a server NOTICE instead.
+ */
+void Parser::sendBlocked(Client* client, Channel* channel, const std::string& target, const char* reason) {
+    if (channel) {
+        sendError(client, IRC::ERR_CANNOTSENDTOCHAN, target, reason);
+        return;
+    }
+    Utils::sendToClient(client, Utils::formatMessage(_server->getServerName(), "NOTICE",
+                                                     client->getNickname() + " :*** Message to " + target +
+                                                     " not sent: " + reason));
+}
+
+/**
+ * @brief Find the channel or client a message goes to
+ * @param client The sender
+ * @param target Channel name or nickname
+ * @param channel Set to the channel for a channel target
+ * @param targetClient Set to the client for a nickname target
+ * @param report Send an error reply when returning false (not for NOTICE)
+ * @return false if the target is unknown or the client may not speak there
+ */
+bool Parser::resolveTarget(Client* client, const std::string& target, Channel*& channel,
+                           Client*& targetClient, bool report) {
     if (target[0] == '#') {
         // Channel message
-        Channel* channel = _server->getChannel(target);
+        channel = _server->getChannel(target);
         if (!channel) {
-            sendError(client, IRC::ERR_NOSUCHCHANNEL, target + " :No such channel");
-            return;
+            if (report) {
+                sendError(client, IRC::ERR_NOSUCHCHANNEL, target, "No such channel");
+            }
+            return false;
         }
         
         if (!channel->hasClient(client)) {
-            sendError(client, IRC::ERR_CANNOTSENDTOCHAN, target + " :Cannot send to channel");
-            return;
+            if (report) {
+                sendError(client, IRC::ERR_CANNOTSENDTOCHAN, target, "Cannot send to channel");
+            }
+            return false;
         }
         
-        std::string privmsgMsg = Utils::formatMessage(client->getPrefix(), "PRIVMSG", target + " :" + message);
-        channel->broadcast(privmsgMsg, client);  // Exclude sender
+        // Banned members can stay but not speak (operators always can)
+        if (!channel->isOperator(client) && channel->isBanned(client)) {
+            if (report) {
+                sendError(client, IRC::ERR_CANNOTSENDTOCHAN, target, "Cannot send to channel (+b)");
+            }
+            return false;
+        }
     } else {
         // Private message to user
-        Client* targetClient = _server->getClientByNick(target);
+        targetClient = _server->getClientByNick(target);
         if (!targetClient) {
-            sendError(client, IRC::ERR_NOSUCHNICK, target + " :No such nick/channel");
-            return;
+            if (report) {
+                sendError(client, IRC::ERR_NOSUCHNICK, target, "No such nick/channel");
+            }
+            return false;
         }
-        
-        std::string privmsgMsg = Utils::formatMessage(client->getPrefix(), "PRIVMSG", target + " :" + message);
-        Utils::sendToClient(targetClient, privmsgMsg);
     }
+    return true;
+}
+
+/**
+ * @brief Apply the server's text policy to a message or topic
+ * @param client The client sending the text
+ * @param command "PRIVMSG" or "TOPIC" (for the FAIL reply)
+ * @param channel Target channel, or NULL
+ * @param text The text as received
+ * @param storage Holds the cleaned text if anything had to be removed
+ * @return The text to use (text or storage), or NULL if it was refused
+ *
+ * The text is classified in one pass (see TextScanner). Plain ASCII, the
+ * usual case, comes back unchanged without any copy:
+ * - with utf8_only, invalid UTF-8 is refused with FAIL ... INVALID_UTF8 and
+ *   control bytes other than formatting codes are removed
+ * - in a +S channel, formatting codes (colors, bold, ...) are removed
+ */
+const std::string* Parser::checkText(Client* client, const std::string& command, Channel* channel,
+                                     const std::string& text, std::string& storage) {
+    return checkText(client, command, channel, text, TextScanner::classify(text), storage);
+}
+
+/**
+ * @brief Same as checkText above, with the text already classified
+ * @param client The client sending the text
+ * @param command The command (for the FAIL reply)
+ * @param channel Target channel, or NULL
+ * @param text The text as received
+ * @param flags TextScanner::classify(text), shared by all targets of a message
+ * @param storage Holds the cleaned text if anything had to be removed
+ * @return The text to use (text or storage), or NULL if it was refused
+ */
+const std::string* Parser::checkText(Client* client, const std::string& command, Channel* channel,
+                                     const std::string& text, unsigned int flags, std::string& storage) {
+    if (flags == 0) {
+        return &text;
+    }
+    
+    unsigned int strip = 0;
+    if (_server->isUtf8Only()) {
+        if (flags & TextScanner::TEXT_INVALID_UTF8) {
+            Utils::sendToClient(client, Utils::formatMessage(_server->getServerName(), "FAIL",
+                                command + " INVALID_UTF8 :Message rejected, your client sent invalid UTF-8"));
+            return NULL;
+        }
+        strip |= flags & TextScanner::TEXT_CONTROL;
+    }
+    if (channel && channel->isStripColors()) {
+        strip |= flags & TextScanner::TEXT_FORMATTING;
+    }
+    if (strip == 0) {
+        return &text;
+    }
+    storage = TextScanner::strip(text, strip);
+    return &storage;
 }
 
 /**
@@ -406,7 +911,7 @@ void Parser::handleKick(Client* client, const IRCCommand& cmd) {
     }
     
     if (cmd.params.size() < 2) {
-        sendError(client, IRC::ERR_NEEDMOREPARAMS, "KICK :Not enough parameters");
+        sendError(client, IRC::ERR_NEEDMOREPARAMS, "KICK", "Not enough parameters");
         return;
     }
     
@@ -416,30 +921,30 @@ void Parser::handleKick(Client* client, const IRCCommand& cmd) {
     
     Channel* channel = _server->getChannel(channelName);
     if (!channel) {
-        sendError(client, IRC::ERR_NOSUCHCHANNEL, channelName + " :No such channel");
+        sendError(client, IRC::ERR_NOSUCHCHANNEL, channelName, "No such channel");
         return;
     }
     
     if (!channel->hasClient(client)) {
-        sendError(client, IRC::ERR_NOTONCHANNEL, channelName + " :You're not on that channel");
+        sendError(client, IRC::ERR_NOTONCHANNEL, channelName, "You're not on that channel");
         return;
     }
     
     if (!channel->isOperator(client)) {
-        sendError(client, IRC::ERR_CHANOPRIVSNEEDED, channelName + " :You're not channel operator");
+        sendError(client, IRC::ERR_CHANOPRIVSNEEDED, channelName, "You're not channel operator");
         return;
     }
     
     Client* targetClient = _server->getClientByNick(targetNick);
     if (!targetClient || !channel->hasClient(targetClient)) {
-        sendError(client, IRC::ERR_USERNOTINCHANNEL, targetNick + " " + channelName + " :They aren't on that channel");
+        sendError(client, IRC::ERR_USERNOTINCHANNEL, targetNick, channelName, "They aren't on that channel");
         return;
     }
     
     // Send KICK message to all channel members
     std::string kickMsg = Utils::formatMessage(client->getPrefix(), "KICK", 
                                              channelName + " " + targetNick + " :" + reason);
-    channel->broadcast(kickMsg);
+    channel->broadcast(kickMsg, NULL, NULL, client);
     
     channel->removeClient(targetClient);
 }
@@ -455,7 +960,7 @@ void Parser::handleInvite(Client* client, const IRCCommand& cmd) {
     }
     
     if (cmd.params.size() < 2) {
-        sendError(client, IRC::ERR_NEEDMOREPARAMS, "INVITE :Not enough parameters");
+        sendError(client, IRC::ERR_NEEDMOREPARAMS, "INVITE", "Not enough parameters");
         return;
     }
     
@@ -464,28 +969,28 @@ void Parser::handleInvite(Client* client, const IRCCommand& cmd) {
     
     Channel* channel = _server->getChannel(channelName);
     if (!channel) {
-        sendError(client, IRC::ERR_NOSUCHCHANNEL, channelName + " :No such channel");
+        sendError(client, IRC::ERR_NOSUCHCHANNEL, channelName, "No such channel");
         return;
     }
     
     if (!channel->hasClient(client)) {
-        sendError(client, IRC::ERR_NOTONCHANNEL, channelName + " :You're not on that channel");
+        sendError(client, IRC::ERR_NOTONCHANNEL, channelName, "You're not on that channel");
         return;
     }
     
     if (!channel->isOperator(client)) {
-        sendError(client, IRC::ERR_CHANOPRIVSNEEDED, channelName + " :You're not channel operator");
+        sendError(client, IRC::ERR_CHANOPRIVSNEEDED, channelName, "You're not channel operator");
         return;
     }
     
     Client* targetClient = _server->getClientByNick(targetNick);
     if (!targetClient) {
-        sendError(client, IRC::ERR_NOSUCHNICK, targetNick + " :No such nick/channel");
+        sendError(client, IRC::ERR_NOSUCHNICK, targetNick, "No such nick/channel");
         return;
     }
     
     if (channel->hasClient(targetClient)) {
-        sendError(client, IRC::ERR_USERONCHANNEL, targetNick + " " + channelName + " :is already on channel");
+        sendError(client, IRC::ERR_USERONCHANNEL, targetNick, channelName, "is already on channel");
         return;
     }
     
@@ -507,7 +1012,7 @@ void Parser::handleTopic(Client* client, const IRCCommand& cmd) {
     }
     
     if (cmd.params.empty()) {
-        sendError(client, IRC::ERR_NEEDMOREPARAMS, "TOPIC :Not enough parameters");
+        sendError(client, IRC::ERR_NEEDMOREPARAMS, "TOPIC", "Not enough parameters");
         return;
     }
     
@@ -515,12 +1020,12 @@ void Parser::handleTopic(Client* client, const IRCCommand& cmd) {
     
     Channel* channel = _server->getChannel(channelName);
     if (!channel) {
-        sendError(client, IRC::ERR_NOSUCHCHANNEL, channelName + " :No such channel");
+        sendError(client, IRC::ERR_NOSUCHCHANNEL, channelName, "No such channel");
         return;
     }
     
     if (!channel->hasClient(client)) {
-        sendError(client, IRC::ERR_NOTONCHANNEL, channelName + " :You're not on that channel");
+        sendError(client, IRC::ERR_NOTONCHANNEL, channelName, "You're not on that channel");
         return;
     }
     
@@ -537,16 +1042,43 @@ void Parser::handleTopic(Client* client, const IRCCommand& cmd) {
     } else {
         // Change topic
         if (channel->isTopicRestricted() && !channel->isOperator(client)) {
-            sendError(client, IRC::ERR_CHANOPRIVSNEEDED, channelName + " :You're not channel operator");
+            sendError(client, IRC::ERR_CHANOPRIVSNEEDED, channelName, "You're not channel operator");
             return;
         }
         
-        std::string newTopic = cmd.params[1];
+        std::string stripped;
+        const std::string* text = checkText(client, "TOPIC", channel, cmd.params[1], stripped);
+        if (!text) {
+            return;
+        }
+        std::string newTopic = *text;
         channel->setTopic(newTopic);
         
         // Broadcast topic change
         std::string topicMsg = Utils::formatMessage(client->getPrefix(), "TOPIC", channelName + " :" + newTopic);
-        channel->broadcast(topicMsg);
+        channel->broadcast(topicMsg, NULL, NULL, client);
+    }
+}
+
+/**
+ * @brief Append one applied mode change to the MODE echo
+ * @param letters Mode letters so far, with signs ("+k-i")
+ * @param params Parameters so far, each with a leading space
+ * @param sign The sign last written to letters (0 before the first change)
+ * @param adding true for '+', false for '-'
+ * @param mode The mode letter
+ * @param param Its parameter, or empty if it takes none
+ */
+static void addModeChange(std::string& letters, std::string& params, char& sign, bool adding, char mode,
+                          const std::string& param) {
+    char wanted = adding ? '+' : '-';
+    if (sign != wanted) {
+        letters += wanted;
+        sign = wanted;
+    }
+    letters += mode;
+    if (!param.empty()) {
+        params += " " + param;
     }
 }
 
@@ -561,7 +1093,7 @@ void Parser::handleMode(Client* client, const IRCCommand& cmd) {
     }
     
     if (cmd.params.empty()) {
-        sendError(client, IRC::ERR_NEEDMOREPARAMS, "MODE :Not enough parameters");
+        sendError(client, IRC::ERR_NEEDMOREPARAMS, "MODE", "Not enough parameters");
         return;
     }
     
@@ -571,12 +1103,12 @@ void Parser::handleMode(Client* client, const IRCCommand& cmd) {
         // Channel mode
         Channel* channel = _server->getChannel(target);
         if (!channel) {
-            sendError(client, IRC::ERR_NOSUCHCHANNEL, target + " :No such channel");
+            sendError(client, IRC::ERR_NOSUCHCHANNEL, target, "No such channel");
             return;
         }
         
         if (!channel->hasClient(client)) {
-            sendError(client, IRC::ERR_NOTONCHANNEL, target + " :You're not on that channel");
+            sendError(client, IRC::ERR_NOTONCHANNEL, target, "You're not on that channel");
             return;
         }
         
@@ -588,15 +1120,27 @@ void Parser::handleMode(Client* client, const IRCCommand& cmd) {
             return;
         }
         
+        // "MODE #chan b" (or +b, e, +e, I, +I) without a mask lists the entries; anyone may do that
+        std::string modeStr = cmd.params[1];
+        if (cmd.params.size() == 2 && !modeStr.empty()) {
+            std::string letters = modeStr[0] == '+' ? modeStr.substr(1) : modeStr;
+            if (letters.length() == 1 && channel->getMaskList(letters[0])) {
+                sendMaskList(client, channel, letters[0]);
+                return;
+            }
+        }
+        
         if (!channel->isOperator(client)) {
-            sendError(client, IRC::ERR_CHANOPRIVSNEEDED, target + " :You're not channel operator");
+            sendError(client, IRC::ERR_CHANOPRIVSNEEDED, target, "You're not channel operator");
             return;
         }
         
-        // Parse mode changes
-        std::string modeStr = cmd.params[1];
+        // Parse mode changes; the broadcast lists only what was applied, letters and parameters in order
         bool adding = true;
         size_t paramIndex = 2;
+        std::string applied;
+        std::string appliedParams;
+        char appliedSign = 0;
         
         for (size_t i = 0; i < modeStr.length(); ++i) {
             char mode = modeStr[i];
@@ -606,42 +1150,111 @@ void Parser::handleMode(Client* client, const IRCCommand& cmd) {
             } else if (mode == '-') {
                 adding = false;
             } else if (mode == 'i') {
-                channel->setInviteOnly(adding);
+                if (channel->isInviteOnly() != adding) {
+                    channel->setInviteOnly(adding);
+                    addModeChange(applied, appliedParams, appliedSign, adding, mode, "");
+                }
             } else if (mode == 't') {
-                channel->setTopicRestricted(adding);
+                if (channel->isTopicRestricted() != adding) {
+                    channel->setTopicRestricted(adding);
+                    addModeChange(applied, appliedParams, appliedSign, adding, mode, "");
+                }
+            } else if (mode == 'S') {
+                if (channel->isStripColors() != adding) {
+                    channel->setStripColors(adding);
+                    addModeChange(applied, appliedParams, appliedSign, adding, mode, "");
+                }
             } else if (mode == 'k') {
                 if (adding && paramIndex < cmd.params.size()) {
-                    channel->setKey(cmd.params[paramIndex++]);
-                } else if (!adding) {
+                    const std::string& key = cmd.params[paramIndex++];
+                    if (!key.empty()) {
+                        channel->setKey(key);
+                        addModeChange(applied, appliedParams, appliedSign, adding, mode, key);
+                    }
+                } else if (!adding && channel->hasKey()) {
                     channel->removeKey();
+                    addModeChange(applied, appliedParams, appliedSign, adding, mode, "");
                 }
             } else if (mode == 'l') {
                 if (adding && paramIndex < cmd.params.size()) {
                     int limit;
                     if (Utils::stringToInt(cmd.params[paramIndex++], limit) && limit > 0) {
                         channel->setUserLimit(static_cast<size_t>(limit));
+                        addModeChange(applied, appliedParams, appliedSign, adding, mode, Utils::intToString(limit));
                     }
-                } else if (!adding) {
+                } else if (!adding && channel->getUserLimit() > 0) {
                     channel->removeUserLimit();
+                    addModeChange(applied, appliedParams, appliedSign, adding, mode, "");
+                }
+            } else if (mode == 'b' || mode == 'e' || mode == 'I') {
+                MaskMatcher* list = channel->getMaskList(mode);
+                if (paramIndex < cmd.params.size()) {
+                    std::string mask = MaskMatcher::normalize(cmd.params[paramIndex++]);
+                    if (adding && list->size() >= MaskMatcher::MAX_ENTRIES) {
+                        sendError(client, IRC::ERR_BANLISTFULL, target + " " + mask, "Channel list is full");
+                    } else if (adding ? list->add(mask, client->getNickname()) : list->remove(mask)) {
+                        addModeChange(applied, appliedParams, appliedSign, adding, mode, mask);
+                    }
+                } else {
+                    sendMaskList(client, channel, mode);
                 }
             } else if (mode == 'o') {
                 if (paramIndex < cmd.params.size()) {
                     Client* targetClient = _server->getClientByNick(cmd.params[paramIndex++]);
-                    if (targetClient && channel->hasClient(targetClient)) {
+                    if (targetClient && channel->hasClient(targetClient) &&
+                        channel->isOperator(targetClient) != adding) {
                         if (adding) {
                             channel->addOperator(targetClient);
                         } else {
                             channel->removeOperator(targetClient);
                         }
+                        addModeChange(applied, appliedParams, appliedSign, adding, mode, targetClient->getNickname());
                     }
                 }
             }
         }
         
+        if (applied.empty()) {
+            return;
+        }
+        
         // Broadcast mode change
-        std::string modeMsg = Utils::formatMessage(client->getPrefix(), "MODE", target + " " + modeStr);
-        channel->broadcast(modeMsg);
+        std::string modeMsg = Utils::formatMessage(client->getPrefix(), "MODE", target + " " + applied + appliedParams);
+        channel->broadcast(modeMsg, NULL, NULL, client);
+    }
+}
+
+/**
+ * @brief Send the entries of a channel mask list
+ * @param client The client asking
+ * @param channel The channel
+ * @param mode 'b', 'e' or 'I'
+ */
+void Parser::sendMaskList(Client* client, Channel* channel, char mode) {
+    int entryCode = IRC::RPL_BANLIST;
+    int endCode = IRC::RPL_ENDOFBANLIST;
+    std::string endText = " :End of channel ban list";
+    if (mode == 'e') {
+        entryCode = IRC::RPL_EXCEPTLIST;
+        endCode = IRC::RPL_ENDOFEXCEPTLIST;
+        endText = " :End of channel exception list";
+    } else if (mode == 'I') {
+        entryCode = IRC::RPL_INVITELIST;
+        endCode = IRC::RPL_ENDOFINVITELIST;
+        endText = " :End of channel invite exception list";
     }
+    
+    const std::vector<MaskEntry>& entries = channel->getMaskList(mode)->getEntries();
+    for (size_t i = 0; i < entries.size(); ++i) {
+        std::string entryMsg = Utils::formatReply(_server->getServerName(), entryCode, client->getNickname(),
+                                                channel->getName() + " " + entries[i].mask + " " + entries[i].setBy +
+                                                " " + Utils::intToString(static_cast<int>(entries[i].setAt)));
+        Utils::sendToClient(client, entryMsg);
+    }
+    
+    std::string endMsg = Utils::formatReply(_server->getServerName(), endCode, client->getNickname(),
+                                          channel->getName() + endText);
+    Utils::sendToClient(client, endMsg);
 }
 
 /**
@@ -652,82 +1265,707 @@ void Parser::handleMode(Client* client, const IRCCommand& cmd) {
 void Parser::handleQuit(Client* client, const IRCCommand& cmd) {
     std::string reason = cmd.params.empty() ? "Client Quit" : cmd.params[0];
     
-    // Broadcast quit message to all channels the client is in
-    // This will be handled by the server when removing the client
-    _server->removeClient(client);
+    // The server sends one QUIT to everyone sharing a channel with the client
+    _server->removeClient(client, reason);
 }
 
 /**
- * @brief Send welcome messages to a newly registered client
- * @param client The client to welcome
+ * @brief Handle STATS command (server statistics)
+ * @param client The client
+ * @param cmd The command
+ * 
+ * STATS m reports memory usage (intern pool sharing, etc.).
  */
-void Parser::sendWelcome(Client* client) {
-    if (client->isWelcomeSent()) {
+void Parser::handleStats(Client* client, const IRCCommand& cmd) {
+    if (!client->isRegistered()) {
+        return;
+    }
+    
+    char query = (cmd.params.empty() || cmd.params[0].empty()) ? 'm' : cmd.params[0][0];
+    
+    std::vector<std::string> lines;
+    _server->collectStats(query, lines);
+    
+    for (size_t i = 0; i < lines.size(); ++i) {
+        std::string statsMsg = Utils::formatReply(_server->getServerName(), IRC::RPL_STATSDEBUG, client->getNickname(),
+                                                ":" + lines[i]);
+        Utils::sendToClient(client, statsMsg);
+    }
+    
+    std::string endMsg = Utils::formatReply(_server->getServerName(), IRC::RPL_ENDOFSTATS, client->getNickname(),
+                                          std::string(1, query) + " :End of STATS report");
+    Utils::sendToClient(client, endMsg);
+}
+
+/**
+ * @brief Handle MIGRATE command (move a client to another I/O thread)
+ * @param client The client
+ * @param cmd The command
+ * 
+ * MIGRATE <nick> <thread> <password> - the password is admin_password from
+ * the config; without one the command is refused for everybody. After a
+ * wrong password the client's address waits before the next is checked. The move
+ * itself finishes a moment later, once the I/O threads have handed the
+ * socket over (STATS m counts it).
+ */
+void Parser::handleMigrate(Client* client, const IRCCommand& cmd) {
+    if (!client->isRegistered()) {
+        return;
+    }
+    
+    if (cmd.params.size() < 3) {
+        sendError(client, IRC::ERR_NEEDMOREPARAMS, "MIGRATE", "Not enough parameters");
+        return;
+    }
+    
+    time_t wait = _server->adminRetryIn(client);
+    if (wait > 0) {
+        std::string text = "Permission Denied- Too many wrong passwords, try again in " +
+                           Utils::intToString(static_cast<int>(wait)) + "s";
+        sendError(client, IRC::ERR_NOPRIVILEGES, text.c_str());
+        return;
+    }
+    if (!_server->checkAdminPassword(client, cmd.params[2])) {
+        sendError(client, IRC::ERR_NOPRIVILEGES, "Permission Denied- You do not have the correct password");
+        return;
+    }
+    
+    Client* target = _server->getClientByNick(cmd.params[0]);
+    if (!target) {
+        sendError(client, IRC::ERR_NOSUCHNICK, cmd.params[0], "No such nick/channel");
+        return;
+    }
+    
+    int thread;
+    std::string result;
+    if (!Utils::stringToInt(cmd.params[1], thread) || thread < 0 ||
+        !_server->migrateClient(target, static_cast<size_t>(thread))) {
+        result = "Cannot move " + target->getNickname() + " to I/O thread " + cmd.params[1];
+    } else {
+        result = "Moving " + target->getNickname() + " to I/O thread " + cmd.params[1];
+    }
+    Utils::sendToClient(client, Utils::formatMessage(_server->getServerName(), "NOTICE",
+                                                     client->getNickname() + " :" + result));
+}
+
+/**
+ * @brief Handle SILENCE command (server-side ignore list)
+ * @param client The client
+ * @param cmd The command
+ * 
+ * SILENCE           - list the masks
+ * SILENCE +mask     - ignore PRIVMSGs from senders matching mask
+ * SILENCE -mask     - stop ignoring them
+ */
+void Parser::handleSilence(Client* client, const IRCCommand& cmd) {
+    if (!client->isRegistered()) {
+        return;
+    }
+    
+    if (cmd.params.empty()) {
+        const SilenceList* list = client->getSilence();
+        if (list) {
+            const std::vector<MaskEntry>& entries = list->getEntries();
+            for (size_t i = 0; i < entries.size(); ++i) {
+                std::string entryMsg = Utils::formatReply(_server->getServerName(), IRC::RPL_SILELIST,
+                                                        client->getNickname(),
+                                                        client->getNickname() + " " + entries[i].mask);
+                Utils::sendToClient(client, entryMsg);
+            }
+        }
+        std::string endMsg = Utils::formatReply(_server->getServerName(), IRC::RPL_ENDOFSILELIST,
+                                              client->getNickname(), ":End of Silence List");
+        Utils::sendToClient(client, endMsg);
+        return;
+    }
+    
+    std::string param = cmd.params[0];
+    bool adding = param[0] != '-';
+    if (param[0] == '+' || param[0] == '-') {
+        param = param.substr(1);
+    }
+    if (param.empty()) {
+        sendError(client, IRC::ERR_NEEDMOREPARAMS, "SILENCE", "Not enough parameters");
+        return;
+    }
+    std::string mask = MaskMatcher::normalize(param);
+    
+    bool changed;
+    if (adding) {
+        if (client->getSilence() && client->getSilence()->size() >= SilenceList::MAX_ENTRIES) {
+            sendError(client, IRC::ERR_SILELISTFULL, mask, "Your silence list is full");
+            return;
+        }
+        changed = client->silence().add(mask);
+    } else {
+        changed = client->getSilence() && client->silence().remove(mask);
+        client->dropSilenceIfEmpty();
+    }
+    if (changed) {
+        refreshMemberships(client);
+    }
+    
+    // Confirm the change like other servers do
+    if (changed) {
+        std::string confirmMsg = Utils::formatMessage(client->getPrefix(), "SILENCE",
+                                                    std::string(adding ? "+" : "-") + mask);
+        Utils::sendToClient(client, confirmMsg);
+    }
+}
+
+/**
+ * @brief Handle WHO command (list users matching a mask or in a channel)
+ * @param client The client
+ * @param cmd The command
+ * 
+ * WHO #channel lists the channel's members. WHO mask lists the clients
+ * whose nickname, username or hostname matches the mask; the search goes
+ * through the server's client index instead of every client. The rows are
+ * queued and rendered a chunk at a time as the client's output drains; at
+ * most who_limit of them, then ERR_TOOMANYMATCHES says the reply is cut.
+ */
+void Parser::handleWho(Client* client, const IRCCommand& cmd) {
+    if (!client->isRegistered()) {
         return;
     }
     
-    std::string nick = client->getNickname();
+    std::string mask = (cmd.params.empty() || cmd.params[0].empty() || cmd.params[0] == "0") ? "*" : cmd.params[0];
+    
+    std::vector<Client*> results;
+    PendingReply row;
+    row.kind = PendingReply::WHO_ROW;
+    if (mask[0] == '#') {
+        Channel* channel = _server->getChannel(mask);
+        if (channel) {
+            results = channel->getClients();
+            row.channel = channel->getName();
+        }
+    } else {
+        _server->findClients(mask, results);
+        row.channel = "*";
+    }
+    
+    // Rows name the client by handle, so a nick change in the meantime doesn't lose the row
+    size_t rows = 0;
+    bool truncated = false;
+    for (size_t i = 0; i < results.size() && !truncated; ++i) {
+        if (!results[i]->isRegistered()) {
+            continue;
+        }
+        row.handle = results[i]->getHandle();
+        truncated = rows == _server->getWhoLimit() || !_server->queueReply(client, row);
+        rows++;
+    }
+    if (truncated) {
+        PendingReply tooMany;
+        tooMany.line = Utils::formatReply(_server->getServerName(), IRC::ERR_TOOMANYMATCHES, client->getNickname(),
+                                          "WHO :Too many lines in the output, restrict your query");
+        _server->queueReply(client, tooMany);
+    }
+    
+    PendingReply end;
+    end.line = Utils::formatReply(_server->getServerName(), IRC::RPL_ENDOFWHO, client->getNickname(),
+                                  mask + " :End of WHO list");
+    _server->queueReply(client, end);
+}
+
+/**
+ * @brief Send one WHO row
+ * @param client The client asking
+ * @param about The client described by the row
+ * @param channel Channel the row is for ("*" if none)
+ */
+void Parser::sendWhoReply(Client* client, Client* about, const std::string& channel) {
+    StringRef flags("H", 1);  // Here (there is no away status)
+    if (channel != "*") {
+        Channel* chan = _server->getChannel(channel);
+        if (chan && chan->isOperator(about)) {
+            flags = StringRef("H@", 2);
+        }
+    }
+    
+    ReplyWriter(client, _server->getServerName(), IRC::RPL_WHOREPLY)
+        .param(channel).param(about->getUsername()).param(about->getHostname())
+        .param(_server->getServerName()).param(about->getNicknameRef()).param(flags)
+        .trailing("0 ").text(about->getRealname()).send();
+}
+
+/**
+ * @brief Handle WHOIS command (details about one user)
+ * @param client The client
+ * @param cmd The command
+ */
+void Parser::handleWhois(Client* client, const IRCCommand& cmd) {
+    if (!client->isRegistered()) {
+        return;
+    }
+    
+    if (cmd.params.empty()) {
+        sendError(client, IRC::ERR_NONICKNAMEGIVEN, "No nickname given");
+        return;
+    }
+    
+    // WHOIS [server] nickname
+    std::string nick = cmd.params.size() > 1 ? cmd.params[1] : cmd.params[0];
     std::string serverName = _server->getServerName();
     
-    // Send welcome sequence
-    std::string welcome = Utils::formatReply(serverName, IRC::RPL_WELCOME, nick, 
-                                           ":Welcome to the Internet Relay Network " + client->getPrefix());
-    Utils::sendToClient(client, welcome);
+    Client* target = _server->getClientByNick(nick);
+    if (!target || !target->isRegistered()) {
+        sendError(client, IRC::ERR_NOSUCHNICK, nick, "No such nick/channel");
+    } else {
+        std::string userMsg = Utils::formatReply(serverName, IRC::RPL_WHOISUSER, client->getNickname(),
+                                               nick + " " + target->getUsername() + " " + target->getHostname() +
+                                               " * :" + target->getRealname());
+        Utils::sendToClient(client, userMsg);
+        
+        const std::vector<Channel*>& channels = target->getChannels();
+        if (!channels.empty()) {
+            std::string list;
+            for (size_t i = 0; i < channels.size(); ++i) {
+                if (i > 0) list += " ";
+                if (channels[i]->isOperator(target)) list += "@";
+                list += channels[i]->getName();
+            }
+            std::string channelsMsg = Utils::formatReply(serverName, IRC::RPL_WHOISCHANNELS, client->getNickname(),
+                                                       nick + " :" + list);
+            Utils::sendToClient(client, channelsMsg);
+        }
+        
+        std::string serverMsg = Utils::formatReply(serverName, IRC::RPL_WHOISSERVER, client->getNickname(),
+                                                 nick + " " + serverName + " :ft_irc server");
+        Utils::sendToClient(client, serverMsg);
+    }
+    
+    std::string endMsg = Utils::formatReply(serverName, IRC::RPL_ENDOFWHOIS, client->getNickname(),
+                                          nick + " :End of WHOIS list");
+    Utils::sendToClient(client, endMsg);
+}
+
+/**
+ * @brief Handle USERHOST command (user@host of up to 5 nicknames)
+ * @param client The client
+ * @param cmd The command
+ */
+void Parser::handleUserhost(Client* client, const IRCCommand& cmd) {
+    if (!client->isRegistered()) {
+        return;
+    }
     
-    std::string yourhost = Utils::formatReply(serverName, IRC::RPL_YOURHOST, nick,
-                                            ":Your host is " + serverName + ", running version 1.0");
-    Utils::sendToClient(client, yourhost);
+    if (cmd.params.empty()) {
+        sendError(client, IRC::ERR_NEEDMOREPARAMS, "USERHOST", "Not enough parameters");
+        return;
+    }
     
-    std::string created = Utils::formatReply(serverName, IRC::RPL_CREATED, nick,
-                                           ":This server was created " + _server->getCreationTime());
-    Utils::sendToClient(client, created);
+    std::string list;
+    for (size_t i = 0; i < cmd.params.size() && i < 5; ++i) {
+        Client* target = _server->getClientByNick(cmd.params[i]);
+        if (target && target->isRegistered()) {
+            if (!list.empty()) list += " ";
+            list += target->getNickname() + "=+" + target->getUsername() + "@" + target->getHostname();
+        }
+    }
     
-    std::string myinfo = Utils::formatReply(serverName, IRC::RPL_MYINFO, nick,
-                                          serverName + " 1.0 o itklno");
-    Utils::sendToClient(client, myinfo);
+    std::string userhostMsg = Utils::formatReply(_server->getServerName(), IRC::RPL_USERHOST, client->getNickname(),
+                                               ":" + list);
+    Utils::sendToClient(client, userhostMsg);
+}
+
+/**
+ * @brief Handle LIST command (list channels, with ELIST filters)
+ * @param client The client
+ * @param cmd The command
+ * 
+ * Every parameter is a comma-separated list of conditions, all of which
+ * must hold:
+ *   #chan, #a*     - name matches one of the masks (M)
+ *   !*mask*        - name matches none of these masks (N)
+ *   >n, <n         - more than / fewer than n members (U)
+ *   T<n, T>n       - topic set less / more than n minutes ago (T)
+ * 
+ * The member count range is answered by the server's channel index, so
+ * only channels inside it are visited. Nothing is collected up front: the
+ * LIST is queued as one entry whose cursor walks the index a row at a time
+ * as the client's output drains.
+ */
+void Parser::handleList(Client* client, const IRCCommand& cmd) {
+    if (!client->isRegistered()) {
+        return;
+    }
     
-    // Send command help manual
-    std::string manual1 = ":" + serverName + " NOTICE " + nick + " :Available Commands:";
-    Utils::sendToClient(client, manual1);
+    ListQuery query;
+    time_t now = time(NULL);
+    std::vector<std::string> masks;
+    
+    for (size_t p = 0; p < cmd.params.size(); ++p) {
+        std::vector<std::string> conditions = Utils::split(cmd.params[p], ',');
+        for (size_t i = 0; i < conditions.size(); ++i) {
+            const std::string& condition = conditions[i];
+            int value = 0;
+            if (condition.empty()) {
+                continue;
+            } else if ((condition[0] == '<' || condition[0] == '>') &&
+                       Utils::stringToInt(condition.substr(1), value) && value >= 0) {
+                if (condition[0] == '>') {
+                    query.minMembers = std::max(query.minMembers, static_cast<size_t>(value) + 1);
+                } else if (value == 0) {
+                    query.minMembers = 1;  // Nothing has fewer than 0 members
+                    query.maxMembers = 0;
+                } else {
+                    query.maxMembers = std::min(query.maxMembers, static_cast<size_t>(value) - 1);
+                }
+            } else if ((condition[0] == 'T' || condition[0] == 't') && condition.length() > 2 &&
+                       (condition[1] == '<' || condition[1] == '>') &&
+                       Utils::stringToInt(condition.substr(2), value) && value >= 0) {
+                if (condition[1] == '<') {
+                    query.topicAfter = now - static_cast<time_t>(value) * 60;
+                } else {
+                    query.topicBefore = now - static_cast<time_t>(value) * 60;
+                }
+            } else if (condition[0] == '!') {
+                query.excluded.push_back(MaskMatcher::fold(condition.substr(1)));
+            } else {
+                masks.push_back(condition);
+                query.masks.push_back(MaskMatcher::fold(condition));
+            }
+        }
+    }
     
-    std::string manual2 = ":" + serverName + " NOTICE " + nick + " :JOIN #channel - Join a channel";
-    Utils::sendToClient(client, manual2);
+    // Queued like the rows, so it can't overtake the tail of an earlier LIST
+    PendingReply start;
+    start.line = Utils::formatReply(_server->getServerName(), IRC::RPL_LISTSTART, client->getNickname(),
+                                    "Channel :Users  Name");
+    _server->queueReply(client, start);
+    
+    // Plain channel names are looked up directly; any wildcard mask needs a walk over the index
+    bool literalOnly = !masks.empty();
+    for (size_t i = 0; i < masks.size(); ++i) {
+        if (masks[i].find_first_of("*?") != std::string::npos) {
+            literalOnly = false;
+        }
+    }
+    if (literalOnly) {
+        std::vector<Channel*> listed;
+        PendingReply row;
+        row.kind = PendingReply::LIST_ROW;
+        for (size_t i = 0; i < masks.size(); ++i) {
+            Channel* channel = _server->getChannel(masks[i]);
+            if (channel && std::find(listed.begin(), listed.end(), channel) == listed.end() &&
+                listMatches(query, channel)) {
+                listed.push_back(channel);
+                row.name = channel->getName();
+                _server->queueReply(client, row);
+            }
+        }
+    } else {
+        PendingReply scan;
+        scan.kind = PendingReply::LIST_SCAN;
+        scan.list = query;
+        _server->queueReply(client, scan);
+    }
     
-    std::string manual3 = ":" + serverName + " NOTICE " + nick + " :PART #channel - Leave a channel";
-    Utils::sendToClient(client, manual3);
+    PendingReply end;
+    end.line = Utils::formatReply(_server->getServerName(), IRC::RPL_LISTEND, client->getNickname(),
+                                  ":End of /LIST");
+    _server->queueReply(client, end);
+}
+
+/**
+ * @brief Check a channel against the filters of a LIST
+ * @param query The filters
+ * @param channel The channel
+ * @return true if the channel belongs in the reply
+ */
+bool Parser::listMatches(const ListQuery& query, Channel* channel) const {
+    size_t members = channel->getClientCount();
+    if (members < query.minMembers || members > query.maxMembers) {
+        return false;
+    }
+    if (query.topicAfter && channel->getTopicTime() < query.topicAfter) {
+        return false;
+    }
+    if (query.topicBefore && (channel->getTopicTime() == 0 || channel->getTopicTime() > query.topicBefore)) {
+        return false;
+    }
     
-    std::string manual4 = ":" + serverName + " NOTICE " + nick + " :PRIVMSG #channel :message - Send message to channel";
-    Utils::sendToClient(client, manual4);
+    std::string name = MaskMatcher::fold(channel->getName());
+    bool matched = query.masks.empty();
+    for (size_t m = 0; m < query.masks.size() && !matched; ++m) {
+        matched = MaskMatcher::globMatch(query.masks[m].data(), query.masks[m].length(), name.data(), name.length());
+    }
+    for (size_t m = 0; m < query.excluded.size() && matched; ++m) {
+        matched = !MaskMatcher::globMatch(query.excluded[m].data(), query.excluded[m].length(),
+                                          name.data(), name.length());
+    }
+    return matched;
+}
+
+/**
+ * @brief Send the next row of a LIST that walks the channel index
+ * @param client The client asking
+ * @param query The LIST; its cursor is moved on
+ * @return false once the walk is over
+ *
+ * Looks at up to LIST_SCAN_STEP channels, so a filter that matches few of
+ * them doesn't stall the tick either.
+ */
+bool Parser::sendNextListRow(Client* client, ListQuery& query) {
+    for (size_t visited = 0; visited < LIST_SCAN_STEP; ++visited) {
+        Channel* channel = _server->nextChannel(query.minMembers, query.maxMembers, query.cursor);
+        if (!channel) {
+            return false;
+        }
+        if (listMatches(query, channel)) {
+            sendListReply(client, channel);
+            return true;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Send one LIST row
+ * @param client The client asking
+ * @param channel The channel described by the row
+ */
+void Parser::sendListReply(Client* client, Channel* channel) {
+    ReplyWriter(client, _server->getServerName(), IRC::RPL_LIST)
+        .param(channel->getName()).param(channel->getClientCount()).trailing(channel->getTopic()).send();
+}
+
+/**
+ * @brief Handle MONITOR command (presence notifications, IRCv3)
+ * @param client The client
+ * @param cmd The command
+ * 
+ * MONITOR + nick,nick  - watch nicknames (replies with their current status)
+ * MONITOR - nick,nick  - stop watching
+ * MONITOR C            - clear the list
+ * MONITOR L            - show the list
+ * MONITOR S            - show the status of every watched nickname
+ */
+void Parser::handleMonitor(Client* client, const IRCCommand& cmd) {
+    if (!client->isRegistered()) {
+        return;
+    }
     
-    std::string manual5 = ":" + serverName + " NOTICE " + nick + " :PRIVMSG nickname :message - Send private message";
-    Utils::sendToClient(client, manual5);
+    if (cmd.params.empty() || cmd.params[0].empty()) {
+        sendError(client, IRC::ERR_NEEDMOREPARAMS, "MONITOR", "Not enough parameters");
+        return;
+    }
     
-    std::string manual6 = ":" + serverName + " NOTICE " + nick + " :TOPIC #channel :topic - Set channel topic (ops only)";
-    Utils::sendToClient(client, manual6);
+    MonitorIndex& monitors = _server->getMonitors();
+    char action = cmd.params[0][0];
+    std::vector<std::string> targets;
     
-    std::string manual7 = ":" + serverName + " NOTICE " + nick + " :KICK #channel nickname - Kick user (ops only)";
-    Utils::sendToClient(client, manual7);
+    if (action == '+' || action == '-') {
+        if (cmd.params.size() < 2) {
+            sendError(client, IRC::ERR_NEEDMOREPARAMS, "MONITOR", "Not enough parameters");
+            return;
+        }
+        targets = Utils::split(cmd.params[1], ',');
+    }
     
-    std::string manual8 = ":" + serverName + " NOTICE " + nick + " :INVITE nickname #channel - Invite user (ops only)";
-    Utils::sendToClient(client, manual8);
+    if (action == '+') {
+        std::vector<std::string> added;
+        for (size_t i = 0; i < targets.size(); ++i) {
+            if (targets[i].empty()) {
+                continue;
+            }
+            if (monitors.getTargets(client).size() >= _server->getMonitorLimit()) {
+                // Report everything not added yet
+                std::string rest;
+                for (size_t j = i; j < targets.size(); ++j) {
+                    if (!rest.empty()) rest += ",";
+                    rest += targets[j];
+                }
+                ReplyWriter(client, _server->getServerName(), IRC::ERR_MONLISTFULL)
+                    .param(_server->getMonitorLimit()).param(rest).trailing("Monitor list is full").send();
+                break;
+            }
+            monitors.add(client, targets[i]);
+            added.push_back(targets[i]);
+        }
+        sendMonitorStatus(client, added);
+    } else if (action == '-') {
+        for (size_t i = 0; i < targets.size(); ++i) {
+            monitors.remove(client, targets[i]);
+        }
+    } else if (action == 'C' || action == 'c') {
+        monitors.clear(client);
+    } else if (action == 'L' || action == 'l') {
+        const std::vector<std::string>& list = monitors.getTargets(client);
+        for (size_t i = 0; i < list.size(); ++i) {
+            std::string listMsg = Utils::formatReply(_server->getServerName(), IRC::RPL_MONLIST, client->getNickname(),
+                                                   ":" + list[i]);
+            Utils::sendToClient(client, listMsg);
+        }
+        std::string endMsg = Utils::formatReply(_server->getServerName(), IRC::RPL_ENDOFMONLIST, client->getNickname(),
+                                              ":End of MONITOR list");
+        Utils::sendToClient(client, endMsg);
+    } else if (action == 'S' || action == 's') {
+        std::vector<std::string> list = monitors.getTargets(client);
+        sendMonitorStatus(client, list);
+    }
+}
+
+/**
+ * @brief Send RPL_MONONLINE/RPL_MONOFFLINE for a list of nicknames
+ * @param client The client asking
+ * @param nicks The nicknames
+ */
+void Parser::sendMonitorStatus(Client* client, const std::vector<std::string>& nicks) {
+    std::string online;
+    std::string offline;
+    for (size_t i = 0; i < nicks.size(); ++i) {
+        Client* target = _server->findOnline(nicks[i]);
+        if (target) {
+            if (!online.empty()) online += ",";
+            online += target->getPrefix();
+        } else {
+            if (!offline.empty()) offline += ",";
+            offline += nicks[i];
+        }
+    }
     
-    std::string manual9 = ":" + serverName + " NOTICE " + nick + " :MODE #channel +/-itklno - Set channel modes (ops only)";
-    Utils::sendToClient(client, manual9);
+    if (!online.empty()) {
+        Utils::sendToClient(client, Utils::formatReply(_server->getServerName(), IRC::RPL_MONONLINE,
+                                                     client->getNickname(), ":" + online));
+    }
+    if (!offline.empty()) {
+        Utils::sendToClient(client, Utils::formatReply(_server->getServerName(), IRC::RPL_MONOFFLINE,
+                                                     client->getNickname(), ":" + offline));
+    }
+}
+
+/**
+ * @brief Send the registration burst
+ * @param client The newly registered client
+ * 
+ * The lines are the same for everyone apart from the nickname, so they were
+ * rendered once (buildWelcome) and are copied into the client's output
+ * queue in one go, followed by the MOTD.
+ */
+void Parser::sendWelcome(Client* client) {
+    if (client->isWelcomeSent()) {
+        return;
+    }
     
-    std::string manual10 = ":" + serverName + " NOTICE " + nick + " :QUIT - Disconnect from server";
-    Utils::sendToClient(client, manual10);
+    _welcome.emit(client);
+    sendMotd(client);
     
     client->setWelcomeSent(true);
 }
 
+/**
+ * @brief Send the message of the day
+ * @param client The client
+ */
+void Parser::sendMotd(Client* client) {
+    if (!_server->getMotd().send(client)) {
+        sendError(client, IRC::ERR_NOMOTD, "MOTD File is missing");
+    }
+}
+
+/**
+ * @brief Handle MOTD command (show the message of the day again)
+ * @param client The client
+ * @param cmd The command
+ */
+void Parser::handleMotd(Client* client, const IRCCommand& cmd) {
+    (void)cmd;
+    if (!client->isRegistered()) {
+        return;
+    }
+    sendMotd(client);
+}
+
+/**
+ * @brief Get the pre-rendered registration burst (for STATS m)
+ * @return Reference to the template
+ */
+const ReplyTemplate& Parser::getWelcome() const {
+    return _welcome;
+}
+
+/**
+ * @brief Render the registration burst into _welcome
+ * 
+ * Everything here is fixed once the server is configured: the server
+ * name, creation time and the settings advertised in RPL_ISUPPORT.
+ */
+void Parser::buildWelcome() {
+    const std::string& serverName = _server->getServerName();
+    std::string maxTargets = Utils::intToString(static_cast<int>(_server->getMaxTargets()));
+    
+    _welcome.clear();
+    _welcome.addText(":" + serverName + " 001 ");
+    _welcome.addSlot(ReplyTemplate::SLOT_NICK);
+    _welcome.addText(" :Welcome to the Internet Relay Network ");
+    _welcome.addSlot(ReplyTemplate::SLOT_PREFIX);
+    _welcome.addText("\r\n");
+    
+    _welcome.addNumeric(serverName, IRC::RPL_YOURHOST, ":Your host is " + serverName + ", running version 1.0");
+    _welcome.addNumeric(serverName, IRC::RPL_CREATED, ":This server was created " + _server->getCreationTime());
+    _welcome.addNumeric(serverName, IRC::RPL_MYINFO, serverName + " 1.0 o beIiklnoSt");
+    _welcome.addNumeric(serverName, IRC::RPL_ISUPPORT,
+                        "CHANTYPES=# PREFIX=(o)@ CHANMODES=beI,k,l,itS MAXLIST=beI:" +
+                        Utils::intToString(static_cast<int>(MaskMatcher::MAX_ENTRIES)) + " SAFELIST ELIST=MNTU NICKLEN=" +
+                        Utils::intToString(static_cast<int>(IRC::NICKLEN)) +
+                        " MONITOR=" + Utils::intToString(static_cast<int>(_server->getMonitorLimit())) +
+                        " SILENCE=" + Utils::intToString(static_cast<int>(SilenceList::MAX_ENTRIES)) +
+                        " TARGMAX=PRIVMSG:" + maxTargets + ",NOTICE:" + maxTargets + ",TAGMSG:" + maxTargets + ",JOIN:,PART:" +
+                        " CHANLIMIT=#:" + Utils::intToString(static_cast<int>(_server->getChannelLimit())) +
+                        (_server->isUtf8Only() ? " UTF8ONLY" : "") +
+                        " :are supported by this server");
+    
+    // Command help manual
+    _welcome.addNotice(serverName, "Available Commands:");
+    _welcome.addNotice(serverName, "JOIN #channel - Join a channel");
+    _welcome.addNotice(serverName, "PART #channel - Leave a channel");
+    _welcome.addNotice(serverName, "PRIVMSG #channel :message - Send message to channel");
+    _welcome.addNotice(serverName, "PRIVMSG nickname :message - Send private message");
+    _welcome.addNotice(serverName, "PRIVMSG #a,#b,nick :message - Send to several targets at once");
+    _welcome.addNotice(serverName, "TOPIC #channel :topic - Set channel topic (ops only)");
+    _welcome.addNotice(serverName, "KICK #channel nickname - Kick user (ops only)");
+    _welcome.addNotice(serverName, "INVITE nickname #channel - Invite user (ops only)");
+    _welcome.addNotice(serverName, "MODE #channel +/-itklno - Set channel modes (ops only)");
+    _welcome.addNotice(serverName, "QUIT - Disconnect from server");
+    _welcome.addNotice(serverName, "STATS m - Show server memory statistics");
+}
+
 /**
  * @brief Send an error message to a client
  * @param client The client
  * @param errorCode The numeric error code
- * @param message The error message
+ * @param text The error message (trailing parameter)
+ * 
+ * Errors are written straight into the client's output queue (ReplyWriter),
+ * so the common "bad command" replies allocate nothing.
+ */
+void Parser::sendError(Client* client, int errorCode, const char* text) {
+    ReplyWriter(client, _server->getServerName(), errorCode).trailing(text).send();
+}
+
+/**
+ * @brief Send an error reply about one thing (a channel, nickname, command...)
+ * @param client The client to send the error to
+ * @param errorCode The error code
+ * @param param What the error is about
+ * @param text The human-readable explanation
+ */
+void Parser::sendError(Client* client, int errorCode, const StringRef& param, const char* text) {
+    ReplyWriter(client, _server->getServerName(), errorCode).param(param).trailing(text).send();
+}
+
+/**
+ * @brief Send an error reply about two things (e.g. a nickname and a channel)
+ * @param client The client to send the error to
+ * @param errorCode The error code
+ * @param first First parameter
+ * @param second Second parameter
+ * @param text The human-readable explanation
  */
-void Parser::sendError(Client* client, int errorCode, const std::string& message) {
-    std::string nick = client->getNickname().empty() ? "*" : client->getNickname();
-    std::string errorMsg = Utils::formatReply(_server->getServerName(), errorCode, nick, message);
-    Utils::sendToClient(client, errorMsg);
+void Parser::sendError(Client* client, int errorCode, const StringRef& first, const StringRef& second,
+                       const char* text) {
+    ReplyWriter(client, _server->getServerName(), errorCode).param(first).param(second).trailing(text).send();
 }
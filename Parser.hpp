@@ -2,9 +2,12 @@
 #define PARSER_HPP
 
 #include "ircserv.hpp"
+#include "Arena.hpp"
+#include "ReplyTemplate.hpp"
 
 // Forward declarations
 class Server;
+struct ListQuery;
 
 /**
  * @brief Structure to represent a parsed IRC command
@@ -13,6 +16,7 @@ class Server;
  * For example: "NICK john" has command="NICK" and params=["john"]
  */
 struct IRCCommand {
+    std::string tags;                      // Client-only message tags ("+a=b;+c"), for message-tags recipients
     std::string prefix;                    // Optional prefix (usually empty for client commands)
     std::string command;                   // The IRC command (NICK, USER, JOIN, etc.)
     std::vector<std::string> params;       // Command parameters
@@ -27,6 +31,11 @@ struct IRCCommand {
 class Parser {
 private:
     Server* _server;    // Pointer to the server instance
+    ReplyTemplate _welcome;  // 001-005 and the help notices, rendered once
+    ReplyTemplate _capList;  // CAP LS reply, rendered once
+
+    // Channels a pumped LIST looks at per row, at most
+    static const size_t LIST_SCAN_STEP = 64;
 
 public:
     // Constructor
@@ -36,7 +45,9 @@ public:
     ~Parser();
     
     // Main parsing functions
-    IRCCommand parseCommand(const std::string& message);
+    // Parsing uses no server state, so I/O threads call these too
+    static IRCCommand parseCommand(const std::string& message);
+    static IRCCommand parseCommand(const char* data, size_t length);  // Parse straight from a receive buffer
     void executeCommand(Client* client, const IRCCommand& cmd);
     
     // Command handlers - each IRC command has its own function
@@ -46,15 +57,53 @@ public:
     void handleJoin(Client* client, const IRCCommand& cmd);
     void handlePart(Client* client, const IRCCommand& cmd);
     void handlePrivmsg(Client* client, const IRCCommand& cmd);
+    void handleNotice(Client* client, const IRCCommand& cmd);
     void handleKick(Client* client, const IRCCommand& cmd);
     void handleInvite(Client* client, const IRCCommand& cmd);
     void handleTopic(Client* client, const IRCCommand& cmd);
     void handleMode(Client* client, const IRCCommand& cmd);
     void handleQuit(Client* client, const IRCCommand& cmd);
+    void handleStats(Client* client, const IRCCommand& cmd);
+    void handleMigrate(Client* client, const IRCCommand& cmd);
+    void handleSilence(Client* client, const IRCCommand& cmd);
+    void handleWho(Client* client, const IRCCommand& cmd);
+    void handleWhois(Client* client, const IRCCommand& cmd);
+    void handleUserhost(Client* client, const IRCCommand& cmd);
+    void handleMonitor(Client* client, const IRCCommand& cmd);
+    void handleList(Client* client, const IRCCommand& cmd);
+    void handleMotd(Client* client, const IRCCommand& cmd);
+    void handleCap(Client* client, const IRCCommand& cmd);
+    void handleTagmsg(Client* client, const IRCCommand& cmd);
     
     // Helper functions
+    void completeRegistration(Client* client);  // Welcome the client once PASS, NICK, USER and CAP are done
     void sendWelcome(Client* client);
-    void sendError(Client* client, int errorCode, const std::string& message);
+    void sendMotd(Client* client);          // 375/372/376, or 422 without a MOTD file
+    void sendMaskList(Client* client, Channel* channel, char mode);  // +b/+e/+I entries
+    void sendWhoReply(Client* client, Client* about, const std::string& channel);  // One RPL_WHOREPLY row
+    void sendMonitorStatus(Client* client, const std::vector<std::string>& nicks);  // 730/731 replies
+    void sendListReply(Client* client, Channel* channel);  // One RPL_LIST row
+    bool sendNextListRow(Client* client, ListQuery& query);  // false once the walk is over
+    bool listMatches(const ListQuery& query, Channel* channel) const;  // LIST filters
+    void joinChannel(Client* client, const std::string& channelName, const std::string& key,
+                     const std::string& prefix);  // One channel of a JOIN list
+    void relayMessage(Client* client, const IRCCommand& cmd, const char* command);  // PRIVMSG/NOTICE/TAGMSG
+    void sendBlocked(Client* client, Channel* channel, const std::string& target,
+                     const char* reason);  // 404 for a channel, a NOTICE for a nickname
+    bool resolveTarget(Client* client, const std::string& target, Channel*& channel,
+                       Client*& targetClient, bool report);  // Message target, or an error reply
+    const std::string* checkText(Client* client, const std::string& command, Channel* channel,
+                                 const std::string& text, std::string& storage);  // UTF8ONLY and +S
+    const std::string* checkText(Client* client, const std::string& command, Channel* channel,
+                                 const std::string& text, unsigned int flags, std::string& storage);
+    void buildWelcome();                    // Render the registration burst template
+    const ReplyTemplate& getWelcome() const;
+    static bool isWhitespace(char c);
+    static size_t findSpace(const char* data, size_t pos, size_t end);
+    void sendError(Client* client, int errorCode, const char* text);
+    void sendError(Client* client, int errorCode, const StringRef& param, const char* text);
+    void sendError(Client* client, int errorCode, const StringRef& first, const StringRef& second,
+                   const char* text);
 };
 
 #endif
@@ -0,0 +1,1071 @@
+#include "Reactor.hpp"
+#include "Utils.hpp"
+#include <linux/filter.h>  // For the SO_REUSEPORT steering program
+#include <sched.h>         // For sched_getcpu()
+
+/**
+ * @brief Get the bytes a connection's reactor has not written yet (state thread)
+ * @return Bytes still in the ring plus bytes in the connection's queues
+ */
+size_t ReactorBacklog::pending() const {
+    size_t taken = __atomic_load_n(&absorbed, __ATOMIC_ACQUIRE);
+    return handed - taken + __atomic_load_n(&queued, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Drop one reference to a mark
+ * @param mark The mark (NULL does nothing)
+ */
+void ShardMark::release(ShardMark* mark) {
+    if (mark && __atomic_sub_fetch(&mark->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        delete mark;
+    }
+}
+
+/**
+ * @brief Count a connection's queued output for the state thread (reactor thread)
+ * @param connection The connection
+ */
+static void updateBacklog(ReactorConnection* connection) {
+    __atomic_store_n(&connection->backlog.queued, connection->output.size() + connection->held.size(),
+                     __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Constructor for Reactor class (nothing runs until start())
+ * @param index Reactor number
+ * @param port Port to listen on
+ * @param sendQueueLimit Queued output bytes after which a connection is dropped
+ * @param outputBacklog State thread outputs not taken yet from which it holds further ones back
+ */
+Reactor::Reactor(size_t index, int port, size_t sendQueueLimit, size_t outputBacklog)
+    : _index(index), _port(port), _sendQueueLimit(sendQueueLimit), _listener(-1), _started(false), _stop(0),
+      _inbound(RING_SIZE), _spare(RING_SIZE), _deliverPending(0), _coreQueued(0), _outputBacklog(outputBacklog),
+      _shards(NULL), _nextConnection(0), _posted(false),
+      _accepted(0), _lines(0), _bytesOut(0), _stalls(0), _open(0), _migratedIn(0), _migratedOut(0), _runningCpu(-1),
+      _cpu(-1), _sampleCpu(0), _sampleTime(0), _load(0), _withheld(0) {
+    _toCore[0] = _toCore[1] = -1;
+    _toReactor[0] = _toReactor[1] = -1;
+}
+
+/**
+ * @brief Destructor for Reactor class
+ */
+Reactor::~Reactor() {
+    stop();
+
+    ReactorEvent* event;
+    while (_inbound.pop(event)) {
+        delete event;
+    }
+    while (_spare.pop(event)) {
+        delete event;
+    }
+    ReactorOutput output;
+    while (_delivered.pop(output)) {
+        BufferPool::instance().releaseChain(output.chain);
+        if (output.moved) {
+            close(output.moved->fd);  // Moved here while this reactor was stopping
+            delete output.moved;
+        }
+        if (output.batch) {
+            ChannelShard::release(output.batch->line);
+            delete output.batch;
+        }
+        ShardMark::release(output.mark);
+    }
+    for (int i = 0; i < 2; ++i) {
+        if (_toCore[i] >= 0) {
+            close(_toCore[i]);
+        }
+        if (_toReactor[i] >= 0) {
+            close(_toReactor[i]);
+        }
+    }
+}
+
+/**
+ * @brief Choose the CPU the thread will be pinned to (call before start())
+ * @param cpu CPU number, -1 to let the scheduler decide
+ */
+void Reactor::setCpu(int cpu) {
+    _cpu = cpu;
+}
+
+/**
+ * @brief Give the reactor the channel shards (call before start())
+ * @param shards The shards, in the order ShardMark counts them (NULL: none)
+ */
+void Reactor::setShards(const std::vector<ChannelShard*>* shards) {
+    _shards = shards;
+}
+
+/**
+ * @brief Open the listening socket and start the I/O thread
+ * @return true if the reactor is running
+ *
+ * All reactors bind the same port; SO_REUSEPORT makes the kernel hand each
+ * new connection to one of them.
+ */
+bool Reactor::start() {
+    if (pipe(_toCore) < 0 || pipe(_toReactor) < 0) {
+        std::cerr << "Reactor " << _index << ": pipe: " << strerror(errno) << std::endl;
+        return false;
+    }
+    for (int i = 0; i < 2; ++i) {
+        fcntl(_toCore[i], F_SETFL, O_NONBLOCK);
+        fcntl(_toReactor[i], F_SETFL, O_NONBLOCK);
+    }
+
+    _listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (_listener < 0) {
+        std::cerr << "Reactor " << _index << ": socket: " << strerror(errno) << std::endl;
+        return false;
+    }
+    int opt = 1;
+    setsockopt(_listener, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (setsockopt(_listener, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        std::cerr << "Reactor " << _index << ": SO_REUSEPORT: " << strerror(errno) << std::endl;
+        return false;
+    }
+    fcntl(_listener, F_SETFL, O_NONBLOCK);
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(_port);
+    if (bind(_listener, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(_listener, 128) < 0) {
+        std::cerr << "Reactor " << _index << ": bind/listen: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Signals (SIGINT, SIGHUP...) must keep going to the state thread
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &previous);
+    int result = pthread_create(&_thread, NULL, &Reactor::threadMain, this);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (result != 0) {
+        std::cerr << "Reactor " << _index << ": cannot start thread" << std::endl;
+        return false;
+    }
+    _started = true;
+    return true;
+}
+
+/**
+ * @brief Build one classic BPF instruction
+ * @param code Opcode
+ * @param k Constant operand
+ * @param jt Jump offset if true (conditional jumps)
+ * @param jf Jump offset if false (conditional jumps)
+ * @return The instruction
+ */
+static struct sock_filter bpfInstruction(unsigned short code, unsigned int k,
+                                         unsigned char jt = 0, unsigned char jf = 0) {
+    struct sock_filter instruction;
+    instruction.code = code;
+    instruction.jt = jt;
+    instruction.jf = jf;
+    instruction.k = k;
+    return instruction;
+}
+
+/**
+ * @brief Attach the connection steering program to the port's listeners
+ * @param cpus CPU each reactor is pinned to, in start() order (-1: not pinned)
+ * @return true if the kernel accepted the program
+ *
+ * Only needs to run on one reactor: the program applies to the whole
+ * SO_REUSEPORT group. It returns the index of the listener (the order the
+ * reactors started listening in) for the CPU handling the SYN: the reactor
+ * pinned to that CPU if there is one, otherwise cpu % reactors.
+ *
+ *     A = cpu
+ *     if A == cpus[0] return 0
+ *     ...
+ *     return A % reactors
+ */
+bool Reactor::steer(const std::vector<int>& cpus) {
+    std::vector<struct sock_filter> program;
+    program.push_back(bpfInstruction(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU));
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        if (cpus[i] >= 0) {
+            program.push_back(bpfInstruction(BPF_JMP | BPF_JEQ | BPF_K, static_cast<unsigned int>(cpus[i]), 0, 1));
+            program.push_back(bpfInstruction(BPF_RET | BPF_K, static_cast<unsigned int>(i)));
+        }
+    }
+    program.push_back(bpfInstruction(BPF_ALU | BPF_MOD | BPF_K, static_cast<unsigned int>(cpus.size())));
+    program.push_back(bpfInstruction(BPF_RET | BPF_A, 0));
+
+    struct sock_fprog filter;
+    filter.len = static_cast<unsigned short>(program.size());
+    filter.filter = &program[0];
+    if (setsockopt(_listener, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &filter, sizeof(filter)) < 0) {
+        std::cerr << "Reactor " << _index << ": SO_ATTACH_REUSEPORT_CBPF: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Stop the I/O thread and close its sockets
+ *
+ * Output already handed over is flushed once, best effort, like the
+ * single-threaded server does when it closes a client.
+ */
+void Reactor::stop() {
+    if (_started) {
+        __atomic_store_n(&_stop, 1, __ATOMIC_RELEASE);
+        ssize_t ignored = write(_toReactor[1], "s", 1);
+        (void)ignored;
+        pthread_join(_thread, NULL);
+        _started = false;
+    }
+    if (_listener >= 0) {
+        close(_listener);
+        _listener = -1;
+    }
+}
+
+/**
+ * @brief Get the descriptor the state thread polls for new events
+ * @return Read end of the wake-up pipe
+ */
+int Reactor::getWakeFd() const {
+    return _toCore[0];
+}
+
+/**
+ * @brief Empty the wake-up pipe (the events themselves are in the ring)
+ */
+void Reactor::clearWake() {
+    char buffer[64];
+    while (read(_toCore[0], buffer, sizeof(buffer)) > 0) {
+    }
+}
+
+/**
+ * @brief Take the next event (state thread)
+ * @return The event (the caller deletes it), or NULL if there is none
+ */
+ReactorEvent* Reactor::receive() {
+    ReactorEvent* event;
+    return _inbound.pop(event) ? event : NULL;
+}
+
+/**
+ * @brief Give an event back once it has been applied (state thread)
+ * @param event An event from receive()
+ *
+ * The reactor reuses it for a later line, strings and all, so a busy
+ * connection doesn't cost an allocation per line.
+ */
+void Reactor::recycle(ReactorEvent* event) {
+    if (!_spare.push(event)) {
+        delete event;
+    }
+}
+
+/**
+ * @brief Hand output to the reactor (state thread)
+ * @param output Output chain and/or close request for one connection, or a migration step
+ *
+ * It goes into the same mailbox as the shards' deliveries, behind whatever
+ * was handed over before. This never waits: when isBehind() the state
+ * thread keeps client output on its side instead (ReactorBacklog::withheld).
+ */
+void Reactor::send(const ReactorOutput& output) {
+    __atomic_fetch_add(&_coreQueued, 1, __ATOMIC_RELAXED);
+    ReactorOutput counted = output;
+    counted.fromCore = true;
+    deliver(counted);
+}
+
+/**
+ * @brief Check whether the reactor is far behind the state thread (state thread)
+ * @return true once io_backlog of the state thread's outputs are not taken yet
+ */
+bool Reactor::isBehind() const {
+    return __atomic_load_n(&_coreQueued, __ATOMIC_ACQUIRE) >= _outputBacklog;
+}
+
+/**
+ * @brief Count one output held back on the state thread for this reactor (state thread)
+ */
+void Reactor::countWithheld() {
+    __atomic_fetch_add(&_withheld, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Queue output for a connection from any thread
+ * @param output The output: from the state thread (see send()), a BATCH or FENCE from a shard,
+ *               or whatever another reactor passes on
+ *
+ * Only the first delivery after the reactor last looked writes to the
+ * wake-up pipe, so a 100k-member fanout costs one wake-up, not 100k.
+ */
+void Reactor::deliver(const ReactorOutput& output) {
+    _delivered.push(output);
+    if (__atomic_exchange_n(&_deliverPending, 1, __ATOMIC_ACQ_REL) == 0) {
+        ssize_t ignored = write(_toReactor[1], "d", 1);
+        (void)ignored;
+    }
+}
+
+/**
+ * @brief Thread entry point
+ * @param reactor The Reactor
+ * @return NULL
+ */
+void* Reactor::threadMain(void* reactor) {
+    Reactor* self = static_cast<Reactor*>(reactor);
+    if (self->_cpu >= 0 && !Utils::pinThread(self->_cpu)) {
+        std::cerr << "Reactor " << self->_index << ": cannot pin to CPU " << self->_cpu << std::endl;
+    }
+    BufferPool::instance().localizeThreadCache();
+    self->loop();
+    return NULL;
+}
+
+/**
+ * @brief The I/O thread's event loop
+ */
+void Reactor::loop() {
+    std::vector<struct pollfd> fds;
+    std::vector<unsigned long> ids;
+
+    while (!__atomic_load_n(&_stop, __ATOMIC_ACQUIRE)) {
+        bool readable = _backlog.empty();  // Stop reading while the state thread catches up
+        __atomic_store_n(&_runningCpu, sched_getcpu(), __ATOMIC_RELAXED);
+
+        fds.clear();
+        ids.clear();
+        struct pollfd entry;
+        entry.fd = _toReactor[0];
+        entry.events = POLLIN;
+        entry.revents = 0;
+        fds.push_back(entry);
+        entry.fd = _listener;
+        entry.events = readable ? POLLIN : 0;
+        fds.push_back(entry);
+        for (std::map<unsigned long, Connection*>::iterator it = _connections.begin(); it != _connections.end(); ++it) {
+            entry.fd = it->second->fd;
+            entry.events = (readable && !it->second->gone && !it->second->paused) ? POLLIN : 0;
+            if (!it->second->output.empty()) {
+                entry.events |= POLLOUT;
+            }
+            fds.push_back(entry);
+            ids.push_back(it->first);
+        }
+
+        // Shards don't wake us when they finish a task: look again soon while output is parked
+        int timeout = readable && _parkedIds.empty() ? 1000 : 1;
+        if (poll(&fds[0], fds.size(), timeout) < 0 && errno != EINTR) {
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            char buffer[64];
+            while (read(_toReactor[0], buffer, sizeof(buffer)) > 0) {
+            }
+        }
+        receiveOutput();
+
+        if (fds[1].revents & POLLIN) {
+            acceptConnections();
+        }
+
+        for (size_t i = 0; i < ids.size(); ++i) {
+            std::map<unsigned long, Connection*>::iterator it = _connections.find(ids[i]);
+            if (it != _connections.end() && !it->second->gone && !it->second->paused &&
+                (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR))) {
+                readConnection(it->first, it->second);
+            }
+        }
+
+        // Send what the state thread handed over; finish closes
+        for (std::map<unsigned long, Connection*>::iterator it = _connections.begin(); it != _connections.end(); ) {
+            Connection* connection = it->second;
+            if (!connection->gone && !connection->output.empty()) {
+                ssize_t sent = connection->output.flush(connection->fd);
+                if (sent < 0) {
+                    drop(it->first, connection, "Write error");
+                } else {
+                    __atomic_fetch_add(&_bytesOut, static_cast<size_t>(sent), __ATOMIC_RELAXED);
+                    if (connection->output.size() + connection->held.size() > _sendQueueLimit) {
+                        drop(it->first, connection, "SendQ exceeded");
+                    } else {
+                        updateBacklog(connection);
+                    }
+                }
+            }
+            if (connection->closing && (connection->gone || connection->output.empty())) {
+                close(connection->fd);
+                delete connection;
+                _connections.erase(it++);
+                __atomic_fetch_sub(&_open, 1, __ATOMIC_RELAXED);
+            } else {
+                ++it;
+            }
+        }
+
+        // One wake-up for everything this iteration produced
+        flushBacklog();
+        if (_posted) {
+            ssize_t ignored = write(_toCore[1], "r", 1);  // A full pipe is already a pending wake-up
+            (void)ignored;
+            _posted = false;
+        }
+    }
+
+    receiveOutput();
+    closeAll();
+    __atomic_store_n(&_stop, 1, __ATOMIC_RELEASE);  // A send() waiting for room must not wait forever
+}
+
+/**
+ * @brief Accept every pending connection
+ */
+void Reactor::acceptConnections() {
+    while (true) {
+        struct sockaddr_in address;
+        socklen_t length = sizeof(address);
+        int fd = accept(_listener, (struct sockaddr*)&address, &length);
+        if (fd < 0) {
+            return;  // EAGAIN: nothing more to accept (or an error for this one connection)
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+
+        unsigned long id = (++_nextConnection << 8) | _index;
+        Connection* connection = new Connection();
+        connection->fd = fd;
+        connection->gone = false;
+        connection->closing = false;
+        connection->paused = false;
+        connection->holding = false;
+        connection->resumed = false;
+        connection->fences = 0;
+        connection->fencesSeen = 0;
+        _connections[id] = connection;
+        __atomic_fetch_add(&_accepted, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&_open, 1, __ATOMIC_RELAXED);
+
+        ReactorEvent* event = newEvent(ReactorEvent::CONNECT, id);
+        event->fd = fd;
+        event->addr = address;
+        event->backlog = &connection->backlog;
+        post(event);
+    }
+}
+
+/**
+ * @brief Read from a connection and forward its complete lines, parsed
+ * @param id Connection id
+ * @param connection The connection
+ *
+ * The same framing as Server::processClientData: lines end with \n (an
+ * optional \r is removed) and a partial line longer than a message with
+ * tags may be drops the connection.
+ */
+void Reactor::readConnection(unsigned long id, Connection* connection) {
+    InputBuffer& input = connection->input;
+    ssize_t bytesRead = input.readFrom(connection->fd);
+    if (bytesRead <= 0) {
+        if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return;
+        }
+        drop(id, connection, bytesRead == 0 ? "Client disconnected" : "Read error");
+        return;
+    }
+
+    const char* data = input.data();
+    size_t length = input.length();
+    size_t start = 0;
+    while (start < length) {
+        const char* newline = static_cast<const char*>(memchr(data + start, '\n', length - start));
+        if (!newline) {
+            break;
+        }
+        const char* line = data + start;
+        size_t lineLength = newline - line;
+        start += lineLength + 1;
+        if (lineLength > 0 && line[lineLength - 1] == '\r') {
+            lineLength--;
+        }
+        if (lineLength > 0) {
+            ReactorEvent* event = newEvent(ReactorEvent::COMMAND, id);
+            event->line.assign(line, lineLength);
+            event->command = Parser::parseCommand(line, lineLength);
+            post(event);
+            __atomic_fetch_add(&_lines, 1, __ATOMIC_RELAXED);
+        }
+    }
+    input.consume(start);
+
+    if (input.length() > 512 + IRC::TAGS_LENGTH) {
+        input.release();
+        drop(id, connection, "Input line too long");
+    }
+}
+
+/**
+ * @brief Take the state thread's, the shards' and other reactors' output and requests
+ *
+ * Chains for connections that are already gone are released right away.
+ */
+void Reactor::receiveOutput() {
+    // Reset first: a delivery racing with the drain below wakes us again
+    __atomic_store_n(&_deliverPending, 0, __ATOMIC_RELEASE);
+
+    // Read before the drain: every line of a task counted here is in the mailbox, though
+    // maybe behind output that waits for it, so it only counts once the drain is over
+    for (size_t i = 0; _shards && i < _shards->size(); ++i) {
+        _finishing.resize(_shards->size());
+        _finishing[i] = (*_shards)[i]->getTasks();
+    }
+
+    ReactorOutput output;
+    while (_delivered.pop(output)) {
+        if (output.fromCore) {
+            __atomic_fetch_sub(&_coreQueued, 1, __ATOMIC_RELEASE);
+            output.fromCore = false;    // Not counted again if it is passed on
+        }
+        apply(output);
+    }
+    _finished.swap(_finishing);
+    if (!_parkedIds.empty()) {
+        releaseParked();
+    }
+}
+
+/**
+ * @brief Carry out one output, close, or migration step
+ * @param output The output
+ */
+void Reactor::apply(ReactorOutput& output) {
+    if (output.kind == ReactorOutput::ADOPT) {
+        adopt(output.connection, output.moved);
+        return;
+    }
+    if (output.kind == ReactorOutput::BATCH) {
+        applyBatch(output.batch);
+        return;
+    }
+    std::map<unsigned long, Connection*>::iterator it = _connections.find(output.connection);
+    if (it == _connections.end()) {
+        pass(output);
+        return;
+    }
+
+    Connection* connection = it->second;
+    switch (output.kind) {
+    case ReactorOutput::MIGRATE:
+        migrate(it, output.target);
+        return;
+    case ReactorOutput::RESUME:
+        connection->paused = false;
+        connection->resumed = true;
+        connection->fences = output.fences;
+        releaseHeld(connection);
+        return;
+    case ReactorOutput::FENCE:
+        connection->fencesSeen++;
+        releaseHeld(connection);
+        return;
+    case ReactorOutput::UNFORWARD:
+        return;     // It moved away and back before this arrived: nothing left to forward
+    default:
+        break;
+    }
+
+    if (output.withheld) {
+        connection->backlog.caughtUp++;
+    }
+    if (!output.forwarded && (!connection->parked.empty() || (output.mark && !reached(output.mark)))) {
+        ReactorParked parked;
+        parked.output = output;
+        parked.shard = 0;
+        parked.task = 0;
+        park(it->first, connection, parked);
+        return;
+    }
+    queue(connection, output);
+}
+
+/**
+ * @brief Add output to a connection's queue, or note its close request
+ * @param connection The connection
+ * @param output State thread output, a forwarded one, or a parked shard line
+ */
+void Reactor::queue(Connection* connection, ReactorOutput& output) {
+    ShardMark::release(output.mark);
+    if (connection->gone) {
+        BufferPool::instance().releaseChain(output.chain);
+    } else if (output.chain) {
+        // Right after a move only what the old owner passes on may go out
+        (!output.forwarded && connection->holding ? connection->held : connection->output).appendChain(output.chain);
+        updateBacklog(connection);
+    }
+    if (output.bytes) {
+        __atomic_fetch_add(&connection->backlog.absorbed, output.bytes, __ATOMIC_RELEASE);
+    }
+    if (output.close) {
+        connection->closing = true;
+        if (connection->holding && !connection->gone) {
+            connection->output.appendChain(connection->held.detach());  // Last words go out anyway
+        }
+    }
+}
+
+/**
+ * @brief Queue a shard's line for each of its recipients on this reactor
+ * @param batch The line and the recipients (freed here)
+ *
+ * The line is copied into each connection's queue, usually into room left
+ * in its last chunk. A recipient that moved away gets its copy passed on
+ * like any other output, and one whose withheld output hasn't all arrived
+ * gets it parked.
+ */
+void Reactor::applyBatch(ShardBatch* batch) {
+    for (size_t i = 0; i < batch->members.size(); ++i) {
+        const ShardMember& member = batch->members[i];
+        const std::string& variant = batch->line->variants[member.caps & Capabilities::TAG_CAPS];
+        std::map<unsigned long, Connection*>::iterator it = _connections.find(member.connection);
+        if (it == _connections.end()) {
+            OutputQueue queue;
+            queue.append(variant.data(), variant.length());
+            ReactorOutput output;
+            output.connection = member.connection;
+            output.chain = queue.detach();
+            pass(output);
+            continue;
+        }
+        Connection* connection = it->second;
+        if (connection->gone) {
+            continue;
+        }
+        if (!connection->parked.empty() || waitsForCore(connection)) {
+            ReactorParked parked;
+            OutputQueue queue;
+            queue.append(variant.data(), variant.length());
+            parked.output.connection = member.connection;
+            parked.output.chain = queue.detach();
+            parked.shard = batch->shard;
+            parked.task = batch->task;
+            park(member.connection, connection, parked);
+            continue;
+        }
+        (connection->holding ? connection->held : connection->output).append(variant.data(), variant.length());
+        updateBacklog(connection);
+    }
+    ChannelShard::release(batch->line);
+    delete batch;
+}
+
+/**
+ * @brief Check whether the shards have finished the tasks a mark names
+ * @param mark The mark
+ * @return true if every shard had finished as many tasks before the last complete drain (their lines are applied)
+ */
+bool Reactor::reached(const ShardMark* mark) const {
+    for (size_t i = 0; i < mark->posted.size(); ++i) {
+        if (i >= _finished.size() || _finished[i] < mark->posted[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Put output in a connection's parked list
+ * @param id Connection id
+ * @param connection The connection
+ * @param parked State thread output, or a shard line arriving while the list is not empty
+ *
+ * A shard line goes ahead of the first state thread output whose mark
+ * says it was handed over after the line's task was posted. State thread
+ * output goes at the end, except that output the state thread withheld
+ * goes ahead of trailing lines whose tasks were posted after its mark.
+ */
+void Reactor::park(unsigned long id, Connection* connection, const ReactorParked& parked) {
+    std::deque<ReactorParked>& list = connection->parked;
+    if (list.empty()) {
+        _parkedIds.push_back(id);
+    }
+    std::deque<ReactorParked>::iterator at = list.end();
+    if (parked.task) {
+        for (at = list.begin(); at != list.end(); ++at) {
+            const ShardMark* mark = at->output.mark;
+            if (!at->task && mark && parked.shard < mark->posted.size() && mark->posted[parked.shard] >= parked.task) {
+                break;
+            }
+        }
+    } else if (parked.output.mark) {
+        const ShardMark* mark = parked.output.mark;
+        while (at != list.begin() && (at - 1)->task && (at - 1)->shard < mark->posted.size() &&
+               (at - 1)->task > mark->posted[(at - 1)->shard]) {
+            --at;
+        }
+    }
+    list.insert(at, parked);
+}
+
+/**
+ * @brief Send parked output in order, up to the first one still waiting
+ *
+ * State thread output waits for the shards its mark names, a shard line
+ * for the output the state thread withheld before it.
+ */
+void Reactor::releaseParked() {
+    for (size_t i = 0; i < _parkedIds.size(); ) {
+        std::map<unsigned long, Connection*>::iterator it = _connections.find(_parkedIds[i]);
+        if (it != _connections.end()) {
+            std::deque<ReactorParked>& list = it->second->parked;
+            while (!list.empty() && (list.front().task ? !waitsForCore(it->second)
+                                                       : !list.front().output.mark || reached(list.front().output.mark))) {
+                ReactorOutput output = list.front().output;
+                list.pop_front();
+                queue(it->second, output);
+            }
+            if (!list.empty()) {
+                ++i;
+                continue;
+            }
+        }
+        _parkedIds[i] = _parkedIds.back();
+        _parkedIds.pop_back();
+    }
+}
+
+/**
+ * @brief Check whether output the state thread withheld is still on its way
+ * @param connection The connection
+ * @return true if fewer withheld outputs arrived than the state thread counted
+ */
+bool Reactor::waitsForCore(const Connection* connection) {
+    return __atomic_load_n(&connection->backlog.withholds, __ATOMIC_ACQUIRE) != connection->backlog.caughtUp;
+}
+
+/**
+ * @brief Forget a connection's parked output (it is gone)
+ * @param connection The connection
+ */
+void Reactor::dropParked(Connection* connection) {
+    for (size_t i = 0; i < connection->parked.size(); ++i) {
+        BufferPool::instance().releaseChain(connection->parked[i].output.chain);
+        ShardMark::release(connection->parked[i].output.mark);
+    }
+    connection->parked.clear();
+}
+
+/**
+ * @brief Hand a connection to another reactor (MIGRATE)
+ * @param it The connection
+ * @param target The reactor taking it over
+ *
+ * Refused while the connection is closing, gone, still waiting for the
+ * fences of its previous move, or has parked output; the state thread then
+ * simply keeps it here.
+ */
+void Reactor::migrate(std::map<unsigned long, Connection*>::iterator it, Reactor* target) {
+    unsigned long id = it->first;
+    Connection* connection = it->second;
+
+    ReactorEvent* event = newEvent(ReactorEvent::MIGRATED, id);
+    event->target = NULL;
+    if (target != this && !connection->gone && !connection->closing && !connection->holding &&
+        connection->parked.empty()) {
+        _connections.erase(it);
+        __atomic_fetch_sub(&_open, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&_migratedOut, 1, __ATOMIC_RELAXED);
+
+        Forward forward;
+        forward.target = target;
+        forward.fencesSeen = 0;
+        forward.fences = 0;
+        forward.counted = false;
+        _forwards[id] = forward;
+
+        ReactorOutput adopt;
+        adopt.kind = ReactorOutput::ADOPT;
+        adopt.connection = id;
+        adopt.moved = connection;
+        target->deliver(adopt);
+        event->target = target;
+    }
+    post(event);    // Behind every line already parsed from this connection
+}
+
+/**
+ * @brief Take over a connection from another reactor (ADOPT)
+ * @param id Connection id (kept: ids are unique across reactors)
+ * @param connection The connection, with its partial input and unsent output
+ */
+void Reactor::adopt(unsigned long id, Connection* connection) {
+    _forwards.erase(id);    // Moved away from here once; every fence of that move has passed
+    connection->paused = true;
+    connection->holding = true;
+    connection->resumed = false;
+    connection->fences = 0;
+    connection->fencesSeen = 0;
+    _connections[id] = connection;
+    __atomic_fetch_add(&_open, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&_migratedIn, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Handle output for a connection this reactor does not own
+ * @param output The output
+ *
+ * A connection that moved away has its output, closes and fences passed on
+ * to the reactor it went to, until UNFORWARD and every fence it announced
+ * came through (or the connection was closed). Anything else is for a
+ * connection that no longer exists and is dropped.
+ */
+void Reactor::pass(ReactorOutput& output) {
+    std::map<unsigned long, Forward>::iterator it = _forwards.find(output.connection);
+    if (it == _forwards.end()) {
+        BufferPool::instance().releaseChain(output.chain);
+        ShardMark::release(output.mark);
+        if (output.kind == ReactorOutput::MIGRATE) {
+            // The state thread waits for an answer
+            ReactorEvent* event = newEvent(ReactorEvent::MIGRATED, output.connection);
+            event->target = NULL;
+            post(event);
+        }
+        return;
+    }
+
+    Forward& forward = it->second;
+    if (output.kind == ReactorOutput::UNFORWARD) {
+        forward.fences = output.fences;
+        forward.counted = true;
+    } else {
+        if (output.kind == ReactorOutput::FENCE) {
+            forward.fencesSeen++;
+        }
+        output.forwarded = true;
+        forward.target->deliver(output);
+        if (output.close) {
+            _forwards.erase(it);
+            return;
+        }
+    }
+    if (forward.counted && forward.fencesSeen >= forward.fences) {
+        _forwards.erase(it);
+    }
+}
+
+/**
+ * @brief Stop holding back shard output once every fence has come through
+ * @param connection A connection that moved here
+ */
+void Reactor::releaseHeld(Connection* connection) {
+    if (!connection->holding || !connection->resumed || connection->fencesSeen < connection->fences) {
+        return;
+    }
+    connection->holding = false;
+    if (!connection->gone) {
+        connection->output.appendChain(connection->held.detach());
+    }
+    connection->held.clear();
+    updateBacklog(connection);
+}
+
+/**
+ * @brief Stop using a connection and tell the state thread
+ * @param id Connection id
+ * @param connection The connection
+ * @param reason Reason for the QUIT message
+ *
+ * The socket stays open until the state thread has removed the client and
+ * answers with a close, so no event for this id can arrive after that.
+ */
+void Reactor::drop(unsigned long id, Connection* connection, const std::string& reason) {
+    connection->gone = true;
+    connection->output.clear();
+    connection->held.clear();
+    dropParked(connection);
+    updateBacklog(connection);
+
+    ReactorEvent* event = newEvent(ReactorEvent::DISCONNECT, id);
+    event->reason = reason;
+    post(event);
+}
+
+/**
+ * @brief Get an event to fill in, one the state thread gave back if there is one
+ * @param kind Event kind
+ * @param id Connection id
+ * @return The event; only kind and connection are set
+ */
+ReactorEvent* Reactor::newEvent(ReactorEvent::Kind kind, unsigned long id) {
+    ReactorEvent* event;
+    if (!_spare.pop(event)) {
+        event = new ReactorEvent();
+    }
+    event->kind = kind;
+    event->connection = id;
+    return event;
+}
+
+/**
+ * @brief Send an event to the state thread
+ * @param event The event (now owned by the state thread)
+ */
+void Reactor::post(ReactorEvent* event) {
+    if (!_backlog.empty() || !_inbound.push(event)) {
+        if (_backlog.empty()) {
+            __atomic_fetch_add(&_stalls, 1, __ATOMIC_RELAXED);
+        }
+        _backlog.push_back(event);
+    }
+    _posted = true;
+}
+
+/**
+ * @brief Move backlogged events into the ring while there is room
+ * @return true if the backlog is empty
+ */
+bool Reactor::flushBacklog() {
+    while (!_backlog.empty() && _inbound.push(_backlog.front())) {
+        _backlog.pop_front();
+    }
+    return _backlog.empty();
+}
+
+/**
+ * @brief Close every connection (the thread is stopping)
+ */
+void Reactor::closeAll() {
+    for (std::map<unsigned long, Connection*>::iterator it = _connections.begin(); it != _connections.end(); ++it) {
+        if (!it->second->gone) {
+            it->second->output.flush(it->second->fd);
+        }
+        dropParked(it->second);
+        close(it->second->fd);
+        delete it->second;
+    }
+    _connections.clear();
+    _parkedIds.clear();
+    for (size_t i = 0; i < _backlog.size(); ++i) {
+        delete _backlog[i];
+    }
+    _backlog.clear();
+    __atomic_store_n(&_open, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the number of connections accepted
+ * @return Count
+ */
+size_t Reactor::getAccepted() const {
+    return __atomic_load_n(&_accepted, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the number of lines forwarded
+ * @return Count
+ */
+size_t Reactor::getLines() const {
+    return __atomic_load_n(&_lines, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the number of bytes written to sockets
+ * @return Bytes
+ */
+size_t Reactor::getBytesOut() const {
+    return __atomic_load_n(&_bytesOut, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the number of times the inbound ring was full
+ * @return Count
+ */
+size_t Reactor::getStalls() const {
+    return __atomic_load_n(&_stalls, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the number of outputs the state thread held back because this reactor was behind
+ * @return Count
+ */
+size_t Reactor::getWithheld() const {
+    return __atomic_load_n(&_withheld, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the number of open connections
+ * @return Count
+ */
+size_t Reactor::getOpen() const {
+    return __atomic_load_n(&_open, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the number of connections moved here from another reactor
+ * @return Count
+ */
+size_t Reactor::getMigratedIn() const {
+    return __atomic_load_n(&_migratedIn, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the number of connections moved to another reactor
+ * @return Count
+ */
+size_t Reactor::getMigratedOut() const {
+    return __atomic_load_n(&_migratedOut, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the CPU the thread is pinned to
+ * @return CPU number, -1 if not pinned
+ */
+int Reactor::getCpu() const {
+    return _cpu;
+}
+
+/**
+ * @brief Get the CPU the thread last ran on
+ * @return CPU number (-1 before the thread started)
+ */
+int Reactor::getRunningCpu() const {
+    return __atomic_load_n(&_runningCpu, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Measure how busy the thread was since the last call (state thread)
+ *
+ * Compares the thread's CPU time with the wall time elapsed. Meant to be
+ * called about once a second; getLoad() returns the result.
+ */
+void Reactor::sampleLoad() {
+    if (!_started) {
+        return;
+    }
+    clockid_t clock;
+    struct timespec cpu, wall;
+    if (pthread_getcpuclockid(_thread, &clock) != 0 || clock_gettime(clock, &cpu) != 0) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &wall);
+    double cpuSeconds = cpu.tv_sec + cpu.tv_nsec / 1e9;
+    double wallSeconds = wall.tv_sec + wall.tv_nsec / 1e9;
+    if (_sampleTime > 0 && wallSeconds > _sampleTime) {
+        _load = (cpuSeconds - _sampleCpu) / (wallSeconds - _sampleTime);
+    }
+    _sampleCpu = cpuSeconds;
+    _sampleTime = wallSeconds;
+}
+
+/**
+ * @brief Get the thread's recent load
+ * @return Busy fraction (0..1) over the last sample period
+ */
+double Reactor::getLoad() const {
+    return _load;
+}
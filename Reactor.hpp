@@ -0,0 +1,327 @@
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include "ircserv.hpp"
+#include "BufferPool.hpp"
+#include "SpscRing.hpp"
+#include "MpscMailbox.hpp"
+#include "ChannelShard.hpp"
+#include "Parser.hpp"
+#include <pthread.h>
+
+class Reactor;
+struct ReactorConnection;
+struct ReactorBacklog;
+
+/**
+ * @brief How many tasks the state thread had posted to each shard when it handed output over
+ *
+ * That output must not go out before the lines of those tasks: the
+ * reactor holds it back until every shard has finished as many. Shared by
+ * everything handed over until the next post.
+ */
+struct ShardMark {
+    std::vector<size_t> posted;         // Per shard, in the order of the reactor's shard list
+    int refs;                           // Outputs holding it, plus the state thread (atomic access)
+
+    static void release(ShardMark* mark);  // Drop one reference (NULL does nothing)
+};
+
+/**
+ * @brief What an I/O thread tells the state thread
+ */
+struct ReactorEvent {
+    enum Kind {
+        CONNECT,                        // New connection (fd, addr)
+        COMMAND,                        // One parsed line (line, command)
+        DISCONNECT,                     // Peer closed, socket error or SendQ exceeded (reason)
+        MIGRATED                        // A MIGRATE was carried out (target) or refused (NULL)
+    };
+
+    Kind kind;
+    unsigned long connection;           // Connection id, unique for the server's lifetime
+    int fd;                             // CONNECT: the socket, for log messages only
+    struct sockaddr_in addr;            // CONNECT: peer address
+    std::string line;                   // COMMAND: the raw line (echoed on the console)
+    IRCCommand command;                 // COMMAND: the parsed line
+    std::string reason;                 // DISCONNECT: why
+    Reactor* target;                    // MIGRATED: the reactor that now owns the connection
+    ReactorBacklog* backlog;            // CONNECT: the connection's output counters
+};
+
+/**
+ * @brief What the state thread (or a shard, or another reactor) tells an I/O thread
+ */
+struct ReactorOutput {
+    enum Kind {
+        DATA,                           // Output and/or close request
+        MIGRATE,                        // State thread -> owner: move the connection to target
+        ADOPT,                          // Old owner -> target: take over moved
+        RESUME,                         // State thread -> target: start reading; fences shard fences to wait for
+        UNFORWARD,                      // State thread -> old owner: stop forwarding after fences shard fences
+        FENCE,                          // Shard -> old owner: nothing more from this shard goes there
+        BATCH                           // Shard -> owner: one line for several of its connections
+    };
+
+    Kind kind;
+    unsigned long connection;           // Connection id
+    IoChunk* chain;                     // Rendered output (pooled chunks), may be NULL
+    size_t bytes;                       // Bytes in chain counted in the connection's ReactorBacklog::handed
+    bool close;                         // Close the connection once the output is sent
+    bool forwarded;                     // Passed on by the connection's previous reactor
+    bool fromCore;                      // Sent by the state thread (counted until taken)
+    bool withheld;                      // DATA the state thread held back (counted in ReactorBacklog::caughtUp)
+    Reactor* target;                    // MIGRATE
+    ReactorConnection* moved;           // ADOPT
+    size_t fences;                      // RESUME, UNFORWARD
+    ShardBatch* batch;                  // BATCH (freed by the reactor)
+    ShardMark* mark;                    // DATA from the state thread: shard tasks to wait for (NULL: none)
+
+    ReactorOutput()
+        : kind(DATA), connection(0), chain(NULL), bytes(0), close(false), forwarded(false), fromCore(false),
+          withheld(false), target(NULL), moved(NULL), fences(0), batch(NULL), mark(NULL) {}
+};
+
+/**
+ * @brief How much output a connection has waiting on its reactor
+ *
+ * Lives in the connection (and moves with it), so the state thread can
+ * stop rendering streamed replies for a client whose reactor hasn't sent
+ * the previous ones yet. Bytes handed over but still in the ring count
+ * too: they are handed minus absorbed.
+ *
+ * While the reactor is behind, the state thread keeps the connection's
+ * output in withheld instead of handing it over, one entry per ShardMark,
+ * and hands it over on a later tick. The reactor holds the shards' lines
+ * for the connection back until as many withheld outputs have arrived as
+ * the state thread counted, so they cannot overtake them.
+ */
+struct ReactorBacklog {
+    size_t handed;                      // State thread only: output bytes passed to send() or withheld
+    size_t absorbed;                    // Reactor: of those, bytes taken out of the ring (atomic access)
+    size_t queued;                      // Reactor: bytes in the connection's queues (atomic access)
+    size_t withholds;                   // State thread: outputs ever withheld (atomic access)
+    size_t caughtUp;                    // Reactor only: of those, the ones that arrived
+    std::vector<ReactorOutput> withheld;  // State thread only: output waiting to be handed over, in order
+
+    ReactorBacklog() : handed(0), absorbed(0), queued(0), withholds(0), caughtUp(0) {}
+    size_t pending() const;             // State thread: bytes not written to the socket yet
+};
+
+/**
+ * @brief Output a connection has to wait for (state thread output behind an unmet ShardMark)
+ */
+struct ReactorParked {
+    ReactorOutput output;               // State thread output (mark set), or a shard's line as a chain
+    size_t shard;                       // Shard line: the shard
+    size_t task;                        // Shard line: its task number (0: state thread output)
+};
+
+/**
+ * @brief One socket owned by a reactor, with everything needed to move it to another one
+ */
+struct ReactorConnection {
+    int fd;
+    InputBuffer input;                  // Partial line not yet parsed
+    OutputQueue output;
+    bool gone;                          // Peer gone, waiting for the state thread's close
+    bool closing;                       // State thread asked to close after sending
+    bool paused;                        // Just moved in: not read until the state thread says RESUME
+    bool holding;                       // Just moved in: shard output waits in held for the fences
+    bool resumed;                       // RESUME arrived (fences is the number to wait for)
+    size_t fences;                      // Shard fences still expected once resumed
+    size_t fencesSeen;                  // Shard fences passed on by the previous reactor
+    OutputQueue held;                   // Shard output sent here directly while holding
+    ReactorBacklog backlog;             // Read by the state thread
+    std::deque<ReactorParked> parked;   // Output waiting for shard tasks, in the order it goes out
+};
+
+/**
+ * @brief One I/O thread: its own listener, poll loop and connections
+ *
+ * With io_threads > 0 the server runs several reactors. Each opens its own
+ * listening socket on the server port with SO_REUSEPORT, so the kernel
+ * spreads new connections across them, and does all socket work for its
+ * connections: accept, recv, cutting the input into lines, parsing them and
+ * writing output. It never touches Server, Client or Channel objects.
+ *
+ * An SpscRing carries parsed commands to the state thread (the one running
+ * Server::run). Everything for the reactor comes back through one
+ * MpscMailbox any thread may push to: the state thread's rendered output,
+ * as chains of pooled chunks appended to the connection's queue as they
+ * are, and with channel_shards the shards' channel traffic, as one BATCH
+ * per task naming the line and the connections here that get it. One
+ * queue keeps each connection's output in the order it was produced: the
+ * state thread hands over what it queued before posting a line to a shard
+ * (ChannelShard::publish), so the shard's copy lands behind it. Each
+ * direction has a pipe to wake the other side's poll() after a batch.
+ * BufferPool is per-thread cached, so chunks allocated by the state thread
+ * can be sent and released here.
+ *
+ * The other way round, output the state thread queued after posting a
+ * line can reach the mailbox before the shard has sent that line. It
+ * carries a ShardMark, and waits in the connection's parked list until
+ * every shard has finished the tasks the mark names; a shard line that
+ * arrives meanwhile is put in the list ahead of the parked output that
+ * came after it.
+ *
+ * A reactor can be pinned to a CPU (io_cpus); it then takes its I/O
+ * buffers from that CPU's NUMA node. With reuseport_steering, a classic BPF
+ * program on the listeners sends each connection to the reactor pinned to
+ * the CPU that received its SYN (the CPU serving its RX queue), so the
+ * connection's packets, socket and buffers stay on one core.
+ *
+ * If the state thread falls behind and the inbound ring fills up, events
+ * wait in a local backlog and the reactor stops reading sockets until it
+ * is drained, so the kernel's buffers absorb the burst. The other way the
+ * state thread holds output back on its side once io_backlog of its
+ * outputs are not taken yet (isBehind()), so one slow reactor stalls
+ * only its own clients, and it sees each connection's unsent bytes
+ * (ReactorBacklog) to pace streamed replies. Events are recycled through
+ * a second ring rather than allocated per line.
+ *
+ * A live connection can move to another reactor (Server::migrateClient),
+ * socket, partial input line and unsent output included, without a byte
+ * lost or reordered:
+ *
+ * 1. The state thread stops handing the client's output over and sends
+ *    MIGRATE to the owner. Its earlier output is ahead in the same mailbox.
+ * 2. The owner takes the connection out of its poll set, hands it to the
+ *    target (ADOPT, through the target's mailbox), posts MIGRATED behind
+ *    the lines it already parsed, and from then on forwards whatever still
+ *    arrives for the connection to the target, in order.
+ * 3. The target sends the connection's output but does not read it yet:
+ *    its lines must not overtake those still queued at the old owner.
+ * 4. On MIGRATED the state thread has applied all of those. It points the
+ *    client at the target, sends it RESUME, and posts a MOVE to every
+ *    shard; each shard updates its rosters and sends a FENCE to the old
+ *    owner, which forwards it like any other output. Until every fence has
+ *    come through, output sent straight to the target is held back, so it
+ *    cannot overtake a shard's older, forwarded lines.
+ * 5. After the last fence the old owner forgets the connection (UNFORWARD
+ *    told it how many to expect).
+ */
+class Reactor {
+private:
+    typedef ReactorConnection Connection;
+
+    // A connection that moved away: where its late output goes
+    struct Forward {
+        Reactor* target;
+        size_t fencesSeen;              // Shard fences passed on
+        size_t fences;                  // Shard fences to pass on (known once counted)
+        bool counted;                   // UNFORWARD arrived
+    };
+
+    size_t _index;                      // Reactor number (low bits of connection ids)
+    int _port;
+    size_t _sendQueueLimit;             // Bytes queued before a connection is dropped
+    int _listener;
+    pthread_t _thread;
+    bool _started;
+    int _stop;                          // Set by the state thread, or when the loop ends (atomic access)
+
+    int _toCore[2];                     // Pipe: reactor -> state thread wake-up
+    int _toReactor[2];                  // Pipe: state thread -> reactor wake-up
+    SpscRing<ReactorEvent*> _inbound;   // Written here, read by the state thread
+    SpscRing<ReactorEvent*> _spare;     // Events the state thread is done with, reused here
+    MpscMailbox<ReactorOutput> _delivered;  // Written by the state thread, shards and reactors, read here
+    int _deliverPending;                // A wake-up for _delivered is under way (atomic access)
+    size_t _coreQueued;                 // State thread outputs not taken yet (atomic access)
+    size_t _outputBacklog;              // Untaken state thread outputs from which isBehind() (io_backlog)
+
+    // Reactor thread only
+    std::map<unsigned long, Connection*> _connections;
+    std::map<unsigned long, Forward> _forwards;  // Connections that moved to another reactor
+    std::deque<ReactorEvent*> _backlog; // Events waiting for room in _inbound
+    const std::vector<ChannelShard*>* _shards;  // For ShardMarks (NULL: no channel shards)
+    std::vector<size_t> _finished;      // Tasks each shard had finished, all their lines applied here
+    std::vector<size_t> _finishing;     // The same, read before the drain in progress
+    std::vector<unsigned long> _parkedIds;  // Connections with parked output
+    unsigned long _nextConnection;
+    bool _posted;                       // Events were posted since the last wake-up
+
+    // Counters (written by the reactor, read with atomic loads for STATS)
+    size_t _accepted;
+    size_t _lines;
+    size_t _bytesOut;
+    size_t _stalls;                     // Times the inbound ring was full
+    size_t _open;                       // Connections currently open
+    size_t _migratedIn;                 // Connections moved here from another reactor
+    size_t _migratedOut;                // Connections moved to another reactor
+    int _runningCpu;                    // CPU the thread last ran on
+
+    // Placement and load
+    int _cpu;                           // CPU to pin the thread to (-1: not pinned)
+    double _sampleCpu;                  // State thread: thread CPU time at the last sample
+    double _sampleTime;                 // State thread: wall time at the last sample
+    double _load;                       // State thread: busy fraction over the last sample period
+    size_t _withheld;                   // State thread: outputs held back because this reactor was behind
+
+    // Not copyable (owns a thread and sockets)
+    Reactor(const Reactor& other);
+    Reactor& operator=(const Reactor& other);
+
+public:
+    static const size_t RING_SIZE = 4096;
+
+    Reactor(size_t index, int port, size_t sendQueueLimit, size_t outputBacklog);
+    ~Reactor();
+
+    void setCpu(int cpu);               // Before start(): pin the thread (-1: don't)
+    void setShards(const std::vector<ChannelShard*>* shards);  // Before start(): the shards ShardMarks count
+    bool start();                       // Open the listener and start the thread
+    bool steer(const std::vector<int>& cpus);  // Attach the CPU steering program (cpus: one per reactor)
+    void stop();                        // Ask the thread to finish and wait for it
+
+    // State thread side
+    int getWakeFd() const;              // Readable when events are waiting
+    void clearWake();
+    ReactorEvent* receive();            // Next event, NULL if none
+    void recycle(ReactorEvent* event);  // Give a received event back for reuse
+    void send(const ReactorOutput& output);  // Queue output
+    bool isBehind() const;              // io_backlog outputs not taken yet: hold further ones back
+    void countWithheld();               // One more output held back for this reactor
+
+    // Any thread (channel shards, other reactors)
+    void deliver(const ReactorOutput& output);  // Queue output and wake the reactor if needed
+
+    size_t getAccepted() const;
+    size_t getLines() const;
+    size_t getBytesOut() const;
+    size_t getStalls() const;
+    size_t getWithheld() const;
+    size_t getOpen() const;
+    size_t getMigratedIn() const;
+    size_t getMigratedOut() const;
+    int getCpu() const;                 // Pinned CPU (-1: not pinned)
+    int getRunningCpu() const;          // CPU the thread last ran on
+    void sampleLoad();                  // State thread, about once a second
+    double getLoad() const;             // Busy fraction (0..1) over the last sample period
+
+private:
+    static void* threadMain(void* reactor);
+    void loop();
+    void acceptConnections();
+    void readConnection(unsigned long id, Connection* connection);
+    void receiveOutput();
+    void apply(ReactorOutput& output);
+    void queue(Connection* connection, ReactorOutput& output);
+    void applyBatch(ShardBatch* batch);
+    bool reached(const ShardMark* mark) const;  // Every task it names finished (at the last drain)?
+    void park(unsigned long id, Connection* connection, const ReactorParked& parked);
+    void releaseParked();               // Apply parked output whose turn has come
+    void dropParked(Connection* connection);
+    static bool waitsForCore(const Connection* connection);  // Withheld output still to come?
+    void migrate(std::map<unsigned long, Connection*>::iterator it, Reactor* target);
+    void adopt(unsigned long id, Connection* connection);
+    void pass(ReactorOutput& output);   // For a connection that is not here (any more)
+    void releaseHeld(Connection* connection);
+    void drop(unsigned long id, Connection* connection, const std::string& reason);
+    ReactorEvent* newEvent(ReactorEvent::Kind kind, unsigned long id);  // Recycled if possible
+    void post(ReactorEvent* event);     // Into the ring or the backlog
+    bool flushBacklog();                // true if the backlog is empty afterwards
+    void closeAll();
+};
+
+#endif
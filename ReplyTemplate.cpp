@@ -0,0 +1,142 @@
+#include "ReplyTemplate.hpp"
+#include "Client.hpp"
+#include "Utils.hpp"
+#include "ReplyWriter.hpp"
+
+/**
+ * @brief Constructor for ReplyTemplate class (empty template)
+ */
+ReplyTemplate::ReplyTemplate() : _pieceStart(0), _lines(0) {
+}
+
+/**
+ * @brief Remove all lines
+ */
+void ReplyTemplate::clear() {
+    _text.clear();
+    _pieces.clear();
+    _pieceStart = 0;
+    _lines = 0;
+}
+
+/**
+ * @brief Append literal text
+ * @param text The text (lines must end with \r\n)
+ */
+void ReplyTemplate::addText(const std::string& text) {
+    _text += text;
+}
+
+/**
+ * @brief Append a slot filled in for each client
+ * @param slot SLOT_NICK or SLOT_PREFIX
+ */
+void ReplyTemplate::addSlot(Slot slot) {
+    Piece piece;
+    piece.offset = _pieceStart;
+    piece.length = _text.length() - _pieceStart;
+    piece.slot = slot;
+    _pieces.push_back(piece);
+    _pieceStart = _text.length();
+}
+
+/**
+ * @brief Append a numeric reply line
+ * @param serverName The server name (prefix)
+ * @param code The numeric
+ * @param text Everything after the nickname (e.g. ":Welcome ...")
+ *
+ * The text is cut so that the line stays within 512 bytes even for the
+ * longest nickname, never inside a UTF-8 character (see ReplyWriter::fit).
+ */
+void ReplyTemplate::addNumeric(const std::string& serverName, int code, const std::string& text) {
+    std::string head = ":" + serverName + " " + std::string(Utils::numericDigits(code), 3) + " ";
+    size_t room = 510 - std::min(static_cast<size_t>(510), head.length() + IRC::NICKLEN + 1);
+    addText(head);
+    addSlot(SLOT_NICK);
+    addText(" " + text.substr(0, ReplyWriter::fit(text.data(), text.length(), room)) + "\r\n");
+    _lines++;
+}
+
+/**
+ * @brief Append a NOTICE line
+ * @param serverName The server name (prefix)
+ * @param text The notice text
+ */
+void ReplyTemplate::addNotice(const std::string& serverName, const std::string& text) {
+    addText(":" + serverName + " NOTICE ");
+    addSlot(SLOT_NICK);
+    addText(" :" + text + "\r\n");
+    _lines++;
+}
+
+/**
+ * @brief Queue the template for a client, with the slots filled in
+ * @param client The client
+ *
+ * The exact size is known up front, so the block is written into one
+ * reserved run of the output queue without any intermediate string.
+ */
+void ReplyTemplate::emit(Client* client) const {
+    if (_text.empty()) {
+        return;
+    }
+
+    StringRef nick = client->getNicknameRef();
+    if (nick.length == 0) {
+        nick = StringRef("*", 1);  // Not registered yet
+    }
+    const std::string& user = client->getUsername();
+    const std::string& host = client->getHostname();
+    size_t prefixLength = nick.length + 1 + user.length() + 1 + host.length();
+
+    size_t total = _text.length();
+    for (size_t i = 0; i < _pieces.size(); ++i) {
+        total += _pieces[i].slot == SLOT_PREFIX ? prefixLength : nick.length;
+    }
+
+    OutputQueue& out = client->queueOutput();
+    char* p = out.reserve(total);
+    const char* text = _text.data();
+    for (size_t i = 0; i < _pieces.size(); ++i) {
+        const Piece& piece = _pieces[i];
+        memcpy(p, text + piece.offset, piece.length);
+        p += piece.length;
+        memcpy(p, nick.data, nick.length);
+        p += nick.length;
+        if (piece.slot == SLOT_PREFIX) {
+            *p++ = '!';
+            memcpy(p, user.data(), user.length());
+            p += user.length();
+            *p++ = '@';
+            memcpy(p, host.data(), host.length());
+            p += host.length();
+        }
+    }
+    memcpy(p, text + _pieceStart, _text.length() - _pieceStart);
+    out.commit(total);
+}
+
+/**
+ * @brief Check if the template has no lines
+ * @return true if empty
+ */
+bool ReplyTemplate::empty() const {
+    return _text.empty();
+}
+
+/**
+ * @brief Get the number of lines
+ * @return Line count
+ */
+size_t ReplyTemplate::getLines() const {
+    return _lines;
+}
+
+/**
+ * @brief Get the size of the literal text
+ * @return Bytes
+ */
+size_t ReplyTemplate::getBytes() const {
+    return _text.length();
+}
@@ -0,0 +1,52 @@
+#ifndef REPLYTEMPLATE_HPP
+#define REPLYTEMPLATE_HPP
+
+#include "ircserv.hpp"
+
+/**
+ * @brief A block of pre-rendered reply lines with slots for the client
+ *
+ * Replies that are the same for every client apart from the nickname (the
+ * registration burst, the MOTD) are rendered once into one string. Where the
+ * nickname (or the full nick!user@host) belongs, the template only records
+ * a slot. emit() then copies the pieces and fills the slots in one pass,
+ * straight into one contiguous run of the client's output queue, so the
+ * whole block leaves in a single writev().
+ */
+class ReplyTemplate {
+public:
+    enum Slot {
+        SLOT_NICK,              // Client's nickname
+        SLOT_PREFIX             // Client's nick!user@host
+    };
+
+private:
+    // Literal text followed by a slot
+    struct Piece {
+        size_t offset;          // Start in _text
+        size_t length;          // Length in _text
+        Slot slot;              // What comes after it
+    };
+
+    std::string _text;          // All literal text
+    std::vector<Piece> _pieces;
+    size_t _pieceStart;         // Start of the literal text not yet closed by a slot
+    size_t _lines;              // Lines in the template
+
+public:
+    ReplyTemplate();
+
+    void clear();
+    void addText(const std::string& text);       // Literal text
+    void addSlot(Slot slot);                      // Client-specific text
+    void addNumeric(const std::string& serverName, int code, const std::string& text);  // ":server NNN nick text"
+    void addNotice(const std::string& serverName, const std::string& text);  // ":server NOTICE nick :text"
+
+    void emit(Client* client) const;             // Queue the lines for the client
+
+    bool empty() const;
+    size_t getLines() const;
+    size_t getBytes() const;    // Literal bytes (without slots)
+};
+
+#endif
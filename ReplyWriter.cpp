@@ -0,0 +1,181 @@
+#include "ReplyWriter.hpp"
+#include "Client.hpp"
+#include "Utils.hpp"
+
+/**
+ * @brief Start a numeric reply
+ * @param client The client the reply goes to
+ * @param serverName The server name (prefix)
+ * @param code The numeric (0-999)
+ *
+ * The target is the client's nickname, or "*" before it has one.
+ */
+ReplyWriter::ReplyWriter(Client* client, const std::string& serverName, int code)
+    : _out(client->queueOutput()), _line(_out.reserve(MAX_LINE)), _length(0), _head(0), _lines(0) {
+    append(":", 1);
+    append(serverName.data(), serverName.length());
+    append(" ", 1);
+    append(Utils::numericDigits(code), 3);
+    append(" ", 1);
+    StringRef nick = client->getNicknameRef();
+    if (nick.length == 0) {
+        nick = StringRef("*", 1);
+    }
+    append(nick.data, nick.length);
+}
+
+/**
+ * @brief Add a middle parameter
+ * @param value The parameter (must not contain spaces)
+ * @return This writer
+ */
+ReplyWriter& ReplyWriter::param(const StringRef& value) {
+    append(" ", 1);
+    append(value.data, value.length);
+    return *this;
+}
+
+/**
+ * @brief Add a numeric middle parameter
+ * @param value The number
+ * @return This writer
+ */
+ReplyWriter& ReplyWriter::param(size_t value) {
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[sizeof(digits) - ++count] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    append(" ", 1);
+    append(digits + sizeof(digits) - count, count);
+    return *this;
+}
+
+/**
+ * @brief Add the trailing parameter
+ * @param text The text (may contain spaces, may be empty)
+ * @return This writer
+ */
+ReplyWriter& ReplyWriter::trailing(const StringRef& text) {
+    append(" :", 2);
+    append(text.data, text.length);
+    return *this;
+}
+
+/**
+ * @brief Append more text to the trailing parameter
+ * @param more The text
+ * @return This writer
+ *
+ * Lets a trailing parameter be written from several pieces (e.g. a prefix
+ * as nick, "!", user, "@", host) without joining them first.
+ */
+ReplyWriter& ReplyWriter::text(const StringRef& more) {
+    append(more.data, more.length);
+    return *this;
+}
+
+/**
+ * @brief Add an entry to a space-separated trailing list
+ * @param value The entry
+ * @return This writer
+ */
+ReplyWriter& ReplyWriter::item(const StringRef& value) {
+    return item('\0', value);
+}
+
+/**
+ * @brief Add an entry with a prefix character to a space-separated trailing list
+ * @param prefix Character written before the entry ('\0' for none)
+ * @param value The entry
+ * @return This writer
+ *
+ * The first entry starts the trailing parameter; everything written before
+ * it is the head that each continuation line repeats.
+ */
+ReplyWriter& ReplyWriter::item(char prefix, const StringRef& value) {
+    size_t needed = (prefix ? 1 : 0) + value.length;
+
+    if (_head == 0) {
+        append(" :", 2);
+        _head = _length;
+    } else if (needed + 1 <= MAX_LINE - 2 - _head) {
+        // Continue on a new line if this one is full (an entry longer
+        // than a whole line is cut instead of split)
+        if (needed + 1 > room()) {
+            const char* previous = _line;
+            send();
+            _line = _out.reserve(MAX_LINE);
+            memcpy(_line, previous, _head);
+            _length = _head;
+        } else {
+            _line[_length++] = ' ';
+        }
+    } else {
+        append(" ", 1);
+    }
+
+    if (prefix) {
+        append(&prefix, 1);
+    }
+    append(value.data, value.length);
+    return *this;
+}
+
+/**
+ * @brief Terminate the line with \r\n and queue it
+ */
+void ReplyWriter::send() {
+    _line[_length++] = '\r';
+    _line[_length++] = '\n';
+    _out.commit(_length);
+    _lines++;
+}
+
+/**
+ * @brief Get the number of lines sent (more than one for a split list)
+ * @return Line count
+ */
+size_t ReplyWriter::getLines() const {
+    return _lines;
+}
+
+/**
+ * @brief Work out how much of a text fits into the room left
+ * @param data The bytes
+ * @param length Number of bytes
+ * @param room Bytes available
+ * @return Number of bytes to keep
+ *
+ * A cut never ends inside a UTF-8 character: continuation bytes (10xxxxxx)
+ * at the cut are dropped together with their lead byte.
+ */
+size_t ReplyWriter::fit(const char* data, size_t length, size_t room) {
+    size_t count = std::min(length, room);
+    if (count < length) {
+        while (count > 0 && (static_cast<unsigned char>(data[count]) & 0xC0) == 0x80) {
+            count--;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Copy bytes into the line, cutting what does not fit
+ * @param data The bytes
+ * @param length Number of bytes
+ */
+void ReplyWriter::append(const char* data, size_t length) {
+    size_t count = fit(data, length, room());
+    memcpy(_line + _length, data, count);
+    _length += count;
+}
+
+/**
+ * @brief Get the space left in the line
+ * @return Bytes that can still be written before \r\n
+ */
+size_t ReplyWriter::room() const {
+    return MAX_LINE - 2 - _length;
+}
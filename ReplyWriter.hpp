@@ -0,0 +1,61 @@
+#ifndef REPLYWRITER_HPP
+#define REPLYWRITER_HPP
+
+#include "ircserv.hpp"
+#include "Arena.hpp"
+#include "BufferPool.hpp"
+
+/**
+ * @brief Formats one numeric reply straight into a client's output queue
+ *
+ *     ReplyWriter(client, serverName, IRC::RPL_LIST)
+ *         .param(channel->getName()).param(count).trailing(topic).send();
+ *
+ * produces ":server 322 nick #chan 5 :topic\r\n". The line is written in
+ * place inside the queue's last chunk (see OutputQueue::reserve), and the
+ * numeric comes from a table of three-digit strings, so a reply costs no
+ * heap allocation and no copy.
+ *
+ * Lines never exceed MAX_LINE bytes including \r\n:
+ * - param() and trailing() cut what does not fit (never inside a UTF-8
+ *   character)
+ * - item() builds space-separated lists (NAMES, ISON-style replies); when
+ *   the next item does not fit, the line is sent and a new one is started
+ *   with the same beginning, so long lists are split instead of cut
+ */
+class ReplyWriter {
+public:
+    static const size_t MAX_LINE = 512;     // RFC 1459 line limit, \r\n included
+
+private:
+    OutputQueue& _out;
+    char* _line;                // The line being written (reserved in _out)
+    size_t _length;             // Bytes written so far
+    size_t _head;               // Bytes repeated on each line of a split list (0: no list yet)
+    size_t _lines;              // Lines sent
+
+    // Not copyable
+    ReplyWriter(const ReplyWriter& other);
+    ReplyWriter& operator=(const ReplyWriter& other);
+
+public:
+    ReplyWriter(Client* client, const std::string& serverName, int code);  // ":server NNN nick"
+
+    ReplyWriter& param(const StringRef& value);      // " value"
+    ReplyWriter& param(size_t value);                // " 123"
+    ReplyWriter& trailing(const StringRef& text);    // " :text" (last parameter, may contain spaces)
+    ReplyWriter& text(const StringRef& more);        // Continue the trailing parameter
+    ReplyWriter& item(const StringRef& value);       // Next entry of a " :a b c" list
+    ReplyWriter& item(char prefix, const StringRef& value);  // Same, with a one-character prefix ("@nick")
+    void send();                                     // Terminate and queue the line
+
+    size_t getLines() const;
+
+    static size_t fit(const char* data, size_t length, size_t room);  // Bytes that fit, cut at a UTF-8 boundary
+
+private:
+    void append(const char* data, size_t length);    // Copy what fits
+    size_t room() const;                             // Bytes left before \r\n
+};
+
+#endif
@@ -3,20 +3,120 @@
 #include "Channel.hpp"
 #include "Parser.hpp"
 #include "Utils.hpp"
+#include "TextScanner.hpp"
+#include "ReplyWriter.hpp"
+#include "Capabilities.hpp"
+#include "TaggedMessage.hpp"
+#include "Reactor.hpp"
+#include "ChannelShard.hpp"
+#include <netdb.h>      // For getnameinfo() and getaddrinfo() (hostname lookups)
 
 // Static member definition
 Server* Server::_currentServer = NULL;
 
+/**
+ * @brief Check that a looked-up name can be shown as a hostname
+ * @param name The name from the reverse lookup
+ * @return true if it is short enough and only has letters, digits, dots and dashes
+ *
+ * Reverse zones are controlled by whoever owns the address, so the name
+ * must not be able to break a prefix (spaces, ':', '!', '@').
+ */
+static bool isValidHostname(const std::string& name) {
+    if (name.empty() || name.length() > 63 || name[0] == '.' || name[0] == '-') {
+        return false;
+    }
+    for (size_t i = 0; i < name.length(); ++i) {
+        if (!isalnum(static_cast<unsigned char>(name[i])) && name[i] != '.' && name[i] != '-') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Reverse DNS lookup of a new client's address (resolve_hostnames)
+ *
+ * Runs on the task pool: a lookup can take seconds. The name is only used
+ * if it resolves back to the same address, so nobody can pose as another
+ * host through their reverse zone.
+ */
+class Server::LookupTask : public Task {
+private:
+    struct sockaddr_in _address;
+    std::string _hostname;                  // Result, empty if not found
+
+public:
+    LookupTask(unsigned long owner, const struct sockaddr_in& address) : Task(owner), _address(address) {}
+
+    virtual void run() {
+        char name[NI_MAXHOST];
+        if (getnameinfo(reinterpret_cast<struct sockaddr*>(&_address), sizeof(_address),
+                        name, sizeof(name), NULL, 0, NI_NAMEREQD) != 0 || !isValidHostname(name)) {
+            return;
+        }
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo* addresses;
+        if (getaddrinfo(name, NULL, &hints, &addresses) != 0) {
+            return;
+        }
+        for (struct addrinfo* entry = addresses; entry; entry = entry->ai_next) {
+            const struct sockaddr_in* forward = reinterpret_cast<const struct sockaddr_in*>(entry->ai_addr);
+            if (forward->sin_addr.s_addr == _address.sin_addr.s_addr) {
+                _hostname = name;
+                break;
+            }
+        }
+        freeaddrinfo(addresses);
+    }
+
+    virtual void complete(Server& server, Client* owner) {
+        server.finishLookup(owner, _hostname);
+    }
+};
+
+/**
+ * @brief Content filter rebuild on the task pool (SIGHUP with task_threads)
+ */
+class Server::FilterTask : public Task {
+private:
+    FilterBuild* _build;
+
+public:
+    explicit FilterTask(FilterBuild* build) : Task(0), _build(build) {}
+
+    virtual ~FilterTask() {
+        delete _build->result;              // Still set if it was never installed
+        delete _build;
+    }
+
+    virtual void run() {
+        buildFilter(_build);
+    }
+
+    virtual void complete(Server& server, Client*) {
+        server._filterQueued = false;
+        server.installFilter(_build);
+    }
+};
+
 /**
  * @brief Signal handler for graceful shutdown
  * @param signal The signal number
  * 
  * When the user presses Ctrl+C (SIGINT), this function requests shutdown
- * of the current server instance.
+ * of the current server instance. SIGHUP requests a content filter reload.
  */
 void Server::signalHandler(int signal) {
-    (void)signal;  // Suppress unused parameter warning
-    if (_currentServer) {
+    if (!_currentServer) {
+        return;
+    }
+    if (signal == SIGHUP) {
+        _currentServer->requestReload();
+    } else {
         _currentServer->requestShutdown();
     }
 }
@@ -29,17 +129,148 @@ void Server::requestShutdown() {
     std::cout << "\nServer shutting down gracefully..." << std::endl;
 }
 
+/**
+ * @brief Request a content filter reload
+ *
+ * Only sets a flag: the main loop starts the rebuild at the next tick.
+ */
+void Server::requestReload() {
+    _reloadRequested = 1;
+}
+
 /**
  * @brief Constructor for Server class
  * @param port The port to listen on
  * @param password The server password
+ * @param config Settings from the config file (defaults if none was given)
+ * 
+ * The Client and Channel pools are preallocated from client_pool_capacity and
+ * channel_pool_capacity, so connects and JOINs don't hit the allocator until
+ * those numbers are exceeded.
  */
-Server::Server(int port, const std::string& password) 
-    : _port(port), _password(password), _serverSocket(-1), _shutdown(false), _parser(NULL) {
+Server::Server(int port, const std::string& password, const Config& config) 
+    : _port(port), _password(password), _serverSocket(-1), _shutdown(false), _config(config),
+      _clientPool(config.getSize("client_pool_capacity", 64)),
+      _channelPool(config.getSize("channel_pool_capacity", 32)), _fanoutEpoch(0),
+      _filter(NULL), _filterBuild(NULL), _reloadRequested(0), _parser(NULL),
+      _fanout(config.getSize("fanout_threads", 0), config.getSize("fanout_threshold", 2000)),
+      _tasks(config.getSize("task_threads", 0)) {
     
     _serverName = "ft_irc.42.fr";// maybe set to terminal name
     _creationTime = Utils::getTimestamp();
     
+    // Debug mode: poison scratch memory at the end of each tick
+    _scratch.setPoison(config.getBool("arena_poison", false));
+    
+    // Clients with more queued output than this are disconnected
+    _sendQueueLimit = config.getSize("sendq_limit", 1024 * 1024);
+    
+    // Large WHO results are rendered at most this many rows per client per tick
+    _replyChunk = config.getSize("reply_chunk_lines", 64);
+    if (_replyChunk == 0) {
+        _replyChunk = 1;
+    }
+    
+    // Advertised as MONITOR=<n> in RPL_ISUPPORT
+    _monitorLimit = config.getSize("monitor_limit", 100);
+    
+    // WHO stops after this many rows with ERR_TOOMANYMATCHES
+    _whoLimit = config.getSize("who_limit", 500);
+    if (_whoLimit == 0) {
+        _whoLimit = 1;
+    }
+    
+    // Sockets are handled by this many I/O threads (0: all in the main loop)
+    _ioThreads = config.getSize("io_threads", 0);
+    
+    // Client output waits here while a reactor has this many outputs not taken yet
+    _ioBacklog = config.getSize("io_backlog", 4096);
+    if (_ioBacklog == 0) {
+        _ioBacklog = 1;
+    }
+    
+    // CPU placement: I/O thread i runs on io_cpus[i % count], this thread on main_cpu
+    _ioCpus = Utils::parseCpuList(config.getString("io_cpus", ""));
+    _mainCpu = -1;
+    std::string mainCpu = config.getString("main_cpu", "");
+    if (!mainCpu.empty() && (!Utils::stringToInt(mainCpu, _mainCpu) || _mainCpu < 0)) {
+        std::cerr << "main_cpu: invalid CPU number, not pinning" << std::endl;
+        _mainCpu = -1;
+    }
+    _steering = config.getBool("reuseport_steering", false);
+    _loadSampled = 0;
+    
+    // Clients move off an I/O thread busier than rebalance_load percent, or by MIGRATE
+    _rebalanceLoad = config.getSize("rebalance_load", 0);
+    _rebalanceInterval = static_cast<time_t>(config.getSize("rebalance_interval", 5));
+    _rebalanced = 0;
+    _imbalanced = 0;
+    _adminPassword = config.getString("admin_password", "");
+    _migrations = 0;
+    _migrationsRefused = 0;
+    
+    // Channel traffic is delivered by this many shard threads (0: by this thread)
+    _shardCount = config.getSize("channel_shards", 0);
+    if (_shardCount > 0 && _ioThreads == 0) {
+        std::cerr << "channel_shards needs io_threads; channel traffic stays on the main thread" << std::endl;
+        _shardCount = 0;
+    }
+    _mark = NULL;
+    _markPosted = 0;
+    _fanoutSingle = 0;
+    _fanoutParallel = 0;
+    
+    // Blocking work (hostname lookups, filter rebuilds) runs on this many task threads
+    _nextHandle = 0;
+    _filterQueued = false;
+    _resolveHosts = config.getBool("resolve_hostnames", false);
+    if (_resolveHosts && config.getSize("task_threads", 0) == 0) {
+        std::cerr << "resolve_hostnames needs task_threads; hostnames stay numeric" << std::endl;
+        _resolveHosts = false;
+    }
+    _resolveQueue = config.getSize("resolve_queue", 64);
+    _lookupsRefused = 0;
+    _resolveTimeout = static_cast<time_t>(config.getSize("resolve_timeout", 5));
+    if (_resolveTimeout == 0) {
+        _resolveTimeout = 1;
+    }
+    
+    // Advertised as TARGMAX and CHANLIMIT in RPL_ISUPPORT
+    _maxTargets = config.getSize("max_targets", 4);
+    if (_maxTargets == 0) {
+        _maxTargets = 1;
+    }
+    _channelLimit = config.getSize("channel_limit", 20);
+    if (_channelLimit == 0) {
+        _channelLimit = 1;
+    }
+    
+    // Advertised as UTF8ONLY in RPL_ISUPPORT
+    _utf8Only = config.getBool("utf8_only", false);
+    
+    // Sent after the welcome burst and by MOTD; the file is read when first needed
+    _motd.configure(config.getString("motd_file", ""), _serverName);
+    
+    // The same text may be sent this many times per window by one client or into one channel
+    _floodRepeat = config.getSize("flood_repeat", 5);
+    _floodWindow = static_cast<time_t>(config.getSize("flood_window", 30));
+    if (_floodWindow == 0) {
+        _floodWindow = 1;
+    }
+    _floodChecks = 0;
+    _floodSuppressed = 0;
+    
+    // Initial content filter, built right here so no message skips it
+    memset(&_filterStats, 0, sizeof(_filterStats));
+    FilterBuild initial;
+    initial.rulesPath = config.getString("spam_filter_file", "");
+    buildFilter(&initial);
+    if (!initial.result) {
+        std::cerr << "Warning: content filter: " << initial.error << std::endl;
+        initial.result = new ContentFilter();
+    }
+    _filter = initial.result;
+    
     // Set current server instance for signal handler
     _currentServer = this;
     
@@ -47,6 +278,7 @@ Server::Server(int port, const std::string& password)
     signal(SIGINT, Server::signalHandler);
     signal(SIGTERM, Server::signalHandler);  // Also handle SIGTERM for proper cleanup//maybe not needed
     signal(SIGPIPE, SIG_IGN);  // Ignore SIGPIPE (broken pipe)
+    signal(SIGHUP, Server::signalHandler);  // Reload the content filter
     //maybe SIGQUIT as well?
     
     _parser = new Parser(this);
@@ -58,6 +290,12 @@ Server::Server(int port, const std::string& password)
 Server::~Server() {
     shutdown();
     
+    if (_filterBuild) {
+        finishFilterBuild();
+    }
+    delete _filter;
+    _filter = NULL;
+    
     if (_parser) {
         delete _parser;
         _parser = NULL;
@@ -74,6 +312,25 @@ Server::~Server() {
  * @return true if successful, false otherwise
  */
 bool Server::initialize() {
+    if (_mainCpu >= 0) {
+        if (!Utils::pinThread(_mainCpu)) {
+            std::cerr << "Cannot pin the main thread to CPU " << _mainCpu << std::endl;
+        }
+        BufferPool::instance().localizeThreadCache();
+    }
+    if (!_fanout.start() || !_tasks.start()) {
+        return false;
+    }
+    // Seconds of work with a large channel: only when asked for, never from a command
+    if (_fanout.getThreads() > 0 && _config.getBool("fanout_benchmark", false)) {
+        _fanoutSingle = _fanout.benchmark(10000, _names, false);
+        _fanoutParallel = _fanout.benchmark(10000, _names, true);
+        std::cout << "Fanout benchmark (10000 members): " << static_cast<int>(_fanoutSingle) << " us single-threaded, "
+                  << static_cast<int>(_fanoutParallel) << " us parallel" << std::endl;
+    }
+    if (_ioThreads > 0) {
+        return startShards() && startReactors();
+    }
     return setupSocket();
 }
 
@@ -86,29 +343,77 @@ bool Server::initialize() {
 void Server::run() {
     std::cout << "Server started on port " << _port << std::endl;
     
+    // Formatting code without a Server pointer (Utils, Channel) uses this arena
+    Arena::setActive(&_scratch);
+    
     while (!_shutdown) {
+        // Between ticks nothing is scanning, so a new filter can be swapped in
+        pollFilterReload();
+        
         // Prepare poll array
         _pollFds.clear();
         
+        // With I/O threads this loop only waits for their wake-up pipes
+        for (size_t i = 0; i < _reactors.size(); ++i) {
+            struct pollfd wakePoll;
+            wakePoll.fd = _reactors[i]->getWakeFd();
+            wakePoll.events = POLLIN;
+            wakePoll.revents = 0;
+            _pollFds.push_back(wakePoll);
+        }
+        
         // Add server socket
-        struct pollfd serverPoll;
-        serverPoll.fd = _serverSocket;
-        serverPoll.events = POLLIN;  // We want to know when new connections arrive
-        serverPoll.revents = 0;
-        _pollFds.push_back(serverPoll);
+        if (_reactors.empty()) {
+            struct pollfd serverPoll;
+            serverPoll.fd = _serverSocket;
+            serverPoll.events = POLLIN;  // We want to know when new connections arrive
+            serverPoll.revents = 0;
+            _pollFds.push_back(serverPoll);
+        }
         
         // Add all client sockets
-        for (size_t i = 0; i < _clients.size(); ++i) {
+        for (size_t i = 0; i < _clients.size() && _reactors.empty(); ++i) {
             struct pollfd clientPoll;
             clientPoll.fd = _clients[i]->getFd();
             clientPoll.events = POLLIN;  // We want to know when clients send data
+            if (!_clients[i]->getOutput().empty()) {
+                clientPoll.events |= POLLOUT;  // ...and when we can send what is still queued
+            }
             clientPoll.revents = 0;
             _pollFds.push_back(clientPoll);
         }
         
+        // Finished offloaded tasks signal this eventfd
+        size_t clientPolls = _pollFds.size();
+        if (_tasks.getEventFd() >= 0) {
+            struct pollfd taskPoll;
+            taskPoll.fd = _tasks.getEventFd();
+            taskPoll.events = POLLIN;
+            taskPoll.revents = 0;
+            _pollFds.push_back(taskPoll);
+        }
+        
         // poll() waits for activity on any of the file descriptors
         // timeout of 1000ms (1 second) allows us to check g_shutdown regularly
-        int pollResult = poll(&_pollFds[0], _pollFds.size(), 1000);
+        // Don't sleep while a client with an empty output queue still has replies pending
+        // Wake up often while a filter is being built so it is swapped in soon
+        // With I/O threads nothing wakes us when a reactor has sent a client's
+        // replies or caught up with held back output, so look again soon
+        int timeout = _filterBuild ? 50 : 1000;
+        if (!_withholding.empty()) {
+            timeout = std::min(timeout, static_cast<int>(REPLY_POLL_INTERVAL));
+        }
+        for (size_t i = 0; i < _streaming.size(); ++i) {
+            if (_reactors.empty() ? _streaming[i]->getOutput().empty()
+                                  : getUnsent(_streaming[i]) < REPLY_LOW_WATER) {
+                timeout = 0;
+                break;
+            }
+            if (!_reactors.empty()) {
+                timeout = std::min(timeout, static_cast<int>(REPLY_POLL_INTERVAL));
+            }
+        }
+        int pollResult = poll(&_pollFds[0], _pollFds.size(), timeout);
         
         if (pollResult < 0) {
             if (errno != EINTR) {  // EINTR means interrupted by signal (normal)
@@ -118,17 +423,47 @@ void Server::run() {
             continue;
         }
         
-        if (pollResult == 0) {
-            continue;  // Timeout, check _shutdown and continue
+        // Registration doesn't wait forever for a hostname lookup
+        bool expired = !_lookups.empty() && expireLookups(time(NULL));
+        
+        if (pollResult == 0 && _streaming.empty() && _withholding.empty() && !expired) {
+            // Timeout: nothing is happening, hand cached I/O buffers back to the shared pool
+            BufferPool::instance().trimThreadCache();
+            continue;  // Check _shutdown and continue
+        }
+        
+        if (!_reactors.empty()) {
+            time_t now = time(NULL);
+            if (now != _loadSampled) {
+                _loadSampled = now;
+                for (size_t i = 0; i < _reactors.size(); ++i) {
+                    _reactors[i]->sampleLoad();
+                }
+                if (_rebalanceLoad > 0 && _reactors.size() > 1) {
+                    rebalanceReactors(now);
+                }
+            }
+            receiveFromReactors();
+        }
+        
+        if (clientPolls < _pollFds.size() && (_pollFds[clientPolls].revents & POLLIN)) {
+            receiveCompletions();
         }
         
         // Check for new connections on server socket
-        if (_pollFds[0].revents & POLLIN) {
+        if (_reactors.empty() && (_pollFds[0].revents & POLLIN)) {
             acceptNewClient();
         }
         
         // Check for data from existing clients
-        for (size_t i = 1; i < _pollFds.size(); ++i) {
+        for (size_t i = 1; i < clientPolls && _reactors.empty(); ++i) {
+            if (_pollFds[i].revents & POLLOUT) {
+                Client* client = getClientByFd(_pollFds[i].fd);
+                if (client && !flushClient(client)) {
+                    continue;  // Client was disconnected
+                }
+            }
+            
             if (_pollFds[i].revents & POLLIN) {
                 Client* client = getClientByFd(_pollFds[i].fd);
                 if (client) {
@@ -144,7 +479,18 @@ void Server::run() {
                 }
             }
         }
+        
+        // Render more of the large replies, send what this tick queued
+        // (after what earlier ticks held back), then forget the tick's
+        // scratch memory
+        pumpReplies();
+        handOffWithheld();
+        handOffQueued();
+        flushAllClients();
+        _scratch.reset();
     }
+    
+    Arena::setActive(NULL);
 }
 
 /**
@@ -159,12 +505,25 @@ void Server::shutdown() {
     }
     
     // Clean up all channels
-    for (std::map<std::string, Channel*>::iterator it = _channels.begin(); 
+    for (std::map<InternedString, Channel*>::iterator it = _channels.begin(); 
          it != _channels.end(); ++it) {
-        delete it->second;
+        destroyChannel(it->second);
     }
     _channels.clear();
     
+    _fanout.stop();
+    _tasks.stop();
+    
+    // Shards deliver what was posted, then the I/O threads send it and close their sockets;
+    // the reactors read the shards' task counts until they stop
+    for (size_t i = 0; i < _shards.size(); ++i) {
+        _shards[i]->stop();
+    }
+    stopReactors();
+    stopShards();
+    ShardMark::release(_mark);
+    _mark = NULL;
+    
     // Close server socket
     if (_serverSocket >= 0) {
         close(_serverSocket);
@@ -199,61 +558,117 @@ void Server::acceptNewClient() {
         return;
     }
     
-    // Get client hostname
-    std::string hostname = getClientHostname(clientFd);
+    // Create new client object - the address stays binary until the hostname is needed
+    Client* newClient = new (_clientPool.allocate()) Client(clientFd, clientAddr, _names);
     
-    // Create new client object
-    Client* newClient = new Client(clientFd, hostname);
-    _clients.push_back(newClient);
+    std::cout << "New client connected from " << inet_ntoa(clientAddr.sin_addr) << " (fd: " << clientFd << ")" << std::endl;
+    admitClient(newClient);
+}
+
+/**
+ * @brief Start tracking a new connection
+ * @param client The client (its reactor connection already set, if any)
+ *
+ * Gives the client its handle and, with resolve_hostnames, starts the
+ * reverse lookup; registration then waits for it (or for resolve_timeout).
+ * With resolve_queue lookups already waiting, a connection burst doesn't
+ * pile up more: the client keeps its address.
+ */
+void Server::admitClient(Client* client) {
+    client->setHandle(++_nextHandle);
+    _handles[client->getHandle()] = client;
+    _clients.push_back(client);
+    _index.update(client);
     
-    std::cout << "New client connected from " << hostname << " (fd: " << clientFd << ")" << std::endl;
+    if (_resolveHosts && _lookups.size() >= _resolveQueue) {
+        _lookupsRefused++;
+        Utils::sendToClient(client, ":" + _serverName + " NOTICE * :*** Too many hostname lookups in progress, using your IP address");
+    } else if (_resolveHosts) {
+        client->setResolving(true);
+        PendingLookup& lookup = _lookups[client->getHandle()];
+        lookup.deadline = time(NULL) + _resolveTimeout;
+        lookup.task = new LookupTask(client->getHandle(), client->getAddress());
+        Utils::sendToClient(client, ":" + _serverName + " NOTICE * :*** Looking up your hostname...");
+        runTask(lookup.task);
+    }
 }
 
 /**
  * @brief Remove a client safely
  * @param client The client to remove
+ * @param reason Reason shown in the QUIT message
+ * 
+ * Every client sharing at least one channel gets exactly one QUIT,
+ * no matter how many channels they share.
  */
-void Server::removeClient(Client* client) {
+void Server::removeClient(Client* client, const std::string& reason) {
     if (!client) return;
     
     std::cout << "Removing client " << client->getNickname() << " (fd: " << client->getFd() << ")" << std::endl;
     
-    // Remove client from all channels
-    for (std::map<std::string, Channel*>::iterator it = _channels.begin(); 
-         it != _channels.end(); ) {
-        Channel* channel = it->second;
-        if (channel->hasClient(client)) {
-            // Send QUIT message to channel members
-            if (client->isRegistered()) {
-                std::string quitMsg = Utils::formatMessage(client->getPrefix(), "QUIT", ":Client disconnected");
-                channel->broadcast(quitMsg, client);
-            }
-            
-            channel->removeClient(client);
-            
-            // Remove empty channels
-            if (channel->getClientCount() == 0) {
-                delete channel;
-                std::map<std::string, Channel*>::iterator toErase = it;
-                ++it;
-                _channels.erase(toErase);
-                continue;
-            }
+    // Send one QUIT message to each neighbor
+    if (client->isRegistered()) {
+        ScratchWriter quitMsg(Arena::active());
+        quitMsg.append(':');
+        client->appendPrefix(quitMsg);
+        quitMsg.append(" QUIT :").append(reason).append("\r\n", 2);
+        sendToNeighbors(client, quitMsg.str(), false);
+    }
+    
+    // Drop the client's own MONITOR list, then tell whoever watches it
+    _monitors.clear(client);
+    if (client->isRegistered()) {
+        notifyPresence(client, false);
+    }
+    
+    // Remove client from all its channels (copy: removeClient() edits the client's list)
+    std::vector<Channel*> channels = client->getChannels();
+    for (size_t i = 0; i < channels.size(); ++i) {
+        Channel* channel = channels[i];
+        channel->removeClient(client);
+        
+        // Remove empty channels
+        if (channel->getClientCount() == 0) {
+            InternedString key = channel->getNameHandle();
+            destroyChannel(channel);
+            _channels.erase(key);
         }
-        ++it;
     }
     
-    // Close socket
-    close(client->getFd());
+    if (client->getReactor()) {
+        // The reactor sends what is still queued, then closes the socket
+        std::vector<Client*>::iterator listed = std::find(_handOffs.begin(), _handOffs.end(), client);
+        if (listed != _handOffs.end()) {
+            _handOffs.erase(listed);
+        }
+        listed = std::find(_withholding.begin(), _withholding.end(), client);
+        if (listed != _withholding.end()) {
+            _withholding.erase(listed);
+        }
+        handOff(client, true);
+    } else {
+        // Best effort: deliver what is still queued before closing
+        client->getOutput().flush(client->getFd());
+        
+        // Close socket
+        close(client->getFd());
+    }
     
-    // Remove from clients vector
+    // Remove from clients vector and the indexes
     std::vector<Client*>::iterator it = std::find(_clients.begin(), _clients.end(), client);
     if (it != _clients.end()) {
         _clients.erase(it);
     }
+    _index.remove(client);
+    _handles.erase(client->getHandle());
+    dropLookup(client);
+    it = std::find(_streaming.begin(), _streaming.end(), client);
+    if (it != _streaming.end()) {
+        _streaming.erase(it);
+    }
     
-    // Delete client object
-    delete client;
+    // Destroy client object and recycle its slot
+    _clientPool.destroy(client);
 }
 
 /**
@@ -262,215 +677,1572 @@ void Server::removeClient(Client* client) {
  * @return Pointer to client or NULL if not found
  */
 Client* Server::getClientByNick(const std::string& nickname) {
-    for (size_t i = 0; i < _clients.size(); ++i) {
-        if (_clients[i]->getNickname() == nickname) {
-            return _clients[i];
-        }
-    }
-    return NULL;
+    return _index.findNick(nickname);
 }
 
 /**
- * @brief Get client by file descriptor
- * @param fd The file descriptor to search for
- * @return Pointer to client or NULL if not found
+ * @brief Find a client by handle
+ * @param handle The handle (see Client::getHandle)
+ * @return The client, or NULL if it disconnected
  */
-Client* Server::getClientByFd(int fd) {
-    for (size_t i = 0; i < _clients.size(); ++i) {
-        if (_clients[i]->getFd() == fd) {
-            return _clients[i];
-        }
-    }
-    return NULL;
+Client* Server::findClient(unsigned long handle) const {
+    std::map<unsigned long, Client*>::const_iterator it = _handles.find(handle);
+    return it != _handles.end() ? it->second : NULL;
 }
 
 /**
- * @brief Get channel by name
- * @param name The channel name
- * @return Pointer to channel or NULL if not found
+ * @brief Run a blocking task off the event loop
+ * @param task The task (owned by the server from now on)
+ *
+ * With task_threads the task goes to the pool and completes in a later
+ * tick (receiveCompletions). Without, it runs and completes right here.
  */
-Channel* Server::getChannel(const std::string& name) {
-    std::map<std::string, Channel*>::iterator it = _channels.find(name);
-    if (it != _channels.end()) {
-        return it->second;
+void Server::runTask(Task* task) {
+    if (_tasks.submit(task)) {
+        return;
     }
-    return NULL;
+    task->run();
+    task->complete(*this, findClient(task->getOwner()));
+    delete task;
 }
 
 /**
- * @brief Create a new channel
- * @param name The channel name
- * @return Pointer to the new channel
+ * @brief Hand the finished tasks to their owners
+ *
+ * A task whose client disconnected while it ran is dropped: its handle
+ * finds nothing, even if the client's slot already holds a new client.
  */
-Channel* Server::createChannel(const std::string& name) {
-    Channel* channel = new Channel(name);
-    _channels[name] = channel;
-    return channel;
+void Server::receiveCompletions() {
+    Task* task;
+    while (_tasks.takeCompleted(task)) {
+        Client* owner = NULL;
+        if (task->getOwner() != 0) {
+            owner = findClient(task->getOwner());
+            if (!owner) {
+                _tasks.retire(task, true);
+                continue;
+            }
+        }
+        task->complete(*this, owner);
+        _tasks.retire(task, false);
+    }
 }
 
 /**
- * @brief Remove a channel
- * @param name The channel name
+ * @brief Let clients whose lookup takes too long register with their address
+ * @param now Current time
+ * @return true if any lookup was given up (replies were queued)
  */
-void Server::removeChannel(const std::string& name) {
-    std::map<std::string, Channel*>::iterator it = _channels.find(name);
-    if (it != _channels.end()) {
-        delete it->second;
-        _channels.erase(it);
+bool Server::expireLookups(time_t now) {
+    std::vector<Client*> expired;
+    for (std::map<unsigned long, PendingLookup>::iterator it = _lookups.begin(); it != _lookups.end(); ++it) {
+        if (it->second.deadline <= now) {
+            expired.push_back(findClient(it->first));
+        }
     }
+    for (size_t i = 0; i < expired.size(); ++i) {
+        finishLookup(expired[i], "");
+    }
+    return !expired.empty();
 }
 
 /**
- * @brief Process data from a client
+ * @brief Use the result of a client's hostname lookup and go on with registration
  * @param client The client
- * 
- * recv() reads data from the client's socket.
- * We accumulate data in a buffer until we have complete lines.
+ * @param hostname The verified name, empty if none was found (or the lookup was given up)
+ *
+ * A result that arrives after the lookup was given up is ignored: the
+ * client may already be registered under its address.
  */
-void Server::processClientData(Client* client) {
-    char buffer[512];
-    
-    // recv() reads data from the socket
-    ssize_t bytesRead = recv(client->getFd(), buffer, sizeof(buffer) - 1, 0);
-    
-    if (bytesRead <= 0) {
-        if (bytesRead == 0) {
-            std::cout << "Client disconnected gracefully" << std::endl;
-        } else {
-            std::cerr << "Error reading from client: " << strerror(errno) << std::endl;
-        }
-        handleClientDisconnect(client);
+void Server::finishLookup(Client* client, const std::string& hostname) {
+    if (!client->isResolving()) {
         return;
     }
+    client->setResolving(false);
+    dropLookup(client);
     
-    buffer[bytesRead] = '\0';
-    client->appendToBuffer(buffer);
-    
-    // Process complete commands (lines ending with \r\n or just \n)
-    std::string& clientBuffer = const_cast<std::string&>(client->getBuffer());
-    size_t pos = 0;
-    
-    // First try to find \r\n (proper IRC)
-    while ((pos = clientBuffer.find("\r\n")) != std::string::npos) {
-        std::string command = clientBuffer.substr(0, pos);
-        clientBuffer.erase(0, pos + 2);  // Remove processed command + \r\n
-        
-        if (!command.empty()) {
-            std::cout << command << std::endl;
-            IRCCommand cmd = _parser->parseCommand(command);
-            _parser->executeCommand(client, cmd);
-            
-            // Check if client was deleted (e.g., by QUIT command)
-            // If client is not in our list anymore, it was deleted
-            bool clientExists = false;
-            for (size_t i = 0; i < _clients.size(); ++i) {
-                if (_clients[i] == client) {
-                    clientExists = true;
-                    break;
-                }
-            }
-            if (!clientExists) {
-                return; // Client was deleted, stop processing
-            }
-        }
-    }
-    
-    // Also handle lines ending with just \n (for nc compatibility)
-    while ((pos = clientBuffer.find("\n")) != std::string::npos) {
-        std::string command = clientBuffer.substr(0, pos);
-        clientBuffer.erase(0, pos + 1);  // Remove processed command + \n
-        
-        // Remove trailing \r if present
-        if (!command.empty() && command[command.length()-1] == '\r') {
-            command.erase(command.length()-1);
-        }
-        
-        if (!command.empty()) {
-            std::cout << command << std::endl;
-            IRCCommand cmd = _parser->parseCommand(command);
-            _parser->executeCommand(client, cmd);
-            
-            // Check if client was deleted (e.g., by QUIT command)
-            bool clientExists = false;
-            for (size_t i = 0; i < _clients.size(); ++i) {
-                if (_clients[i] == client) {
-                    clientExists = true;
-                    break;
-                }
-            }
-            if (!clientExists) {
-                return; // Client was deleted, stop processing
-            }
-        }
+    if (!hostname.empty()) {
+        client->setHostname(intern(hostname));
+        _index.update(client);
+        Utils::sendToClient(client, ":" + _serverName + " NOTICE * :*** Found your hostname");
+    } else {
+        Utils::sendToClient(client, ":" + _serverName + " NOTICE * :*** Couldn't look up your hostname, using your IP address instead");
     }
-    
-    // Limit buffer size to prevent memory attacks
-    if (clientBuffer.length() > 512) {
-        clientBuffer.clear();
-        handleClientDisconnect(client);
-        return; // Important: return immediately after disconnecting // new!!!
+    _parser->completeRegistration(client);
+}
+
+/**
+ * @brief Stop waiting for a client's hostname lookup
+ * @param client The client
+ *
+ * A worker that has not started the lookup yet skips it: the client left,
+ * or registration went on without it. The task still comes back and is
+ * dropped or ignored there.
+ */
+void Server::dropLookup(Client* client) {
+    std::map<unsigned long, PendingLookup>::iterator it = _lookups.find(client->getHandle());
+    if (it != _lookups.end()) {
+        it->second.task->cancel();
+        _lookups.erase(it);
     }
 }
 
 /**
- * @brief Handle client disconnection
- * @param client The client that disconnected
+ * @brief Update the indexes after a client's nickname or username changed
+ * @param client The client
  */
-void Server::handleClientDisconnect(Client* client) {
-    removeClient(client);
+void Server::indexClient(Client* client) {
+    _index.update(client);
 }
 
 /**
- * @brief Get the server password
- * @return The password
+ * @brief Find clients whose nickname, username or hostname matches a mask
+ * @param mask Glob mask ('*' and '?')
+ * @param results Matching clients are appended here
  */
-const std::string& Server::getPassword() const {
-    return _password;
+void Server::findClients(const std::string& mask, std::vector<Client*>& results) {
+    _index.match(mask, results);
 }
 
 /**
- * @brief Get the server name
- * @return The server name
+ * @brief Queue a reply to be rendered once the client's output has room
+ * @param client The client
+ * @param reply The reply
+ * @return false if the client already has PENDING_LIMIT replies waiting (the reply is dropped)
  */
-const std::string& Server::getServerName() const {
-    return _serverName;
+bool Server::queueReply(Client* client, const PendingReply& reply) {
+    if (client->getPendingCount() >= PENDING_LIMIT) {
+        return false;
+    }
+    if (!client->hasPendingReplies()) {
+        _streaming.push_back(client);
+    }
+    client->queueReply(reply);
+    return true;
 }
 
 /**
- * @brief Get the server creation time
- * @return The creation time
+ * @brief Step through the channels within a member count range
+ * @param minMembers Smallest member count wanted
+ * @param maxMembers Largest member count wanted
+ * @param cursor Where the walk stands
+ * @return The next channel, biggest first, or NULL when there are no more
  */
-const std::string& Server::getCreationTime() const {
-    return _creationTime;
+Channel* Server::nextChannel(size_t minMembers, size_t maxMembers, ChannelIndex::Cursor& cursor) {
+    return _channelIndex.next(minMembers, maxMembers, cursor);
 }
 
 /**
- * @brief Broadcast message to all clients
- * @param message The message to send
- * @param exclude Client to exclude (optional)
+ * @brief Get the MONITOR subscriptions
+ * @return Reference to the monitor index
  */
-void Server::broadcastToAll(const std::string& message, Client* exclude) {
-    for (size_t i = 0; i < _clients.size(); ++i) {
-        if (_clients[i] != exclude && _clients[i]->isRegistered()) {
-            Utils::sendToClient(_clients[i], message);
-        }
-    }
+MonitorIndex& Server::getMonitors() {
+    return _monitors;
 }
 
 /**
- * @brief Set up the server socket
- * @return true if successful, false otherwise
- * 
- * This function creates and configures the main server socket that listens for connections.
+ * @brief Get the maximum number of MONITOR entries per client
+ * @return The limit
  */
-bool Server::setupSocket() {
-    // socket() creates a new socket
-    // AF_INET = IPv4, SOCK_STREAM = TCP, 0 = default protocol
-    _serverSocket = socket(AF_INET, SOCK_STREAM, 0);
-    if (_serverSocket < 0) {
-        std::cerr << "Error creating socket: " << strerror(errno) << std::endl;
-        return false;
-    }
+size_t Server::getMonitorLimit() const {
+    return _monitorLimit;
+}
+
+/**
+ * @brief Get the most rows one WHO reply may have
+ * @return The who_limit setting
+ */
+size_t Server::getWhoLimit() const {
+    return _whoLimit;
+}
+
+/**
+ * @brief Get the maximum number of targets of one PRIVMSG/NOTICE/TAGMSG
+ * @return The limit
+ */
+size_t Server::getMaxTargets() const {
+    return _maxTargets;
+}
+
+/**
+ * @brief Get the maximum number of channels per client
+ * @return The limit
+ */
+size_t Server::getChannelLimit() const {
+    return _channelLimit;
+}
+
+/**
+ * @brief Check if only valid UTF-8 text is accepted
+ * @return true with utf8_only
+ */
+bool Server::isUtf8Only() const {
+    return _utf8Only;
+}
+
+/**
+ * @brief Get the message of the day cache
+ * @return Reference to the cache
+ */
+MotdCache& Server::getMotd() {
+    return _motd;
+}
+
+/**
+ * @brief Find a registered client by nickname
+ * @param nickname The nickname (exact, like NICK)
+ * @return The client, or NULL if nobody with that nick is online
+ */
+Client* Server::findOnline(const std::string& nickname) {
+    Client* client = _index.findNick(nickname);
+    return (client && client->isRegistered()) ? client : NULL;
+}
+
+/**
+ * @brief Tell the watchers of a client's nickname that it came or went
+ * @param client The client (its current nickname is the one announced)
+ * @param online true for RPL_MONONLINE, false for RPL_MONOFFLINE
+ * 
+ * Only clients in the reverse index entry for the nickname are visited.
+ */
+void Server::notifyPresence(Client* client, bool online) {
+    const std::vector<Client*>& watchers = _monitors.getWatchers(client->getNickname());
+    if (watchers.empty()) {
+        return;
+    }
+    
+    int code = online ? IRC::RPL_MONONLINE : IRC::RPL_MONOFFLINE;
+    for (size_t i = 0; i < watchers.size(); ++i) {
+        ReplyWriter reply(watchers[i], _serverName, code);
+        reply.trailing(client->getNicknameRef());
+        if (online) {
+            reply.text("!").text(client->getUsername()).text("@").text(client->getHostname());
+        }
+        reply.send();
+    }
+    _monitors.countNotifications(watchers.size());
+}
+
+/**
+ * @brief Scan a message for blocked phrases
+ * @param text The message text
+ * @param rules Indexes of the rules found, whatever their channel (see isFiltered)
+ * @return true if any rule was found
+ *
+ * Every PRIVMSG is scanned exactly once, before any fanout and however many
+ * targets it has.
+ */
+bool Server::scanFilter(const std::string& text, std::vector<size_t>& rules) {
+    if (_filter->getRuleCount() == 0) {
+        return false;
+    }
+    
+    _filter->scanAll(text.data(), text.length(), rules);
+    _filterStats.messages++;
+    _filterStats.bytes += text.length();
+    return !rules.empty();
+}
+
+/**
+ * @brief Check whether the rules a message hit block it for one target
+ * @param rules Rules found by scanFilter
+ * @param channel Target channel, or empty for a private message (global rules only)
+ * @return true if the message must not be delivered there
+ */
+bool Server::isFiltered(const std::vector<size_t>& rules, const std::string& channel) {
+    std::string folded;
+    for (size_t i = 0; i < rules.size(); ++i) {
+        const ContentFilter::Rule& rule = _filter->getRule(rules[i]);
+        if (!rule.channel.empty()) {
+            if (channel.empty()) {
+                continue;
+            }
+            if (folded.empty()) {
+                folded = MaskMatcher::fold(channel);
+            }
+            if (rule.channel != folded) {
+                continue;
+            }
+        }
+        _filterStats.blocked++;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Count a message in its sender's flood table
+ * @param sender The sending client
+ * @param hash FloodGuard::hash() of the text
+ * @return true if the sender repeated the text too often (nothing may be delivered)
+ *
+ * Called once per message, however many targets it has, so a message to
+ * five channels counts as one copy for the sender. Going over flood_repeat
+ * within flood_window seconds suppresses the message before any recipient
+ * gets a copy.
+ */
+bool Server::isFlooding(Client* sender, unsigned int hash) {
+    if (_floodRepeat == 0) {
+        return false;
+    }
+    _floodChecks++;
+    if (sender->getRecentMessages().record(hash, time(NULL), _floodWindow) <= _floodRepeat) {
+        return false;
+    }
+    _floodSuppressed++;
+    return true;
+}
+
+/**
+ * @brief Count a message in a target channel's flood table
+ * @param channel The channel
+ * @param hash FloodGuard::hash() of the text
+ * @return true if the channel saw the text too often (many clients pasting one line)
+ */
+bool Server::isFlooding(Channel* channel, unsigned int hash) {
+    if (_floodRepeat == 0) {
+        return false;
+    }
+    if (channel->getRecentMessages().record(hash, time(NULL), _floodWindow) <= _floodRepeat) {
+        return false;
+    }
+    _floodSuppressed++;
+    return true;
+}
+
+/**
+ * @brief Get client by file descriptor
+ * @param fd The file descriptor to search for
+ * @return Pointer to client or NULL if not found
+ */
+Client* Server::getClientByFd(int fd) {
+    for (size_t i = 0; i < _clients.size(); ++i) {
+        if (_clients[i]->getFd() == fd) {
+            return _clients[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Get channel by name
+ * @param name The channel name
+ * @return Pointer to channel or NULL if not found
+ */
+Channel* Server::getChannel(const std::string& name) {
+    // A name that isn't pooled can't belong to any channel
+    InternedString key = _names.find(name);
+    if (key.empty()) {
+        return NULL;
+    }
+    
+    std::map<InternedString, Channel*>::iterator it = _channels.find(key);
+    if (it != _channels.end()) {
+        return it->second;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Create a new channel
+ * @param name The channel name
+ * @return Pointer to the new channel
+ */
+Channel* Server::createChannel(const std::string& name) {
+    InternedString key = _names.intern(name);
+    Channel* channel = new (_channelPool.allocate()) Channel(key, &_channelIndex);
+    channel->setShard(shardFor(name));
+    channel->setFanout(&_fanout);
+    _channels[key] = channel;
+    return channel;
+}
+
+/**
+ * @brief Remove a channel
+ * @param name The channel name
+ */
+void Server::removeChannel(const std::string& name) {
+    InternedString key = _names.find(name);
+    if (key.empty()) {
+        return;
+    }
+    
+    std::map<InternedString, Channel*>::iterator it = _channels.find(key);
+    if (it != _channels.end()) {
+        destroyChannel(it->second);
+        _channels.erase(it);
+    }
+}
+
+/**
+ * @brief Destroy a channel and recycle its slot
+ * @param channel The channel (must already be unlinked or about to be erased from _channels)
+ */
+void Server::destroyChannel(Channel* channel) {
+    _channelPool.destroy(channel);
+}
+
+/**
+ * @brief Process data from a client
+ * @param client The client
+ * 
+ * recv() reads data from the client's socket.
+ * We accumulate data in a buffer until we have complete lines.
+ */
+void Server::processClientData(Client* client) {
+    InputBuffer& input = client->getInput();
+    
+    // recv() reads data from the socket straight into the client's pooled buffer
+    ssize_t bytesRead = input.readFrom(client->getFd());
+    
+    if (bytesRead <= 0) {
+        if (bytesRead == 0) {
+            std::cout << "Client disconnected gracefully" << std::endl;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return;  // Nothing to read after all
+        } else {
+            std::cerr << "Error reading from client: " << strerror(errno) << std::endl;
+        }
+        handleClientDisconnect(client);
+        return;
+    }
+    
+    // Process complete commands (lines ending with \r\n or just \n for nc compatibility).
+    // Lines are parsed in place; the consumed part is dropped once at the end.
+    const char* data = input.data();
+    size_t length = input.length();
+    size_t start = 0;
+    
+    while (start < length) {
+        const char* newline = static_cast<const char*>(memchr(data + start, '\n', length - start));
+        if (!newline) {
+            break;  // Partial line, wait for more data
+        }
+        
+        const char* line = data + start;
+        size_t lineLength = newline - line;
+        start += lineLength + 1;  // Skip processed command + \n
+        
+        // Remove trailing \r if present
+        if (lineLength > 0 && line[lineLength - 1] == '\r') {
+            lineLength--;
+        }
+        
+        if (lineLength > 0) {
+            IRCCommand cmd = _parser->parseCommand(line, lineLength);
+            logLine(line, lineLength, cmd);
+            _parser->executeCommand(client, cmd);
+            
+            // Check if client was deleted (e.g., by QUIT command)
+            // If client is not in our list anymore, it was deleted
+            if (!hasClient(client)) {
+                return; // Client was deleted, stop processing
+            }
+        }
+    }
+    input.consume(start);  // Returns the buffer to the pool once it is empty
+    
+    // Limit buffer size to prevent memory attacks (lines may carry tags with message-tags)
+    size_t lineLimit = 512;
+    if (client->hasCap(Capabilities::CAP_MESSAGE_TAGS)) {
+        lineLimit += IRC::TAGS_LENGTH;
+    }
+    if (input.length() > lineLimit) {
+        input.release();
+        handleClientDisconnect(client);
+        return; // Important: return immediately after disconnecting // new!!!
+    }
+}
+
+/**
+ * @brief Write a client's queued output to its socket
+ * @param client The client
+ * @return false if the client was disconnected (socket error or SendQ exceeded)
+ * 
+ * Whatever the socket doesn't accept stays queued; poll() will report
+ * POLLOUT when there is room again. A client whose queue keeps growing
+ * beyond sendq_limit can't keep up and is disconnected.
+ */
+bool Server::flushClient(Client* client) {
+    OutputQueue& output = client->getOutput();
+    if (output.empty()) {
+        return true;
+    }
+    
+    if (!_reactors.empty()) {
+        handOff(client, false);  // The reactor writes it and enforces sendq_limit
+        return true;
+    }
+    
+    if (output.flush(client->getFd()) < 0) {
+        std::cerr << "Error sending to client: " << strerror(errno) << std::endl;
+        output.clear();
+        handleClientDisconnect(client);
+        return false;
+    }
+    
+    if (output.size() > _sendQueueLimit) {
+        std::cerr << "SendQ exceeded for client (fd: " << client->getFd() << ")" << std::endl;
+        output.clear();
+        handleClientDisconnect(client);
+        return false;
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Render pending replies for clients whose output queue has room
+ * 
+ * A WHO or LIST matching thousands of entries would otherwise render all its rows
+ * in one go: a long stall for everybody else, and an output queue that may
+ * even exceed the SendQ limit. Instead each client gets at most _replyChunk
+ * rows per tick, and only while less than REPLY_LOW_WATER bytes are queued,
+ * so the rows go out at the speed the client reads them. With io_threads
+ * the output is handed to the reactor every tick, so what counts is what
+ * the reactor hasn't written yet (getUnsent).
+ */
+void Server::pumpReplies() {
+    for (size_t i = 0; i < _streaming.size(); ) {
+        Client* client = _streaming[i];
+        
+        size_t rendered = 0;
+        while (client->hasPendingReplies() && rendered < _replyChunk &&
+               getUnsent(client) < REPLY_LOW_WATER) {
+            rendered++;
+            if (client->peekReply().kind == PendingReply::LIST_SCAN) {
+                if (!_parser->sendNextListRow(client, client->peekReply().list)) {
+                    client->popReply();  // Walk finished
+                }
+                continue;
+            }
+            
+            PendingReply reply = client->popReply();
+            if (reply.kind == PendingReply::WHO_ROW) {
+                Client* about = findClient(reply.handle);
+                if (about) {  // Skip clients that left since the query
+                    _parser->sendWhoReply(client, about, reply.channel);
+                }
+            } else if (reply.kind == PendingReply::LIST_ROW) {
+                Channel* channel = getChannel(reply.name);
+                if (channel) {  // Skip channels that were emptied since the query
+                    _parser->sendListReply(client, channel);
+                }
+            } else {
+                Utils::sendToClient(client, reply.line);
+            }
+        }
+        
+        if (client->hasPendingReplies()) {
+            ++i;
+        } else {
+            _streaming.erase(_streaming.begin() + i);
+        }
+    }
+}
+
+/**
+ * @brief Get how much of a client's output has not reached its socket yet
+ * @param client The client
+ * @return Bytes queued here, plus those its reactor has not written
+ */
+size_t Server::getUnsent(Client* client) const {
+    size_t unsent = client->getOutput().size();
+    if (client->getBacklog()) {
+        unsent += client->getBacklog()->pending();
+    }
+    return unsent;
+}
+
+/**
+ * @brief Flush every client with queued output (end of each tick)
+ */
+void Server::flushAllClients() {
+    for (size_t i = 0; i < _clients.size(); ) {
+        Client* client = _clients[i];
+        if (flushClient(client)) {
+            ++i;  // Otherwise the client was removed and index i holds the next one
+        }
+    }
+}
+
+/**
+ * @brief Check if a client is still connected
+ * @param client The client pointer to look for
+ * @return true if it is in our client list
+ */
+bool Server::hasClient(Client* client) const {
+    return std::find(_clients.begin(), _clients.end(), client) != _clients.end();
+}
+
+/**
+ * @brief Start a requested content filter build, or swap in a finished one
+ *
+ * Reading and compiling a large rules file takes far longer than a tick, so
+ * it runs on a helper thread while the loop keeps serving clients with the
+ * old filter. The loop only ever replaces the pointer here, between ticks,
+ * so no scan can see a half-built filter. A SIGHUP that arrives during a
+ * build is kept and starts another build once this one is done.
+ * 
+ * With task_threads the build is a task on the pool instead, and the new
+ * filter is swapped in when the loop collects the finished task.
+ */
+void Server::pollFilterReload() {
+    if (_filterBuild) {
+        pthread_mutex_lock(&_filterBuild->lock);
+        bool done = _filterBuild->done;
+        pthread_mutex_unlock(&_filterBuild->lock);
+        if (done) {
+            finishFilterBuild();
+        }
+        return;
+    }
+    
+    if (!_reloadRequested || _filterQueued) {
+        return;
+    }
+    _reloadRequested = 0;
+    
+    FilterBuild* build = new FilterBuild();
+    build->done = false;
+    build->configPath = _config.getPath();
+    build->rulesPath = _config.getString("spam_filter_file", "");
+    build->result = NULL;
+    if (_tasks.getThreads() > 0) {
+        _filterQueued = true;
+        runTask(new FilterTask(build));
+        std::cout << "Reloading content filter..." << std::endl;
+        return;
+    }
+    pthread_mutex_init(&build->lock, NULL);
+    if (pthread_create(&build->thread, NULL, &Server::filterThread, build) != 0) {
+        std::cerr << "Warning: content filter: cannot start builder thread" << std::endl;
+        pthread_mutex_destroy(&build->lock);
+        delete build;
+        return;
+    }
+    _filterBuild = build;
+    std::cout << "Reloading content filter..." << std::endl;
+}
+
+/**
+ * @brief Join the builder thread and swap in its filter
+ *
+ * Blocks until the thread is done (only when shutting down is it not done yet).
+ * A failed build keeps the old filter.
+ */
+void Server::finishFilterBuild() {
+    FilterBuild* build = _filterBuild;
+    _filterBuild = NULL;
+    pthread_join(build->thread, NULL);
+    pthread_mutex_destroy(&build->lock);
+    installFilter(build);
+    delete build;
+}
+
+/**
+ * @brief Swap in a freshly built filter
+ * @param build The finished build; its result now belongs to the server
+ * 
+ * A failed build keeps the old filter.
+ */
+void Server::installFilter(FilterBuild* build) {
+    if (build->result) {
+        delete _filter;
+        _filter = build->result;
+        build->result = NULL;
+        _filterStats.reloads++;
+        std::cout << "Content filter reloaded: " << _filter->getRuleCount() << " rules, "
+                  << _filter->getStateCount() << " states" << std::endl;
+    } else {
+        std::cerr << "Warning: content filter not reloaded: " << build->error << std::endl;
+    }
+}
+
+/**
+ * @brief Read the rules and compile a filter
+ * @param build Paths in, filter (or error) out
+ *
+ * Touches nothing but the build, so it can run on the builder thread. The
+ * config file is re-read so that SIGHUP also picks up a changed
+ * spam_filter_file; other settings keep their startup values.
+ */
+void Server::buildFilter(FilterBuild* build) {
+    build->result = NULL;
+    
+    if (!build->configPath.empty()) {
+        Config config;
+        if (!config.load(build->configPath)) {
+            build->error = "cannot read " + build->configPath;
+            return;
+        }
+        build->rulesPath = config.getString("spam_filter_file", "");
+    }
+    
+    ContentFilter* filter = new ContentFilter();
+    if (!build->rulesPath.empty() && !filter->loadFile(build->rulesPath, build->error)) {
+        delete filter;
+        return;
+    }
+    filter->compile();
+    build->result = filter;
+}
+
+/**
+ * @brief Builder thread entry point
+ * @param build The FilterBuild
+ * @return NULL
+ */
+void* Server::filterThread(void* build) {
+    FilterBuild* job = static_cast<FilterBuild*>(build);
+    buildFilter(job);
+    
+    pthread_mutex_lock(&job->lock);
+    job->done = true;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+/**
+ * @brief Handle client disconnection
+ * @param client The client that disconnected
+ */
+void Server::handleClientDisconnect(Client* client) {
+    removeClient(client);
+}
+
+/**
+ * @brief Get the server password
+ * @return The password
+ */
+const std::string& Server::getPassword() const {
+    return _password;
+}
+
+/**
+ * @brief Seconds before a client's address may give an admin password again
+ * @param client The client
+ * @return 0 if a password is checked right now
+ */
+time_t Server::adminRetryIn(const Client* client) const {
+    std::map<std::string, AdminFailures>::const_iterator it =
+        _adminFailures.find(inet_ntoa(client->getAddress().sin_addr));
+    time_t now = time(NULL);
+    if (it == _adminFailures.end() || it->second.retry <= now) {
+        return 0;
+    }
+    return it->second.retry - now;
+}
+
+/**
+ * @brief Check the password for administrative commands (MIGRATE)
+ * @param client The client giving it
+ * @param password The password given
+ * @return false if it is wrong or admin_password is not set
+ *
+ * Each wrong password in a row doubles how long the client's address has
+ * to wait before the next one is checked (1 s, 2 s, 4 s ... up to
+ * ADMIN_RETRY_MAX), so guessing is slow even across reconnects. A right
+ * password, or a quiet ADMIN_RETRY_MAX after the wait, starts over.
+ */
+bool Server::checkAdminPassword(const Client* client, const std::string& password) {
+    if (_adminPassword.empty()) {
+        return false;
+    }
+    std::string address = inet_ntoa(client->getAddress().sin_addr);
+    if (password == _adminPassword) {
+        _adminFailures.erase(address);
+        return true;
+    }
+
+    time_t now = time(NULL);
+    std::map<std::string, AdminFailures>::iterator it = _adminFailures.begin();
+    while (it != _adminFailures.end()) {
+        if (it->second.retry + ADMIN_RETRY_MAX < now) {
+            _adminFailures.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+    AdminFailures& failures = _adminFailures[address];
+    time_t wait = failures.count < 6 ? static_cast<time_t>(1) << failures.count : ADMIN_RETRY_MAX;
+    failures.count++;
+    failures.retry = now + (wait < ADMIN_RETRY_MAX ? wait : ADMIN_RETRY_MAX);
+    std::cout << "Wrong admin password from " << address << " (" << failures.count << " in a row)" << std::endl;
+    return false;
+}
+
+/**
+ * @brief Get the server name
+ * @return The server name
+ */
+const std::string& Server::getServerName() const {
+    return _serverName;
+}
+
+/**
+ * @brief Get the server creation time
+ * @return The creation time
+ */
+const std::string& Server::getCreationTime() const {
+    return _creationTime;
+}
+
+/**
+ * @brief Get a pooled handle for an identifier
+ * @param value The hostname, username or channel name
+ * @return Handle shared with every other user of the same string
+ */
+InternedString Server::intern(const std::string& value) {
+    return _names.intern(value);
+}
+
+/**
+ * @brief Collect statistics lines for the STATS command
+ * @param query The STATS letter ('m' = memory)
+ * @param lines Vector the report lines are appended to
+ */
+void Server::collectStats(char query, std::vector<std::string>& lines) {
+    if (query == 'm') {
+        lines.push_back("Intern pool: " + Utils::intToString(static_cast<int>(_names.size())) + " entries, " +
+                        Utils::intToString(static_cast<int>(_names.getBytesStored())) + " bytes stored, " +
+                        Utils::intToString(static_cast<int>(_names.getBytesSaved())) + " bytes saved");
+        lines.push_back("Intern pool: " + Utils::intToString(static_cast<int>(_names.getLookups())) + " lookups, " +
+                        Utils::intToString(static_cast<int>(_names.getHitRate())) + "% hit rate");
+        
+        size_t clientBytes = 0;
+        for (size_t i = 0; i < _clients.size(); ++i) {
+            clientBytes += _clients[i]->getMemoryUsage();
+        }
+        size_t perClient = _clients.empty() ? 0 : clientBytes / _clients.size();
+        lines.push_back("Clients: " + Utils::intToString(static_cast<int>(_clients.size())) + " connected, " +
+                        Utils::intToString(static_cast<int>(clientBytes)) + " bytes, " +
+                        Utils::intToString(static_cast<int>(perClient)) + " bytes per connection");
+        lines.push_back("Client pool: " + Utils::intToString(static_cast<int>(_clientPool.getLive())) + " live, " +
+                        Utils::intToString(static_cast<int>(_clientPool.getFree())) + " free, " +
+                        Utils::intToString(static_cast<int>(_clientPool.getHighWater())) + " high-water");
+        lines.push_back("Channel pool: " + Utils::intToString(static_cast<int>(_channelPool.getLive())) + " live, " +
+                        Utils::intToString(static_cast<int>(_channelPool.getFree())) + " free, " +
+                        Utils::intToString(static_cast<int>(_channelPool.getHighWater())) + " high-water");
+        lines.push_back("Scratch arena: " + Utils::intToString(static_cast<int>(_scratch.getBlockCount())) + " blocks, " +
+                        Utils::intToString(static_cast<int>(_scratch.getBytesReserved())) + " bytes reserved, " +
+                        Utils::intToString(static_cast<int>(_scratch.getPeakUsed())) + " bytes peak per tick, " +
+                        Utils::intToString(static_cast<int>(_scratch.getOversized())) + " oversized" +
+                        (_scratch.isPoisoned() ? " (poison on)" : ""));
+        BufferPool::ClassStats slabs[BufferPool::CLASS_COUNT];
+        BufferPool::instance().getStats(slabs);
+        size_t pooledBytes = 0;
+        for (size_t i = 0; i < BufferPool::CLASS_COUNT; ++i) {
+            size_t utilization = slabs[i].total ? (slabs[i].inUse * 100) / slabs[i].total : 0;
+            pooledBytes += slabs[i].inUse * slabs[i].chunkSize;
+            lines.push_back("I/O slab " + Utils::intToString(static_cast<int>(slabs[i].chunkSize)) + "B: " +
+                            Utils::intToString(static_cast<int>(slabs[i].slabs)) + " slabs, " +
+                            Utils::intToString(static_cast<int>(slabs[i].inUse)) + "/" +
+                            Utils::intToString(static_cast<int>(slabs[i].total)) + " chunks in use (" +
+                            Utils::intToString(static_cast<int>(utilization)) + "%), " +
+                            Utils::intToString(static_cast<int>(slabs[i].depotFree)) + " in depot, " +
+                            Utils::intToString(static_cast<int>(slabs[i].cached)) + " in thread caches");
+        }
+        
+        // Internal fragmentation: pooled chunk bytes not holding queued data
+        size_t bufferedBytes = 0;
+        for (size_t i = 0; i < _clients.size(); ++i) {
+            bufferedBytes += _clients[i]->getInput().length() + _clients[i]->getOutput().size();
+        }
+        size_t fragmentation = pooledBytes ? ((pooledBytes - bufferedBytes) * 100) / pooledBytes : 0;
+        lines.push_back("I/O buffers: " + Utils::intToString(static_cast<int>(bufferedBytes)) + " bytes buffered in " +
+                        Utils::intToString(static_cast<int>(pooledBytes)) + " pooled bytes (" +
+                        Utils::intToString(static_cast<int>(fragmentation)) + "% internal fragmentation)");
+        size_t masks = 0;
+        for (std::map<InternedString, Channel*>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
+            masks += it->second->getMaskList('b')->size() + it->second->getMaskList('e')->size() +
+                     it->second->getMaskList('I')->size();
+        }
+        lines.push_back("Channel masks: " + Utils::intToString(static_cast<int>(masks)) + " listed, " +
+                        Utils::intToString(static_cast<int>(MaskMatcher::getChecks())) + " checks, " +
+                        Utils::intToString(static_cast<int>(MaskMatcher::getGlobTests())) + " glob tests");
+        size_t silenced = 0;
+        for (size_t i = 0; i < _clients.size(); ++i) {
+            if (_clients[i]->getSilence()) {
+                silenced++;
+            }
+        }
+        lines.push_back("Silence lists: " + Utils::intToString(static_cast<int>(silenced)) + " clients, " +
+                        Utils::intToString(static_cast<int>(SilenceList::getChecks())) + " checks, " +
+                        Utils::intToString(static_cast<int>(SilenceList::getFilterPasses())) + " passed by bloom filter, " +
+                        Utils::intToString(static_cast<int>(SilenceList::getDropped())) + " dropped");
+        lines.push_back("Client index: " + Utils::intToString(static_cast<int>(_index.size())) + " clients, " +
+                        Utils::intToString(static_cast<int>(_index.getQueries())) + " queries, " +
+                        Utils::intToString(static_cast<int>(_index.getScans())) + " full scans, " +
+                        Utils::intToString(static_cast<int>(_index.getVisited())) + " entries visited, " +
+                        Utils::intToString(static_cast<int>(_streaming.size())) + " clients streaming replies");
+        lines.push_back("Channel index: " + Utils::intToString(static_cast<int>(_channelIndex.size())) + " channels, " +
+                        Utils::intToString(static_cast<int>(_channelIndex.getQueries())) + " LIST queries, " +
+                        Utils::intToString(static_cast<int>(_channelIndex.getVisited())) + " channels visited");
+        lines.push_back("Monitor: " + Utils::intToString(static_cast<int>(_monitors.getSubscriptions())) + " subscriptions, " +
+                        Utils::intToString(static_cast<int>(_monitors.getWatchedNicks())) + " nicknames watched, " +
+                        Utils::intToString(static_cast<int>(_monitors.getNotifications())) + " notifications sent");
+        lines.push_back("Content filter: " + Utils::intToString(static_cast<int>(_filter->getRuleCount())) + " rules, " +
+                        Utils::intToString(static_cast<int>(_filter->getStateCount())) + " states x " +
+                        Utils::intToString(static_cast<int>(_filter->getClassCount())) + " classes, " +
+                        Utils::intToString(static_cast<int>(_filter->getTableBytes())) + " bytes, " +
+                        Utils::intToString(static_cast<int>(_filterStats.reloads)) + " reloads");
+        lines.push_back("Content scans: " + Utils::intToString(static_cast<int>(_filterStats.messages)) + " messages, " +
+                        Utils::intToString(static_cast<int>(_filterStats.bytes)) + " bytes, " +
+                        Utils::intToString(static_cast<int>(_filterStats.blocked)) + " blocked");
+        lines.push_back("Flood guard: " + Utils::intToString(static_cast<int>(_floodChecks)) + " messages checked, " +
+                        Utils::intToString(static_cast<int>(_floodSuppressed)) + " suppressed, " +
+                        Utils::intToString(static_cast<int>(sizeof(FloodGuard))) + " bytes per channel/client");
+        lines.push_back("Text scanner: " + Utils::intToString(static_cast<int>(TextScanner::getMessages())) + " texts, " +
+                        Utils::intToString(static_cast<int>(TextScanner::getBytes())) + " bytes, " +
+                        Utils::intToString(static_cast<int>(TextScanner::getFastBytes())) + " bytes on the " +
+                        (TextScanner::hasVectorPath() ? "SSE2" : "(absent) vector") + " path");
+        for (size_t i = 0; i < _reactors.size(); ++i) {
+            lines.push_back("I/O thread " + Utils::intToString(static_cast<int>(i)) + ": " +
+                            Utils::intToString(static_cast<int>(_reactors[i]->getOpen())) + " connections (" +
+                            Utils::intToString(static_cast<int>(_reactors[i]->getAccepted())) + " accepted), " +
+                            Utils::intToString(static_cast<int>(_reactors[i]->getLines())) + " lines in, " +
+                            Utils::intToString(static_cast<int>(_reactors[i]->getBytesOut())) + " bytes out, " +
+                            Utils::intToString(static_cast<int>(_reactors[i]->getStalls())) + " ring stalls, " +
+                            Utils::intToString(static_cast<int>(_reactors[i]->getWithheld())) + " outputs held back, " +
+                            Utils::intToString(static_cast<int>(_reactors[i]->getMigratedIn())) + " moved in, " +
+                            Utils::intToString(static_cast<int>(_reactors[i]->getMigratedOut())) + " moved out, " +
+                            Utils::intToString(static_cast<int>(_reactors[i]->getLoad() * 100)) + "% load on CPU " +
+                            Utils::intToString(_reactors[i]->getRunningCpu()) +
+                            (_reactors[i]->getCpu() >= 0 ? " (pinned)" : ""));
+        }
+        if (_reactors.size() > 1) {
+            lines.push_back("Connection moves: " + Utils::intToString(static_cast<int>(_migrations)) + " done, " +
+                            Utils::intToString(static_cast<int>(_migrationsRefused)) + " refused, rebalancing " +
+                            (_rebalanceLoad > 0 ? "from " + Utils::intToString(static_cast<int>(_rebalanceLoad)) +
+                                                  "% load every " + Utils::intToString(static_cast<int>(_rebalanceInterval)) + "s"
+                                                : std::string("off")));
+        }
+        if (!_reactors.empty() || _mainCpu >= 0) {
+            lines.push_back("CPU placement: main thread " +
+                            (_mainCpu >= 0 ? "pinned to CPU " + Utils::intToString(_mainCpu) : std::string("not pinned")) + ", " +
+                            Utils::intToString(static_cast<int>(BufferPool::instance().getNodeCount())) + " NUMA node(s) with local buffer depots, " +
+                            "connection steering " + (_steering ? "on" : "off"));
+        }
+        if (_fanout.getThreads() > 0) {
+            double average = _fanout.getBroadcasts() > 0 ? _fanout.getSeconds() * 1e6 / _fanout.getBroadcasts() : 0;
+            lines.push_back("Parallel fanout: " + Utils::intToString(static_cast<int>(_fanout.getThreads())) + " threads from " +
+                            Utils::intToString(static_cast<int>(_fanout.getThreshold())) + " members, " +
+                            Utils::intToString(static_cast<int>(_fanout.getBroadcasts())) + " broadcasts, " +
+                            Utils::intToString(static_cast<int>(_fanout.getRecipients())) + " lines, " +
+                            Utils::intToString(static_cast<int>(average)) + " us average");
+            if (_fanoutParallel > 0) {
+                lines.push_back("Fanout benchmark (10000 members, at startup): " +
+                                Utils::intToString(static_cast<int>(_fanoutSingle)) + " us single-threaded, " +
+                                Utils::intToString(static_cast<int>(_fanoutParallel)) + " us parallel");
+            }
+        }
+        if (_tasks.getThreads() > 0) {
+            std::string workers;
+            for (size_t i = 0; i < _tasks.getThreads(); ++i) {
+                workers += (i > 0 ? ", " : "") + Utils::intToString(static_cast<int>(_tasks.getExecuted(i))) + " (" +
+                           Utils::intToString(static_cast<int>(_tasks.getStolen(i))) + " stolen)";
+            }
+            lines.push_back("Task pool: " + Utils::intToString(static_cast<int>(_tasks.getThreads())) + " threads, " +
+                            Utils::intToString(static_cast<int>(_tasks.getSubmitted())) + " tasks, " +
+                            Utils::intToString(static_cast<int>(_tasks.getDelivered())) + " completed, " +
+                            Utils::intToString(static_cast<int>(_tasks.getDropped())) + " dropped (client gone), " +
+                            Utils::intToString(static_cast<int>(_tasks.getPending())) + " pending, " +
+                            Utils::intToString(static_cast<int>(_tasks.getSkipped())) + " skipped (cancelled), " +
+                            Utils::intToString(static_cast<int>(_lookups.size())) + " hostname lookups waiting, " +
+                            Utils::intToString(static_cast<int>(_lookupsRefused)) + " refused (queue full); run per thread: " +
+                            workers);
+        }
+        for (size_t i = 0; i < _shards.size(); ++i) {
+            lines.push_back("Channel shard " + Utils::intToString(static_cast<int>(i)) + ": " +
+                            Utils::intToString(static_cast<int>(_shards[i]->getChannels())) + " channels, " +
+                            Utils::intToString(static_cast<int>(_shards[i]->getTasks())) + " tasks, " +
+                            Utils::intToString(static_cast<int>(_shards[i]->getDeliveries())) + " lines delivered");
+        }
+        lines.push_back("Tagged messages: " + Utils::intToString(static_cast<int>(TaggedMessage::getMessages())) + " relayed, " +
+                        Utils::intToString(static_cast<int>(TaggedMessage::getRenders())) + " tagged renders, " +
+                        Utils::intToString(static_cast<int>(TaggedMessage::getDeliveries())) + " lines queued");
+        const ReplyTemplate& welcome = _parser->getWelcome();
+        lines.push_back("Welcome burst: " + Utils::intToString(static_cast<int>(welcome.getLines())) + " lines, " +
+                        Utils::intToString(static_cast<int>(welcome.getBytes())) + " bytes pre-rendered; MOTD: " +
+                        Utils::intToString(static_cast<int>(_motd.getLines())) + " lines, " +
+                        Utils::intToString(static_cast<int>(_motd.getRenders())) + " renders");
+        size_t coldRecords = 0;
+        for (size_t i = 0; i < _clients.size(); ++i) {
+            if (_clients[i]->hasColdRecord()) {
+                coldRecords++;
+            }
+        }
+        size_t recordBytes = sizeof(Client) * _clients.size() + sizeof(ClientInfo) * coldRecords;
+        lines.push_back("Client record: " + Utils::intToString(static_cast<int>(sizeof(Client))) + " bytes hot, " +
+                        Utils::intToString(static_cast<int>(sizeof(ClientInfo))) + " bytes cold; " +
+                        Utils::intToString(static_cast<int>(coldRecords)) + " of " +
+                        Utils::intToString(static_cast<int>(_clients.size())) + " clients have a cold record, " +
+                        Utils::intToString(static_cast<int>(_clients.empty() ? 0 : recordBytes / _clients.size())) +
+                        " bytes per client on average");
+    }
+}
+
+/**
+ * @brief Broadcast message to all clients
+ * @param message The message to send
+ * @param exclude Client to exclude (optional)
+ */
+void Server::broadcastToAll(const std::string& message, Client* exclude) {
+    for (size_t i = 0; i < _clients.size(); ++i) {
+        if (_clients[i] != exclude && _clients[i]->isRegistered()) {
+            Utils::sendToClient(_clients[i], message);
+        }
+    }
+}
+
+/**
+ * @brief Send a line to every client that shares a channel with a client
+ * @param client The client whose neighbors get the line
+ * @param line The line, including the trailing \r\n
+ * @param includeSelf Whether the client itself gets the line too
+ * @return Number of clients the line was sent to
+ * 
+ * Used for NICK and QUIT, which concern everyone who can see the client
+ * and nobody else. We walk the members of the client's channels and use
+ * a fresh epoch number to mark who already got the line, so each neighbor
+ * receives it exactly once even when sharing many channels.
+ * 
+ * Neighbors met through a sharded channel get the line from that channel's
+ * shard, after whatever the shard still has queued for them from this
+ * client. The line is rendered once for all shards.
+ */
+size_t Server::sendToNeighbors(Client* client, const StringRef& line, bool includeSelf) {
+    unsigned int epoch = ++_fanoutEpoch;
+    if (epoch == 0) {
+        // Wrapped around: reset every mark so no stale mark equals a future epoch
+        for (size_t i = 0; i < _clients.size(); ++i) {
+            _clients[i]->markFanout(0);
+        }
+        epoch = ++_fanoutEpoch;
+    }
+    
+    size_t sent = 0;
+    TaggedMessage message(line);
+    client->markFanout(epoch);
+    if (includeSelf) {
+        message.send(client);
+        sent++;
+    }
+    
+    std::map<ChannelShard*, ShardTask*> tasks;
+    const std::vector<Channel*>& channels = client->getChannels();
+    for (size_t i = 0; i < channels.size(); ++i) {
+        ChannelShard* shard = channels[i]->getShard();
+        ShardTask* task = NULL;
+        if (shard) {
+            ShardTask*& slot = tasks[shard];
+            if (!slot) {
+                slot = new ShardTask();
+                slot->kind = ShardTask::DIRECT;
+            }
+            task = slot;
+        }
+        const std::vector<Client*>& members = channels[i]->getClients();
+        for (size_t j = 0; j < members.size(); ++j) {
+            if (members[j]->markFanout(epoch)) {
+                if (task) {
+                    ShardMember target;
+                    target.reactor = members[j]->getReactor();
+                    target.connection = members[j]->getConnection();
+                    target.caps = members[j]->getCaps();
+                    task->targets.push_back(target);
+                } else {
+                    message.send(members[j]);
+                }
+                sent++;
+            }
+        }
+    }
+    
+    if (!tasks.empty()) {
+        ShardLine* shared = ChannelShard::share(message, static_cast<int>(tasks.size()));
+        for (std::map<ChannelShard*, ShardTask*>::iterator it = tasks.begin(); it != tasks.end(); ++it) {
+            it->second->line = shared;
+            it->first->publish(it->second);
+        }
+    }
+    
+    return sent;
+}
+
+/**
+ * @brief Start the I/O threads (io_threads > 0)
+ * @return true if all of them are listening
+ */
+bool Server::startReactors() {
+    std::vector<int> cpus;
+    for (size_t i = 0; i < _ioThreads; ++i) {
+        Reactor* reactor = new Reactor(i, _port, _sendQueueLimit, _ioBacklog);
+        _reactors.push_back(reactor);
+        cpus.push_back(_ioCpus.empty() ? -1 : _ioCpus[i % _ioCpus.size()]);
+        reactor->setCpu(cpus.back());
+        reactor->setShards(_shards.empty() ? NULL : &_shards);
+        if (!reactor->start()) {
+            stopReactors();
+            return false;
+        }
+    }
+    std::cout << "Using " << _ioThreads << " I/O threads" << std::endl;
+    
+    // Without steering the kernel hashes connections over the listeners
+    _steering = _steering && _reactors[0]->steer(cpus);
+    if (_steering) {
+        std::cout << "Steering connections to the I/O thread on their RX CPU" << std::endl;
+    }
+    return true;
+}
+
+/**
+ * @brief Stop and delete the I/O threads
+ */
+void Server::stopReactors() {
+    // Stop them all first: one may still pass a moving connection to another
+    for (size_t i = 0; i < _reactors.size(); ++i) {
+        _reactors[i]->stop();
+    }
+    for (size_t i = 0; i < _reactors.size(); ++i) {
+        delete _reactors[i];
+    }
+    _reactors.clear();
+}
+
+/**
+ * @brief Apply everything the I/O threads forwarded since the last tick
+ * 
+ * Connections become clients, parsed lines are executed exactly as if this
+ * thread had read them, and closed connections are removed. Events for a
+ * connection whose client is already gone (it sent QUIT, or was dropped)
+ * are ignored.
+ */
+void Server::receiveFromReactors() {
+    for (size_t r = 0; r < _reactors.size(); ++r) {
+        Reactor* reactor = _reactors[r];
+        reactor->clearWake();
+        
+        ReactorEvent* event;
+        while ((event = reactor->receive()) != NULL) {
+            if (event->kind == ReactorEvent::CONNECT) {
+                Client* client = new (_clientPool.allocate()) Client(event->fd, event->addr, _names);
+                client->setConnection(reactor, event->connection, event->backlog);
+                if (!_shards.empty()) {
+                    client->setHandOffList(&_handOffs);
+                }
+                _remote[event->connection] = client;
+                std::cout << "New client connected from " << inet_ntoa(event->addr.sin_addr)
+                          << " (fd: " << event->fd << ", I/O thread " << r << ")" << std::endl;
+                admitClient(client);
+            } else {
+                std::map<unsigned long, Client*>::iterator it = _remote.find(event->connection);
+                if (it != _remote.end()) {
+                    if (event->kind == ReactorEvent::COMMAND) {
+                        logLine(event->line.data(), event->line.size(), event->command);
+                        it->second->countActivity();
+                        _parser->executeCommand(it->second, event->command);
+                    } else if (event->kind == ReactorEvent::MIGRATED) {
+                        finishMigration(it->second, reactor, event->target);
+                    } else {
+                        std::cout << event->reason << std::endl;
+                        removeClient(it->second, event->reason);
+                    }
+                }
+            }
+            reactor->recycle(event);
+        }
+    }
+}
+
+/**
+ * @brief Move a client's queued output to its I/O thread
+ * @param client The client (must have a reactor connection)
+ * @param close true when the client is being removed: the reactor closes the socket after sending
+ * 
+ * The chunks change owner as they are; nothing is copied. While the socket
+ * moves to another reactor the output stays here (only a close goes out,
+ * and the old reactor passes it on). While the reactor is behind it is
+ * withheld instead; a close hands over what was withheld first.
+ */
+void Server::handOff(Client* client, bool close) {
+    Reactor* reactor = client->getReactor();
+    if (!reactor || (client->isMigrating() && !close)) {
+        return;
+    }
+    ReactorOutput output;
+    output.connection = client->getConnection();
+    output.bytes = client->getOutput().size();
+    output.chain = client->getOutput().detach();
+    output.close = close;
+    if (output.chain || close) {
+        if (!_shards.empty()) {
+            output.mark = currentMark();
+        }
+        client->getBacklog()->handed += output.bytes;
+        if (!close && reactor->isBehind()) {
+            withhold(client, output);
+        } else {
+            sendWithheld(client);
+            reactor->send(output);
+        }
+    }
+    if (close) {
+        _remote.erase(client->getConnection());
+        client->setConnection(NULL, 0, NULL);
+    }
+}
+
+/**
+ * @brief Keep a client's output here until its reactor catches up
+ * @param client The client
+ * @param output Its output, with the mark for now
+ *
+ * Output with the same mark joins the previous piece: nothing was posted
+ * to a shard in between. Each new piece is counted in the backlog before
+ * the next post, so the reactor holds the shards' later lines for the
+ * connection back until the piece arrives.
+ */
+void Server::withhold(Client* client, ReactorOutput& output) {
+    std::vector<ReactorOutput>& withheld = client->getBacklog()->withheld;
+    if (withheld.empty()) {
+        _withholding.push_back(client);
+    }
+    if (!withheld.empty() && withheld.back().mark == output.mark) {
+        OutputQueue joined;
+        joined.appendChain(withheld.back().chain);
+        joined.appendChain(output.chain);
+        withheld.back().chain = joined.detach();
+        withheld.back().bytes += output.bytes;
+        ShardMark::release(output.mark);
+        return;
+    }
+    output.withheld = true;
+    withheld.push_back(output);
+    __atomic_fetch_add(&client->getBacklog()->withholds, 1, __ATOMIC_RELEASE);
+    client->getReactor()->countWithheld();
+}
+
+/**
+ * @brief Hand a client's withheld output to its reactor, in order
+ * @param client The client (it stays on _withholding; callers take it off)
+ */
+void Server::sendWithheld(Client* client) {
+    std::vector<ReactorOutput>& withheld = client->getBacklog()->withheld;
+    for (size_t i = 0; i < withheld.size(); ++i) {
+        client->getReactor()->send(withheld[i]);
+    }
+    withheld.clear();
+}
+
+/**
+ * @brief Retry the output held back for reactors that were behind (end of each tick)
+ *
+ * A client whose unsent output, held back or not, passed sendq_limit is
+ * disconnected; its held back output is dropped and no longer counted, so
+ * the reactor stops waiting for it.
+ */
+void Server::handOffWithheld() {
+    for (size_t i = 0; i < _withholding.size(); ) {
+        Client* client = _withholding[i];
+        ReactorBacklog* backlog = client->getBacklog();
+        if (getUnsent(client) > _sendQueueLimit) {
+            for (size_t j = 0; j < backlog->withheld.size(); ++j) {
+                BufferPool::instance().releaseChain(backlog->withheld[j].chain);
+                ShardMark::release(backlog->withheld[j].mark);
+            }
+            __atomic_fetch_sub(&backlog->withholds, backlog->withheld.size(), __ATOMIC_RELEASE);
+            backlog->withheld.clear();
+            removeClient(client, "SendQ exceeded");
+            continue;
+        }
+        if (client->getReactor()->isBehind()) {
+            ++i;
+            continue;
+        }
+        _withholding[i] = _withholding.back();
+        _withholding.pop_back();
+        sendWithheld(client);
+    }
+}
+
+/**
+ * @brief Hand the output of every client that got some since the last call to its reactor
+ *
+ * With channel_shards this runs before each line posted to a shard
+ * (ChannelShard::publish): the shard delivers straight to the reactors,
+ * so output queued here before the line must be there first. Only the
+ * clients that got output since the previous line are visited.
+ */
+void Server::handOffQueued() {
+    for (size_t i = 0; i < _handOffs.size(); ++i) {
+        _handOffs[i]->unlist();
+        handOff(_handOffs[i], false);
+    }
+    _handOffs.clear();
+}
+
+/**
+ * @brief ChannelShard::HandOff callback
+ * @param server The Server
+ */
+void Server::handOffQueued(void* server) {
+    static_cast<Server*>(server)->handOffQueued();
+}
+
+/**
+ * @brief Get the mark for output handed to a reactor now
+ * @return A new reference to it
+ *
+ * It lists how many tasks each shard had been posted; the reactor holds
+ * the output back until the shards finished them, so lines posted before
+ * the output reach the connection first. Rebuilt only after a post.
+ */
+ShardMark* Server::currentMark() {
+    size_t posted = 0;
+    for (size_t i = 0; i < _shards.size(); ++i) {
+        posted += _shards[i]->getPosted();
+    }
+    if (!_mark || posted != _markPosted) {
+        ShardMark::release(_mark);
+        _mark = new ShardMark();
+        _mark->refs = 1;
+        for (size_t i = 0; i < _shards.size(); ++i) {
+            _mark->posted.push_back(_shards[i]->getPosted());
+        }
+        _markPosted = posted;
+    }
+    __atomic_add_fetch(&_mark->refs, 1, __ATOMIC_RELAXED);
+    return _mark;
+}
+
+/**
+ * @brief Move a client's socket to another I/O thread
+ * @param client The client
+ * @param reactor Number of the I/O thread to move it to
+ * @return false if there is nothing to do: no such thread, already there, or already moving
+ *
+ * Output queued so far goes to the current reactor ahead of the request;
+ * from now on it is held here until the reactor answers with MIGRATED
+ * (see Reactor for the whole exchange). A client with output withheld for
+ * a busy reactor stays where it is until that output is handed over.
+ */
+bool Server::migrateClient(Client* client, size_t reactor) {
+    Reactor* from = client->getReactor();
+    if (!from || reactor >= _reactors.size() || _reactors[reactor] == from || client->isMigrating() ||
+        !client->getBacklog()->withheld.empty()) {
+        return false;
+    }
+    handOff(client, false);
+    ReactorOutput output;
+    output.kind = ReactorOutput::MIGRATE;
+    output.connection = client->getConnection();
+    output.target = _reactors[reactor];
+    from->send(output);
+    client->setMigrating(true);
+    return true;
+}
+
+/**
+ * @brief Apply the old reactor's answer to a MIGRATE
+ * @param client The client
+ * @param from The reactor that owned the socket
+ * @param to The reactor that owns it now, NULL if it stayed
+ *
+ * Every line the old reactor read has been executed by now, so the new one
+ * may start reading. Each shard gets a MOVE for its rosters and fences the
+ * old reactor; both reactors are told how many fences there will be.
+ */
+void Server::finishMigration(Client* client, Reactor* from, Reactor* to) {
+    client->setMigrating(false);
+    if (!to) {
+        _migrationsRefused++;
+        return;     // The held output goes out with the next flush, as usual
+    }
+    unsigned long connection = client->getConnection();
+    client->setConnection(to, connection, client->getBacklog());  // The counters moved with the socket
+
+    ShardMember member;
+    member.reactor = to;
+    member.connection = connection;
+    member.caps = client->getCaps();
+    const std::vector<Channel*>& channels = client->getChannels();
+    for (size_t i = 0; i < _shards.size(); ++i) {
+        std::vector<const void*> rosters;
+        for (size_t j = 0; j < channels.size(); ++j) {
+            if (channels[j]->getShard() == _shards[i]) {
+                rosters.push_back(channels[j]);
+            }
+        }
+        _shards[i]->move(rosters, member, from);
+    }
+
+    ReactorOutput resume;
+    resume.kind = ReactorOutput::RESUME;
+    resume.connection = connection;
+    resume.fences = _shards.size();
+    to->send(resume);
+    ReactorOutput unforward;
+    unforward.kind = ReactorOutput::UNFORWARD;
+    unforward.connection = connection;
+    unforward.fences = _shards.size();
+    from->send(unforward);
+
+    _migrations++;
+    for (size_t i = 0; i < _reactors.size(); ++i) {
+        if (_reactors[i] == to) {
+            std::cout << "Client " << client->getNickname() << " moved to I/O thread " << i << std::endl;
+        }
+    }
+}
+
+/**
+ * @brief Move a busy client off the busiest I/O thread
+ * @param now Current time
+ *
+ * Runs right after the loads are sampled. A thread counts as overloaded
+ * when it is at least rebalance_load percent busy, has more than one
+ * connection, and another thread has at most half its load. Only after
+ * REBALANCE_SAMPLES overloaded samples in a row, and at most once per
+ * rebalance_interval, does a client move, so a short burst moves nobody.
+ * A client's share of the thread's load is estimated from the lines it
+ * sent over the last second; only a client whose share is less than the
+ * difference between the two loads narrows the gap, and of those the one
+ * that leaves the two threads closest to even is moved.
+ */
+void Server::rebalanceReactors(time_t now) {
+    size_t busiest = 0;
+    size_t idlest = 0;
+    for (size_t i = 1; i < _reactors.size(); ++i) {
+        if (_reactors[i]->getLoad() > _reactors[busiest]->getLoad()) {
+            busiest = i;
+        }
+        if (_reactors[i]->getLoad() < _reactors[idlest]->getLoad()) {
+            idlest = i;
+        }
+    }
+    double high = _reactors[busiest]->getLoad();
+    double low = _reactors[idlest]->getLoad();
+    if (high * 100 >= _rebalanceLoad && low * 2 <= high && _reactors[busiest]->getOpen() > 1) {
+        _imbalanced++;
+    } else {
+        _imbalanced = 0;
+    }
+    bool move = _imbalanced >= REBALANCE_SAMPLES && now >= _rebalanced + _rebalanceInterval;
+
+    // Every client's count restarts, moved or not
+    std::vector<std::pair<unsigned int, Client*> > active;
+    unsigned long total = 0;
+    for (size_t i = 0; i < _clients.size(); ++i) {
+        unsigned int activity = _clients[i]->takeActivity();
+        if (move && activity > 0 && _clients[i]->getReactor() == _reactors[busiest]) {
+            active.push_back(std::make_pair(activity, _clients[i]));
+            total += activity;
+        }
+    }
+    Client* candidate = NULL;
+    double gap = high - low;
+    double best = gap;
+    for (size_t i = 0; i < active.size(); ++i) {
+        double share = high * active[i].first / total;
+        double left = gap - 2 * share;
+        if (left < 0) {
+            left = -left;
+        }
+        if (share < gap && left < best) {
+            candidate = active[i].second;
+            best = left;
+        }
+    }
+    if (candidate && migrateClient(candidate, idlest)) {
+        _rebalanced = now;
+        _imbalanced = 0;
+        std::cout << "Rebalancing: I/O thread " << busiest << " at " << static_cast<int>(high * 100)
+                  << "% load, moving " << candidate->getNickname() << " to I/O thread " << idlest << std::endl;
+    }
+}
+
+/**
+ * @brief Echo a received command to the log
+ * @param line The raw line
+ * @param length Its length
+ * @param cmd The line parsed
+ *
+ * The password MIGRATE carries is replaced by ***.
+ */
+void Server::logLine(const char* line, size_t length, const IRCCommand& cmd) const {
+    if (cmd.command == "MIGRATE" && cmd.params.size() > 2) {
+        std::cout << "MIGRATE " << cmd.params[0] << " " << cmd.params[1] << " ***" << std::endl;
+        return;
+    }
+    std::cout.write(line, length) << std::endl;
+}
+
+/**
+ * @brief Start the channel shards (channel_shards > 0)
+ * @return true if all of them are running
+ */
+bool Server::startShards() {
+    for (size_t i = 0; i < _shardCount; ++i) {
+        ChannelShard* shard = new ChannelShard(i);
+        shard->setHandOff(&Server::handOffQueued, this);
+        _shards.push_back(shard);
+        if (!shard->start()) {
+            stopShards();
+            return false;
+        }
+    }
+    if (_shardCount > 0) {
+        std::cout << "Delivering channel traffic from " << _shardCount << " shards" << std::endl;
+    }
+    return true;
+}
+
+/**
+ * @brief Stop and delete the channel shards
+ */
+void Server::stopShards() {
+    for (size_t i = 0; i < _shards.size(); ++i) {
+        delete _shards[i];  // Delivers what is queued, then joins the thread
+    }
+    _shards.clear();
+}
+
+/**
+ * @brief Pick the shard for a channel
+ * @param channelName The channel name
+ * @return The shard, or NULL without channel shards
+ * 
+ * FNV-1a of the name (channel names are case-sensitive here, so the name
+ * is already the canonical form).
+ */
+ChannelShard* Server::shardFor(const std::string& channelName) const {
+    if (_shards.empty()) {
+        return NULL;
+    }
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < channelName.length(); ++i) {
+        hash = (hash ^ static_cast<unsigned char>(channelName[i])) * 16777619u;
+    }
+    return _shards[hash % _shards.size()];
+}
+
+/**
+ * @brief Set up the server socket
+ * @return true if successful, false otherwise
+ * 
+ * This function creates and configures the main server socket that listens for connections.
+ */
+bool Server::setupSocket() {
+    // socket() creates a new socket
+    // AF_INET = IPv4, SOCK_STREAM = TCP, 0 = default protocol
+    _serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (_serverSocket < 0) {
+        std::cerr << "Error creating socket: " << strerror(errno) << std::endl;
+        return false;
+    }
     
     // Set socket options
     int opt = 1;
@@ -514,20 +2286,3 @@ bool Server::setupSocket() {
     return true;
 }
 
-/**
- * @brief Get hostname for a client connection
- * @param clientFd The client's file descriptor
- * @return The hostname or IP address
- */
-std::string Server::getClientHostname(int clientFd) {
-    struct sockaddr_in clientAddr;
-    socklen_t addrLen = sizeof(clientAddr);
-    
-    // getpeername() gets the address of the peer (client)
-    if (getpeername(clientFd, (struct sockaddr*)&clientAddr, &addrLen) < 0) {
-        return "unknown";
-    }
-
-    // inet_ntoa() converts IP address to string
-    return inet_ntoa(clientAddr.sin_addr);
-}
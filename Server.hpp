@@ -2,11 +2,71 @@
 #define SERVER_HPP
 
 #include "ircserv.hpp"
+#include "InternPool.hpp"
+#include "ObjectPool.hpp"
+#include "Config.hpp"
+#include "Arena.hpp"
+#include "Client.hpp"
+#include "Channel.hpp"
+#include "FanoutPool.hpp"
+#include "TaskPool.hpp"
+#include "ClientIndex.hpp"
+#include "MonitorIndex.hpp"
+#include "ContentFilter.hpp"
+#include "MotdCache.hpp"
+#include <pthread.h>     // For the content filter builder thread
 
 // Forward declarations
-class Client;
-class Channel;
 class Parser;
+struct IRCCommand;
+class Reactor;
+struct ReactorEvent;
+struct ReactorOutput;
+class ChannelShard;
+struct ShardMark;
+
+/**
+ * @brief A content filter being built by a helper thread (or a task pool worker)
+ *
+ * The thread re-reads the config file (for spam_filter_file) and the rules
+ * file and compiles the filter, then sets done. The main
+ * loop only looks at the other fields after seeing done under the lock.
+ */
+struct FilterBuild {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    bool done;
+    std::string configPath;                 // Config file to re-read (empty: keep rulesPath)
+    std::string rulesPath;                  // Rules file from the current config
+    ContentFilter* result;                  // The new filter, NULL if the build failed
+    std::string error;                      // Why the build failed
+};
+
+/**
+ * @brief A hostname lookup a client's registration waits for
+ */
+struct PendingLookup {
+    time_t deadline;                        // Given up at this time (resolve_timeout)
+    Task* task;                             // Cancelled once the result is no longer wanted
+};
+
+/**
+ * @brief Wrong admin passwords from one address
+ */
+struct AdminFailures {
+    unsigned int count;                     // Wrong passwords in a row
+    time_t retry;                           // No password is checked before this time
+};
+
+/**
+ * @brief Content filter counters
+ */
+struct FilterStats {
+    size_t reloads;                         // Filters swapped in
+    size_t messages;                        // Messages scanned
+    size_t bytes;                           // Bytes scanned
+    size_t blocked;                         // Messages blocked
+};
 
 /**
  * @brief The Server class is the main IRC server
@@ -23,11 +83,83 @@ private:
     std::string _password;                  // Server password
     int _serverSocket;                      // Main server socket file descriptor
     bool _shutdown;                         // Flag to control server shutdown
+    Config _config;                         // Settings from the optional config file
     
+    InternPool _names;                      // Pooled hostnames, usernames and channel names
+    ObjectPool<Client> _clientPool;         // Storage for Client objects (recycled on disconnect)
+    ObjectPool<Channel> _channelPool;       // Storage for Channel objects (recycled when emptied)
+    Arena _scratch;                         // Per-tick scratch memory for parsing and formatting
+    size_t _sendQueueLimit;                 // Max queued output bytes per client (sendq_limit)
     std::vector<Client*> _clients;          // All connected clients
-    std::map<std::string, Channel*> _channels;  // All channels (key = channel name)
+    ClientIndex _index;                     // Clients by nickname, username and hostname
+    std::vector<Client*> _streaming;        // Clients with replies waiting to be rendered
+    size_t _replyChunk;                     // Max pending replies rendered per client per tick
+    MonitorIndex _monitors;                 // MONITOR subscriptions (nick -> watchers)
+    size_t _monitorLimit;                   // Max MONITOR entries per client (monitor_limit)
+    size_t _whoLimit;                       // Max rows per WHO reply (who_limit)
+    size_t _maxTargets;                     // Targets per PRIVMSG/NOTICE/TAGMSG (max_targets, TARGMAX)
+    size_t _channelLimit;                   // Channels a client may be in (channel_limit, CHANLIMIT)
+    bool _utf8Only;                         // Refuse invalid UTF-8 text (utf8_only, UTF8ONLY)
+    MotdCache _motd;                        // Rendered message of the day (motd_file)
+    std::map<InternedString, Channel*> _channels;  // All channels (key = pooled channel name)
+    ChannelIndex _channelIndex;             // Channels ordered by member count (LIST)
+    unsigned int _fanoutEpoch;              // Incremented for every neighbor fanout
+    
+    // Content filter (spam_filter_file), rebuilt by a helper thread on SIGHUP
+    ContentFilter* _filter;                 // Current filter, only replaced between ticks
+    FilterBuild* _filterBuild;              // Build in progress, NULL if none
+    volatile sig_atomic_t _reloadRequested; // Set by the SIGHUP handler
+    FilterStats _filterStats;               // Scan counters for STATS m
+    
+    // Repeated-message flood detection
+    size_t _floodRepeat;                    // Copies of a text allowed per window (flood_repeat, 0: off)
+    time_t _floodWindow;                    // Seconds a text is remembered (flood_window)
+    size_t _floodChecks;                    // Messages checked
+    size_t _floodSuppressed;                // Messages not delivered
     Parser* _parser;                        // Command parser
     
+    // I/O threads (io_threads > 0): sockets live in the reactors, this thread owns all state
+    size_t _ioThreads;                      // Number of reactors (0: single-threaded)
+    std::vector<Reactor*> _reactors;
+    std::map<unsigned long, Client*> _remote;   // Connection id -> client
+    std::vector<Client*> _handOffs;         // Output queued since the last hand-off (channel_shards)
+    size_t _ioBacklog;                      // Untaken outputs from which a reactor gets no more (io_backlog)
+    std::vector<Client*> _withholding;      // Clients with output held back for a reactor that was behind
+    std::vector<int> _ioCpus;               // CPUs to pin the I/O threads to (io_cpus, empty: none)
+    int _mainCpu;                           // CPU to pin this thread to (main_cpu, -1: none)
+    bool _steering;                         // Steer connections to the reactor on their RX CPU
+    time_t _loadSampled;                    // Last time the reactors' load was sampled
+    size_t _rebalanceLoad;                  // Busy percent from which a thread hands a client off (rebalance_load, 0: off)
+    time_t _rebalanceInterval;              // Seconds between automatic moves (rebalance_interval)
+    time_t _rebalanced;                     // Last automatic move
+    size_t _imbalanced;                     // Load samples in a row that found a thread overloaded
+    std::string _adminPassword;             // Password for MIGRATE (admin_password, empty: disabled)
+    std::map<std::string, AdminFailures> _adminFailures;  // Peer address -> its wrong passwords
+    size_t _migrations;                     // Clients moved to another I/O thread
+    size_t _migrationsRefused;              // Moves the reactor turned down (connection closing)
+    
+    // Channel shards (channel_shards > 0, needs io_threads): channel fanout on worker threads
+    size_t _shardCount;
+    std::vector<ChannelShard*> _shards;
+    ShardMark* _mark;                       // Tasks posted when it was built; handed output waits for them
+    size_t _markPosted;                     // Sum of the shards' posted tasks when _mark was built
+    
+    // Parallel fanout for large channels (fanout_threads > 0)
+    FanoutPool _fanout;
+    double _fanoutSingle;                   // Startup benchmark, us per broadcast (0: fanout_benchmark off)
+    double _fanoutParallel;
+    
+    // Offloaded blocking work (task_threads > 0): hostname lookups, filter rebuilds
+    TaskPool _tasks;
+    unsigned long _nextHandle;              // Last Client handle given out
+    std::map<unsigned long, Client*> _handles;  // Handle -> client, for task results
+    bool _resolveHosts;                     // Look up client hostnames (resolve_hostnames)
+    time_t _resolveTimeout;                 // Seconds registration waits for a lookup (resolve_timeout)
+    size_t _resolveQueue;                   // Lookups waiting at most; later clients keep their address (resolve_queue)
+    size_t _lookupsRefused;                 // Clients not looked up because the queue was full
+    std::map<unsigned long, PendingLookup> _lookups;  // Handle -> its lookup
+    bool _filterQueued;                     // A filter rebuild task is queued or running
+    
     // Poll-related members for handling multiple connections
     std::vector<struct pollfd> _pollFds;    // Array of file descriptors for poll()
     
@@ -35,12 +167,27 @@ private:
     std::string _serverName;                // Server name
     std::string _creationTime;              // When server was created
 
+    // Pending replies are only rendered while less than this is queued
+    static const size_t REPLY_LOW_WATER = 8192;
+
+    // With io_threads, how often (ms) to look at a reactor's progress with a reply still pending
+    static const int REPLY_POLL_INTERVAL = 10;
+
+    // Replies a client may have waiting before further ones are dropped
+    static const size_t PENDING_LIMIT = 2048;
+
+    // Load samples in a row a thread must be overloaded before a client moves off it
+    static const size_t REBALANCE_SAMPLES = 3;
+
+    // Longest wait (s) after wrong admin passwords before an address may try again
+    static const time_t ADMIN_RETRY_MAX = 60;
+
     // Static pointer to current server instance for signal handler
     static Server* _currentServer;
 
 public:
     // Constructor
-    Server(int port, const std::string& password);
+    Server(int port, const std::string& password, const Config& config);
     
     // Destructor
     ~Server();
@@ -52,17 +199,47 @@ public:
     
     // Client management
     void acceptNewClient();                // Accept incoming connections
-    void removeClient(Client* client);     // Remove a client safely
+    void removeClient(Client* client, const std::string& reason = "Client disconnected");  // Remove a client safely
     Client* getClientByNick(const std::string& nickname);
     Client* getClientByFd(int fd);
+    void indexClient(Client* client);      // Call after the nickname or username changed
+    Client* findClient(unsigned long handle) const;  // NULL once the client is gone
+    void runTask(Task* task);              // On the task pool, or right here without one
+    void findClients(const std::string& mask, std::vector<Client*>& results);  // WHO-style search
+    bool queueReply(Client* client, const PendingReply& reply);  // Rendered when output has room; false if full
+    bool migrateClient(Client* client, size_t reactor);  // Move its socket to another I/O thread
+    time_t adminRetryIn(const Client* client) const;  // Seconds before its address may give a password again
+    bool checkAdminPassword(const Client* client, const std::string& password);  // MIGRATE allowed? Counts wrong ones
+    
+    // Presence (MONITOR)
+    MonitorIndex& getMonitors();
+    size_t getMonitorLimit() const;
+    size_t getWhoLimit() const;
+    size_t getMaxTargets() const;
+    size_t getChannelLimit() const;
+    Client* findOnline(const std::string& nickname);  // Registered client with this exact nick
+    void notifyPresence(Client* client, bool online);  // Tell the watchers of the client's nick
+    
+    // Content filter
+    bool scanFilter(const std::string& text, std::vector<size_t>& rules);  // spam_filter_file rules in the text
+    bool isFiltered(const std::vector<size_t>& rules, const std::string& channel);  // Do they apply there?
+    bool isFlooding(Client* sender, unsigned int hash);     // Sender repeated the text too often?
+    bool isFlooding(Channel* channel, unsigned int hash);   // Channel saw the text too often?
+    bool isUtf8Only() const;
+    MotdCache& getMotd();
     
     // Channel management
     Channel* getChannel(const std::string& name);
     Channel* createChannel(const std::string& name);
     void removeChannel(const std::string& name);
+    Channel* nextChannel(size_t minMembers, size_t maxMembers, ChannelIndex::Cursor& cursor);  // By member count
     
     // Network operations
     void processClientData(Client* client); // Read and process client data
+    bool flushClient(Client* client);       // Send queued output, false if client was dropped
+    void flushAllClients();                 // End of tick: send everything queued
+    void pumpReplies();                     // End of tick: render some pending replies
+    size_t getUnsent(Client* client) const; // Output queued here or at the client's reactor
     void handleClientDisconnect(Client* client);
     
     // Getters
@@ -70,18 +247,55 @@ public:
     const std::string& getServerName() const;
     const std::string& getCreationTime() const;
     
+    // Identifier pool
+    InternedString intern(const std::string& value);  // Pool a hostname/username/channel name
+    void collectStats(char query, std::vector<std::string>& lines);  // Lines for the STATS command
+    
     // Utility functions
     void broadcastToAll(const std::string& message, Client* exclude = NULL);
+    size_t sendToNeighbors(Client* client, const StringRef& line, bool includeSelf);  // Everyone sharing a channel, once
     
     // Signal handling
     static void signalHandler(int signal);
     void requestShutdown();
+    void requestReload();                   // SIGHUP: rebuild the content filter
     
 private:
     // Helper functions
     bool setupSocket();                    // Create and configure server socket
+    bool startReactors();                  // io_threads > 0: start the I/O threads
+    void stopReactors();
+    void receiveFromReactors();            // Apply the events the I/O threads forwarded
+    void handOff(Client* client, bool close);  // Give queued output to the client's reactor
+    void handOffQueued();                  // handOff() every client on _handOffs
+    void handOffWithheld();                // End of tick: retry the output held back for busy reactors
+    void withhold(Client* client, ReactorOutput& output);  // Keep it until the reactor catches up
+    void sendWithheld(Client* client);     // Hand over what was held back, in order
+    static void handOffQueued(void* server);   // ChannelShard::HandOff callback
+    ShardMark* currentMark();              // A reference to the mark for output handed now
+    void finishMigration(Client* client, Reactor* from, Reactor* to);  // to NULL: the move was refused
+    void rebalanceReactors(time_t now);    // Once a second with rebalance_load
+    void logLine(const char* line, size_t length, const IRCCommand& cmd) const;  // Echo a command, passwords hidden
+    bool startShards();
+    void stopShards();
+    ChannelShard* shardFor(const std::string& channelName) const;
+    void admitClient(Client* client);      // Track a new connection, start its hostname lookup
+    void receiveCompletions();             // Hand finished tasks to their owners
+    bool expireLookups(time_t now);        // Stop waiting for slow lookups, true if any was given up
+    void finishLookup(Client* client, const std::string& hostname);  // Empty hostname: not found
+    void dropLookup(Client* client);       // Forget its lookup, cancel the task if it hasn't run
     void cleanupResources();              // Clean up all allocated resources
-    std::string getClientHostname(int clientFd);  // Get client's hostname
+    void destroyChannel(Channel* channel);  // Return a channel to its pool
+    bool hasClient(Client* client) const;   // Is this pointer still one of our clients?
+    void pollFilterReload();               // Start a requested filter build, swap in a finished one
+    void finishFilterBuild();              // Join the builder thread and take its result
+    void installFilter(FilterBuild* build);  // Swap in a built filter (takes build->result)
+    static void buildFilter(FilterBuild* build);  // Read the rules and compile a filter
+    static void* filterThread(void* build);  // Builder thread entry point
+    
+    // Tasks for the task pool (defined in Server.cpp)
+    class LookupTask;
+    class FilterTask;
 };
 
 #endif
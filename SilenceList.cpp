@@ -0,0 +1,198 @@
+#include "SilenceList.hpp"
+#include "Client.hpp"
+
+// Static member definitions
+size_t SilenceList::_checks = 0;
+size_t SilenceList::_filterPasses = 0;
+size_t SilenceList::_dropped = 0;
+
+/**
+ * @brief Constructor for SilenceList class
+ */
+SilenceList::SilenceList() : _unfiltered(0) {
+    memset(_filter, 0, sizeof(_filter));
+}
+
+/**
+ * @brief Add a mask
+ * @param mask The mask (normalized to nick!user@host)
+ * @return true if added, false if already listed
+ */
+bool SilenceList::add(const std::string& mask) {
+    if (!_masks.add(mask, "")) {
+        return false;
+    }
+    rebuildFilter();
+    return true;
+}
+
+/**
+ * @brief Remove a mask
+ * @param mask The mask
+ * @return true if it was listed
+ *
+ * A bloom filter can't forget single keys, so it is rebuilt from the
+ * remaining masks (at most MAX_ENTRIES of them).
+ */
+bool SilenceList::remove(const std::string& mask) {
+    if (!_masks.remove(mask)) {
+        return false;
+    }
+    rebuildFilter();
+    return true;
+}
+
+/**
+ * @brief Fold a sender's names once for any number of lists
+ * @param sender The sending client
+ */
+SilenceSubject::SilenceSubject(const Client* sender)
+    : nick(MaskMatcher::fold(sender->getNickname())), user(MaskMatcher::fold(sender->getUsername())),
+      host(MaskMatcher::fold(sender->getHostname())) {
+    prefix.reserve(nick.length() + user.length() + host.length() + 2);
+    prefix.append(nick).append(1, '!').append(user).append(1, '@').append(host);
+}
+
+/**
+ * @brief Check if a message from a sender should be dropped
+ * @param sender The sending client
+ * @return true if one of the masks matches the sender
+ */
+bool SilenceList::matches(const Client* sender) const {
+    return matches(SilenceSubject(sender));
+}
+
+/**
+ * @brief Check if a message from an already folded sender should be dropped
+ * @param sender The sender
+ * @return true if one of the masks matches the sender
+ */
+bool SilenceList::matches(const SilenceSubject& sender) const {
+    __atomic_fetch_add(&_checks, 1, __ATOMIC_RELAXED);
+
+    if (_unfiltered == 0 && !mayContain('n', sender.nick) && !mayContain('u', sender.user) &&
+        !mayContain('h', sender.host)) {
+        __atomic_fetch_add(&_filterPasses, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    if (_masks.matches(sender.prefix)) {
+        __atomic_fetch_add(&_dropped, 1, __ATOMIC_RELAXED);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Get the masks (for the SILENCE listing)
+ * @return Reference to the entries
+ */
+const std::vector<MaskEntry>& SilenceList::getEntries() const {
+    return _masks.getEntries();
+}
+
+/**
+ * @brief Get the number of masks
+ * @return Number of masks
+ */
+size_t SilenceList::size() const {
+    return _masks.size();
+}
+
+/**
+ * @brief Get the number of messages checked against any list
+ * @return Check count
+ */
+size_t SilenceList::getChecks() {
+    return __atomic_load_n(&_checks, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the number of checks the bloom filter answered on its own
+ * @return Filter pass count
+ */
+size_t SilenceList::getFilterPasses() {
+    return __atomic_load_n(&_filterPasses, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the number of messages dropped
+ * @return Drop count
+ */
+size_t SilenceList::getDropped() {
+    return __atomic_load_n(&_dropped, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Refill the bloom filter from the masks
+ */
+void SilenceList::rebuildFilter() {
+    memset(_filter, 0, sizeof(_filter));
+    _unfiltered = 0;
+
+    const std::vector<MaskEntry>& entries = _masks.getEntries();
+    for (size_t i = 0; i < entries.size(); ++i) {
+        std::string mask = MaskMatcher::fold(entries[i].mask);
+        size_t bang = mask.find('!');
+        size_t at = mask.find('@', bang);
+        std::string nick = mask.substr(0, bang);
+        std::string user = mask.substr(bang + 1, at - bang - 1);
+        std::string host = mask.substr(at + 1);
+
+        // File the most selective literal part
+        if (nick.find_first_of("*?") == std::string::npos) {
+            addKey('n', nick);
+        } else if (host.find_first_of("*?") == std::string::npos) {
+            addKey('h', host);
+        } else if (user.find_first_of("*?") == std::string::npos) {
+            addKey('u', user);
+        } else {
+            _unfiltered++;
+        }
+    }
+}
+
+/**
+ * @brief Set the filter bits of a key
+ * @param kind 'n', 'u' or 'h' (keeps equal text in different fields apart)
+ * @param text The folded text
+ */
+void SilenceList::addKey(char kind, const std::string& text) {
+    unsigned int hash = hashKey(kind, text);
+    for (int i = 0; i < 2; ++i) {
+        size_t bit = (hash >> (i * 16)) % FILTER_BITS;
+        _filter[bit / WORD_BITS] |= 1UL << (bit % WORD_BITS);
+    }
+}
+
+/**
+ * @brief Check the filter bits of a key
+ * @param kind 'n', 'u' or 'h'
+ * @param text The folded text
+ * @return false if the key was definitely never added
+ */
+bool SilenceList::mayContain(char kind, const std::string& text) const {
+    unsigned int hash = hashKey(kind, text);
+    for (int i = 0; i < 2; ++i) {
+        size_t bit = (hash >> (i * 16)) % FILTER_BITS;
+        if (!(_filter[bit / WORD_BITS] & (1UL << (bit % WORD_BITS)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief FNV-1a hash of a key (the two halves give the two bit positions)
+ * @param kind 'n', 'u' or 'h'
+ * @param text The folded text
+ * @return 32-bit hash
+ */
+unsigned int SilenceList::hashKey(char kind, const std::string& text) {
+    unsigned int hash = 2166136261u;
+    hash = (hash ^ static_cast<unsigned char>(kind)) * 16777619u;
+    for (size_t i = 0; i < text.length(); ++i) {
+        hash = (hash ^ static_cast<unsigned char>(text[i])) * 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,77 @@
+#ifndef SILENCELIST_HPP
+#define SILENCELIST_HPP
+
+#include "ircserv.hpp"
+#include "MaskMatcher.hpp"
+
+/**
+ * @brief A sender the way silence lists compare it (everything case-folded)
+ *
+ * Built once per message by the thread sending it; lists only read it, so
+ * fanout workers can share one.
+ */
+struct SilenceSubject {
+    std::string nick;
+    std::string user;
+    std::string host;
+    std::string prefix;                 // nick!user@host
+
+    explicit SilenceSubject(const Client* sender);
+};
+
+/**
+ * @brief A client's server-side ignore list (SILENCE)
+ *
+ * Messages from senders matching one of the masks are dropped by the server
+ * instead of being delivered and discarded by the client.
+ *
+ * Almost every message comes from someone who is not ignored, so a small
+ * bloom filter answers that case first. For each mask we file one literal
+ * part in the filter: the nickname if it has no wildcards, otherwise the
+ * hostname, otherwise the username. A sender whose nickname, username and
+ * hostname are all absent from the filter cannot match any mask, and the
+ * mask list is not walked at all. Masks without any literal part (rare,
+ * e.g. "*!*@*.example.com") switch the filter off for this list.
+ *
+ * Clients that never use SILENCE have no list at all (a NULL pointer).
+ */
+class SilenceList {
+public:
+    static const size_t MAX_ENTRIES = 15;       // Advertised as SILENCE=15
+
+private:
+    static const size_t FILTER_BITS = 256;
+    static const size_t WORD_BITS = sizeof(unsigned long) * 8;
+
+    MaskMatcher _masks;
+    unsigned long _filter[FILTER_BITS / WORD_BITS];
+    size_t _unfiltered;                 // Masks with no literal part to file
+
+    // Statistics shared by all lists (atomic access: fanout workers check lists too)
+    static size_t _checks;              // Messages checked against a list
+    static size_t _filterPasses;        // Checks answered by the bloom filter alone
+    static size_t _dropped;             // Messages dropped
+
+public:
+    SilenceList();
+
+    bool add(const std::string& mask);          // false if already listed
+    bool remove(const std::string& mask);       // false if not listed
+    bool matches(const Client* sender) const;   // Should a message from sender be dropped?
+    bool matches(const SilenceSubject& sender) const;
+
+    const std::vector<MaskEntry>& getEntries() const;
+    size_t size() const;
+
+    static size_t getChecks();
+    static size_t getFilterPasses();
+    static size_t getDropped();
+
+private:
+    void rebuildFilter();
+    void addKey(char kind, const std::string& text);
+    bool mayContain(char kind, const std::string& text) const;
+    static unsigned int hashKey(char kind, const std::string& text);
+};
+
+#endif
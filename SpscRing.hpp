@@ -0,0 +1,108 @@
+#ifndef SPSCRING_HPP
+#define SPSCRING_HPP
+
+#include "ircserv.hpp"
+
+/**
+ * @brief Lock-free queue between exactly one producer and one consumer thread
+ * @tparam T The element type (small, copyable: the reactors pass pointers)
+ *
+ * A fixed array used as a ring. The producer only writes _tail, the consumer
+ * only writes _head, so neither needs a lock or a compare-and-swap: a
+ * release store publishes the slot that was just filled (or emptied) and
+ * the other side's acquire load makes it visible. Each side also keeps a
+ * private copy of the other's index and only reloads it when the ring looks
+ * full (or empty), so in the common case a push or pop touches no cache line
+ * the other thread is writing. The indexes sit on separate cache lines for
+ * the same reason.
+ *
+ * The capacity is rounded up to a power of two so wrapping is a mask.
+ * C++98 has no <atomic>; the GCC/Clang __atomic builtins are used instead.
+ */
+template <typename T>
+class SpscRing {
+private:
+    static const size_t CACHE_LINE = 64;
+
+    // Producer side
+    size_t _tail;                       // Next slot to fill
+    size_t _cachedHead;                 // Producer's last view of _head
+    char _padProducer[CACHE_LINE - 2 * sizeof(size_t)];
+
+    // Consumer side
+    size_t _head;                       // Next slot to read
+    size_t _cachedTail;                 // Consumer's last view of _tail
+    char _padConsumer[CACHE_LINE - 2 * sizeof(size_t)];
+
+    T* _slots;
+    size_t _mask;
+
+    // Not copyable (owns _slots)
+    SpscRing(const SpscRing& other);
+    SpscRing& operator=(const SpscRing& other);
+
+public:
+    /**
+     * @brief Constructor
+     * @param capacity Minimum number of elements the ring can hold
+     */
+    explicit SpscRing(size_t capacity)
+        : _tail(0), _cachedHead(0), _head(0), _cachedTail(0) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        _slots = new T[size];
+        _mask = size - 1;
+    }
+
+    ~SpscRing() {
+        delete[] _slots;
+    }
+
+    /**
+     * @brief Add an element (producer thread only)
+     * @param value The element
+     * @return false if the ring is full
+     */
+    bool push(const T& value) {
+        size_t tail = _tail;
+        if (tail - _cachedHead > _mask) {
+            _cachedHead = __atomic_load_n(&_head, __ATOMIC_ACQUIRE);
+            if (tail - _cachedHead > _mask) {
+                return false;
+            }
+        }
+        _slots[tail & _mask] = value;
+        __atomic_store_n(&_tail, tail + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /**
+     * @brief Take the oldest element (consumer thread only)
+     * @param value Receives the element
+     * @return false if the ring is empty
+     */
+    bool pop(T& value) {
+        size_t head = _head;
+        if (head == _cachedTail) {
+            _cachedTail = __atomic_load_n(&_tail, __ATOMIC_ACQUIRE);
+            if (head == _cachedTail) {
+                return false;
+            }
+        }
+        value = _slots[head & _mask];
+        __atomic_store_n(&_head, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /**
+     * @brief Get the number of slots
+     * @return Capacity
+     */
+    size_t capacity() const {
+        return _mask + 1;
+    }
+};
+
+#endif
@@ -0,0 +1,144 @@
+#include "TaggedMessage.hpp"
+#include "Client.hpp"
+#include "Utils.hpp"
+#include <cstdio>
+#include <sys/time.h>
+
+unsigned long TaggedMessage::_nextId = 0;
+size_t TaggedMessage::_messages = 0;
+size_t TaggedMessage::_renders = 0;
+size_t TaggedMessage::_deliveries = 0;
+
+/**
+ * @brief Constructor for TaggedMessage class
+ * @param line The untagged line, including the trailing \r\n (must outlive the message)
+ * @param clientTags Client-only tags to relay to message-tags recipients
+ * @param tagOnly true for TAGMSG, which only message-tags recipients get
+ */
+TaggedMessage::TaggedMessage(const StringRef& line, const StringRef& clientTags, bool tagOnly)
+    : _line(line), _clientTags(clientTags), _tagOnly(tagOnly), _id(0) {
+    for (unsigned int i = 0; i < VARIANTS; ++i) {
+        _rendered[i] = false;
+    }
+    _variants[0] = line;
+    _rendered[0] = true;
+    _time[0] = '\0';
+    __atomic_fetch_add(&_messages, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the line for a recipient
+ * @param caps The recipient's capabilities
+ * @return The line with the tags the recipient asked for (empty: send nothing)
+ *
+ * Rendered into scratch memory the first time each variant is needed.
+ */
+StringRef TaggedMessage::render(unsigned int caps) {
+    unsigned int variant = caps & Capabilities::TAG_CAPS;
+    if (_tagOnly && !(variant & Capabilities::CAP_MESSAGE_TAGS)) {
+        return StringRef();
+    }
+    if (_rendered[variant]) {
+        return _variants[variant];
+    }
+
+    ScratchWriter out(Arena::active(), _line.length + 128 + _clientTags.length);
+    out.append('@');
+    if (variant & Capabilities::CAP_SERVER_TIME) {
+        appendTime(out);
+    }
+    if (variant & Capabilities::CAP_MESSAGE_TAGS) {
+        if (variant & Capabilities::CAP_SERVER_TIME) {
+            out.append(';');
+        }
+        appendId(out);
+        if (_clientTags.length > 0) {
+            out.append(';').append(_clientTags);
+        }
+    }
+    out.append(' ').append(_line);
+
+    _variants[variant] = out.str();
+    _rendered[variant] = true;
+    __atomic_fetch_add(&_renders, 1, __ATOMIC_RELAXED);
+    return _variants[variant];
+}
+
+/**
+ * @brief Queue the message for a client
+ * @param client The recipient
+ * @return false if the client doesn't get this message (TAGMSG without message-tags)
+ */
+bool TaggedMessage::send(Client* client) {
+    StringRef line = render(client->getCaps());
+    if (line.length == 0) {
+        return false;
+    }
+    __atomic_fetch_add(&_deliveries, 1, __ATOMIC_RELAXED);
+    return Utils::sendLine(client, line);
+}
+
+/**
+ * @brief Write the server-time tag (time=YYYY-MM-DDThh:mm:ss.sssZ)
+ * @param out Where to write it
+ */
+void TaggedMessage::appendTime(ScratchWriter& out) {
+    if (_time[0] == '\0') {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        struct tm utc;
+        gmtime_r(&now.tv_sec, &utc);
+        size_t length = strftime(_time, sizeof(_time), "%Y-%m-%dT%H:%M:%S", &utc);
+        sprintf(_time + length, ".%03dZ", static_cast<int>(now.tv_usec / 1000));
+    }
+    out.append("time=", 5).append(_time);
+}
+
+/**
+ * @brief Write the msgid tag
+ * @param out Where to write it
+ *
+ * Ids are the time the first id was handed out and a counter, both in
+ * hex, so they stay unique across restarts.
+ */
+void TaggedMessage::appendId(ScratchWriter& out) {
+    static const time_t started = time(NULL);
+    if (_id == 0) {
+        _id = __atomic_add_fetch(&_nextId, 1, __ATOMIC_RELAXED);
+    }
+    char id[48];
+    int length = sprintf(id, "msgid=%lx-%lx", static_cast<unsigned long>(started), _id);
+    out.append(id, length);
+}
+
+/**
+ * @brief Get the number of messages relayed
+ * @return Message count
+ */
+size_t TaggedMessage::getMessages() {
+    return __atomic_load_n(&_messages, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the number of tagged variants rendered
+ * @return Render count (at most three per message)
+ */
+size_t TaggedMessage::getRenders() {
+    return __atomic_load_n(&_renders, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the number of lines queued
+ * @return Delivery count
+ */
+size_t TaggedMessage::getDeliveries() {
+    return __atomic_load_n(&_deliveries, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Count lines queued by the fanout workers
+ * @param count Number of lines
+ */
+void TaggedMessage::addDeliveries(size_t count) {
+    __atomic_fetch_add(&_deliveries, count, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,58 @@
+#ifndef TAGGEDMESSAGE_HPP
+#define TAGGEDMESSAGE_HPP
+
+#include "ircserv.hpp"
+#include "Arena.hpp"
+#include "Capabilities.hpp"
+
+/**
+ * @brief One relayed message, rendered once per tag variant
+ *
+ * A message going out to many clients (a channel PRIVMSG, JOIN, NICK...)
+ * looks different depending on whether the recipient enabled server-time
+ * and/or message-tags. Instead of rendering it per recipient, each of the
+ * four variants is rendered the first time a recipient needs it, in scratch
+ * memory, and the same bytes are queued for every recipient with that
+ * combination. The plain variant is the line itself and is never copied.
+ *
+ * The time and msgid are fixed when first needed, so every recipient sees
+ * the same values.
+ *
+ * Messages are built on the state thread, but FanoutPool workers call
+ * render() too, so the shared counters and the msgid sequence are updated
+ * atomically.
+ */
+class TaggedMessage {
+private:
+    static const unsigned int VARIANTS = Capabilities::TAG_CAPS + 1;  // TAG_CAPS are the low bits
+
+    StringRef _line;                    // Untagged line, with \r\n
+    StringRef _clientTags;              // Client-only tags from the sender ("+a=b;+c"), without the '@'
+    bool _tagOnly;                      // TAGMSG: nothing for recipients without message-tags
+    StringRef _variants[VARIANTS];      // Rendered lines, index = caps & TAG_CAPS
+    bool _rendered[VARIANTS];
+    char _time[32];                     // server-time value, empty until needed
+    unsigned long _id;                  // msgid number, 0 until needed
+
+    static unsigned long _nextId;
+    static size_t _messages;            // Messages relayed
+    static size_t _renders;             // Tagged variants rendered
+    static size_t _deliveries;          // Lines queued
+
+public:
+    explicit TaggedMessage(const StringRef& line, const StringRef& clientTags = StringRef(), bool tagOnly = false);
+
+    StringRef render(unsigned int caps);    // The line for a recipient with these capabilities
+    bool send(Client* client);              // Queue the right variant, false if there is none
+
+    static size_t getMessages();
+    static size_t getRenders();
+    static size_t getDeliveries();
+    static void addDeliveries(size_t count);    // Lines queued without send() (FanoutPool)
+
+private:
+    void appendTime(ScratchWriter& out);
+    void appendId(ScratchWriter& out);
+};
+
+#endif
@@ -0,0 +1,403 @@
+#include "TaskPool.hpp"
+#include <sys/eventfd.h>
+
+__thread TaskPool::Worker* TaskPool::_current = NULL;
+
+/**
+ * @brief Constructor for Task class
+ * @param owner Handle of the client the result is for (0: none)
+ */
+Task::Task(unsigned long owner) : _owner(owner), _cancelled(0) {
+}
+
+/**
+ * @brief Destructor for Task class
+ */
+Task::~Task() {
+}
+
+/**
+ * @brief Get the handle of the client the result is for
+ * @return Client handle (0: the task belongs to no client)
+ */
+unsigned long Task::getOwner() const {
+    return _owner;
+}
+
+/**
+ * @brief Tell the pool the result is no longer wanted (state thread)
+ *
+ * A worker that has not started the task passes it straight back; one
+ * that is running it finishes. Either way it still comes back through
+ * takeCompleted().
+ */
+void Task::cancel() {
+    __atomic_store_n(&_cancelled, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Check whether the task was cancelled
+ * @return true after cancel()
+ */
+bool Task::isCancelled() const {
+    return __atomic_load_n(&_cancelled, __ATOMIC_RELAXED) != 0;
+}
+
+/**
+ * @brief Constructor for TaskPool class
+ * @param threads Worker threads (0: tasks run inline)
+ */
+TaskPool::TaskPool(size_t threads)
+    : _size(threads), _nextWorker(0), _queued(0), _sleeping(0), _stop(false), _eventFd(-1),
+      _signalPending(0), _submitted(0), _delivered(0), _dropped(0) {
+    pthread_mutex_init(&_sleepLock, NULL);
+    pthread_cond_init(&_work, NULL);
+}
+
+/**
+ * @brief Destructor for TaskPool class
+ */
+TaskPool::~TaskPool() {
+    stop();
+    pthread_cond_destroy(&_work);
+    pthread_mutex_destroy(&_sleepLock);
+}
+
+/**
+ * @brief Start the worker threads
+ * @return true if all of them are running
+ */
+bool TaskPool::start() {
+    if (_size == 0) {
+        return true;
+    }
+    _eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_eventFd < 0) {
+        std::cerr << "Task pool: eventfd: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Every deque exists before the first thread looks for one to steal from
+    for (size_t i = 0; i < _size; ++i) {
+        Worker* worker = new Worker();
+        worker->pool = this;
+        worker->index = i;
+        worker->started = false;
+        worker->executed = 0;
+        worker->stolen = 0;
+        worker->skipped = 0;
+        pthread_mutex_init(&worker->lock, NULL);
+        _workers.push_back(worker);
+    }
+
+    // Signals must keep going to the main thread
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &previous);
+    for (size_t i = 0; i < _size; ++i) {
+        if (pthread_create(&_workers[i]->thread, NULL, &TaskPool::threadMain, _workers[i]) != 0) {
+            pthread_sigmask(SIG_SETMASK, &previous, NULL);
+            std::cerr << "Task pool: cannot start thread" << std::endl;
+            stop();
+            return false;
+        }
+        _workers[i]->started = true;
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    std::cout << "Offloaded work runs on " << _size << " task threads" << std::endl;
+    return true;
+}
+
+/**
+ * @brief Stop and join the worker threads
+ *
+ * Tasks already running finish first; queued tasks and results that were
+ * not collected are deleted without complete() being called.
+ */
+void TaskPool::stop() {
+    pthread_mutex_lock(&_sleepLock);
+    __atomic_store_n(&_stop, true, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&_work);
+    pthread_mutex_unlock(&_sleepLock);
+    for (size_t i = 0; i < _workers.size(); ++i) {
+        if (_workers[i]->started) {
+            pthread_join(_workers[i]->thread, NULL);
+        }
+    }
+    for (size_t i = 0; i < _workers.size(); ++i) {
+        Worker* worker = _workers[i];
+        for (size_t j = 0; j < worker->tasks.size(); ++j) {
+            delete worker->tasks[j];
+        }
+        pthread_mutex_destroy(&worker->lock);
+        delete worker;
+    }
+    _workers.clear();
+
+    Task* task;
+    while (_completed.pop(task)) {
+        delete task;
+    }
+    if (_eventFd >= 0) {
+        close(_eventFd);
+        _eventFd = -1;
+    }
+}
+
+/**
+ * @brief Queue a task for the workers
+ * @param task The task (owned by the pool if accepted)
+ * @return false if there are no workers: the caller runs the task itself
+ *
+ * From the state thread the task goes to the next worker in turn; from a
+ * worker (a task splitting its work) it goes to that worker's own deque,
+ * where idle workers can steal it.
+ */
+bool TaskPool::submit(Task* task) {
+    if (_workers.empty()) {
+        return false;
+    }
+    Worker* worker = _current;
+    if (!worker || worker->pool != this) {
+        worker = _workers[_nextWorker];
+        _nextWorker = (_nextWorker + 1) % _workers.size();
+    }
+    __atomic_add_fetch(&_submitted, 1, __ATOMIC_RELAXED);
+    push(worker, task);
+    return true;
+}
+
+/**
+ * @brief Get the eventfd that becomes readable when results are waiting
+ * @return The file descriptor, -1 if the pool has no workers
+ */
+int TaskPool::getEventFd() const {
+    return _eventFd;
+}
+
+/**
+ * @brief Take the next finished task (state thread)
+ * @param task Receives the task
+ * @return false if there is none
+ *
+ * The eventfd is read and re-armed before the mailbox is drained, so a
+ * result finished during the drain signals it again.
+ */
+bool TaskPool::takeCompleted(Task*& task) {
+    if (__atomic_load_n(&_signalPending, __ATOMIC_ACQUIRE)) {
+        uint64_t count;
+        ssize_t ignored = read(_eventFd, &count, sizeof(count));
+        (void)ignored;
+        __atomic_store_n(&_signalPending, 0, __ATOMIC_RELEASE);
+    }
+    return _completed.pop(task);
+}
+
+/**
+ * @brief Count a finished task and delete it (state thread)
+ * @param task The task from takeCompleted()
+ * @param dropped true if its owner was gone and complete() was not called
+ */
+void TaskPool::retire(Task* task, bool dropped) {
+    if (dropped) {
+        _dropped++;
+    } else {
+        _delivered++;
+    }
+    delete task;
+}
+
+/**
+ * @brief Get the number of worker threads
+ * @return Thread count (0: tasks run inline)
+ */
+size_t TaskPool::getThreads() const {
+    return _workers.size();
+}
+
+/**
+ * @brief Get the number of tasks submitted (by the state thread or by other tasks)
+ * @return Task count
+ */
+size_t TaskPool::getSubmitted() const {
+    return __atomic_load_n(&_submitted, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the number of results handed to their owner
+ * @return Task count
+ */
+size_t TaskPool::getDelivered() const {
+    return _delivered;
+}
+
+/**
+ * @brief Get the number of results dropped because their client disconnected
+ * @return Task count
+ */
+size_t TaskPool::getDropped() const {
+    return _dropped;
+}
+
+/**
+ * @brief Get the number of submitted tasks whose result was not collected yet
+ * @return Task count
+ */
+size_t TaskPool::getPending() const {
+    return getSubmitted() - _delivered - _dropped;
+}
+
+/**
+ * @brief Get the number of tasks a worker ran
+ * @param worker Worker number
+ * @return Task count
+ */
+size_t TaskPool::getExecuted(size_t worker) const {
+    return __atomic_load_n(&_workers[worker]->executed, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the number of tasks a worker stole from the others
+ * @param worker Worker number
+ * @return Task count
+ */
+size_t TaskPool::getStolen(size_t worker) const {
+    return __atomic_load_n(&_workers[worker]->stolen, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the number of cancelled tasks the workers did not run
+ * @return Task count
+ */
+size_t TaskPool::getSkipped() const {
+    size_t skipped = 0;
+    for (size_t i = 0; i < _workers.size(); ++i) {
+        skipped += __atomic_load_n(&_workers[i]->skipped, __ATOMIC_RELAXED);
+    }
+    return skipped;
+}
+
+/**
+ * @brief Thread entry point
+ * @param worker The Worker
+ * @return NULL
+ */
+void* TaskPool::threadMain(void* worker) {
+    Worker* self = static_cast<Worker*>(worker);
+    _current = self;
+    self->pool->work(self);
+    return NULL;
+}
+
+/**
+ * @brief Worker loop: run own tasks, then stolen ones, sleep when there are none
+ *
+ * A worker announces itself in _sleeping before it looks at _queued one
+ * last time, and push() raises _queued before it looks at _sleeping, so
+ * either the worker sees the task or the pusher sees the sleeper and
+ * signals it (under the lock, so not before the worker waits).
+ */
+void TaskPool::work(Worker* self) {
+    while (!__atomic_load_n(&_stop, __ATOMIC_ACQUIRE)) {
+        Task* task = take(self);
+        if (!task) {
+            task = steal(self);
+        }
+        if (task) {
+            __atomic_sub_fetch(&_queued, 1, __ATOMIC_SEQ_CST);
+            if (task->isCancelled()) {
+                __atomic_add_fetch(&self->skipped, 1, __ATOMIC_RELAXED);
+            } else {
+                task->run();
+                __atomic_add_fetch(&self->executed, 1, __ATOMIC_RELAXED);
+            }
+            finish(task);
+            continue;
+        }
+
+        pthread_mutex_lock(&_sleepLock);
+        __atomic_add_fetch(&_sleeping, 1, __ATOMIC_SEQ_CST);
+        while (!_stop && __atomic_load_n(&_queued, __ATOMIC_SEQ_CST) == 0) {
+            pthread_cond_wait(&_work, &_sleepLock);
+        }
+        __atomic_sub_fetch(&_sleeping, 1, __ATOMIC_SEQ_CST);
+        bool stop = _stop;
+        pthread_mutex_unlock(&_sleepLock);
+        if (stop) {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Take the oldest task from a worker's own deque
+ * @param self The worker
+ * @return The task, NULL if the deque is empty
+ */
+Task* TaskPool::take(Worker* self) {
+    Task* task = NULL;
+    pthread_mutex_lock(&self->lock);
+    if (!self->tasks.empty()) {
+        task = self->tasks.front();
+        self->tasks.pop_front();
+    }
+    pthread_mutex_unlock(&self->lock);
+    return task;
+}
+
+/**
+ * @brief Take the oldest task of another worker
+ * @param self The idle worker
+ * @return The task, NULL if every deque is empty
+ */
+Task* TaskPool::steal(Worker* self) {
+    for (size_t i = 1; i < _workers.size(); ++i) {
+        Worker* victim = _workers[(self->index + i) % _workers.size()];
+        Task* task = NULL;
+        pthread_mutex_lock(&victim->lock);
+        if (!victim->tasks.empty()) {
+            task = victim->tasks.front();
+            victim->tasks.pop_front();
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if (task) {
+            __atomic_add_fetch(&self->stolen, 1, __ATOMIC_RELAXED);
+            return task;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Add a task to a worker's deque and wake a sleeping worker
+ * @param worker The deque's owner
+ * @param task The task
+ */
+void TaskPool::push(Worker* worker, Task* task) {
+    pthread_mutex_lock(&worker->lock);
+    worker->tasks.push_back(task);
+    pthread_mutex_unlock(&worker->lock);
+
+    __atomic_add_fetch(&_queued, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&_sleeping, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&_sleepLock);
+        pthread_cond_signal(&_work);
+        pthread_mutex_unlock(&_sleepLock);
+    }
+}
+
+/**
+ * @brief Hand a finished task to the state thread
+ * @param task The task
+ *
+ * Only the first result after the state thread last looked signals the
+ * eventfd.
+ */
+void TaskPool::finish(Task* task) {
+    _completed.push(task);
+    if (__atomic_exchange_n(&_signalPending, 1, __ATOMIC_ACQ_REL) == 0) {
+        uint64_t one = 1;
+        ssize_t ignored = write(_eventFd, &one, sizeof(one));
+        (void)ignored;
+    }
+}
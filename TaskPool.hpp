@@ -0,0 +1,138 @@
+#ifndef TASKPOOL_HPP
+#define TASKPOOL_HPP
+
+#include "ircserv.hpp"
+#include "MpscMailbox.hpp"
+#include <pthread.h>
+
+class Server;
+class Client;
+
+/**
+ * @brief A piece of blocking or CPU-heavy work that must not run on the event loop
+ *
+ * run() is called on a pool worker and may only touch the task itself.
+ * complete() is called afterwards on the state thread, where it may use
+ * the server and the owning client. A task that belongs to a client
+ * carries the client's handle (see Client::getHandle), not a pointer: if
+ * the client disconnected while the task ran, complete() is never called
+ * and the task is simply deleted. The state thread can also cancel() a
+ * task whose result nobody wants any more; a worker that has not started
+ * it yet then skips run().
+ */
+class Task {
+private:
+    unsigned long _owner;               // Handle of the client the result is for (0: none)
+    int _cancelled;                     // Set by the state thread, read by the worker (atomic access)
+
+    // Not copyable (subclasses own their results)
+    Task(const Task& other);
+    Task& operator=(const Task& other);
+
+public:
+    explicit Task(unsigned long owner);
+    virtual ~Task();
+
+    unsigned long getOwner() const;
+    void cancel();                      // State thread: don't run it if it hasn't started
+    bool isCancelled() const;
+
+    virtual void run() = 0;                                 // Worker thread
+    virtual void complete(Server& server, Client* owner) = 0;  // State thread; owner NULL if none
+};
+
+/**
+ * @brief Worker threads for offloaded work, with per-worker deques and work stealing
+ *
+ * With task_threads > 0, work such as hostname lookups and content filter
+ * rebuilds is handed to this pool instead of running on the event loop.
+ * Every worker has its own deque: submit() deals tasks to the workers in
+ * turn (and a task submitted from a worker goes to that worker's own
+ * deque), a worker takes its oldest task first, so clients are looked up
+ * in the order they connected, and a worker whose deque is empty steals
+ * the oldest task of another one. One slow lookup thus never holds up the
+ * tasks queued behind it while another worker is idle.
+ * Each deque has its own small lock, taken once per task by its owner or
+ * a thief; idle workers sleep on a condition variable and are only woken
+ * when some are actually asleep.
+ *
+ * Finished tasks go into an MpscMailbox and the first one of a batch
+ * signals an eventfd that Server::run polls, so the loop wakes up as soon
+ * as a result is ready and calls complete() on its own thread.
+ *
+ * With task_threads = 0 there are no workers: submit() refuses the task
+ * and Server::runTask runs and completes it on the spot, as before.
+ */
+class TaskPool {
+private:
+    // One worker thread and its deque
+    struct Worker {
+        TaskPool* pool;
+        size_t index;
+        pthread_t thread;
+        bool started;                   // The thread is running (and must be joined)
+        pthread_mutex_t lock;           // Protects tasks (owner and thieves)
+        std::deque<Task*> tasks;        // Owner and thieves take from the front (oldest first)
+        size_t executed;                // Tasks run by this worker (atomic access)
+        size_t skipped;                 // Cancelled tasks it passed on without running (atomic access)
+        size_t stolen;                  // ... of which were taken from another worker (atomic access)
+    };
+
+    size_t _size;                       // Worker threads (0: run tasks inline)
+    std::vector<Worker*> _workers;
+    size_t _nextWorker;                 // Next deque for submit() from outside the pool
+
+    // Sleeping: a worker sleeps only while no deque has a task
+    pthread_mutex_t _sleepLock;
+    pthread_cond_t _work;
+    size_t _queued;                     // Tasks in the deques (atomic access)
+    size_t _sleeping;                   // Workers waiting on _work (atomic access)
+    bool _stop;                         // Written under _sleepLock (atomic access)
+
+    // Results: workers -> state thread
+    MpscMailbox<Task*> _completed;
+    int _eventFd;                       // Readable while results are waiting
+    int _signalPending;                 // The eventfd was signalled and not read yet (atomic access)
+
+    // Counters (state thread only, except _submitted: atomic access)
+    size_t _submitted;
+    size_t _delivered;                  // complete() called
+    size_t _dropped;                    // Owner gone, result thrown away
+
+    static __thread Worker* _current;   // The worker running on this thread (NULL elsewhere)
+
+    // Not copyable (owns threads)
+    TaskPool(const TaskPool& other);
+    TaskPool& operator=(const TaskPool& other);
+
+public:
+    explicit TaskPool(size_t threads);
+    ~TaskPool();
+
+    bool start();
+    void stop();                        // Join the workers; tasks not run yet are deleted
+
+    bool submit(Task* task);            // false: no workers, the caller must run it inline
+    int getEventFd() const;             // -1 without workers
+    bool takeCompleted(Task*& task);    // State thread: next finished task
+    void retire(Task* task, bool dropped);  // State thread: count and delete a finished task
+
+    size_t getThreads() const;
+    size_t getSubmitted() const;
+    size_t getDelivered() const;
+    size_t getDropped() const;
+    size_t getPending() const;          // Queued or running
+    size_t getExecuted(size_t worker) const;
+    size_t getStolen(size_t worker) const;
+    size_t getSkipped() const;          // Cancelled before they ran
+
+private:
+    static void* threadMain(void* worker);
+    void work(Worker* self);
+    Task* take(Worker* self);
+    Task* steal(Worker* self);
+    void push(Worker* worker, Task* task);
+    void finish(Task* task);
+};
+
+#endif
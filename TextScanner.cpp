@@ -0,0 +1,236 @@
+#include "TextScanner.hpp"
+#ifdef __SSE2__
+# include <emmintrin.h>  // SSE2 intrinsics
+#endif
+
+// Static member definitions
+size_t TextScanner::_messages = 0;
+size_t TextScanner::_bytes = 0;
+size_t TextScanner::_fastBytes = 0;
+
+/**
+ * @brief Where a UTF-8 decoder is inside a multi-byte sequence
+ */
+struct Utf8State {
+    unsigned int need;      // Continuation bytes still expected
+    unsigned char lo;       // Allowed range of the next continuation byte
+    unsigned char hi;
+};
+
+/**
+ * @brief Kind of a byte below 0x20 (or DEL)
+ * @param c The byte
+ * @return TEXT_FORMATTING, TEXT_CONTROL, or 0 for tab and CTCP's \x01
+ */
+static unsigned int controlKind(unsigned char c) {
+    switch (c) {
+        case 0x02: case 0x03: case 0x04: case 0x0F: case 0x11:
+        case 0x16: case 0x1D: case 0x1E: case 0x1F:
+            return TextScanner::TEXT_FORMATTING;
+        case 0x01: case '\t':
+            return 0;
+        default:
+            return TextScanner::TEXT_CONTROL;
+    }
+}
+
+/**
+ * @brief Feed one byte to the decoder
+ * @param state Decoder state
+ * @param c The byte
+ * @param flags TEXT_* bits found so far
+ *
+ * The ranges for the second byte rule out overlong forms (E0, F0),
+ * UTF-16 surrogates (ED) and code points above U+10FFFF (F4).
+ */
+static inline void feed(Utf8State& state, unsigned char c, unsigned int& flags) {
+    if (state.need > 0) {
+        if (c >= state.lo && c <= state.hi) {
+            state.need--;
+            state.lo = 0x80;
+            state.hi = 0xBF;
+            return;
+        }
+        flags |= TextScanner::TEXT_INVALID_UTF8;
+        state.need = 0;     // c starts something new
+    }
+
+    if (c < 0x80) {
+        if (c < 0x20 || c == 0x7F) {
+            flags |= controlKind(c);
+        }
+        return;
+    }
+
+    flags |= TextScanner::TEXT_NON_ASCII;
+    state.lo = 0x80;
+    state.hi = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF) {
+        state.need = 1;
+    } else if (c == 0xE0) {
+        state.need = 2;
+        state.lo = 0xA0;
+    } else if (c == 0xED) {
+        state.need = 2;
+        state.hi = 0x9F;
+    } else if (c >= 0xE1 && c <= 0xEF) {
+        state.need = 2;
+    } else if (c == 0xF0) {
+        state.need = 3;
+        state.lo = 0x90;
+    } else if (c >= 0xF1 && c <= 0xF3) {
+        state.need = 3;
+    } else if (c == 0xF4) {
+        state.need = 3;
+        state.hi = 0x8F;
+    } else {
+        flags |= TextScanner::TEXT_INVALID_UTF8;  // Continuation byte or C0, C1, F5-FF
+    }
+}
+
+/**
+ * @brief Skip up to max characters of a set
+ * @param text The text
+ * @param i Position, advanced past the skipped characters
+ * @param max Maximum number to skip
+ * @param hex true for hex digits, false for decimal digits
+ */
+static void skipDigits(const std::string& text, size_t& i, size_t max, bool hex) {
+    for (size_t n = 0; n < max && i < text.length(); ++n, ++i) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (!(hex ? isxdigit(c) : isdigit(c))) {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Classify a message text
+ * @param text The text
+ * @return TEXT_* bits (0 for plain printable ASCII)
+ */
+unsigned int TextScanner::classify(const std::string& text) {
+    _messages++;
+    _bytes += text.length();
+    return scan(reinterpret_cast<const unsigned char*>(text.data()), text.length(), _fastBytes);
+}
+
+/**
+ * @brief Remove formatting codes and/or control bytes
+ * @param text The text
+ * @param kinds TEXT_FORMATTING, TEXT_CONTROL or both
+ * @return The text without them
+ *
+ * A color code (\x03) takes its "fg[,bg]" digits with it, and a hex color
+ * code (\x04) its "rrggbb[,rrggbb]", so no stray numbers are left behind.
+ */
+std::string TextScanner::strip(const std::string& text, unsigned int kinds) {
+    std::string result;
+    result.reserve(text.length());
+
+    size_t i = 0;
+    while (i < text.length()) {
+        unsigned char c = static_cast<unsigned char>(text[i++]);
+        unsigned int kind = (c < 0x20 || c == 0x7F) ? controlKind(c) : 0;
+        if (!(kind & kinds)) {
+            result += static_cast<char>(c);
+            continue;
+        }
+        if (c == 0x03 || c == 0x04) {
+            bool hex = c == 0x04;
+            size_t start = i;
+            skipDigits(text, i, hex ? 6 : 2, hex);
+            if (i > start && i + 1 < text.length() && text[i] == ',' &&
+                (hex ? isxdigit(static_cast<unsigned char>(text[i + 1])) : isdigit(static_cast<unsigned char>(text[i + 1])))) {
+                ++i;
+                skipDigits(text, i, hex ? 6 : 2, hex);
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Check if the 16-byte SSE2 path was compiled in
+ * @return true with SSE2
+ */
+bool TextScanner::hasVectorPath() {
+#ifdef __SSE2__
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Get the number of texts classified
+ * @return Text count
+ */
+size_t TextScanner::getMessages() {
+    return _messages;
+}
+
+/**
+ * @brief Get the number of bytes classified
+ * @return Byte count
+ */
+size_t TextScanner::getBytes() {
+    return _bytes;
+}
+
+/**
+ * @brief Get the number of bytes accepted by the 16-byte path
+ * @return Byte count
+ */
+size_t TextScanner::getFastBytes() {
+    return _fastBytes;
+}
+
+/**
+ * @brief Classify a text
+ * @param text The bytes
+ * @param length Number of bytes
+ * @param fastBytes Incremented by the bytes accepted 16 at a time
+ * @return TEXT_* bits
+ *
+ * Only the all-printable-ASCII check is vectorised. Multi-byte UTF-8 is
+ * always validated by the byte-wise decoder.
+ */
+unsigned int TextScanner::scan(const unsigned char* text, size_t length, size_t& fastBytes) {
+    Utf8State state;
+    state.need = 0;
+    state.lo = 0x80;
+    state.hi = 0xBF;
+    unsigned int flags = 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // Signed compare: bytes >= 0x80 are negative, so "< 0x20" catches them too
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i del = _mm_set1_epi8(0x7F);
+    while (i + 16 <= length) {
+        if (state.need == 0) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+            __m128i special = _mm_or_si128(_mm_cmplt_epi8(block, space), _mm_cmpeq_epi8(block, del));
+            if (_mm_movemask_epi8(special) == 0) {
+                i += 16;
+                fastBytes += 16;
+                continue;
+            }
+        }
+        for (size_t end = i + 16; i < end; ++i) {
+            feed(state, text[i], flags);
+        }
+    }
+#else
+    (void)fastBytes;
+#endif
+
+    for (; i < length; ++i) {
+        feed(state, text[i], flags);
+    }
+    if (state.need > 0) {
+        flags |= TEXT_INVALID_UTF8;     // Text ends inside a sequence
+    }
+    return flags;
+}
@@ -0,0 +1,52 @@
+#ifndef TEXTSCANNER_HPP
+#define TEXTSCANNER_HPP
+
+#include "ircserv.hpp"
+
+/**
+ * @brief Classifies message text: UTF-8 validity, formatting and control bytes
+ *
+ * PRIVMSG and TOPIC text is checked once before it is sent anywhere:
+ * - invalid UTF-8 is refused when the server runs with utf8_only
+ * - stray control bytes are removed when the server runs with utf8_only
+ * - mIRC formatting codes (bold, colors, ...) are removed in +S channels
+ *
+ * Almost all chat is plain printable ASCII, so the scan first looks at 16
+ * bytes at a time with SSE2: one compare finds whether any byte in the block
+ * is below 0x20 or above 0x7E. That is a printable-ASCII fast path, not a
+ * vectorised UTF-8 validator: any block that contains such a byte, and so
+ * every block with multi-byte UTF-8 in it, is walked byte by byte through a
+ * small UTF-8 decoder (which also tracks sequences that cross block
+ * boundaries). Without SSE2 every byte takes the byte-by-byte path.
+ */
+class TextScanner {
+public:
+    // Result bits of classify()
+    enum {
+        TEXT_NON_ASCII = 1 << 0,        // Contains bytes >= 0x80
+        TEXT_INVALID_UTF8 = 1 << 1,     // Not valid UTF-8
+        TEXT_FORMATTING = 1 << 2,       // Contains mIRC formatting codes
+        TEXT_CONTROL = 1 << 3           // Contains other control bytes (not CTCP's \x01 or tab)
+    };
+
+private:
+    // Statistics
+    static size_t _messages;            // Texts classified
+    static size_t _bytes;               // Bytes classified
+    static size_t _fastBytes;           // Bytes accepted 16 at a time
+
+public:
+    static unsigned int classify(const std::string& text);  // TEXT_* bits
+    static std::string strip(const std::string& text, unsigned int kinds);  // Remove TEXT_FORMATTING and/or TEXT_CONTROL bytes
+
+    static bool hasVectorPath();        // Was this built with SSE2?
+
+    static size_t getMessages();
+    static size_t getBytes();
+    static size_t getFastBytes();
+
+private:
+    static unsigned int scan(const unsigned char* text, size_t length, size_t& fastBytes);
+};
+
+#endif
@@ -2,7 +2,8 @@
 #include "Client.hpp"
 #include <sys/time.h>
 #include <climits>     // For INT_MAX and INT_MIN
-#include <iomanip>     // For setfill and setw
+#include <pthread.h>   // For pthread_setaffinity_np()
+#include <sched.h>     // For cpu_set_t
 
 /**
  * @brief Split a string by a delimiter
@@ -83,31 +84,36 @@ std::string Utils::toLower(const std::string& str) {
  * @brief Send a message to a client
  * @param client Pointer to the client
  * @param message The message to send
- * @return true if successful, false if failed
+ * @return true if queued, false if there is no client
  * 
- * send() is a system function that sends data over a socket.
- * It returns the number of bytes sent, or -1 on error.
+ * The message is queued for sending (see sendLine); send()/writev()
+ * happen in Server::flushClient.
  */
 bool Utils::sendToClient(Client* client, const std::string& message) {
     if (!client) return false;
     
-    std::string fullMessage = message + "\r\n";  // IRC messages end with \r\n
+    // IRC messages end with \r\n - build the full line in scratch memory
+    ScratchWriter fullMessage(Arena::active(), message.length() + 2);
+    fullMessage.append(message).append("\r\n", 2);
     
-    // send(socket, data, length, flags)
-    // On macOS, MSG_NOSIGNAL is not available. Using 0 for flags.
-    // For robust SIGPIPE handling on macOS, SO_NOSIGPIPE socket option should be set elsewhere.
-    ssize_t bytesSent = send(client->getFd(), fullMessage.c_str(), fullMessage.length(), 0);
-    
-    if (bytesSent < 0) {
-        std::cerr << "Error sending to client: " << strerror(errno) << std::endl;
-        return false;
-    }
-    
-    if (static_cast<size_t>(bytesSent) != fullMessage.length()) {
-        std::cerr << "Warning: Partial send to client" << std::endl;
-        return false;
-    }
+    return sendLine(client, fullMessage.str());
+}
+
+/**
+ * @brief Send an already terminated line to a client
+ * @param client Pointer to the client
+ * @param line The line, including the trailing \r\n
+ * @return true if queued, false if there is no client
+ * 
+ * Used by broadcasts, which format the line once and send it to many clients.
+ * The line is appended to the client's output queue; the server writes the
+ * queue out at the end of the tick (or later, when poll() reports POLLOUT),
+ * so a slow client never blocks us and partial sends are simply resumed.
+ */
+bool Utils::sendLine(Client* client, const StringRef& line) {
+    if (!client) return false;
     
+    client->queueOutput().append(line.data, line.length);
     return true;
 }
 
@@ -133,7 +139,7 @@ std::string Utils::getTimestamp() {
  * IRC nicknames must start with a letter and contain only letters, numbers, and certain symbols.
  */
 bool Utils::isValidNickname(const std::string& nickname) {
-    if (nickname.empty() || nickname.length() > 30) {
+    if (nickname.empty() || nickname.length() > IRC::NICKLEN) {
         return false;
     }
     
@@ -190,19 +196,35 @@ bool Utils::isValidChannelName(const std::string& channelName) {
  */
 std::string Utils::formatMessage(const std::string& prefix, const std::string& command, 
                                 const std::string& params) {
-    std::string message;
+    // Assemble in scratch memory, then make a single std::string
+    StringRef line = formatLine(Arena::active(), prefix, command, params);
+    return std::string(line.data, line.length - 2);  // Without the \r\n
+}
+
+/**
+ * @brief Format an IRC message in scratch memory
+ * @param arena The arena to build the line in
+ * @param prefix The message prefix (sender)
+ * @param command The IRC command
+ * @param params The command parameters
+ * @return View of ":prefix COMMAND params\r\n", valid until the arena is reset
+ */
+StringRef Utils::formatLine(Arena& arena, const std::string& prefix, const std::string& command,
+                            const std::string& params) {
+    ScratchWriter message(arena, prefix.length() + command.length() + params.length() + 5);
     
     if (!prefix.empty()) {
-        message += ":" + prefix + " ";
+        message.append(':').append(prefix).append(' ');
     }
     
-    message += command;
+    message.append(command);
     
     if (!params.empty()) {
-        message += " " + params;
+        message.append(' ').append(params);
     }
     
-    return message;
+    message.append("\r\n", 2);
+    return message.str();
 }
 
 /**
@@ -213,10 +235,12 @@ std::string Utils::formatMessage(const std::string& prefix, const std::string& c
  * @return Formatted numeric reply
  */
 std::string Utils::formatReply(int code, const std::string& target, const std::string& message) {
-    std::stringstream ss;
-    ss << std::setfill('0') << std::setw(3) << code;  // Format as 3-digit number with leading zeros
+    ScratchWriter reply(Arena::active(), target.length() + message.length() + 5);
+    appendCode(reply, code);
+    reply.append(' ').append(target).append(' ').append(message);
     
-    return ss.str() + " " + target + " " + message;
+    StringRef result = reply.str();
+    return std::string(result.data, result.length);
 }
 
 /**
@@ -228,10 +252,48 @@ std::string Utils::formatReply(int code, const std::string& target, const std::s
  * @return Formatted numeric reply with server prefix
  */
 std::string Utils::formatReply(const std::string& serverName, int code, const std::string& target, const std::string& message) {
-    std::stringstream ss;
-    ss << ":" << serverName << " " << std::setfill('0') << std::setw(3) << code << " " << target << " " << message;
+    ScratchWriter reply(Arena::active(), serverName.length() + target.length() + message.length() + 7);
+    reply.append(':').append(serverName).append(' ');
+    appendCode(reply, code);
+    reply.append(' ').append(target).append(' ').append(message);
     
-    return ss.str();
+    StringRef result = reply.str();
+    return std::string(result.data, result.length);
+}
+
+/**
+ * @brief Append a numeric reply code as three digits with leading zeros
+ * @param out The writer
+ * @param code The numeric code (0-999)
+ */
+void Utils::appendCode(ScratchWriter& out, int code) {
+    out.append(numericDigits(code), 3);
+}
+
+/**
+ * @brief Table of all three-digit numerics, filled once at startup
+ */
+struct NumericTable {
+    char digits[1000][3];
+
+    NumericTable() {
+        for (int code = 0; code < 1000; ++code) {
+            digits[code][0] = static_cast<char>('0' + code / 100);
+            digits[code][1] = static_cast<char>('0' + (code / 10) % 10);
+            digits[code][2] = static_cast<char>('0' + code % 10);
+        }
+    }
+};
+
+static const NumericTable numericTable;
+
+/**
+ * @brief Get the three digits of a numeric reply code
+ * @param code The numeric code (0-999)
+ * @return Pointer to three characters (not null-terminated)
+ */
+const char* Utils::numericDigits(int code) {
+    return numericTable.digits[static_cast<unsigned int>(code) % 1000];
 }
 
 /**
@@ -268,3 +330,48 @@ std::string Utils::intToString(int value) {
     ss << value;
     return ss.str();
 }
+
+/**
+ * @brief Parse a CPU list such as "0-3,8"
+ * @param list Comma-separated CPU numbers and ranges
+ * @return The CPUs in the order given (empty if the list is empty or invalid)
+ */
+std::vector<int> Utils::parseCpuList(const std::string& list) {
+    std::vector<int> cpus;
+    std::vector<std::string> items = split(list, ',');
+    for (size_t i = 0; i < items.size(); ++i) {
+        std::string item = trim(items[i]);
+        size_t dash = item.find('-');
+        int first, last;
+        if (dash == std::string::npos) {
+            if (!stringToInt(item, first)) {
+                return std::vector<int>();
+            }
+            last = first;
+        } else if (!stringToInt(item.substr(0, dash), first) || !stringToInt(item.substr(dash + 1), last)) {
+            return std::vector<int>();
+        }
+        if (first < 0 || last < first) {
+            return std::vector<int>();
+        }
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+/**
+ * @brief Pin the calling thread to one CPU
+ * @param cpu The CPU number
+ * @return true on success (false: no such CPU, or not allowed)
+ */
+bool Utils::pinThread(int cpu) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
@@ -2,6 +2,7 @@
 #define UTILS_HPP
 
 #include "ircserv.hpp"
+#include "Arena.hpp"
 
 /**
  * @brief Utility functions for the IRC server
@@ -20,6 +21,7 @@ public:
     
     // Network utilities
     static bool sendToClient(Client* client, const std::string& message);
+    static bool sendLine(Client* client, const StringRef& line);  // line already ends with \r\n
     static std::string getTimestamp();
     
     // Validation functions
@@ -31,10 +33,18 @@ public:
                                    const std::string& params);
     static std::string formatReply(int code, const std::string& target, const std::string& message);
     static std::string formatReply(const std::string& serverName, int code, const std::string& target, const std::string& message);
+    static StringRef formatLine(Arena& arena, const std::string& prefix, const std::string& command,
+                                const std::string& params);  // Built in scratch memory, with \r\n
+    static void appendCode(ScratchWriter& out, int code);  // Three-digit numeric
+    static const char* numericDigits(int code);  // "001".."999" from a table (not terminated)
     
     // Number conversion with error checking
     static bool stringToInt(const std::string& str, int& result);
     static std::string intToString(int value);
+    
+    // Threads and CPUs
+    static std::vector<int> parseCpuList(const std::string& list);  // "0-3,8" -> 0 1 2 3 8
+    static bool pinThread(int cpu);             // Pin the calling thread to one CPU
 };
 
 /**
@@ -44,25 +54,67 @@ public:
  * Using a namespace provides better code organization and prevents global namespace pollution.
  */
 namespace IRC {
+    // Protocol limits
+    const size_t NICKLEN = 30;          // Maximum nickname length
+    const size_t TAGS_LENGTH = 4096;    // Room for message tags in front of a 512-byte line
+    
     // Success reply codes (001-099)
     const int RPL_WELCOME = 001;
     const int RPL_YOURHOST = 002;
     const int RPL_CREATED = 003;
     const int RPL_MYINFO = 004;
+    const int RPL_ISUPPORT = 005;
+    
+    // Statistics reply codes (200-299)
+    const int RPL_ENDOFSTATS = 219;
+    const int RPL_STATSDEBUG = 249;
+    const int RPL_SILELIST = 271;
+    const int RPL_ENDOFSILELIST = 272;
     
     // Command response codes (300-399)
+    const int RPL_USERHOST = 302;
+    const int RPL_WHOISUSER = 311;
+    const int RPL_WHOISSERVER = 312;
+    const int RPL_ENDOFWHO = 315;
+    const int RPL_ENDOFWHOIS = 318;
+    const int RPL_WHOISCHANNELS = 319;
+    const int RPL_LISTSTART = 321;
+    const int RPL_LIST = 322;
+    const int RPL_LISTEND = 323;
     const int RPL_TOPIC = 332;
+    const int RPL_WHOREPLY = 352;
     const int RPL_NAMREPLY = 353;
     const int RPL_ENDOFNAMES = 366;
     const int RPL_CHANNELMODEIS = 324;
+    const int RPL_INVITELIST = 346;
+    const int RPL_ENDOFINVITELIST = 347;
+    const int RPL_EXCEPTLIST = 348;
+    const int RPL_ENDOFEXCEPTLIST = 349;
+    const int RPL_BANLIST = 367;
+    const int RPL_ENDOFBANLIST = 368;
+    const int RPL_MOTD = 372;
+    const int RPL_MOTDSTART = 375;
+    const int RPL_ENDOFMOTD = 376;
+    
+    // MONITOR reply codes (IRCv3)
+    const int RPL_MONONLINE = 730;
+    const int RPL_MONOFFLINE = 731;
+    const int RPL_MONLIST = 732;
+    const int RPL_ENDOFMONLIST = 733;
+    const int ERR_MONLISTFULL = 734;
     
     // Error codes (400-599)
     const int ERR_NOSUCHNICK = 401;
     const int ERR_NOSUCHCHANNEL = 403;
     const int ERR_CANNOTSENDTOCHAN = 404;
+    const int ERR_TOOMANYCHANNELS = 405;
+    const int ERR_TOOMANYTARGETS = 407;
+    const int ERR_INVALIDCAPCMD = 410;
     const int ERR_NORECIPIENT = 411;
     const int ERR_NOTEXTTOSEND = 412;
+    const int ERR_TOOMANYMATCHES = 416;
     const int ERR_UNKNOWNCOMMAND = 421;
+    const int ERR_NOMOTD = 422;
     const int ERR_NONICKNAMEGIVEN = 431;
     const int ERR_ERRONEUSNICKNAME = 432;
     const int ERR_NICKNAMEINUSE = 433;
@@ -75,8 +127,12 @@ namespace IRC {
     const int ERR_PASSWDMISMATCH = 464;
     const int ERR_CHANNELISFULL = 471;
     const int ERR_INVITEONLYCHAN = 473;
+    const int ERR_BANNEDFROMCHAN = 474;
     const int ERR_BADCHANNELKEY = 475;
+    const int ERR_BANLISTFULL = 478;
+    const int ERR_NOPRIVILEGES = 481;
     const int ERR_CHANOPRIVSNEEDED = 482;
+    const int ERR_SILELISTFULL = 511;
 }
 
 #endif
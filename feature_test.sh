@@ -0,0 +1,753 @@
+#!/bin/bash
+
+# IRC Server Feature Tests
+# One behaviour check per server feature. Each check starts its own server
+# with the config it needs and talks to it through bash's /dev/tcp, so
+# nothing but bash is required.
+#
+# Usage: ./feature_test.sh [check...]    (no argument: run every check)
+
+PORT=6670
+PASSWORD="testpass"
+SERVER_PID=""
+WORKDIR=$(mktemp -d)
+PASSED=0
+FAILED=0
+declare -A FDS
+
+# Start the server; each argument is one config file line
+start_server() {
+    printf '%s\n' "$@" > "$WORKDIR/server.conf"
+    ./ircserv $PORT $PASSWORD "$WORKDIR/server.conf" > "$WORKDIR/server.log" 2>&1 &
+    SERVER_PID=$!
+    sleep 0.5
+    if ! kill -0 $SERVER_PID 2>/dev/null; then
+        echo "FAILED: Server failed to start"
+        cat "$WORKDIR/server.log"
+        exit 1
+    fi
+}
+
+# Stop the server and forget every client connection
+stop_server() {
+    local name fd
+    for name in "${!FDS[@]}"; do
+        fd=${FDS[$name]}
+        exec {fd}>&-
+    done
+    FDS=()
+    if [ -n "$SERVER_PID" ]; then
+        kill -INT $SERVER_PID 2>/dev/null
+        wait $SERVER_PID 2>/dev/null
+        SERVER_PID=""
+    fi
+}
+
+# Open a connection: connect_client name [nick]  (with a nick it also registers)
+connect_client() {
+    local fd
+    exec {fd}<>/dev/tcp/127.0.0.1/$PORT
+    FDS[$1]=$fd
+    if [ -n "$2" ]; then
+        send "$1" "PASS $PASSWORD"
+        send "$1" "NICK $2"
+        send "$1" "USER $2 0 * :Test $2"
+        read_lines "$1" 0.5 > /dev/null
+    fi
+}
+
+# Close a connection
+disconnect_client() {
+    local fd=${FDS[$1]}
+    exec {fd}>&-
+    unset "FDS[$1]"
+}
+
+# Send one line: send name line
+send() {
+    printf '%s\r\n' "$2" >&${FDS[$1]}
+}
+
+# Print what a client receives until nothing arrives for a while: read_lines name [seconds]
+read_lines() {
+    local line
+    while IFS= read -r -t "${2:-0.5}" -u ${FDS[$1]} line; do
+        printf '%s\n' "${line%$'\r'}"
+    done
+}
+
+# Record a result: check description command...
+check() {
+    local description="$1"
+    shift
+    if "$@"; then
+        echo "PASSED: $description"
+        PASSED=$((PASSED + 1))
+    else
+        echo "FAILED: $description"
+        FAILED=$((FAILED + 1))
+    fi
+}
+
+# True if the text (first argument) matches the pattern (second argument)
+contains() {
+    printf '%s\n' "$1" | grep -q -- "$2"
+}
+
+# True if the text does not match the pattern
+lacks() {
+    ! contains "$1" "$2"
+}
+
+# Print the number in a STATS m line: stat_value output "line prefix" "word after the number"
+stat_value() {
+    printf '%s\n' "$1" | grep -- "$2" | grep -o -- "[0-9]* $3" | head -1 | cut -d' ' -f1
+}
+
+# user-026: hostnames and channel names are pooled and shared
+test_intern_pool() {
+    echo "=== Intern pool ==="
+    start_server
+    connect_client a alice
+    connect_client b bob
+    send a "JOIN #pool"
+    send b "JOIN #pool"
+    read_lines a > /dev/null
+    read_lines b > /dev/null
+    send a "STATS m"
+    local output=$(read_lines a 1)
+    check "Intern pool is reported" contains "$output" "Intern pool: .* entries"
+    check "Shared hostname and channel name save bytes" [ "$(stat_value "$output" "Intern pool:" "bytes saved")" -gt 0 ]
+    stop_server
+}
+
+# user-027: an idle connection has no cold record; the address is rendered at accept time
+test_client_record() {
+    echo "=== Compact client record ==="
+    start_server
+    connect_client idle
+    connect_client a alice
+    send a "WHOIS alice"
+    send a "STATS m"
+    local output=$(read_lines a 1)
+    check "Only the registered client has a cold record" contains "$output" "1 of 2 clients have a cold record"
+    check "Hostname is the peer address" contains "$output" " 311 alice alice alice 127.0.0.1 "
+    stop_server
+}
+
+# user-028: Client objects are recycled through the pool
+test_object_pools() {
+    echo "=== Object pools ==="
+    start_server "client_pool_capacity = 8"
+    local i
+    for i in 1 2 3; do
+        connect_client "c$i" "churn$i"
+    done
+    for i in 1 2 3; do
+        send "c$i" "QUIT :bye"
+        disconnect_client "c$i"
+    done
+    sleep 0.3
+    connect_client a alice
+    send a "STATS m"
+    local output=$(read_lines a 1)
+    check "Freed clients go back to the pool" contains "$output" "Client pool: 1 live, 7 free"
+    check "High-water mark remembers the peak" contains "$output" "Client pool: .* 3 high-water"
+    stop_server
+}
+
+# user-029: per-tick replies are built in the scratch arena, which is reset every tick
+test_scratch_arena() {
+    echo "=== Scratch arena ==="
+    start_server
+    connect_client a alice
+    connect_client b bob
+    send a "JOIN #arena"
+    send b "JOIN #arena"
+    send a "PRIVMSG #arena :hello from the arena"
+    read_lines a > /dev/null
+    read_lines b > /dev/null
+    send a "STATS m"
+    local output=$(read_lines a 1)
+    check "Arena stays at one block" contains "$output" "Scratch arena: 1 blocks"
+    check "Arena was used during a tick" [ "$(stat_value "$output" "Scratch arena:" "bytes peak")" -gt 0 ]
+    check "Short replies never fall back to the heap" contains "$output" "Scratch arena: .* 0 oversized"
+    stop_server
+}
+
+# user-030: socket buffers come from size-classed slabs and go back when a client leaves
+test_io_slabs() {
+    echo "=== I/O slabs ==="
+    start_server
+    local i
+    for i in 1 2 3; do
+        connect_client "c$i" "slab$i"
+        send "c$i" "JOIN #slab"
+    done
+    send c1 "PRIVMSG #slab :$(printf 'x%.0s' $(seq 1 400))"
+    for i in 1 2 3; do
+        read_lines "c$i" > /dev/null
+        send "c$i" "QUIT :bye"
+        disconnect_client "c$i"
+    done
+    sleep 0.3
+    connect_client a alice
+    send a "STATS m"
+    local output=$(read_lines a 1)
+    check "Small size class is reported" contains "$output" "I/O slab 512B: "
+    check "Chunks of departed clients are released" contains "$output" "I/O slab 4096B: 1 slabs, 1/"
+    check "No oversized chunk for short lines" contains "$output" "I/O slab 65536B: 0 slabs"
+    stop_server
+    # One depot per node directory in sysfs, whatever the ids (user-047)
+    local nodes=$(ls -d /sys/devices/system/node/node[0-9]* 2>/dev/null | wc -l)
+    [ "$nodes" -ge 1 ] || nodes=1
+    [ "$nodes" -le 8 ] || nodes=8
+    start_server "io_threads = 2"
+    connect_client a alice
+    send a "STATS m"
+    output=$(read_lines a 1)
+    check "A depot for each NUMA node" contains "$output" ", $nodes NUMA node(s) with local buffer depots"
+    check "Thread caches are counted" [ -n "$(stat_value "$output" "I/O slab 512B:" "in thread caches")" ]
+    stop_server
+}
+
+# user-031: a NICK change reaches each peer once, however many channels they share
+test_nick_fanout() {
+    echo "=== NICK fan-out ==="
+    start_server
+    connect_client a alice
+    connect_client b bob
+    local channel
+    for channel in "#one" "#two" "#three"; do
+        send a "JOIN $channel"
+        send b "JOIN $channel"
+    done
+    read_lines a > /dev/null
+    read_lines b > /dev/null
+    send a "NICK alicia"
+    local output=$(read_lines b)
+    check "Peer sees the NICK change" contains "$output" ":alice!alice@127.0.0.1 NICK alicia"
+    check "Peer sees it only once" [ "$(printf '%s\n' "$output" | grep -c "NICK alicia")" -eq 1 ]
+    stop_server
+}
+
+# user-032: channel mask lists; MODE echoes exactly the changes applied, in order
+test_mode_echo() {
+    echo "=== Channel mask lists and MODE echo ==="
+    start_server
+    connect_client a alice
+    connect_client b bob
+    send a "JOIN #modes"
+    send b "JOIN #modes"
+    read_lines a > /dev/null
+    read_lines b > /dev/null
+    send a "MODE #modes +kb secret spammer"
+    local output=$(read_lines b)
+    check "Letters and parameters stay paired" contains "$output" "MODE #modes +kb secret spammer!\*@\*$"
+    send a "MODE #modes +b spammer"
+    send a "MODE #modes +b"
+    output=$(read_lines b)
+    check "Duplicate ban and list query are not echoed" lacks "$output" "MODE"
+    send a "MODE #modes +b"
+    output=$(read_lines a)
+    check "Ban list is listed to the operator" contains "$output" " 367 alice #modes spammer!\*@\* alice "
+    send a "MODE #modes -k+i *"
+    output=$(read_lines b)
+    check "Mixed signs are echoed as applied" contains "$output" "MODE #modes -k+i$"
+    local i
+    for i in $(seq 1 100); do
+        send a "MODE #modes +b filler$i"
+    done
+    output=$(read_lines a 1)
+    check "A full list refuses more masks" contains "$output" " 478 alice #modes filler100!\*@\* :Channel list is full"
+    connect_client c
+    send c "PASS $PASSWORD"
+    send c "NICK carol"
+    send c "USER carol 0 * :Test carol"
+    output=$(read_lines c)
+    check "List size is advertised" contains "$output" "MAXLIST=beI:100"
+    stop_server
+}
+
+# user-033: SILENCE drops private and channel messages from matching senders
+test_silence() {
+    echo "=== SILENCE ==="
+    start_server
+    connect_client a alice
+    connect_client b bob
+    send a "JOIN #quiet"
+    send b "JOIN #quiet"
+    read_lines a > /dev/null
+    read_lines b > /dev/null
+    send a "SILENCE +bob"
+    local output=$(read_lines a)
+    check "Mask is added and echoed" contains "$output" "SILENCE +bob!\*@\*"
+    send b "PRIVMSG alice :private hello"
+    send b "PRIVMSG #quiet :channel hello"
+    output=$(read_lines a)
+    check "Silenced sender's messages are dropped" lacks "$output" "hello"
+    send a "SILENCE -bob"
+    read_lines a > /dev/null
+    send b "PRIVMSG alice :hello again"
+    output=$(read_lines a)
+    check "Removing the mask lets messages through" contains "$output" ":bob!bob@127.0.0.1 PRIVMSG alice :hello again"
+    stop_server
+}
+
+# user-046: fanout workers check SILENCE against a sender folded once; STATS m runs no benchmark
+test_parallel_fanout() {
+    echo "=== Parallel fanout ==="
+    start_server "fanout_threads = 2" "fanout_threshold = 2"
+    connect_client a alice
+    connect_client b bob
+    connect_client c carol
+    local client
+    for client in a b c; do
+        send $client "JOIN #wide"
+    done
+    send a "SILENCE +BOB!*@*"
+    read_lines a > /dev/null
+    read_lines b > /dev/null
+    read_lines c > /dev/null
+    send b "PRIVMSG #wide :wide hello"
+    check "A member who silenced the sender doesn't get the line" lacks "$(read_lines a)" "wide hello"
+    check "Other members get it" contains "$(read_lines c)" ":bob!bob@127.0.0.1 PRIVMSG #wide :wide hello"
+    send a "STATS m"
+    local output=$(read_lines a)
+    check "The drop is counted" [ "$(stat_value "$output" "Silence lists:" "dropped")" -ge 1 ]
+    check "STATS m runs no fanout benchmark" lacks "$output" "Fanout benchmark"
+    stop_server
+    start_server "fanout_threads = 2" "fanout_benchmark = yes"
+    check "fanout_benchmark measures at startup" contains "$(cat "$WORKDIR/server.log")" "Fanout benchmark (10000 members)"
+    stop_server
+}
+
+# user-048: a connection burst queues at most resolve_queue hostname lookups
+test_lookup_queue() {
+    echo "=== Hostname lookup queue ==="
+    start_server "io_threads = 1" "task_threads = 1" "resolve_hostnames = yes" "resolve_queue = 2"
+    # Stopped, the server can't look anyone up before the whole burst is in
+    kill -STOP $SERVER_PID
+    local i
+    for i in 1 2 3 4 5; do
+        connect_client "l$i"
+    done
+    kill -CONT $SERVER_PID
+    local output=""
+    for i in 1 2 3 4 5; do
+        output="$output$(read_lines "l$i")"$'\n'
+    done
+    check "Only resolve_queue lookups are started" [ "$(printf '%s' "$output" | grep -c "Looking up your hostname")" -eq 2 ]
+    check "The other clients keep their address" [ "$(printf '%s' "$output" | grep -c "Too many hostname lookups")" -eq 3 ]
+    send l5 "PASS $PASSWORD"
+    send l5 "NICK late"
+    send l5 "USER late 0 * :Late"
+    check "They register without waiting" contains "$(read_lines l5)" " 001 late "
+    stop_server
+}
+
+# user-034: WHO goes through the client index and streams at most who_limit rows
+test_who_streaming() {
+    echo "=== WHO streaming ==="
+    start_server "who_limit = 3"
+    connect_client a alice
+    local i
+    for i in 1 2 3 4; do
+        connect_client "w$i" "walker$i"
+    done
+    send a "WHO walker*"
+    local output=$(read_lines a)
+    check "Rows stop at who_limit" [ "$(printf '%s\n' "$output" | grep -c " 352 ")" -eq 3 ]
+    check "A cut reply says so" contains "$output" " 416 alice WHO :Too many lines"
+    check "The reply is still terminated" contains "$output" " 315 alice walker\* :End of WHO list"
+    stop_server
+}
+
+# user-035: MONITOR tells watchers when a nickname comes and goes; nicknames are case-sensitive
+test_monitor() {
+    echo "=== MONITOR ==="
+    start_server
+    connect_client a alice
+    send a "MONITOR + Bob,bob"
+    local output=$(read_lines a)
+    check "Both spellings start offline" contains "$output" " 731 alice :Bob,bob"
+    connect_client b bob
+    output=$(read_lines a)
+    check "Watcher hears the exact nickname sign on" contains "$output" " 730 alice :bob!bob@127.0.0.1$"
+    check "A different case is a different nickname" lacks "$output" ":Bob!"
+    send a "MONITOR - bob"
+    send b "QUIT :bye"
+    disconnect_client b
+    output=$(read_lines a)
+    check "No notice after unwatching" lacks "$output" " 731 "
+    stop_server
+}
+
+# user-036: LIST walks the channel index by member count, with ELIST filters
+test_list() {
+    echo "=== LIST ==="
+    start_server
+    connect_client a alice
+    connect_client b bob
+    send a "JOIN #big,#bad,#small"
+    send b "JOIN #big,#bad"
+    read_lines a > /dev/null
+    read_lines b > /dev/null
+    send a "LIST"
+    local output=$(read_lines a)
+    check "Reply starts with 321" contains "$(printf '%s\n' "$output" | head -1)" " 321 alice "
+    check "Reply ends with 323" contains "$(printf '%s\n' "$output" | tail -1)" " 323 alice "
+    check "Biggest channels come first" contains "$(printf '%s\n' "$output" | grep " 322 " | tail -1)" " 322 alice #small 1 "
+    send a "LIST >1,!#ba*"
+    output=$(read_lines a)
+    check "Member count filter and exclusion mask apply" [ "$(printf '%s\n' "$output" | grep " 322 " | cut -d' ' -f4 | tr '\n' ' ')" = "#big " ]
+    send a "LIST #small"
+    output=$(read_lines a)
+    check "Plain name is looked up directly" contains "$output" " 322 alice #small 1 "
+    stop_server
+}
+
+# user-037: the content filter blocks banned phrases; 404 for channels, a NOTICE for nicknames
+test_content_filter() {
+    echo "=== Content filter ==="
+    printf '%s\n' "* free money" "#help buy followers" > "$WORKDIR/rules.txt"
+    start_server "spam_filter_file = $WORKDIR/rules.txt"
+    connect_client a alice
+    connect_client b bob
+    send a "JOIN #help"
+    send b "JOIN #help"
+    read_lines a > /dev/null
+    read_lines b > /dev/null
+    send a "PRIVMSG #help :want to BUY FOLLOWERS?"
+    local output=$(read_lines a)
+    check "Channel rule blocks with 404" contains "$output" " 404 alice #help :Message blocked by content filter"
+    send a "PRIVMSG bob :free money here"
+    output=$(read_lines a)
+    check "Private message gets a NOTICE, not 404" contains "$output" "NOTICE alice :\*\*\* Message to bob not sent: Message blocked by content filter"
+    check "No channel numeric for a nickname" lacks "$output" " 404 "
+    send a "PRIVMSG bob :buy followers"
+    output=$(read_lines b)
+    check "Channel-scoped rule leaves private messages alone" contains "$output" "PRIVMSG bob :buy followers"
+    check "Blocked text never reached the recipient" lacks "$output" "money"
+    send a "STATS m"
+    output=$(read_lines a)
+    check "Scans are counted" contains "$output" "Content scans: 3 messages, [0-9]* bytes, 2 blocked"
+    check "No throughput figure" lacks "$output" "MB/s"
+    stop_server
+}
+
+# user-038: repeated text is suppressed per sender and per channel, even when rotated with others
+test_flood_guard() {
+    echo "=== Flood guard ==="
+    start_server "flood_repeat = 2"
+    connect_client a alice
+    connect_client b bob
+    send a "JOIN #flood"
+    send b "JOIN #flood"
+    read_lines a > /dev/null
+    read_lines b > /dev/null
+    local i
+    for i in 1 2 3; do
+        send a "PRIVMSG #flood :same old line"
+    done
+    local output=$(read_lines a)
+    check "Third copy in a channel trips the guard" contains "$output" " 404 alice #flood :Message suppressed (repeated text)"
+    check "Only one copy is refused" [ "$(printf '%s\n' "$output" | grep -c " 404 ")" -eq 1 ]
+    local round
+    for round in 1 2 3; do
+        for i in 1 2 3 4 5 6 7 8 9 10 11 12; do
+            send b "PRIVMSG alice :rotating text $i"
+        done
+    done
+    output=$(read_lines b 1)
+    check "Rotating twelve texts doesn't hide the repeats" [ "$(printf '%s\n' "$output" | grep -c "Message suppressed")" -eq 12 ]
+    check "A private message is refused with a NOTICE" contains "$output" "NOTICE bob :\*\*\* Message to alice not sent: Message suppressed (repeated text)"
+    check "No channel numeric for a nickname" lacks "$output" " 404 "
+    stop_server
+    # Default limits: a busy channel of distinct lines never looks like a flood
+    start_server
+    connect_client w watcher
+    send w "JOIN #busy"
+    local member
+    for member in $(seq 1 12); do
+        connect_client m$member member$member
+        send m$member "JOIN #busy"
+    done
+    read_lines w > /dev/null
+    for i in $(seq 1 25); do
+        for member in $(seq 1 12); do
+            send m$member "PRIVMSG #busy :member $member says thing number $i"
+        done
+    done
+    output=$(read_lines w 1)
+    check "300 distinct lines in one channel all get through" [ "$(printf '%s\n' "$output" | grep -c "PRIVMSG #busy :member")" -eq 300 ]
+    send w "STATS m"
+    check "None is counted as a repeat" contains "$(read_lines w)" "Flood guard: [0-9]* messages checked, 0 suppressed"
+    stop_server
+}
+
+# user-039: utf8_only refuses invalid UTF-8; printable ASCII takes the 16-byte path
+test_text_scanner() {
+    echo "=== Text scanner ==="
+    start_server "utf8_only = yes"
+    connect_client a alice
+    connect_client b bob
+    send a "PRIVMSG bob :$(printf 'caf\xc3\xa9 ok')"
+    send a "PRIVMSG bob :$(printf 'bad \xc3\x28 byte')"
+    send a "PRIVMSG bob :plain ascii text that fills two blocks"
+    local output=$(read_lines b)
+    check "Valid UTF-8 is delivered" contains "$output" "PRIVMSG bob :$(printf 'caf\xc3\xa9 ok')"
+    check "Invalid UTF-8 is not delivered" lacks "$output" "bad "
+    output=$(read_lines a)
+    check "Sender is told with FAIL" contains "$output" "FAIL PRIVMSG INVALID_UTF8"
+    send a "STATS m"
+    output=$(read_lines a)
+    check "Plain ASCII took the fast path" [ "$(stat_value "$output" "Text scanner:" "bytes on the")" -ge 32 ]
+    check "STATS m runs no benchmark" lacks "$output" "benchmark:"
+    stop_server
+}
+
+# user-040: numerics are written in place and cut at 512 bytes; NAMES spreads over several 353 lines
+test_reply_writer() {
+    echo "=== Reply writer ==="
+    start_server
+    local i nick
+    for i in $(seq 10 29); do
+        nick="member${i}_with_a_long_nickname"
+        connect_client "n$i"
+        send "n$i" "PASS $PASSWORD"
+        send "n$i" "NICK ${nick:0:28}"
+        send "n$i" "USER m$i 0 * :Member"
+        send "n$i" "JOIN #names"
+    done
+    connect_client a alice
+    send a "JOIN #names"
+    local output=$(read_lines a 1)
+    check "Long member list is split" [ "$(printf '%s\n' "$output" | grep -c " 353 alice = #names :")" -ge 2 ]
+    check "No line is longer than 512 bytes" [ "$(printf '%s\n' "$output" | awk '{ if (length($0) + 2 > max) max = length($0) + 2 } END { print max }')" -le 512 ]
+    check "Every member is listed" [ "$(printf '%s\n' "$output" | grep " 353 " | grep -o "member[0-9]*_" | sort -u | wc -l)" -eq 20 ]
+    send a "PRIVMSG nobody_here :hi"
+    output=$(read_lines a)
+    check "Error numerics carry the parameter" contains "$output" " 401 alice nobody_here :No such nick/channel"
+    stop_server
+}
+
+# user-041: the MOTD is rendered once per file version; long lines are cut at a character boundary
+test_motd() {
+    echo "=== MOTD ==="
+    local long=$(printf '\xc3\xa9%.0s' $(seq 1 300))
+    printf '%s\n' "Welcome to the test server" "$long" > "$WORKDIR/motd.txt"
+    start_server "motd_file = $WORKDIR/motd.txt"
+    connect_client a
+    send a "PASS $PASSWORD"
+    send a "NICK alice"
+    send a "USER alice 0 * :Test alice"
+    local output=$(read_lines a)
+    check "MOTD is sent at registration" contains "$output" " 372 alice :- Welcome to the test server"
+    local cut=$(printf '%s\n' "$output" | grep " 372 " | tail -1)
+    check "Long line stays within 512 bytes" [ $((${#cut} + 2)) -le 512 ]
+    check "Long line is not cut inside a character" bash -c 'printf "%s" "$1" | iconv -f UTF-8 -t UTF-8 > /dev/null 2>&1' _ "$cut"
+    : > "$WORKDIR/motd.txt"
+    sleep 1.1
+    send a "MOTD"
+    output=$(read_lines a)
+    check "A truncated file is picked up" lacks "$output" "Welcome"
+    check "Empty MOTD is still framed by 375/376" contains "$output" " 376 alice "
+    stop_server
+}
+
+# user-042: server-time and message-tags variants are rendered once per message; no batch capability
+test_message_tags() {
+    echo "=== Message tags ==="
+    start_server
+    connect_client a
+    send a "CAP LS 302"
+    local output=$(read_lines a)
+    check "Offered capabilities" contains "$output" "CAP \* LS :server-time message-tags echo-message$"
+    check "batch is not offered" lacks "$output" "batch"
+    send a "CAP REQ :server-time message-tags"
+    send a "CAP END"
+    send a "PASS $PASSWORD"
+    send a "NICK alice"
+    send a "USER alice 0 * :Test alice"
+    send a "JOIN #tags"
+    read_lines a > /dev/null
+    connect_client b bob
+    send b "JOIN #tags"
+    send b "@+draft/react=1 PRIVMSG #tags :tagged hello"
+    output=$(read_lines a)
+    check "Tagged recipient gets time, msgid and client tags" contains "$output" "^@time=[0-9T:.-]*Z;msgid=[^ ;]*;+draft/react=1 :bob!bob@127.0.0.1 PRIVMSG #tags :tagged hello"
+    output=$(read_lines b)
+    check "Untagged member gets the plain line" lacks "$output" "@time"
+    send a "CAP REQ batch"
+    output=$(read_lines a)
+    check "batch is refused" contains "$output" "CAP alice NAK :batch"
+    stop_server
+}
+
+test_notice_quiet() {
+    echo "=== Quiet NOTICE, one flood count per message ==="
+    start_server "flood_repeat = 2"
+    connect_client a alice
+    connect_client b bob
+    send a "JOIN #one"
+    send a "JOIN #two"
+    send b "JOIN #one"
+    send b "JOIN #two"
+    read_lines a > /dev/null
+    read_lines b > /dev/null
+    send a "NOTICE nobody :hello"
+    send a "NOTICE #nowhere :hello"
+    send a "NOTICE bob"
+    send a "NOTICE"
+    local output=$(read_lines a)
+    check "NOTICE errors are never answered" [ -z "$output" ]
+    send a "PRIVMSG #one,#two :twice over"
+    send a "PRIVMSG #one,#two :twice over"
+    output=$(read_lines b)
+    check "Two copies to two channels count as two for the sender" [ "$(printf '%s\n' "$output" | grep -c "twice over")" -eq 4 ]
+    check "Nothing suppressed" lacks "$(read_lines a)" "Message suppressed"
+    send a "NOTICE #one :again"
+    send a "NOTICE #one :again"
+    send a "NOTICE #one :again"
+    output=$(read_lines a)
+    check "A flooding NOTICE is dropped silently" [ -z "$output" ]
+    stop_server
+}
+
+test_reactor_backpressure() {
+    echo "=== Streamed replies wait for the I/O thread ==="
+    start_server "io_threads = 1" "channel_limit = 300" "sendq_limit = 65536"
+    connect_client a alice
+    local i j names
+    for i in 0 1 2 3 4 5 6 7 8 9; do
+        names="#bp${i}0"
+        for j in $(seq 1 29); do
+            names="$names,#bp$i$j"
+        done
+        send a "JOIN $names"
+    done
+    read_lines a > /dev/null
+    # About 4 MB of LIST rows that alice doesn't read
+    for i in $(seq 1 400); do
+        send a "LIST"
+    done
+    sleep 2
+    check "A slow reader isn't dropped for SendQ" lacks "$(cat "$WORKDIR/server.log")" "SendQ exceeded"
+    local before=$(awk '{ print $14 + $15 }' /proc/$SERVER_PID/stat)
+    sleep 1
+    local after=$(awk '{ print $14 + $15 }' /proc/$SERVER_PID/stat)
+    check "Waiting for the reader doesn't spin" [ $((after - before)) -lt 50 ]
+    stop_server
+}
+
+# user-044: output held back for a busy I/O thread keeps its place among the shards' lines
+test_held_back_output() {
+    echo "=== Output waits on the main thread while an I/O thread is behind ==="
+    start_server "io_threads = 2" "channel_shards = 2" "io_backlog = 1" "flood_repeat = 0"
+    connect_client y yara
+    connect_client x xavi
+    send y "JOIN #held"
+    send x "JOIN #held"
+    read_lines y > /dev/null
+    read_lines x > /dev/null
+    local i
+    for i in $(seq 1 100); do
+        send y "PRIVMSG xavi :private $i"
+        send y "PRIVMSG #held :public $i"
+    done
+    local output=$(read_lines x 2)
+    local sequence=$(printf '%s\n' "$output" | grep -o "PRIVMSG [#a-z]* :p[a-z]* [0-9]*" | awk '{ print $3 $4 }' | tr -d ':' | tr '\n' ' ')
+    local expected=""
+    for i in $(seq 1 100); do
+        expected="${expected}private$i public$i "
+    done
+    check "Every line arrives once and in order" [ "$sequence" = "$expected" ]
+    send x "STATS m"
+    output=$(read_lines x 1)
+    local held=$(printf '%s\n' "$output" | grep -o "[0-9]* outputs held back" | awk '{ total += $1 } END { print total + 0 }')
+    check "Output was held back on the main thread" [ "$held" -gt 0 ]
+    check "Nobody was dropped" lacks "$(cat "$WORKDIR/server.log")" "SendQ exceeded"
+    stop_server
+}
+
+test_shard_order() {
+    echo "=== Shard lines keep their place in each client's output ==="
+    start_server "io_threads = 2" "channel_shards = 2" "flood_repeat = 0"
+    connect_client y yara
+    connect_client x xavi
+    send y "JOIN #order"
+    read_lines y > /dev/null
+    local i
+    for i in $(seq 1 40); do
+        send y "PRIVMSG #order :before $i"
+    done
+    send x "JOIN #order"
+    for i in $(seq 1 40); do
+        send y "PRIVMSG xavi :private $i"
+        send y "PRIVMSG #order :public $i"
+    done
+    local output=$(read_lines x 1)
+    local names=$(printf '%s\n' "$output" | grep -n " 366 " | cut -d: -f1)
+    local first=$(printf '%s\n' "$output" | grep -n "PRIVMSG #order" | head -1 | cut -d: -f1)
+    check "JOIN and NAMES come before the channel's lines" [ "${names:-999999}" -lt "${first:-999999}" ]
+    local sequence=$(printf '%s\n' "$output" | grep -o "PRIVMSG [#a-z]* :p[a-z]* [0-9]*" | awk '{ print $3 $4 }' | tr -d ':' | tr '\n' ' ')
+    local expected=""
+    for i in $(seq 1 40); do
+        expected="${expected}private$i public$i "
+    done
+    check "One sender's private and channel lines stay in order" [ "$sequence" = "$expected" ]
+    stop_server
+}
+
+# user-050: moving connections between I/O threads keeps their bytes in order; admin passwords are guarded
+test_migration() {
+    echo "=== Connection migration ==="
+    start_server "io_threads = 2" "admin_password = secret" "flood_repeat = 0"
+    connect_client y yara
+    connect_client x xavi
+    connect_client a admin
+    local i
+    for i in $(seq 1 200); do
+        send y "PRIVMSG xavi :line $i"
+        if [ $((i % 10)) -eq 0 ]; then
+            send a "MIGRATE xavi $((i / 10 % 2)) secret"
+            send a "MIGRATE yara $((i / 20 % 2)) secret"
+        fi
+    done
+    local output=$(read_lines x 1)
+    local sequence=$(printf '%s\n' "$output" | grep -o "PRIVMSG xavi :line [0-9]*" | awk '{ print $4 }' | tr '\n' ' ')
+    check "Every line arrives once and in order across moves" [ "$sequence" = "$(seq 1 200 | tr '\n' ' ')" ]
+    send a "STATS m"
+    output=$(read_lines a 1)
+    check "Moves are counted" [ "$(stat_value "$output" "Connection moves:" "done")" -gt 0 ]
+    check "The password is not logged" lacks "$(cat "$WORKDIR/server.log")" "secret"
+    send a "MIGRATE xavi 1 guess"
+    send a "MIGRATE xavi 1 secret"
+    output=$(read_lines a)
+    check "A wrong password is refused" contains "$output" " 481 admin :Permission Denied- You do not have the correct password"
+    check "The next try has to wait" contains "$output" " 481 admin :Permission Denied- Too many wrong passwords"
+    sleep 1
+    send a "MIGRATE xavi 1 secret"
+    check "After the wait the password is checked again" contains "$(read_lines a)" "NOTICE admin :.* xavi to I/O thread 1"
+    stop_server
+}
+
+cleanup() {
+    stop_server
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT INT TERM
+
+if [ ! -f "./ircserv" ]; then
+    make || exit 1
+fi
+
+ALL_TESTS="test_intern_pool test_client_record test_object_pools test_scratch_arena test_io_slabs test_nick_fanout test_mode_echo test_silence test_parallel_fanout test_lookup_queue test_who_streaming test_reactor_backpressure test_held_back_output test_shard_order test_monitor test_list test_content_filter test_flood_guard test_notice_quiet test_text_scanner test_reply_writer test_motd test_message_tags test_migration"
+for test in ${@:-$ALL_TESTS}; do
+    $test
+    echo ""
+done
+
+echo "=== $PASSED passed, $FAILED failed ==="
+[ $FAILED -eq 0 ]
@@ -6,6 +6,8 @@
 #include <string>       // For std::string class
 #include <vector>       // For std::vector container (dynamic arrays)
 #include <map>          // For std::map container (key-value pairs)
+#include <set>          // For std::set container (unique sorted values)
+#include <deque>        // For std::deque container (queues)
 #include <sstream>      // For string stream operations
 #include <algorithm>    // For standard algorithms like std::find
 
@@ -13,6 +15,8 @@
 #include <cstring>      // For string manipulation functions
 #include <cstdlib>      // For general utilities like atoi()
 #include <cerrno>       // For error number definitions
+#include <cctype>       // For character classification (tolower, etc.)
+#include <ctime>        // For time() timestamps
 
 // System includes for networking
 #include <sys/socket.h>  // For socket operations
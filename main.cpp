@@ -1,15 +1,17 @@
 #include "ircserv.hpp"
 #include "Server.hpp"
 #include "Utils.hpp"
+#include "Config.hpp"
 
 /**
  * @brief Print usage information
  * @param programName The name of the program
  */
 void printUsage(const std::string& programName) {
-    std::cerr << "Usage: " << programName << " <port> <password>" << std::endl;
+    std::cerr << "Usage: " << programName << " <port> <password> [config]" << std::endl;
     std::cerr << "  port:     The port number to listen on (1024-65535)" << std::endl;
     std::cerr << "  password: The connection password for clients" << std::endl;
+    std::cerr << "  config:   Optional file with \"key = value\" server settings" << std::endl;
 }
 
 /**
@@ -72,7 +74,7 @@ bool validatePassword(const std::string& password) {
  */
 int main(int argc, char* argv[]) {
     // Check if correct number of arguments provided
-    if (argc != 3) {
+    if (argc != 3 && argc != 4) {
         printUsage(argv[0]);
         return 1;
     }
@@ -89,6 +91,12 @@ int main(int argc, char* argv[]) {
         return 1;
     }
     
+    // Load optional configuration file
+    Config config;
+    if (argc == 4 && !config.load(argv[3])) {
+        return 1;
+    }
+    
     // Print startup information
     std::cout << "Starting IRC Server..." << std::endl;
     std::cout << "Port: " << port << std::endl;
@@ -100,7 +108,7 @@ int main(int argc, char* argv[]) {
     Server* server = NULL;
     
     try {
-        server = new Server(port, password);
+        server = new Server(port, password, config);
         
         // Initialize server (set up socket)
         if (!server->initialize()) {